@@ -0,0 +1,394 @@
+//
+//  BMPartitionedConv.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMPartitionedConv.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include "BMIntegerMath.h"
+#include "Constants.h"
+
+// bits in kernelState
+#define BMPartitionedConv_ActiveSetMask 0x1
+#define BMPartitionedConv_UpdatePending 0x2
+#define BMPartitionedConv_Fading 0x4
+
+
+// forward declarations
+void BMPartitionedConv_processBlock(BMPartitionedConv *This);
+
+
+
+void BMPartitionedConv_init(BMPartitionedConv *This,
+							size_t partitionLength,
+							size_t maxKernelLength){
+	assert(isPowerOfTwo(partitionLength));
+
+	size_t B = partitionLength;
+	This->partitionLength = B;
+	This->maxPartitions = BM_MAX(1, (maxKernelLength + B - 1) / B);
+
+	// the FFT length is twice the partition length
+	BMFFT_init(&This->fft, 2 * B);
+	BMFFT_init(&This->kernelFFT, 2 * B);
+
+	// Each spectrum has B complex values in vDSP packed format, with the
+	// Nyquist term stored in the imaginary part of the DC term. We need two
+	// for each partition of the kernel, one for each partition of the
+	// frequency domain delay line, and two to sum into.
+	size_t numSpectra = 3 * This->maxPartitions + 2;
+	This->spectrumMemory = malloc(sizeof(float) * 2 * B * numSpectra);
+	This->kernelSpectra[0] = malloc(sizeof(DSPSplitComplex) * 2 * This->maxPartitions);
+	This->kernelSpectra[1] = This->kernelSpectra[0] + This->maxPartitions;
+	This->inputSpectra = malloc(sizeof(DSPSplitComplex) * This->maxPartitions);
+	float *m = This->spectrumMemory;
+	for(size_t i=0; i<This->maxPartitions; i++){
+		for(size_t k=0; k<2; k++){
+			This->kernelSpectra[k][i].realp = m; m += B;
+			This->kernelSpectra[k][i].imagp = m; m += B;
+		}
+		This->inputSpectra[i].realp = m; m += B;
+		This->inputSpectra[i].imagp = m; m += B;
+	}
+	This->sum.realp = m; m += B;
+	This->sum.imagp = m; m += B;
+	This->fadeSum.realp = m; m += B;
+	This->fadeSum.imagp = m;
+
+	This->inputBlock = malloc(sizeof(float) * 2 * B);
+	This->outputBlock = malloc(sizeof(float) * B);
+	This->timeBuffer = malloc(sizeof(float) * 2 * B);
+	This->fadeBuffer = malloc(sizeof(float) * 2 * B);
+	This->kernelBuffer = malloc(sizeof(float) * 2 * B);
+
+	// start with an empty kernel, which outputs zeros
+	This->numPartitions[0] = This->numPartitions[1] = 0;
+	atomic_init(&This->kernelState, 0);
+	This->crossfade = false;
+
+	BMPartitionedConv_clearBuffers(This);
+}
+
+
+
+
+void BMPartitionedConv_free(BMPartitionedConv *This){
+	BMFFT_free(&This->fft);
+	BMFFT_free(&This->kernelFFT);
+
+	free(This->spectrumMemory);
+	This->spectrumMemory = NULL;
+	free(This->kernelSpectra[0]);
+	This->kernelSpectra[0] = This->kernelSpectra[1] = NULL;
+	free(This->inputSpectra);
+	This->inputSpectra = NULL;
+	free(This->inputBlock);
+	This->inputBlock = NULL;
+	free(This->outputBlock);
+	This->outputBlock = NULL;
+	free(This->timeBuffer);
+	This->timeBuffer = NULL;
+	free(This->fadeBuffer);
+	This->fadeBuffer = NULL;
+	free(This->kernelBuffer);
+	This->kernelBuffer = NULL;
+}
+
+
+
+
+void BMPartitionedConv_clearBuffers(BMPartitionedConv *This){
+	size_t B = This->partitionLength;
+	for(size_t i=0; i<This->maxPartitions; i++){
+		vDSP_vclr(This->inputSpectra[i].realp, 1, B);
+		vDSP_vclr(This->inputSpectra[i].imagp, 1, B);
+	}
+	vDSP_vclr(This->inputBlock, 1, 2 * B);
+	vDSP_vclr(This->outputBlock, 1, B);
+	This->fdlIndex = 0;
+	This->blockFill = 0;
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_beginKernelUpdate
+ *
+ * @abstract get the kernel set that isn't in use
+ *
+ * Withdraws any update that the process function hasn't picked up yet so that
+ * it can't switch to the inactive set while we are writing to it. If it is
+ * fading out of the inactive set we wait for it to finish, which takes at most
+ * the time to process one block.
+ *
+ * @returns the index of the inactive set
+ */
+static int BMPartitionedConv_beginKernelUpdate(BMPartitionedConv *This){
+	int state = atomic_load(&This->kernelState);
+	do {
+		while(state & BMPartitionedConv_Fading){
+			sched_yield();
+			state = atomic_load(&This->kernelState);
+		}
+	} while(!atomic_compare_exchange_weak(&This->kernelState, &state, state & BMPartitionedConv_ActiveSetMask));
+	return (state & BMPartitionedConv_ActiveSetMask) ^ 1;
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_publishKernel
+ *
+ * @abstract hand the kernel set from beginKernelUpdate to the process function
+ */
+static void BMPartitionedConv_publishKernel(BMPartitionedConv *This, int set){
+	atomic_store(&This->kernelState, (set ^ 1) | BMPartitionedConv_UpdatePending);
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_setPartitionSpectrum
+ *
+ * @abstract take the FFT of the kernel partition in the first half of kernelBuffer
+ */
+static void BMPartitionedConv_setPartitionSpectrum(BMPartitionedConv *This, int set, size_t partition){
+	size_t B = This->partitionLength;
+	DSPSplitComplex *spectrum = &This->kernelSpectra[set][partition];
+
+	// the second half is zero padding
+	vDSP_vclr(This->kernelBuffer + B, 1, B);
+
+	BMFFT_FFTComplexOutput(&This->kernelFFT, This->kernelBuffer, spectrum, 2 * B);
+
+	// The vDSP forward FFT is scaled by 2. BMFFT_IFFT corrects for that once,
+	// so we have to correct for it once more since we multiply two spectra.
+	float half = 0.5f;
+	vDSP_vsmul(spectrum->realp, 1, &half, spectrum->realp, 1, B);
+	vDSP_vsmul(spectrum->imagp, 1, &half, spectrum->imagp, 1, B);
+}
+
+
+
+
+void BMPartitionedConv_setKernel(BMPartitionedConv *This,
+								 const float *kernel,
+								 size_t kernelLength){
+	size_t B = This->partitionLength;
+	int set = BMPartitionedConv_beginKernelUpdate(This);
+	This->numPartitions[set] = BM_MAX(1, (kernelLength + B - 1) / B);
+	assert(This->numPartitions[set] <= This->maxPartitions);
+
+	for(size_t p=0; p<This->numPartitions[set]; p++){
+		size_t start = p * B;
+		size_t length = BM_MIN(B, kernelLength - start);
+		vDSP_vclr(This->kernelBuffer, 1, B);
+		memcpy(This->kernelBuffer, kernel + start, sizeof(float) * length);
+		BMPartitionedConv_setPartitionSpectrum(This, set, p);
+	}
+	
+	BMPartitionedConv_publishKernel(This, set);
+}
+
+
+
+
+void BMPartitionedConv_setSparseKernel(BMPartitionedConv *This,
+									   const size_t *delays,
+									   const float *gains,
+									   size_t numTaps){
+	size_t B = This->partitionLength;
+	int set = BMPartitionedConv_beginKernelUpdate(This);
+
+	// find the length of the kernel
+	size_t maxDelay = 0;
+	for(size_t i=0; i<numTaps; i++)
+		maxDelay = BM_MAX(maxDelay, delays[i]);
+	This->numPartitions[set] = maxDelay / B + 1;
+	assert(This->numPartitions[set] <= This->maxPartitions);
+
+	for(size_t p=0; p<This->numPartitions[set]; p++){
+		// write the taps that fall into this partition
+		size_t start = p * B;
+		vDSP_vclr(This->kernelBuffer, 1, B);
+		for(size_t i=0; i<numTaps; i++)
+			if(delays[i] >= start && delays[i] < start + B)
+				This->kernelBuffer[delays[i] - start] += gains[i];
+
+		BMPartitionedConv_setPartitionSpectrum(This, set, p);
+	}
+	
+	BMPartitionedConv_publishKernel(This, set);
+}
+
+
+
+
+void BMPartitionedConv_setCrossfade(BMPartitionedConv *This, bool crossfade){
+	This->crossfade = crossfade;
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_multiplyAccumulate
+ *
+ * @abstract sum += A * B for spectra in vDSP packed format
+ */
+static void BMPartitionedConv_multiplyAccumulate(const DSPSplitComplex *A,
+												 const DSPSplitComplex *B,
+												 DSPSplitComplex *sum,
+												 size_t length){
+	// DC and Nyquist are real and packed into the first element
+	float dc = sum->realp[0] + A->realp[0] * B->realp[0];
+	float nyquist = sum->imagp[0] + A->imagp[0] * B->imagp[0];
+
+	// complex multiply-add for the rest
+	DSPSplitComplex A1 = {A->realp + 1, A->imagp + 1};
+	DSPSplitComplex B1 = {B->realp + 1, B->imagp + 1};
+	DSPSplitComplex sum1 = {sum->realp + 1, sum->imagp + 1};
+	vDSP_zvma(&A1, 1, &B1, 1, &sum1, 1, &sum1, 1, length - 1);
+
+	sum->realp[0] = dc;
+	sum->imagp[0] = nyquist;
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_convolveBlock
+ *
+ * @abstract sum the products of the kernel partitions and the input spectra
+ * with the matching delays and transform the result to the time domain
+ *
+ * The first half of the result in output is aliased. Only the second half
+ * is valid.
+ */
+static void BMPartitionedConv_convolveBlock(BMPartitionedConv *This,
+											const DSPSplitComplex *kernel,
+											size_t numPartitions,
+											DSPSplitComplex *sum,
+											float *output){
+	size_t B = This->partitionLength;
+	vDSP_vclr(sum->realp, 1, B);
+	vDSP_vclr(sum->imagp, 1, B);
+	for(size_t p=0; p<numPartitions; p++){
+		size_t i = (This->fdlIndex + This->maxPartitions - p) % This->maxPartitions;
+		BMPartitionedConv_multiplyAccumulate(&This->inputSpectra[i], &kernel[p], sum, B);
+	}
+	BMFFT_IFFT(&This->fft, sum, output, B);
+}
+
+
+
+
+/*!
+ *BMPartitionedConv_processBlock
+ *
+ * @abstract called each time we have a complete block of input
+ */
+void BMPartitionedConv_processBlock(BMPartitionedConv *This){
+	size_t B = This->partitionLength;
+
+	// switch to the latest kernel if there is an update waiting. If we
+	// crossfade, the fading flag keeps the set functions from overwriting the
+	// old kernel until we are done with it.
+	int state = atomic_load(&This->kernelState);
+	int fadeFrom = -1;
+	if(state & BMPartitionedConv_UpdatePending){
+		int active = state & BMPartitionedConv_ActiveSetMask;
+		bool fade = This->crossfade && This->numPartitions[active] > 0;
+		int swapped = (active ^ 1) | (fade ? BMPartitionedConv_Fading : 0);
+		// if this fails, the update was withdrawn while we were looking at it
+		// and state is set to the current value, which has the same active set
+		if(atomic_compare_exchange_strong(&This->kernelState, &state, swapped)){
+			state = swapped;
+			if(fade) fadeFrom = active;
+		}
+	}
+	int active = state & BMPartitionedConv_ActiveSetMask;
+
+	// transform the last two blocks of input and put the result in the
+	// frequency domain delay line
+	This->fdlIndex = (This->fdlIndex + 1) % This->maxPartitions;
+	BMFFT_FFTComplexOutput(&This->fft, This->inputBlock, &This->inputSpectra[This->fdlIndex], 2 * B);
+
+	// multiply each partition of the kernel by the input spectrum with the
+	// matching delay and go back to the time domain, keeping only the second
+	// half of the result
+	BMPartitionedConv_convolveBlock(This, This->kernelSpectra[active], This->numPartitions[active], &This->sum, This->timeBuffer);
+	memcpy(This->outputBlock, This->timeBuffer + B, sizeof(float) * B);
+
+	// crossfade: old + ramp * (new - old)
+	if(fadeFrom >= 0){
+		float *oldOutput = This->fadeBuffer + B;
+		BMPartitionedConv_convolveBlock(This, This->kernelSpectra[fadeFrom], This->numPartitions[fadeFrom], &This->fadeSum, This->fadeBuffer);
+		atomic_fetch_and(&This->kernelState, ~BMPartitionedConv_Fading);
+
+		float fadeStep = 1.0f / (float)B;
+		float fadeStart = fadeStep;
+		vDSP_vsub(oldOutput, 1, This->outputBlock, 1, This->outputBlock, 1, B);
+		vDSP_vrampmuladd(This->outputBlock, 1, &fadeStart, &fadeStep, oldOutput, 1, B);
+		memcpy(This->outputBlock, oldOutput, sizeof(float) * B);
+	}
+
+	// the current block becomes the previous block
+	memcpy(This->inputBlock, This->inputBlock + B, sizeof(float) * B);
+}
+
+
+
+
+void BMPartitionedConv_process(BMPartitionedConv *This,
+							   const float *input,
+							   float *output,
+							   size_t numSamples){
+	assert(input != output);
+
+	size_t B = This->partitionLength;
+	size_t samplesProcessed = 0;
+	while(samplesProcessed < numSamples){
+		size_t samplesProcessing = BM_MIN(B - This->blockFill, numSamples - samplesProcessed);
+
+		// buffer the input and read from the output of the last block
+		memcpy(This->inputBlock + B + This->blockFill, input + samplesProcessed, sizeof(float) * samplesProcessing);
+		memcpy(output + samplesProcessed, This->outputBlock + This->blockFill, sizeof(float) * samplesProcessing);
+
+		This->blockFill += samplesProcessing;
+		samplesProcessed += samplesProcessing;
+
+		// when the input block is full, compute the next output block
+		if(This->blockFill == B){
+			BMPartitionedConv_processBlock(This);
+			This->blockFill = 0;
+		}
+	}
+}
+
+
+
+
+float BMPartitionedConv_costPerSample(size_t partitionLength, size_t kernelLength){
+	size_t B = partitionLength;
+	size_t numPartitions = BM_MAX(1, (kernelLength + B - 1) / B);
+
+	// A real FFT of length N takes about 2.5 N log2(N) flops. We do one
+	// forward and one inverse of length 2B every B samples.
+	float fftCost = 10.0f * log2f(2.0f * B);
+
+	// one complex multiply-add per bin per partition, B bins every B samples
+	float multiplyCost = 8.0f * numPartitions;
+
+	// one time domain multiply-add is 2 flops
+	return (fftCost + multiplyCost) / 2.0f;
+}
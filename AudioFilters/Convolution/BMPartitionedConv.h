@@ -0,0 +1,169 @@
+//
+//  BMPartitionedConv.h
+//  AudioFiltersXcodeProject
+//
+//  Uniformly partitioned FFT convolution (overlap-save with a frequency
+//  domain delay line). The cost per sample is roughly constant with respect
+//  to the number of non-zero coefficients in the kernel and grows with the
+//  kernel length, so it beats direct time-domain convolution for long, dense
+//  kernels.
+//
+//  The output is delayed by partitionLength samples. To convolve without
+//  latency, process the first partitionLength samples of the kernel in the
+//  time domain and give the rest of the kernel to this struct, shifted back
+//  by partitionLength samples. The kernel can be set as a sparse list of taps,
+//  which is convenient for velvet noise.
+//
+//  The kernel spectra are double buffered, like the tap sets of
+//  BMMultiTapDelay. The set functions transform the new kernel into the set
+//  that isn't in use, on the calling thread, and the process function
+//  switches to it at the start of the next block.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMPartitionedConv_h
+#define BMPartitionedConv_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "BMFFT.h"
+
+typedef struct BMPartitionedConv {
+	BMFFT fft;
+	DSPSplitComplex *inputSpectra;
+	DSPSplitComplex sum, fadeSum;
+	float *spectrumMemory, *inputBlock, *outputBlock, *timeBuffer, *fadeBuffer;
+	size_t partitionLength, maxPartitions, fdlIndex, blockFill;
+	
+	// Two sets of kernel spectra. The state holds the index of the active set
+	// in bit 0, a flag in bit 1 that indicates that the other set has an
+	// update waiting, and a flag in bit 2 that is set while the process
+	// function fades from the old set to the new one. A set with no
+	// partitions is all zeros.
+	DSPSplitComplex *kernelSpectra [2];
+	size_t numPartitions [2];
+	_Atomic int kernelState;
+	bool crossfade;
+	
+	// the set functions have their own FFT so they don't disturb processing
+	BMFFT kernelFFT;
+	float *kernelBuffer;
+} BMPartitionedConv;
+
+
+
+/*!
+ *BMPartitionedConv_init
+ *
+ * @param This             pointer to a struct
+ * @param partitionLength  block length of the FFT processing; a power of two. This is also the latency.
+ * @param maxKernelLength  the longest kernel that can be set without calling init again
+ */
+void BMPartitionedConv_init(BMPartitionedConv *This,
+							size_t partitionLength,
+							size_t maxKernelLength);
+
+
+
+/*!
+ *BMPartitionedConv_free
+ */
+void BMPartitionedConv_free(BMPartitionedConv *This);
+
+
+
+/*!
+ *BMPartitionedConv_setKernel
+ *
+ * The set functions may be called from a thread other than the audio thread,
+ * but only from one thread at a time. If the process function is fading to
+ * the last kernel when this is called, this waits for that block to finish.
+ *
+ * @param This          pointer to an initialised struct
+ * @param kernel        filter coefficients
+ * @param kernelLength  must not exceed the maxKernelLength set on init
+ */
+void BMPartitionedConv_setKernel(BMPartitionedConv *This,
+								 const float *kernel,
+								 size_t kernelLength);
+
+
+
+/*!
+ *BMPartitionedConv_setSparseKernel
+ *
+ * Sets a kernel that is zero everywhere except at the given taps
+ *
+ * @param This      pointer to an initialised struct
+ * @param delays    position of each tap in samples; each must be < maxKernelLength
+ * @param gains     coefficient of each tap
+ * @param numTaps   length of delays and gains
+ */
+void BMPartitionedConv_setSparseKernel(BMPartitionedConv *This,
+									   const size_t *delays,
+									   const float *gains,
+									   size_t numTaps);
+
+
+
+/*!
+ *BMPartitionedConv_setCrossfade
+ *
+ * When crossfade is on, the block that switches to a new kernel fades from
+ * the output of the old kernel to the output of the new one, so that the
+ * kernel can change while audio is running. That block costs one more
+ * inverse FFT and twice the multiplies. There is no fade when the old kernel
+ * is empty, as it is after init. Off by default.
+ */
+void BMPartitionedConv_setCrossfade(BMPartitionedConv *This, bool crossfade);
+
+
+
+/*!
+ *BMPartitionedConv_process
+ *
+ * The output is the input convolved with the kernel and delayed by
+ * partitionLength samples
+ *
+ * @param This        pointer to an initialised struct
+ * @param input       input buffer of length numSamples
+ * @param output      output buffer of length numSamples. may not be the same as input
+ * @param numSamples  any length
+ */
+void BMPartitionedConv_process(BMPartitionedConv *This,
+							   const float *input,
+							   float *output,
+							   size_t numSamples);
+
+
+
+/*!
+ *BMPartitionedConv_clearBuffers
+ */
+void BMPartitionedConv_clearBuffers(BMPartitionedConv *This);
+
+
+
+/*!
+ *BMPartitionedConv_costPerSample
+ *
+ * Estimates the processing cost per sample in units of one time-domain
+ * multiply-add. Use this to decide between direct and FFT convolution.
+ *
+ * @param partitionLength  a power of two
+ * @param kernelLength     length of the part of the kernel processed by FFT
+ */
+float BMPartitionedConv_costPerSample(size_t partitionLength, size_t kernelLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMPartitionedConv_h */
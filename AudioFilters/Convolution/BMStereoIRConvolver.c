@@ -0,0 +1,356 @@
+//
+//  BMStereoIRConvolver.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMStereoIRConvolver.h"
+#include <stdlib.h>
+#include <assert.h>
+#include "Constants.h"
+
+
+// Each segment has a partition length 8 times longer than the one before
+#define BMIRConv_segmentGrowth 8
+
+
+// forward declarations
+void BMStereoIRConvolver_freePaths(BMStereoIRConvolver *This);
+void BMStereoIRConvolver_loadKernels(BMStereoIRConvolver *This, const BMStereoIRCacheEntry *entry);
+
+
+
+void BMStereoIRConvolver_init(BMStereoIRConvolver *This){
+	This->numSegments = 0;
+	This->numCacheEntries = 0;
+	This->currentKey = 0;
+	This->useCount = 0;
+	This->kernelLoaded = false;
+
+	for(size_t i=0; i<BMIRConv_numStages; i++){
+		This->jobs[i].owner = This;
+		This->jobs[i].index = i;
+	}
+	This->workerGroup = dispatch_group_create();
+}
+
+
+
+
+void BMStereoIRConvolver_freePaths(BMStereoIRConvolver *This){
+	if(!This->kernelLoaded)
+		return;
+
+	for(size_t p=0; p<BMIRConv_numPaths; p++){
+		BMStereoIRConvolverPath *path = &This->paths[p];
+		BMFIRFilter_free(&path->head);
+		for(size_t s=0; s<This->numSegments; s++)
+			BMPartitionedConv_free(&path->segments[s]);
+		for(size_t s=0; s<=This->numSegments; s++){
+			free(path->stageOutputs[s]);
+			path->stageOutputs[s] = NULL;
+		}
+	}
+	This->kernelLoaded = false;
+}
+
+
+
+
+void BMStereoIRConvolver_free(BMStereoIRConvolver *This){
+	BMStereoIRConvolver_freePaths(This);
+
+	for(size_t i=0; i<This->numCacheEntries; i++)
+		for(size_t p=0; p<BMIRConv_numPaths; p++){
+			free(This->cache[i].kernels[p]);
+			This->cache[i].kernels[p] = NULL;
+		}
+	This->numCacheEntries = 0;
+
+	dispatch_release(This->workerGroup);
+	This->workerGroup = NULL;
+}
+
+
+
+
+/*!
+ *BMStereoIRConvolver_segmentStart
+ *
+ * @abstract position in the kernel where a segment starts
+ *
+ * A segment with partition length B has latency B, so it can't start before
+ * B samples into the kernel.
+ */
+static size_t BMStereoIRConvolver_segmentStart(size_t segment){
+	if(segment == 0)
+		return BMIRConv_headLength;
+	size_t partitionLength = BMIRConv_headLength;
+	for(size_t s=0; s<segment; s++)
+		partitionLength *= BMIRConv_segmentGrowth;
+	return 2 * partitionLength;
+}
+
+
+
+
+void BMStereoIRConvolver_loadKernels(BMStereoIRConvolver *This, const BMStereoIRCacheEntry *entry){
+	BMStereoIRConvolver_freePaths(This);
+
+	size_t length = entry->length;
+	size_t headLength = BM_MIN(BMIRConv_headLength, length);
+
+	This->numSegments = 0;
+	while(This->numSegments < BMIRConv_maxSegments &&
+		  BMStereoIRConvolver_segmentStart(This->numSegments) < length)
+		This->numSegments++;
+
+	float *segmentKernel = malloc(sizeof(float) * length);
+
+	for(size_t p=0; p<BMIRConv_numPaths; p++){
+		BMStereoIRConvolverPath *path = &This->paths[p];
+		const float *kernel = entry->kernels[p];
+
+		BMFIRFilter_init(&path->head, (float*)kernel, headLength);
+
+		size_t partitionLength = BMIRConv_headLength;
+		for(size_t s=0; s<This->numSegments; s++){
+			size_t start = BMStereoIRConvolver_segmentStart(s);
+			size_t end = (s + 1 < This->numSegments) ? BMStereoIRConvolver_segmentStart(s + 1) : length;
+
+			// The output of the segment is delayed by one partition, so its
+			// kernel is shifted back by that much. This leaves zeros at the
+			// start where the kernel overlaps the previous segment.
+			size_t offset = start - partitionLength;
+			size_t segmentLength = end - partitionLength;
+			memset(segmentKernel, 0, sizeof(float) * offset);
+			memcpy(segmentKernel + offset, kernel + start, sizeof(float) * (end - start));
+
+			BMPartitionedConv_init(&path->segments[s], partitionLength, segmentLength);
+			BMPartitionedConv_setKernel(&path->segments[s], segmentKernel, segmentLength);
+
+			partitionLength *= BMIRConv_segmentGrowth;
+		}
+
+		for(size_t s=0; s<=This->numSegments; s++)
+			path->stageOutputs[s] = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
+	}
+
+	free(segmentKernel);
+
+	This->currentKey = entry->key;
+	This->kernelLoaded = true;
+}
+
+
+
+
+bool BMStereoIRConvolver_loadCached(BMStereoIRConvolver *This, uint64_t key){
+	if(This->kernelLoaded && This->currentKey == key)
+		return true;
+
+	for(size_t i=0; i<This->numCacheEntries; i++)
+		if(This->cache[i].key == key){
+			This->cache[i].lastUsed = ++This->useCount;
+			BMStereoIRConvolver_loadKernels(This, &This->cache[i]);
+			return true;
+		}
+
+	return false;
+}
+
+
+
+
+void BMStereoIRConvolver_setIR(BMStereoIRConvolver *This,
+							   uint64_t key,
+							   float * const *kernels,
+							   size_t length){
+	assert(length > 0);
+
+	// find a free cache entry or the least recently used one
+	BMStereoIRCacheEntry *entry;
+	if(This->numCacheEntries < BMIRConv_cacheSize){
+		entry = &This->cache[This->numCacheEntries++];
+	}
+	else {
+		entry = &This->cache[0];
+		for(size_t i=1; i<BMIRConv_cacheSize; i++)
+			if(This->cache[i].lastUsed < entry->lastUsed)
+				entry = &This->cache[i];
+		for(size_t p=0; p<BMIRConv_numPaths; p++)
+			free(entry->kernels[p]);
+	}
+
+	entry->key = key;
+	entry->length = length;
+	entry->lastUsed = ++This->useCount;
+	for(size_t p=0; p<BMIRConv_numPaths; p++){
+		entry->kernels[p] = malloc(sizeof(float) * length);
+		memcpy(entry->kernels[p], kernels[p], sizeof(float) * length);
+	}
+
+	BMStereoIRConvolver_loadKernels(This, entry);
+}
+
+
+
+
+/*!
+ *BMStereoIRConvolver_processStage
+ *
+ * @abstract process the time domain head or one segment of one path
+ */
+static void BMStereoIRConvolver_processStage(BMStereoIRConvolver *This, size_t job){
+	size_t stagesPerPath = This->numSegments + 1;
+	size_t p = job / stagesPerPath;
+	size_t stage = job % stagesPerPath;
+	BMStereoIRConvolverPath *path = &This->paths[p];
+
+	// paths 0 and 1 take the left input, 2 and 3 take the right
+	const float *input = This->input[p / 2];
+
+	if(stage == 0)
+		BMFIRFilter_process(&path->head, (float*)input, path->stageOutputs[0], This->numSamples);
+	else
+		BMPartitionedConv_process(&path->segments[stage - 1], input, path->stageOutputs[stage], This->numSamples);
+}
+
+
+
+
+static void BMStereoIRConvolver_workerJob(void *context){
+	BMStereoIRConvolverJob *job = context;
+	BMStereoIRConvolver_processStage(job->owner, job->index);
+}
+
+
+
+
+/*!
+ *BMStereoIRConvolver_isParallelJob
+ *
+ * @returns true if the stage is a long segment that will compute a block in
+ * the next numSamples samples. Everything else is cheap enough to do inline.
+ */
+static bool BMStereoIRConvolver_isParallelJob(const BMStereoIRConvolver *This, size_t job, size_t numSamples){
+	size_t stagesPerPath = This->numSegments + 1;
+	size_t stage = job % stagesPerPath;
+	if(stage == 0)
+		return false;
+
+	const BMPartitionedConv *segment = &This->paths[job / stagesPerPath].segments[stage - 1];
+	return segment->partitionLength >= BMIRConv_minParallelPartition &&
+		   segment->blockFill + numSamples >= segment->partitionLength;
+}
+
+
+
+
+void BMStereoIRConvolver_process(BMStereoIRConvolver *This,
+								 const float *inputL, const float *inputR,
+								 float *outputL, float *outputR,
+								 size_t numSamples){
+	assert(This->kernelLoaded);
+
+	size_t numJobs = BMIRConv_numPaths * (This->numSegments + 1);
+	dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	float *outputs [2] = {outputL, outputR};
+
+	size_t samplesProcessed = 0;
+	while(samplesProcessed < numSamples){
+		size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, numSamples - samplesProcessed);
+
+		This->input[0] = inputL + samplesProcessed;
+		This->input[1] = inputR + samplesProcessed;
+		This->numSamples = samplesProcessing;
+
+		// Send the long segments that are due for an FFT to the workers and
+		// process everything else here while they run
+		bool parallel [BMIRConv_numStages];
+		bool workersRunning = false;
+		for(size_t j=0; j<numJobs; j++){
+			parallel[j] = BMStereoIRConvolver_isParallelJob(This, j, samplesProcessing);
+			if(parallel[j]){
+				dispatch_group_async_f(This->workerGroup, queue, &This->jobs[j], BMStereoIRConvolver_workerJob);
+				workersRunning = true;
+			}
+		}
+		for(size_t j=0; j<numJobs; j++)
+			if(!parallel[j])
+				BMStereoIRConvolver_processStage(This, j);
+		if(workersRunning)
+			dispatch_group_wait(This->workerGroup, DISPATCH_TIME_FOREVER);
+
+		// Sum the stages of the paths to each output channel. Paths 0 and 2
+		// go to the left output, 1 and 3 to the right. The input has all
+		// been read by now so it's safe to write over it.
+		for(size_t c=0; c<2; c++){
+			float *output = outputs[c] + samplesProcessed;
+			memcpy(output, This->paths[c].stageOutputs[0], sizeof(float) * samplesProcessing);
+			for(size_t p=c; p<BMIRConv_numPaths; p+=2)
+				for(size_t s=0; s<=This->numSegments; s++)
+					if(p != c || s != 0)
+						vDSP_vadd(output, 1, This->paths[p].stageOutputs[s], 1, output, 1, samplesProcessing);
+		}
+
+		samplesProcessed += samplesProcessing;
+	}
+}
+
+
+
+
+void BMStereoIRConvolver_clearBuffers(BMStereoIRConvolver *This){
+	if(!This->kernelLoaded)
+		return;
+
+	// reloading the kernels is the simplest way to clear the head filters
+	for(size_t i=0; i<This->numCacheEntries; i++)
+		if(This->cache[i].key == This->currentKey){
+			BMStereoIRConvolver_loadKernels(This, &This->cache[i]);
+			return;
+		}
+}
+
+
+
+
+uint64_t BMStereoIRConvolver_hash(const void *data, size_t numBytes, uint64_t seed){
+	const uint8_t *bytes = data;
+	uint64_t hash = 14695981039346656037ull ^ seed;
+	for(size_t i=0; i<numBytes; i++){
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+
+
+
+size_t BMStereoIRConvolver_audibleLength(float * const *kernels,
+										 size_t numKernels,
+										 size_t length,
+										 float thresholdDb){
+	float peak = 0.0f;
+	for(size_t k=0; k<numKernels; k++){
+		float kernelPeak;
+		vDSP_maxmgv(kernels[k], 1, &kernelPeak, length);
+		peak = BM_MAX(peak, kernelPeak);
+	}
+	float threshold = peak * BM_DB_TO_GAIN(thresholdDb);
+
+	// search backwards for the last sample above the threshold
+	size_t audibleLength = 1;
+	for(size_t k=0; k<numKernels; k++)
+		for(size_t i=length; i>audibleLength; i--)
+			if(fabsf(kernels[k][i-1]) > threshold){
+				audibleLength = i;
+				break;
+			}
+
+	return audibleLength;
+}
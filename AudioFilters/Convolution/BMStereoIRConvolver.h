@@ -0,0 +1,190 @@
+//
+//  BMStereoIRConvolver.h
+//  AudioFiltersXcodeProject
+//
+//  Convolves a stereo signal with a true stereo impulse response, which is a
+//  set of four kernels from each input channel to each output channel. This
+//  is for replacing an LTI effect with its rendered impulse response during
+//  offline rendering.
+//
+//  There is no latency. The first BMIRConv_headLength samples of each kernel
+//  are convolved in the time domain and the rest is split into segments with
+//  partition lengths that grow along the kernel, each processed by a
+//  BMPartitionedConv. Most of the work is done inline on the calling thread.
+//  The segments with the longest partitions do a large FFT once every few
+//  buffers; when that is due, they run on worker threads while the rest of
+//  the buffer is processed inline.
+//
+//  Rendering an impulse response can be slow, so a few of them are kept in a
+//  cache. Each is identified by a key, normally a hash of the parameters of
+//  the effect that produced it.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMStereoIRConvolver_h
+#define BMStereoIRConvolver_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <dispatch/dispatch.h>
+#include "BMFIRFilter.h"
+#include "BMPartitionedConv.h"
+
+#define BMIRConv_headLength 128
+#define BMIRConv_maxSegments 3
+#define BMIRConv_cacheSize 4
+
+// one kernel for each combination of input and output channel
+#define BMIRConv_numPaths 4
+
+// segments with a partition at least this long run on worker threads
+#define BMIRConv_minParallelPartition 4096
+
+#define BMIRConv_numStages (BMIRConv_numPaths * (BMIRConv_maxSegments + 1))
+
+
+// the convolution from one input channel to one output channel
+typedef struct BMStereoIRConvolverPath {
+	BMFIRFilter head;
+	BMPartitionedConv segments [BMIRConv_maxSegments];
+	float *stageOutputs [BMIRConv_maxSegments + 1];
+} BMStereoIRConvolverPath;
+
+
+typedef struct BMStereoIRCacheEntry {
+	uint64_t key;
+	float *kernels [BMIRConv_numPaths];
+	size_t length;
+	uint64_t lastUsed;
+} BMStereoIRCacheEntry;
+
+
+// context for processing one stage of one path
+typedef struct BMStereoIRConvolverJob {
+	struct BMStereoIRConvolver *owner;
+	size_t index;
+} BMStereoIRConvolverJob;
+
+
+typedef struct BMStereoIRConvolver {
+	BMStereoIRConvolverPath paths [BMIRConv_numPaths];
+	BMStereoIRCacheEntry cache [BMIRConv_cacheSize];
+	size_t numSegments, numCacheEntries;
+	uint64_t currentKey, useCount;
+	bool kernelLoaded;
+
+	// set during processing, for the parallel jobs
+	const float *input [2];
+	size_t numSamples;
+	BMStereoIRConvolverJob jobs [BMIRConv_numStages];
+	dispatch_group_t workerGroup;
+} BMStereoIRConvolver;
+
+
+
+/*!
+ *BMStereoIRConvolver_init
+ *
+ * Memory for the convolution is allocated when the first impulse response
+ * is loaded.
+ */
+void BMStereoIRConvolver_init(BMStereoIRConvolver *This);
+
+
+
+/*!
+ *BMStereoIRConvolver_free
+ */
+void BMStereoIRConvolver_free(BMStereoIRConvolver *This);
+
+
+
+/*!
+ *BMStereoIRConvolver_loadCached
+ *
+ * Loads the impulse response with the given key if it is in the cache.
+ *
+ * @returns true if the impulse response with this key is now loaded
+ */
+bool BMStereoIRConvolver_loadCached(BMStereoIRConvolver *This, uint64_t key);
+
+
+
+/*!
+ *BMStereoIRConvolver_setIR
+ *
+ * Copies an impulse response into the cache, replacing the least recently
+ * used entry if the cache is full, and loads it for processing. This
+ * allocates memory.
+ *
+ * @param This     pointer to an initialised struct
+ * @param key      identifies the impulse response in calls to loadCached
+ * @param kernels  BMIRConv_numPaths kernels: left to left, left to right, right to left, right to right
+ * @param length   length of each kernel
+ */
+void BMStereoIRConvolver_setIR(BMStereoIRConvolver *This,
+							   uint64_t key,
+							   float * const *kernels,
+							   size_t length);
+
+
+
+/*!
+ *BMStereoIRConvolver_process
+ *
+ * @param This        pointer to a struct with an impulse response loaded
+ * @param inputL      left input, length numSamples
+ * @param inputR      right input, length numSamples
+ * @param outputL     left output, length numSamples. may be the same as inputL
+ * @param outputR     right output, length numSamples. may be the same as inputR
+ * @param numSamples  any length
+ */
+void BMStereoIRConvolver_process(BMStereoIRConvolver *This,
+								 const float *inputL, const float *inputR,
+								 float *outputL, float *outputR,
+								 size_t numSamples);
+
+
+
+/*!
+ *BMStereoIRConvolver_clearBuffers
+ */
+void BMStereoIRConvolver_clearBuffers(BMStereoIRConvolver *This);
+
+
+
+/*!
+ *BMStereoIRConvolver_hash
+ *
+ * 64 bit FNV-1a hash, for making cache keys from effect parameters
+ *
+ * @param data      bytes to hash
+ * @param numBytes  length of data
+ * @param seed      hash of other data, or 0
+ */
+uint64_t BMStereoIRConvolver_hash(const void *data, size_t numBytes, uint64_t seed);
+
+
+
+/*!
+ *BMStereoIRConvolver_audibleLength
+ *
+ * @returns the length of the kernels after removing the part at the end
+ * where all of them are more than thresholdDb below their peak
+ */
+size_t BMStereoIRConvolver_audibleLength(float * const *kernels,
+										 size_t numKernels,
+										 size_t length,
+										 float thresholdDb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMStereoIRConvolver_h */
@@ -0,0 +1,366 @@
+//
+//  BMBatchedFDN.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMBatchedFDN.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <Accelerate/Accelerate.h>
+#include "BMReverb.h"
+#include "BMFastHadamard.h"
+#include "Constants.h"
+
+
+// forward declarations
+void BMBatchedFDN_randomSigns(float* A, size_t length);
+void BMBatchedFDN_updateDecayGains(BMBatchedFDN *This, size_t instance);
+
+
+
+void BMBatchedFDN_init(BMBatchedFDN *This,
+					   size_t numInstances,
+					   size_t numDelays,
+					   float minDelayTimeSeconds,
+					   float maxDelayTimeSeconds,
+					   float RT60DecayTimeSeconds,
+					   float sampleRate){
+	// number of delays must be a power of two and we need at least one delay
+	// for each stereo channel
+	assert(BMPowerOfTwoQ(numDelays) && numDelays >= 2);
+	assert(numInstances > 0);
+
+	This->numInstances = numInstances;
+	This->numDelays = numDelays;
+	This->sampleRate = sampleRate;
+
+	// instances are processed in groups of BMBATCHEDFDN_LANES. If numInstances
+	// isn't a multiple of the group size, the last group has unused lanes.
+	This->numGroups = (numInstances + BMBATCHEDFDN_LANES - 1) / BMBATCHEDFDN_LANES;
+	size_t numLanes = This->numGroups * BMBATCHEDFDN_LANES;
+	size_t G = This->numGroups;
+
+	// half the delays take input from the left channel and half from the right
+	This->inputAttenuation = 1.0f / sqrtf((float)numDelays / 2.0f);
+
+	// keep the Hadamard mixing matrix unitary
+	This->matrixAttenuation = sqrtf(1.0f / (float)numDelays);
+
+	// allocate memory for per-delay settings. The topology is shared so we
+	// need only one copy of these
+	This->delayLengths = malloc(sizeof(size_t) * numDelays);
+	This->delayStartIndices = malloc(sizeof(size_t) * numDelays);
+	This->rwIndices = calloc(numDelays, sizeof(size_t));
+	This->outputSigns = malloc(sizeof(float) * numDelays);
+
+	// allocate memory for per-instance settings
+	This->rt60 = malloc(sizeof(float) * numLanes);
+	This->wetMix = malloc(sizeof(float) * numLanes);
+	This->wetGain = malloc(sizeof(float) * numLanes);
+	This->dryGain = malloc(sizeof(float) * numLanes);
+
+	// allocate memory for per-delay, per-instance arrays
+	This->decayGains = malloc(sizeof(simd_float4) * numDelays * G);
+	This->feedback = calloc(numDelays * G, sizeof(simd_float4));
+
+	// buffers for the input and wet output in instance-interleaved format
+	This->inputL = malloc(sizeof(simd_float4) * BM_BUFFER_CHUNK_SIZE * G);
+	This->inputR = malloc(sizeof(simd_float4) * BM_BUFFER_CHUNK_SIZE * G);
+	This->wetL = malloc(sizeof(simd_float4) * BM_BUFFER_CHUNK_SIZE * G);
+	This->wetR = malloc(sizeof(simd_float4) * BM_BUFFER_CHUNK_SIZE * G);
+
+	// generate unique delay times in the specified range. The output is sorted,
+	// so assigning them alternately to left and right gives both channels
+	// about the same average delay time.
+	size_t minDelay = minDelayTimeSeconds * sampleRate;
+	size_t maxDelay = maxDelayTimeSeconds * sampleRate;
+	BMReverbRandomsInRange(minDelay, maxDelay, This->delayLengths, numDelays);
+
+	// Allocate the delay memory. Each delay has a block of delayLength * G
+	// vectors. Sample n of delay i for group g is stored at
+	// delayStartIndices[i] + n*G + g, so one tap from all instances is a
+	// contiguous run of G vectors.
+	size_t totalLength = 0;
+	for(size_t i=0; i<numDelays; i++){
+		This->delayStartIndices[i] = totalLength;
+		totalLength += This->delayLengths[i] * G;
+	}
+	This->delayMemory = calloc(totalLength, sizeof(simd_float4));
+
+	// in each channel, half the output taps are inverted
+	for(size_t i=0; i<numDelays; i+=2){
+		This->outputSigns[i] = (i/2) % 2 == 0 ? 1.0f : -1.0f;
+		This->outputSigns[i+1] = -This->outputSigns[i];
+	}
+	BMBatchedFDN_randomSigns(This->outputSigns, numDelays);
+
+	// set per-instance defaults
+	for(size_t i=0; i<numLanes; i++){
+		This->rt60[i] = RT60DecayTimeSeconds;
+		This->wetMix[i] = This->wetGain[i] = 1.0f;
+		This->dryGain[i] = 0.0f;
+	}
+	for(size_t i=0; i<numInstances; i++)
+		BMBatchedFDN_updateDecayGains(This, i);
+
+	// unused lanes decay immediately
+	for(size_t i=numInstances; i<numLanes; i++){
+		float *gains = (float*)This->decayGains;
+		for(size_t j=0; j<numDelays; j++)
+			gains[j*numLanes + i] = 0.0f;
+	}
+}
+
+
+
+
+/*!
+ *BMBatchedFDN_randomSigns
+ *
+ * @abstract randomly shuffle the output signs of the left and right channel separately
+ */
+void BMBatchedFDN_randomSigns(float* A, size_t length){
+	// A[even] are left channel, A[odd] are right
+	for(size_t c=0; c<2; c++){
+		for(size_t i=c; i<length; i+=2){
+			size_t randomIndex = c + 2*(arc4random() % (length/2));
+			float temp = A[i];
+			A[i] = A[randomIndex];
+			A[randomIndex] = temp;
+		}
+	}
+}
+
+
+
+
+void BMBatchedFDN_updateDecayGains(BMBatchedFDN *This, size_t instance){
+	size_t numLanes = This->numGroups * BMBATCHEDFDN_LANES;
+	float *gains = (float*)This->decayGains;
+
+	for(size_t i=0; i<This->numDelays; i++){
+		double delayTime = (double)This->delayLengths[i] / This->sampleRate;
+		float rt60Gain = BMReverbDelayGainFromRT60(This->rt60[instance], delayTime);
+
+		// the element for delay i in instance k is lane k of vector i*G + k/4
+		gains[i*numLanes + instance] = rt60Gain * This->matrixAttenuation;
+	}
+}
+
+
+
+
+void BMBatchedFDN_setRT60DecayTime(BMBatchedFDN *This, size_t instance, float rt60){
+	assert(instance < This->numInstances);
+	assert(rt60 > 0.0f);
+
+	This->rt60[instance] = rt60;
+	BMBatchedFDN_updateDecayGains(This, instance);
+}
+
+
+
+
+void BMBatchedFDN_setWetMix(BMBatchedFDN *This, size_t instance, float wetMix){
+	assert(instance < This->numInstances);
+	assert(0.0f <= wetMix && wetMix <= 1.0f);
+
+	This->wetMix[instance] = wetMix;
+}
+
+
+
+
+/*!
+ *BMBatchedFDN_hadamard
+ *
+ * @abstract in-place fast Hadamard transform on an array of numDelays elements, where each element is G vectors wide
+ */
+static inline void BMBatchedFDN_hadamard(simd_float4 *x, size_t numDelays, size_t G){
+	for(size_t h=1; h<numDelays; h *= 2){
+		for(size_t i=0; i<numDelays; i += 2*h){
+			for(size_t j=i; j<i+h; j++){
+				simd_float4 *a = x + j*G;
+				simd_float4 *b = x + (j+h)*G;
+				for(size_t g=0; g<G; g++){
+					simd_float4 t = a[g];
+					a[g] = t + b[g];
+					b[g] = t - b[g];
+				}
+			}
+		}
+	}
+}
+
+
+
+
+/*!
+ *BMBatchedFDN_processWet
+ *
+ * @abstract process interleaved input in This->inputL/R to interleaved wet output in This->wetL/R
+ */
+static void BMBatchedFDN_processWet(BMBatchedFDN *This, size_t numSamples){
+	size_t G = This->numGroups;
+	size_t N = This->numDelays;
+
+	for(size_t n=0; n<numSamples; n++){
+		simd_float4 *inL = This->inputL + n*G;
+		simd_float4 *inR = This->inputR + n*G;
+		simd_float4 *outL = This->wetL + n*G;
+		simd_float4 *outR = This->wetR + n*G;
+
+		for(size_t g=0; g<G; g++)
+			outL[g] = outR[g] = 0.0f;
+
+		// read from the delays, sum to output and apply decay
+		for(size_t i=0; i<N; i++){
+			const simd_float4 *read = This->delayMemory + This->delayStartIndices[i] + This->rwIndices[i]*G;
+			const simd_float4 *gain = This->decayGains + i*G;
+			simd_float4 *fb = This->feedback + i*G;
+			simd_float4 *out = (i % 2 == 0) ? outL : outR;
+			float sign = This->outputSigns[i];
+			for(size_t g=0; g<G; g++){
+				out[g] += sign * read[g];
+				fb[g] = read[g] * gain[g];
+			}
+		}
+
+		// mix the feedback
+		BMBatchedFDN_hadamard(This->feedback, N, G);
+
+		// mix input with feedback, write back to the delays and advance the
+		// indices. Since all instances share the same topology, one index
+		// update covers the whole batch.
+		for(size_t i=0; i<N; i++){
+			simd_float4 *write = This->delayMemory + This->delayStartIndices[i] + This->rwIndices[i]*G;
+			const simd_float4 *fb = This->feedback + i*G;
+			const simd_float4 *in = (i % 2 == 0) ? inL : inR;
+			for(size_t g=0; g<G; g++)
+				write[g] = fb[g] + in[g];
+
+			This->rwIndices[i]++;
+			if(This->rwIndices[i] >= This->delayLengths[i])
+				This->rwIndices[i] = 0;
+		}
+	}
+}
+
+
+
+
+void BMBatchedFDN_processBufferStereo(BMBatchedFDN *This,
+									  float* const* inputL,
+									  float* const* inputR,
+									  float* const* outputL,
+									  float* const* outputR,
+									  size_t numSamples){
+	size_t numLanes = This->numGroups * BMBATCHEDFDN_LANES;
+	float *inL = (float*)This->inputL;
+	float *inR = (float*)This->inputR;
+	float *wetL = (float*)This->wetL;
+	float *wetR = (float*)This->wetR;
+
+	size_t samplesProcessed = 0;
+	while(samplesProcessed < numSamples){
+		size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, numSamples - samplesProcessed);
+
+		// clear the input so that unused lanes are silent
+		if(numLanes != This->numInstances){
+			vDSP_vclr(inL, 1, numLanes * samplesProcessing);
+			vDSP_vclr(inR, 1, numLanes * samplesProcessing);
+		}
+
+		// attenuate the input and interleave it so that sample n of instance
+		// k is at index n*numLanes + k
+		for(size_t k=0; k<This->numInstances; k++){
+			vDSP_vsmul(inputL[k] + samplesProcessed, 1, &This->inputAttenuation, inL + k, numLanes, samplesProcessing);
+			vDSP_vsmul(inputR[k] + samplesProcessed, 1, &This->inputAttenuation, inR + k, numLanes, samplesProcessing);
+		}
+
+		// process all instances together
+		BMBatchedFDN_processWet(This, samplesProcessing);
+
+		// de-interleave and mix wet and dry. If the mix changed since the last
+		// buffer we ramp the gain linearly to the new setting.
+		for(size_t k=0; k<This->numInstances; k++){
+			const float *dryL = inputL[k] + samplesProcessed;
+			const float *dryR = inputR[k] + samplesProcessed;
+			float *outL = outputL[k] + samplesProcessed;
+			float *outR = outputR[k] + samplesProcessed;
+
+			float targetWet = This->wetMix[k];
+			float targetDry = sqrtf(1.0f - targetWet*targetWet);
+			if(targetWet == This->wetGain[k] && targetDry == This->dryGain[k]){
+				vDSP_vsmsma(wetL + k, numLanes, &This->wetGain[k], dryL, 1, &This->dryGain[k], outL, 1, samplesProcessing);
+				vDSP_vsmsma(wetR + k, numLanes, &This->wetGain[k], dryR, 1, &This->dryGain[k], outR, 1, samplesProcessing);
+			} else {
+				float wetGain = This->wetGain[k];
+				float dryGain = This->dryGain[k];
+				float wetIncrement = (targetWet - wetGain) / (float)samplesProcessing;
+				float dryIncrement = (targetDry - dryGain) / (float)samplesProcessing;
+				for(size_t i=0; i<samplesProcessing; i++){
+					wetGain += wetIncrement;
+					dryGain += dryIncrement;
+					outL[i] = wetL[i*numLanes + k]*wetGain + dryL[i]*dryGain;
+					outR[i] = wetR[i*numLanes + k]*wetGain + dryR[i]*dryGain;
+				}
+				This->wetGain[k] = targetWet;
+				This->dryGain[k] = targetDry;
+			}
+		}
+
+		samplesProcessed += samplesProcessing;
+	}
+}
+
+
+
+
+void BMBatchedFDN_clearBuffers(BMBatchedFDN *This){
+	size_t totalLength = 0;
+	for(size_t i=0; i<This->numDelays; i++)
+		totalLength += This->delayLengths[i] * This->numGroups;
+	memset(This->delayMemory, 0, sizeof(simd_float4) * totalLength);
+	memset(This->feedback, 0, sizeof(simd_float4) * This->numDelays * This->numGroups);
+}
+
+
+
+
+void BMBatchedFDN_free(BMBatchedFDN *This){
+	free(This->delayMemory);
+	This->delayMemory = NULL;
+	free(This->decayGains);
+	This->decayGains = NULL;
+	free(This->feedback);
+	This->feedback = NULL;
+	free(This->inputL);
+	This->inputL = NULL;
+	free(This->inputR);
+	This->inputR = NULL;
+	free(This->wetL);
+	This->wetL = NULL;
+	free(This->wetR);
+	This->wetR = NULL;
+	free(This->delayLengths);
+	This->delayLengths = NULL;
+	free(This->delayStartIndices);
+	This->delayStartIndices = NULL;
+	free(This->rwIndices);
+	This->rwIndices = NULL;
+	free(This->outputSigns);
+	This->outputSigns = NULL;
+	free(This->rt60);
+	This->rt60 = NULL;
+	free(This->wetMix);
+	This->wetMix = NULL;
+	free(This->wetGain);
+	This->wetGain = NULL;
+	free(This->dryGain);
+	This->dryGain = NULL;
+}
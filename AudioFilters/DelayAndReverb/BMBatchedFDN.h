@@ -0,0 +1,131 @@
+//
+//  BMBatchedFDN.h
+//  AudioFiltersXcodeProject
+//
+//  A bank of independent feedback delay network reverbs that share the same
+//  delay times. Because the topology is identical for all instances, the delay
+//  memory is interleaved so that reading a given tap from every instance is a
+//  contiguous series of simd_float4 loads, and all instances are processed in a
+//  single call. This is useful when running one reverb per voice in a
+//  polyphonic instrument, where hundreds of separate BMSimpleFDN or BMReverb
+//  structs would each pay their own call and cache overhead.
+//
+//  Each instance has its own RT60 decay time and wet mix setting.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMBatchedFDN_h
+#define BMBatchedFDN_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <simd/simd.h>
+
+// number of reverb instances processed together in one SIMD vector
+#define BMBATCHEDFDN_LANES 4
+
+typedef struct BMBatchedFDN {
+	simd_float4 *delayMemory, *decayGains, *feedback;
+	simd_float4 *inputL, *inputR, *wetL, *wetR;
+	size_t *delayLengths, *delayStartIndices, *rwIndices;
+	float *outputSigns, *rt60, *wetMix, *wetGain, *dryGain;
+	size_t numInstances, numGroups, numDelays;
+	float sampleRate, inputAttenuation, matrixAttenuation;
+} BMBatchedFDN;
+
+
+
+/*!
+ *BMBatchedFDN_init
+ *
+ * @param This                  pointer to a struct
+ * @param numInstances          number of independent reverbs in the batch
+ * @param numDelays             number of delays in each network. must be a power of two, >= 2
+ * @param minDelayTimeSeconds   shortest delay time in each network
+ * @param maxDelayTimeSeconds   longest delay time in each network
+ * @param RT60DecayTimeSeconds  initial RT60 decay time for all instances
+ * @param sampleRate            sample rate
+ */
+void BMBatchedFDN_init(BMBatchedFDN *This,
+					   size_t numInstances,
+					   size_t numDelays,
+					   float minDelayTimeSeconds,
+					   float maxDelayTimeSeconds,
+					   float RT60DecayTimeSeconds,
+					   float sampleRate);
+
+
+
+/*!
+ *BMBatchedFDN_free
+ */
+void BMBatchedFDN_free(BMBatchedFDN *This);
+
+
+
+/*!
+ *BMBatchedFDN_processBufferStereo
+ *
+ * Process all instances in one call. Each of the array arguments is an array of
+ * numInstances pointers to buffers of length numSamples. Processing in place
+ * (inputL[i] == outputL[i]) is supported.
+ *
+ * @param This        pointer to an initialised struct
+ * @param inputL      array of numInstances left channel input buffers
+ * @param inputR      array of numInstances right channel input buffers
+ * @param outputL     array of numInstances left channel output buffers
+ * @param outputR     array of numInstances right channel output buffers
+ * @param numSamples  length of each buffer
+ */
+void BMBatchedFDN_processBufferStereo(BMBatchedFDN *This,
+									  float* const* inputL,
+									  float* const* inputR,
+									  float* const* outputL,
+									  float* const* outputR,
+									  size_t numSamples);
+
+
+
+/*!
+ *BMBatchedFDN_setRT60DecayTime
+ *
+ * @param This          pointer to an initialised struct
+ * @param instance      index of the reverb in [0, numInstances)
+ * @param rt60          time in seconds for the wet signal to decay by 60 dB
+ */
+void BMBatchedFDN_setRT60DecayTime(BMBatchedFDN *This, size_t instance, float rt60);
+
+
+
+/*!
+ *BMBatchedFDN_setWetMix
+ *
+ * Sets the mix with wetGain^2 + dryGain^2 = 1. The change is applied with a
+ * linear ramp over the next call to the process function.
+ *
+ * @param This          pointer to an initialised struct
+ * @param instance      index of the reverb in [0, numInstances)
+ * @param wetMix        0 = all dry, 1 = all wet
+ */
+void BMBatchedFDN_setWetMix(BMBatchedFDN *This, size_t instance, float wetMix);
+
+
+
+/*!
+ *BMBatchedFDN_clearBuffers
+ *
+ * @abstract silence the tail of every instance
+ */
+void BMBatchedFDN_clearBuffers(BMBatchedFDN *This);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMBatchedFDN_h */
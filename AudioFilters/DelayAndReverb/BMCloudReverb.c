@@ -9,6 +9,7 @@
 #include "BMCloudReverb.h"
 #include "BMReverb.h"
 #include "BMFastHadamard.h"
+#include <dispatch/dispatch.h>
 
 
 
@@ -27,11 +28,27 @@
 #define FDN_BaseMaxDelaySecond 0.800f
 #define VND_BaseLength 0.2f
 
+//Rendered impulse response
+#define IR_MaxSeconds 60.0f
+#define IR_SettleSeconds 0.5f
+#define IR_AudibleDb -100.0f
+
 void BMCloudReverb_updateDiffusion(BMCloudReverb* This);
 void BMCloudReverb_prepareLoopDelay(BMCloudReverb* This);
 void BMCloudReverb_updateLoopGain(BMCloudReverb* This,size_t* delayTimeL,size_t* delayTimeR,float* gainL,float* gainR);
 float calculateScaleVol(BMCloudReverb* This);
 void BMCloudReverb_updateVND(BMCloudReverb* This);
+void BMCloudReverb_initVNDBank(BMCloudReverb* This);
+void BMCloudReverb_processNetwork(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t numSamples,bool offlineRendering);
+void BMCloudReverb_processRenderedIR(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t numSamples);
+void BMCloudReverb_updateSleepHold(BMCloudReverb* This);
+
+//Context for rendering the impulse response from each input channel in parallel
+typedef struct BMCloudReverbIRJob {
+    BMCloudReverb* This;
+    float* kernels [BMIRConv_numPaths];
+    size_t length;
+} BMCloudReverbIRJob;
 
 float getVNDLength(float numTaps,float length){
     float vndLength = ((numTaps*numTaps)*length)/(1 + numTaps + numTaps*numTaps);
@@ -46,6 +63,10 @@ float randomAround1(int percent){
 
 void BMCloudReverb_init(BMCloudReverb* This,float sr){
     This->sampleRate = sr;
+    This->useRenderedIR = false;
+    This->irParams.diffusion = 1.0f;
+    This->irParams.fadeInS = 0.0f;
+    BMStereoIRConvolver_init(&This->irConvolver);
     //BIQUAD FILTER
     BMMultiLevelBiquad_init(&This->biquadFilter, Filter_TotalLevel, sr, true, false, true);
     //Highpass 1st order 100Hz
@@ -69,10 +90,10 @@ void BMCloudReverb_init(BMCloudReverb* This,float sr){
     This->numInput = 8;
     This->numVND = This->numInput;
     This->vndArray = malloc(sizeof(BMVelvetNoiseDecorrelator)*This->numVND);
-    This->vnd1BufferL = malloc(sizeof(float*)*This->numInput);
-    This->vnd1BufferR = malloc(sizeof(float*)*This->numInput);
-    This->vnd2BufferL = malloc(sizeof(float*)*This->numInput);
-    This->vnd2BufferR = malloc(sizeof(float*)*This->numInput);
+    This->vnd1BufferL = malloc(sizeof(float*)*This->numVND);
+    This->vnd1BufferR = malloc(sizeof(float*)*This->numVND);
+    This->vnd2BufferL = malloc(sizeof(float*)*This->numVND);
+    This->vnd2BufferR = malloc(sizeof(float*)*This->numVND);
     
     //Using vnd
     for(int i=0;i<This->numVND;i++){
@@ -87,6 +108,8 @@ void BMCloudReverb_init(BMCloudReverb* This,float sr){
         This->vnd2BufferL[i] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
         This->vnd2BufferR[i] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
     }
+    //Process all vnd in one pass
+    BMCloudReverb_initVNDBank(This);
     
     //Pitch shifting
     size_t delayRange = (1000*sr)/48000.0f;
@@ -119,6 +142,10 @@ void BMCloudReverb_init(BMCloudReverb* This,float sr){
     //Loop delay
     BMCloudReverb_prepareLoopDelay(This);
     
+    //Sleep when the input is silent and the tail has decayed
+    BMTailSleep_init(&This->sleep, 0);
+    BMCloudReverb_updateSleepHold(This);
+    
     BMCloudReverb_setLoopDecayTime(This, 10);
     BMCloudReverb_setDelayPitchMixer(This, 0.5f);
     BMWetDryMixer_init(&This->reverbMixer, sr);
@@ -147,7 +174,8 @@ void BMCloudReverb_destroy(BMCloudReverb* This){
     for(int i=0;i<This->numVND;i++){
         BMVelvetNoiseDecorrelator_free(&This->vndArray[i]);
     }
-    for(int i=0;i<This->numInput;i++){
+    BMSparseFIR_free(&This->vndBank);
+    for(int i=0;i<This->numVND;i++){
         free(This->vnd1BufferL[i]);
         This->vnd1BufferL[i] = nil;
         free(This->vnd1BufferR[i]);
@@ -170,6 +198,8 @@ void BMCloudReverb_destroy(BMCloudReverb* This){
     
     BMLongLoopFDN_free(&This->loopFDN);
     
+    BMStereoIRConvolver_free(&This->irConvolver);
+    
     free(This->buffer.bufferL);
     This->buffer.bufferL = nil;
     free(This->buffer.bufferR);
@@ -196,66 +226,199 @@ void BMCloudReverb_processStereo(BMCloudReverb* This,float* inputL,float* inputR
     if(This->initNo==ReadyNo){
         assert(numSamples<=BM_BUFFER_CHUNK_SIZE);
         
-        BMCloudReverb_updateVND(This);
-        BMCloudReverb_updateDiffusion(This);
-        
-        //1st layer VND
-        for(int i=0;i<This->numInput;i++){
-            //PitchShifting delay into wetbuffer
-            BMVelvetNoiseDecorrelator_processBufferStereo(&This->vndArray[i], inputL, inputR, This->vnd1BufferL[i], This->vnd1BufferR[i], numSamples);
-        }
-        
-        if(This->numInput>4){
-            BMFastHadamardTransformBuffer(This->vnd1BufferL, This->vnd2BufferL, This->numInput, numSamples);
-            BMFastHadamardTransformBuffer(This->vnd1BufferR, This->vnd2BufferR, This->numInput, numSamples);
-        }else{
-            for(int j=0;j<This->numInput;j++){
-                memcpy(This->vnd2BufferL[j], This->vnd1BufferL[j], sizeof(float)*numSamples);
-                memcpy(This->vnd2BufferR[j], This->vnd1BufferR[j], sizeof(float)*numSamples);
-            }
+        //Skip processing if the input is silent and the tail has decayed
+        bool inputSilent = BMTailSleep_isSilent(&This->sleep, inputL, numSamples) && BMTailSleep_isSilent(&This->sleep, inputR, numSamples);
+        if(BMTailSleep_skip(&This->sleep, inputSilent)){
+            memset(outputL, 0, sizeof(float)*numSamples);
+            memset(outputR, 0, sizeof(float)*numSamples);
+            return;
         }
         
-        //Long FDN
-        BMLongLoopFDN_processMultiChannelInput(&This->loopFDN, This->vnd2BufferL, This->vnd2BufferR, This->numInput, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
-        
-//        memcpy(outputL,This->wetBuffer.bufferL, sizeof(float)*numSamples);
-//        memcpy(outputR,This->wetBuffer.bufferR , sizeof(float)*numSamples);
-//        return;
-		
-        //Add vnd2Buffer[0] to the output of FDN to simulate the zero tap of fdn. Cant use zero tap setting
-        // becauz of the Fast Hadamard Transform mix all the input.
-        float mul = 1.0f;
-        vDSP_vsma(This->vnd2BufferL[0], 1, &mul, This->wetBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
-        vDSP_vsma(This->vnd2BufferR[0], 1, &mul, This->wetBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
-        
-        BMPitchShiftDelay_processStereoBuffer(&This->pitchShiftDelay, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
-        
-        //Filters
-        BMMultiLevelBiquad_processBufferStereo(&This->biquadFilter, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+        if(offlineRendering && This->useRenderedIR)
+            BMCloudReverb_processRenderedIR(This, inputL, inputR, outputL, outputR, numSamples);
+        else
+            BMCloudReverb_processNetwork(This, inputL, inputR, outputL, outputR, numSamples, offlineRendering);
         
-        //Normalize vol
-        BMSmoothGain_processBuffer(&This->smoothGain, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
-        
-        //LFO pan
-        // Input pan LFO
-        BMPanLFO_process(&This->inputPan, This->LFOBuffer.bufferL, This->LFOBuffer.bufferR, numSamples);
-        vDSP_vmul(This->wetBuffer.bufferL, 1, This->LFOBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
-        vDSP_vmul(This->wetBuffer.bufferR, 1, This->LFOBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
-        BMPanLFO_process(&This->outputPan, This->LFOBuffer.bufferL, This->LFOBuffer.bufferR, numSamples);
-        vDSP_vmul(This->wetBuffer.bufferL, 1, This->LFOBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
-        vDSP_vmul(This->wetBuffer.bufferR, 1, This->LFOBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
-        
-        //mix dry & wet reverb
-        if(offlineRendering){
-            float dryMix = 1 - This->reverbMixer.mixTarget;
-            vDSP_vsmsma(This->wetBuffer.bufferL, 1, &This->reverbMixer.mixTarget, inputL, 1, &dryMix, outputL, 1, numSamples);
-            vDSP_vsmsma(This->wetBuffer.bufferR, 1, &This->reverbMixer.mixTarget, inputR, 1, &dryMix, outputR, 1, numSamples);
-        }else{
-            //Process reverb dry/wet mixer
-            BMWetDryMixer_processBufferInPhase(&This->reverbMixer, This->wetBuffer.bufferL, This->wetBuffer.bufferR, inputL, inputR, outputL, outputR, numSamples);
+        //Check the tail in the wet signal, before the dry signal is mixed in
+        BMTailSleep_update(&This->sleep, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    }
+}
+
+
+void BMCloudReverb_processNetwork(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t numSamples,bool offlineRendering){
+    BMCloudReverb_updateVND(This);
+    BMCloudReverb_updateDiffusion(This);
+    
+    //1st layer VND
+    BMSparseFIR_processStereo(&This->vndBank, inputL, inputR, This->vnd1BufferL, This->vnd1BufferR, numSamples);
+    
+    if(This->numInput>4){
+        BMFastHadamardTransformBuffer(This->vnd1BufferL, This->vnd2BufferL, This->numInput, numSamples);
+        BMFastHadamardTransformBuffer(This->vnd1BufferR, This->vnd2BufferR, This->numInput, numSamples);
+    }else{
+        for(int j=0;j<This->numInput;j++){
+            memcpy(This->vnd2BufferL[j], This->vnd1BufferL[j], sizeof(float)*numSamples);
+            memcpy(This->vnd2BufferR[j], This->vnd1BufferR[j], sizeof(float)*numSamples);
         }
+    }
+    
+    //Long FDN
+    BMLongLoopFDN_processMultiChannelInput(&This->loopFDN, This->vnd2BufferL, This->vnd2BufferR, This->numInput, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    
+    //Add vnd2Buffer[0] to the output of FDN to simulate the zero tap of fdn. Cant use zero tap setting
+    // becauz of the Fast Hadamard Transform mix all the input.
+    float mul = 1.0f;
+    vDSP_vsma(This->vnd2BufferL[0], 1, &mul, This->wetBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
+    vDSP_vsma(This->vnd2BufferR[0], 1, &mul, This->wetBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
+    
+    BMPitchShiftDelay_processStereoBuffer(&This->pitchShiftDelay, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    
+    //Filters
+    BMMultiLevelBiquad_processBufferStereo(&This->biquadFilter, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    
+    //Normalize vol
+    BMSmoothGain_processBuffer(&This->smoothGain, This->wetBuffer.bufferL, This->wetBuffer.bufferR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    
+    //LFO pan
+    // Input pan LFO
+    BMPanLFO_process(&This->inputPan, This->LFOBuffer.bufferL, This->LFOBuffer.bufferR, numSamples);
+    vDSP_vmul(This->wetBuffer.bufferL, 1, This->LFOBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
+    vDSP_vmul(This->wetBuffer.bufferR, 1, This->LFOBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
+    BMPanLFO_process(&This->outputPan, This->LFOBuffer.bufferL, This->LFOBuffer.bufferR, numSamples);
+    vDSP_vmul(This->wetBuffer.bufferL, 1, This->LFOBuffer.bufferL, 1, This->wetBuffer.bufferL, 1, numSamples);
+    vDSP_vmul(This->wetBuffer.bufferR, 1, This->LFOBuffer.bufferR, 1, This->wetBuffer.bufferR, 1, numSamples);
+    
+    //mix dry & wet reverb
+    if(offlineRendering){
+        float dryMix = 1 - This->reverbMixer.mixTarget;
+        vDSP_vsmsma(This->wetBuffer.bufferL, 1, &This->reverbMixer.mixTarget, inputL, 1, &dryMix, outputL, 1, numSamples);
+        vDSP_vsmsma(This->wetBuffer.bufferR, 1, &This->reverbMixer.mixTarget, inputR, 1, &dryMix, outputR, 1, numSamples);
+    }else{
+        //Process reverb dry/wet mixer
+        BMWetDryMixer_processBufferInPhase(&This->reverbMixer, This->wetBuffer.bufferL, This->wetBuffer.bufferR, inputL, inputR, outputL, outputR, numSamples);
+    }
+}
+
+
+#pragma mark - Rendered impulse response
+void BMCloudReverb_setUseRenderedIR(BMCloudReverb* This,bool useRenderedIR){
+    This->useRenderedIR = useRenderedIR;
+}
+
+
+/*!
+ *BMCloudReverb_getLongestPathS
+ *
+ * @returns the sum of the longest delays in the VND, the FDN and the pitch
+ * shifter. A signal can take this long to reach the output.
+ */
+static float BMCloudReverb_getLongestPathS(BMCloudReverb* This,float fadeInS){
+    float pitchShiftDelayS = 20000.0f/48000.0f;
+    float vndLengthS = BM_MAX(VND_BaseLength, fadeInS);
+    return vndLengthS + This->loopFDN.maxDelayS + pitchShiftDelayS;
+}
+
 
+static size_t BMCloudReverb_getIRLength(BMCloudReverb* This){
+    //1.5 times the RT60 decay time is -90 dB
+    float seconds = 1.5f*This->irParams.decayTime + BMCloudReverb_getLongestPathS(This, This->irParams.fadeInS);
+    return (size_t)(BM_MIN(seconds, IR_MaxSeconds) * This->sampleRate);
+}
+
+
+void BMCloudReverb_updateSleepHold(BMCloudReverb* This){
+    BMTailSleep_setHoldSamples(&This->sleep, BMCloudReverb_getLongestPathS(This, This->fadeInS) * This->sampleRate);
+}
+
+
+/*!
+ *BMCloudReverb_renderIRChannel
+ *
+ * @abstract render the response to an impulse on one input channel with a
+ * new reverb set to the same parameters as the job's reverb
+ */
+static void BMCloudReverb_renderIRChannel(void* context, size_t channel){
+    BMCloudReverbIRJob* job = context;
+    const BMCloudReverbIRParams* params = &job->This->irParams;
+    
+    BMCloudReverb* reverb = malloc(sizeof(BMCloudReverb));
+    BMCloudReverb_init(reverb, job->This->sampleRate);
+    BMCloudReverb_setLoopDecayTime(reverb, params->decayTime);
+    BMCloudReverb_setDelayPitchMixer(reverb, params->delayPitchMix);
+    BMCloudReverb_setDiffusion(reverb, params->diffusion);
+    BMCloudReverb_setLSGain(reverb, params->lsGain);
+    BMCloudReverb_setHighCutFreq(reverb, params->highCutFreq);
+    BMCloudReverb_setFadeInVND(reverb, params->fadeInS);
+    //100% wet
+    BMCloudReverb_setOutputMixer(reverb, 1.0f);
+    reverb->biquadFilter.useSmoothUpdate = false;
+    
+    float* zeros = calloc(BM_BUFFER_CHUNK_SIZE, sizeof(float));
+    float* impulse = calloc(BM_BUFFER_CHUNK_SIZE, sizeof(float));
+    float* scratchL = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+    float* scratchR = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+    impulse[0] = 1.0f;
+    
+    //Let the smoothed parameters settle before the impulse
+    size_t settleSamples = IR_SettleSeconds * reverb->sampleRate;
+    for(size_t i=0; i<settleSamples; i+=BM_BUFFER_CHUNK_SIZE)
+        BMCloudReverb_processNetwork(reverb, zeros, zeros, scratchL, scratchR, BM_BUFFER_CHUNK_SIZE, true);
+    
+    //Paths from the left input are 0 and 1, from the right 2 and 3
+    float* outputL = job->kernels[2*channel];
+    float* outputR = job->kernels[2*channel + 1];
+    size_t samplesProcessed = 0;
+    while(samplesProcessed<job->length){
+        size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, job->length - samplesProcessed);
+        float* input = samplesProcessed==0 ? impulse : zeros;
+        BMCloudReverb_processNetwork(reverb,
+                                     channel==0 ? input : zeros,
+                                     channel==1 ? input : zeros,
+                                     outputL+samplesProcessed, outputR+samplesProcessed,
+                                     samplesProcessing, true);
+        samplesProcessed += samplesProcessing;
     }
+    
+    BMCloudReverb_destroy(reverb);
+    free(reverb);
+    free(zeros);
+    free(impulse);
+    free(scratchL);
+    free(scratchR);
+}
+
+
+void BMCloudReverb_renderIR(BMCloudReverb* This,uint64_t key){
+    BMCloudReverbIRJob job;
+    job.This = This;
+    job.length = BMCloudReverb_getIRLength(This);
+    for(size_t i=0; i<BMIRConv_numPaths; i++)
+        job.kernels[i] = malloc(sizeof(float)*job.length);
+    
+    //Left and right input in parallel
+    dispatch_apply_f(2, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), &job, BMCloudReverb_renderIRChannel);
+    
+    //Drop the silent part of the tail
+    size_t length = BMStereoIRConvolver_audibleLength(job.kernels, BMIRConv_numPaths, job.length, IR_AudibleDb);
+    BMStereoIRConvolver_setIR(&This->irConvolver, key, job.kernels, length);
+    
+    for(size_t i=0; i<BMIRConv_numPaths; i++)
+        free(job.kernels[i]);
+}
+
+
+void BMCloudReverb_processRenderedIR(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t numSamples){
+    //Render the impulse response if it isn't in the cache
+    uint64_t key = BMStereoIRConvolver_hash(&This->irParams, sizeof(BMCloudReverbIRParams), (uint64_t)This->sampleRate);
+    if(!BMStereoIRConvolver_loadCached(&This->irConvolver, key))
+        BMCloudReverb_renderIR(This, key);
+    
+    BMStereoIRConvolver_process(&This->irConvolver, inputL, inputR, This->wetBuffer.bufferL, This->wetBuffer.bufferR, numSamples);
+    
+    //mix dry & wet reverb
+    float dryMix = 1 - This->reverbMixer.mixTarget;
+    vDSP_vsmsma(This->wetBuffer.bufferL, 1, &This->reverbMixer.mixTarget, inputL, 1, &dryMix, outputL, 1, numSamples);
+    vDSP_vsmsma(This->wetBuffer.bufferR, 1, &This->reverbMixer.mixTarget, inputR, 1, &dryMix, outputR, 1, numSamples);
 }
 
 
@@ -301,6 +464,7 @@ float calculateScaleVol(BMCloudReverb* This){
 #pragma mark - Set
 void BMCloudReverb_setLoopDecayTime(BMCloudReverb* This,float decayTime){
     This->decayTime = decayTime;
+    This->irParams.decayTime = decayTime;
     BMLongLoopFDN_setRT60Decay(&This->loopFDN, decayTime);
     
     float gainDB = calculateScaleVol(This);
@@ -355,6 +519,7 @@ float BMCloudReverb_getDurationBaseOnMode(BMCloudReverb* This,float mode){
 }
 
 void BMCloudReverb_setDelayPitchMixer(BMCloudReverb* This,float wetMix){
+    This->irParams.delayPitchMix = wetMix;
     //Set delayrange of pitch shift to control speed of pitch shift
     //0 to 5
     float mode = BM_MIN(roundf((wetMix*5.0f)/0.75f),5);
@@ -385,6 +550,7 @@ void BMCloudReverb_setOutputMixer(BMCloudReverb* This,float wetMix){
 void BMCloudReverb_setDiffusion(BMCloudReverb* This,float diffusion){
     if(This->diffusion!=diffusion){
         This->diffusion = diffusion;
+        This->irParams.diffusion = diffusion;
         This->updateDiffusion = true;
         This->numInput = BM_MAX((roundf(8 * diffusion)/2.0f)*2,2);
         
@@ -405,14 +571,17 @@ void BMCloudReverb_updateDiffusion(BMCloudReverb* This){
         for(int i=0;i<This->numVND;i++){
             BMVelvetNoiseDecorrelator_setNumTaps(&This->vndArray[i], numTaps);
         }
+        BMVelvetNoiseDecorrelator_compileBank(This->vndArray, This->numInput, &This->vndBank, true);
     }
 }
 
 void BMCloudReverb_setLSGain(BMCloudReverb* This,float gainDb){
+    This->irParams.lsGain = gainDb;
     BMMultiLevelBiquad_setLowShelfFirstOrder(&This->biquadFilter, Filter_LS_FC, gainDb, Filter_Level_Lowshelf);
 }
 
 void BMCloudReverb_setHighCutFreq(BMCloudReverb* This,float freq){
+    This->irParams.highCutFreq = freq;
     BMMultiLevelBiquad_setLowPass6db(&This->biquadFilter, freq, Filter_Level_Tone);
 }
 
@@ -424,6 +593,8 @@ void BMCloudReverb_setFadeInVND(BMCloudReverb* This,float timeInS){
         This->desiredVNDLength = timeInS;
     }
     This->fadeInS = timeInS;
+    This->irParams.fadeInS = timeInS;
+    BMCloudReverb_updateSleepHold(This);
     
     This->updateVND = true;
     
@@ -444,6 +615,9 @@ void BMCloudReverb_updateVND(BMCloudReverb* This){
                 //Update fade in
                 BMVelvetNoiseDecorrelator_setFadeIn(&This->vndArray[i], This->fadeInS);
             }
+            //The bank needs a longer delay memory
+            BMSparseFIR_free(&This->vndBank);
+            BMCloudReverb_initVNDBank(This);
 
             BMCloudReverb_setDiffusion(This, This->diffusion);
         }else{
@@ -451,10 +625,18 @@ void BMCloudReverb_updateVND(BMCloudReverb* This){
                 //Update fade in
                 BMVelvetNoiseDecorrelator_setFadeIn(&This->vndArray[i], This->fadeInS);
             }
+            BMVelvetNoiseDecorrelator_compileBank(This->vndArray, This->numInput, &This->vndBank, true);
         }
     }
 }
 
+void BMCloudReverb_initVNDBank(BMCloudReverb* This){
+    size_t maxDelay = ceil(This->vndLength*This->sampleRate);
+    size_t maxTaps = This->numVND * This->maxTapsEachVND;
+    BMSparseFIR_init(&This->vndBank, This->numVND, maxDelay, maxTaps, This->sampleRate);
+    BMVelvetNoiseDecorrelator_compileBank(This->vndArray, This->numInput, &This->vndBank, false);
+}
+
 #pragma mark - Test
 void BMCloudReverb_impulseResponse(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t length){
     size_t sampleProcessed = 0;
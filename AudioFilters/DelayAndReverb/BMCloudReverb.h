@@ -22,15 +22,29 @@
 #include "BMFIRFilter.h"
 #include "BMSimpleDelay.h"
 #include "BMSmoothGain.h"
+#include "BMStereoIRConvolver.h"
+#include "BMTailSleep.h"
 
 typedef struct BMStereoBuffer{
     void* bufferL;
     void* bufferR;
 } BMStereoBuffer;
 
+// Parameters that change the impulse response of the reverb. They are hashed
+// to identify rendered impulse responses in the cache.
+typedef struct BMCloudReverbIRParams {
+    float decayTime;
+    float delayPitchMix;
+    float diffusion;
+    float lsGain;
+    float highCutFreq;
+    float fadeInS;
+} BMCloudReverbIRParams;
+
 typedef struct BMCloudReverb {
     BMMultiLevelBiquad biquadFilter;
     BMVelvetNoiseDecorrelator* vndArray;
+    BMSparseFIR vndBank;
     
     float** vnd1BufferL;
     float** vnd1BufferR;
@@ -74,6 +88,12 @@ typedef struct BMCloudReverb {
     int initNo;
     
     BMSmoothGain smoothGain;
+    
+    //Offline rendering by convolution with a rendered impulse response
+    bool useRenderedIR;
+    BMCloudReverbIRParams irParams;
+    BMStereoIRConvolver irConvolver;
+    BMTailSleep sleep;
 } BMCloudReverb;
 
 void BMCloudReverb_init(BMCloudReverb* This,float sr);
@@ -88,6 +108,23 @@ void BMCloudReverb_setDiffusion(BMCloudReverb* This,float diffusion);
 void BMCloudReverb_setLSGain(BMCloudReverb* This,float gainDb);
 void BMCloudReverb_setHighCutFreq(BMCloudReverb* This,float freq);
 void BMCloudReverb_setFadeInVND(BMCloudReverb* This,float timeInS);
+
+/*!
+ *BMCloudReverb_setUseRenderedIR
+ *
+ * When this is on and processStereo is called with offlineRendering = true,
+ * the reverb renders its stereo impulse response for the current settings
+ * and convolves the input with it instead of running the reverb network.
+ * This is many times faster for long renders. The rendered impulse response
+ * is a snapshot of the modulated parts of the network, so the result is not
+ * identical to realtime processing.
+ *
+ * Rendering the impulse response takes a while and happens inside the first
+ * call to processStereo after a parameter changes. Up to BMIRConv_cacheSize
+ * impulse responses are cached, so switching back to earlier settings is
+ * fast.
+ */
+void BMCloudReverb_setUseRenderedIR(BMCloudReverb* This,bool useRenderedIR);
 //Test
 void BMCloudReverb_impulseResponse(BMCloudReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t length);
 #endif /* BMCloudReverb_h */
@@ -16,6 +16,20 @@ extern "C" {
 #include "BMVelvetNoise.h"
 #include <stdlib.h>
     
+    
+    // forward declarations
+    void BMEarlyReflections_allocSetting(BMEarlyReflections *This, size_t maxTaps);
+    void BMEarlyReflections_publishTaps(BMEarlyReflections *This);
+    void BMEarlyReflections_loadImageSourceTaps(BMEarlyReflections *This);
+    
+    
+    // context for the background update when the source or listener moves
+    typedef struct BMEarlyReflectionsMove {
+        BMEarlyReflections *This;
+        simd_float3 source, listener;
+    } BMEarlyReflectionsMove;
+    
+    
     /*
      * Initialises a stereo early reflections simulation with the first
      * reflection starting after startTimeMS and last reflection ending
@@ -52,21 +66,12 @@ extern "C" {
         setting->startTimeMS = startTimeMS;
         setting->endTimeMS = endTimeMS;
         
+        This->imageSource = NULL;
+        This->queue = NULL;
+        atomic_init(&This->wetAmount, wetAmount);
+        atomic_init(&This->wetUpdatePending, false);
         
-        // allocate memory for indices, gains and temp specification
-        setting->indices = malloc(sizeof(size_t*) * setting->numberOfChannel);
-        setting->gain = malloc(sizeof(float*) * setting->numberOfChannel);
-        
-        This->gain = malloc(sizeof(float*) * setting->numberOfChannel);
-        
-        for (int i=0; i<setting->numberOfChannel; i++) {
-            //allocate memory for each channel
-            //we + 1 to the numTap because we want to use the slot 0 for the dry signal
-            setting->indices[i] = malloc(sizeof(size_t) * (setting->numberTaps + 1));
-            setting->gain[i] = malloc(sizeof(float) * (setting->numberTaps + 1));
-            
-            This->gain[i] = malloc(sizeof(float) * (setting->numberTaps + 1));
-        }
+        BMEarlyReflections_allocSetting(This, numTapsPerChannel);
         
         // seed the random number generator for consistent results
         srand(0);
@@ -88,8 +93,144 @@ extern "C" {
         BMEarlyReflections_setWetAmount(This,wetAmount);
     }
     
+    /*!
+     *BMEarlyReflections_allocSetting
+     */
+    void BMEarlyReflections_allocSetting(BMEarlyReflections *This, size_t maxTaps){
+        BMEarlyReflectionsSetting* setting = &This->setting;
+        setting->maxTaps = maxTaps;
+        
+        // allocate memory for indices, gains and temp specification
+        setting->indices = malloc(sizeof(size_t*) * setting->numberOfChannel);
+        setting->gain = malloc(sizeof(float*) * setting->numberOfChannel);
+        
+        This->gain = malloc(sizeof(float*) * setting->numberOfChannel);
+        
+        for (int i=0; i<setting->numberOfChannel; i++) {
+            //allocate memory for each channel
+            //we + 1 to the numTap because we want to use the slot 0 for the dry signal
+            setting->indices[i] = malloc(sizeof(size_t) * (maxTaps + 1));
+            setting->gain[i] = malloc(sizeof(float) * (maxTaps + 1));
+            
+            This->gain[i] = malloc(sizeof(float) * (maxTaps + 1));
+        }
+    }
+    
+    
+    
+    void BMEarlyReflections_initImageSource(BMEarlyReflections *This,
+                                            const BMImageSourceRoom *room,
+                                            float sampleRate,
+                                            float wetAmount,
+                                            size_t maxTapsPerChannel){
+        BMEarlyReflectionsSetting* setting = &This->setting;
+        
+        setting->numberOfChannel = 2;
+        setting->numberTaps = 0;
+        setting->sampleRate = sampleRate;
+        setting->startTimeMS = 0.0f;
+        setting->endTimeMS = room->maxTimeMS;
+        setting->wet = wetAmount;
+        setting->dry = sqrt(1.0f - wetAmount*wetAmount);
+        atomic_init(&This->wetAmount, wetAmount);
+        atomic_init(&This->wetUpdatePending, false);
+        
+        BMEarlyReflections_allocSetting(This, maxTapsPerChannel);
+        
+        // generate the taps for the initial positions
+        This->imageSource = malloc(sizeof(BMImageSourceReflections));
+        BMImageSourceReflections_init(This->imageSource, room, sampleRate, maxTapsPerChannel);
+        
+        // initialise the multi-tap delay with only the dry tap
+        setting->indices[0][0] = setting->indices[1][0] = 0;
+        This->gain[0][0] = This->gain[1][0] = setting->dry;
+        BMMultiTapDelay_Init(&This->delay, true,
+                             setting->indices[0], setting->indices[1],
+                             BMImageSourceReflections_maxDelay(This->imageSource),
+                             This->gain[0], This->gain[1],
+                             1,
+                             maxTapsPerChannel + 1);
+        BMEarlyReflections_loadImageSourceTaps(This);
+        
+        // Switch to the initial taps now. After that, when the source or
+        // listener moves, the delay fades from the old reflections to the new
+        // ones over one buffer so that the change doesn't click.
+        BMMultiTapDelay_PerformUpdateIndices(&This->delay);
+        BMMultiTapDelay_setCrossfade(&This->delay, true);
+        
+        // later updates run on a background queue
+        atomic_init(&This->pendingMoves, 0);
+        dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+        This->queue = dispatch_queue_create("BMEarlyReflections", attr);
+    }
+    
+    
+    
+    /*!
+     *BMEarlyReflections_loadImageSourceTaps
+     *
+     * @abstract copy the taps from the image source generator and send them
+     * to the multi-tap delay
+     */
+    void BMEarlyReflections_loadImageSourceTaps(BMEarlyReflections *This){
+        BMEarlyReflectionsSetting* setting = &This->setting;
+        BMImageSourceReflections* imageSource = This->imageSource;
+        
+        // The multi-tap delay has the same number of taps on each channel,
+        // so we pad the shorter channel with silent taps
+        setting->numberTaps = BM_MAX(imageSource->numTaps[0], imageSource->numTaps[1]);
+        for (int i=0; i<setting->numberOfChannel; i++) {
+            size_t numTaps = imageSource->numTaps[i];
+            memcpy(setting->indices[i] + 1, imageSource->tapDelays[i], sizeof(size_t) * numTaps);
+            memcpy(setting->gain[i] + 1, imageSource->tapGains[i], sizeof(float) * numTaps);
+            for (size_t j=numTaps + 1; j<=setting->numberTaps; j++) {
+                setting->indices[i][j] = 0;
+                setting->gain[i][j] = 0.0f;
+            }
+        }
+        
+        BMEarlyReflections_publishTaps(This);
+    }
+    
+    
+    
+    static void BMEarlyReflections_moveJob(void *context){
+        BMEarlyReflectionsMove *move = context;
+        BMEarlyReflections *This = move->This;
+        
+        // if another move is waiting on the queue, skip this one
+        if(atomic_fetch_sub(&This->pendingMoves, 1) == 1){
+            BMImageSourceReflections_setPositions(This->imageSource, move->source, move->listener);
+            BMEarlyReflections_loadImageSourceTaps(This);
+        }
+        
+        free(move);
+    }
+    
+    
+    
+    void BMEarlyReflections_setPositions(BMEarlyReflections *This,
+                                         simd_float3 source,
+                                         simd_float3 listener){
+        assert(This->imageSource);
+        
+        BMEarlyReflectionsMove *move = malloc(sizeof(BMEarlyReflectionsMove));
+        move->This = This;
+        move->source = source;
+        move->listener = listener;
+        
+        atomic_fetch_add(&This->pendingMoves, 1);
+        dispatch_async_f(This->queue, move, BMEarlyReflections_moveJob);
+    }
+    
+    
+    
     void BMEarlyReflection_RegenIndicesAndGain(BMEarlyReflections *This){
         BMEarlyReflectionsSetting* setting = &This->setting;
+        
+        // the taps of an image source room come from the room geometry
+        if(This->imageSource)
+            return;
 
         float gainScale = 1.0 / sqrt((float)setting->numberTaps);
         
@@ -113,10 +254,26 @@ extern "C" {
     }
     
     
+    static void BMEarlyReflections_noop(void *context){}
+    
+    
     /*
      * free memory used by the struct at *This
      */
     void BMEarlyReflections_destroy(BMEarlyReflections *This){
+        // wait for background updates to finish
+        if(This->queue){
+            dispatch_sync_f(This->queue, NULL, BMEarlyReflections_noop);
+            dispatch_release(This->queue);
+            This->queue = NULL;
+        }
+        
+        if(This->imageSource){
+            BMImageSourceReflections_free(This->imageSource);
+            free(This->imageSource);
+            This->imageSource = NULL;
+        }
+        
         BMMultiTapDelay_free(&This->delay);
         
         BMEarlyReflectionsSetting* setting = &This->setting;
@@ -128,8 +285,15 @@ extern "C" {
             setting->gain[i] = NULL;
             
             free(This->gain[i]);
-            This->gain = NULL;
+            This->gain[i] = NULL;
         }
+        
+        free(setting->indices);
+        setting->indices = NULL;
+        free(setting->gain);
+        setting->gain = NULL;
+        free(This->gain);
+        This->gain = NULL;
     }
     
     
@@ -150,6 +314,16 @@ extern "C" {
     }
     
     
+    static void BMEarlyReflections_setWetAmountJob(void *context){
+        BMEarlyReflections *This = context;
+        
+        // clear the flag first so that a change made while we are publishing
+        // queues another job
+        atomic_store(&This->wetUpdatePending, false);
+        BMEarlyReflections_publishTaps(This);
+    }
+    
+    
     /*
      * set the portion of wet signal to mix with output. This also
      * sets dry gain so that wet^2 + dry^2 == 1.0
@@ -160,24 +334,49 @@ extern "C" {
                                          float wetAmount){
         assert(wetAmount <= 1.0f);
         assert(wetAmount >= 0.0f);
+        
+        atomic_store(&This->wetAmount, wetAmount);
+        
+        // The background queue may be publishing taps, so the new gains are
+        // published there. If a job is already waiting it will pick up the
+        // new wet amount.
+        if(This->queue){
+            if(!atomic_exchange(&This->wetUpdatePending, true))
+                dispatch_async_f(This->queue, This, BMEarlyReflections_setWetAmountJob);
+            return;
+        }
+        
+        BMEarlyReflections_publishTaps(This);
+    }
+    
+    
+    
+    /*!
+     *BMEarlyReflections_publishTaps
+     *
+     * @abstract apply wet and dry gain and send the taps to the multi-tap delay
+     */
+    void BMEarlyReflections_publishTaps(BMEarlyReflections *This){
         BMEarlyReflectionsSetting* setting = &This->setting;
         
+        float wetAmount = atomic_load(&This->wetAmount);
         setting->wet = wetAmount;
         setting->dry = sqrt(1.0f - wetAmount*wetAmount);
         
-        //apply
         for (int i=0; i<setting->numberOfChannel; i++) {
             setting->indices[i][0] = 0;
             This->gain[i][0] = setting->dry;
             
             for (int j=1; j<=setting->numberTaps; j++) {
-                This->gain[i][j] = setting->gain[i][j] * wetAmount;
+                This->gain[i][j] = setting->gain[i][j] * setting->wet;
             }
         }
         
         //apply to multitap delay
-        BMMultiTapDelay_setDelayTimes(&This->delay, setting->indices[0], setting->indices[1]);
-        BMMultiTapDelay_setGains(&This->delay, This->gain[0], This->gain[1]);
+        BMMultiTapDelay_setTaps(&This->delay,
+                                setting->indices[0], setting->indices[1],
+                                This->gain[0], This->gain[1],
+                                setting->numberTaps + 1);
     }
     
     
@@ -18,7 +18,10 @@ extern "C" {
 #define BMEarlyReflections_h
     
 #include "BMMultiTapDelay.h"
+#include "BMImageSourceReflections.h"
 #include "Constants.h"
+#include <dispatch/dispatch.h>
+#include <stdatomic.h>
 
     typedef struct BMEarlyReflectionsSetting {
         size_t** indices;
@@ -26,6 +29,7 @@ extern "C" {
         
         size_t numberOfChannel;
         size_t numberTaps;
+        size_t maxTaps;
         float sampleRate;
         
         float startTimeMS, endTimeMS;
@@ -39,6 +43,17 @@ extern "C" {
         float** gain;
         
         BMEarlyReflectionsSetting setting;
+        
+        // used only by BMEarlyReflections_initImageSource. The taps are
+        // generated on a serial queue and handed to the multi-tap delay.
+        BMImageSourceReflections* imageSource;
+        dispatch_queue_t queue;
+        _Atomic int pendingMoves;
+        
+        // set by BMEarlyReflections_setWetAmount on any thread and applied
+        // to the taps by whichever thread publishes them next
+        _Atomic float wetAmount;
+        _Atomic bool wetUpdatePending;
     } BMEarlyReflections;
     
     
@@ -71,10 +86,54 @@ extern "C" {
     
     
     
+    /*!
+     *BMEarlyReflections_initImageSource
+     *
+     * Initialises a stereo early reflections simulation of a rectangular
+     * room. The reflections are computed with the image source method and
+     * rendered by the multi-tap delay with one tap per reflection, sorted
+     * by delay time.
+     *
+     * @param This               pointer to the struct to initialise
+     * @param room               size and absorption of the room and the positions of the source and listener
+     * @param sampleRate         sample rate of audio system in samples per second
+     * @param wetAmount          wet^2 + dry^2 == 1
+     * @param maxTapsPerChannel  if the room has more reflections than this within room->maxTimeMS, the latest ones are dropped
+     */
+    void BMEarlyReflections_initImageSource(BMEarlyReflections *This,
+                                            const BMImageSourceRoom *room,
+                                            float sampleRate,
+                                            float wetAmount,
+                                            size_t maxTapsPerChannel);
+    
+    
+    
+    /*!
+     *BMEarlyReflections_setPositions
+     *
+     * Moves the source and listener of a struct initialised with
+     * BMEarlyReflections_initImageSource. The new taps are computed on a
+     * background queue and the audio thread switches to them at the start of
+     * the next buffer after they are ready. If this is called again before
+     * the update finishes, only the latest positions are computed.
+     *
+     * @param This      pointer to an initialised struct
+     * @param source    position of the source in metres
+     * @param listener  position of the listener in metres
+     */
+    void BMEarlyReflections_setPositions(BMEarlyReflections *This,
+                                         simd_float3 source,
+                                         simd_float3 listener);
+    
+    
+    
     /*
      * set the portion of wet signal to mix with output. This also
      * sets dry gain so that wet^2 + dry^2 == 1.0
      *
+     * For a struct initialised with BMEarlyReflections_initImageSource this
+     * doesn't block. The new gains are published from the background queue.
+     *
      * @param wetAmount  gain of wet signal; must be in [0.0,1.0]
      */
     void BMEarlyReflections_setWetAmount(BMEarlyReflections *This,
@@ -0,0 +1,290 @@
+//
+//  BMImageSourceReflections.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMImageSourceReflections.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include "Constants.h"
+
+
+// forward declarations
+void BMImageSourceReflections_initImages(BMImageSourceReflections *This);
+void BMImageSourceReflections_update(BMImageSourceReflections *This, bool fullSort);
+
+
+
+void BMImageSourceReflections_init(BMImageSourceReflections *This,
+								   const BMImageSourceRoom *room,
+								   float sampleRate,
+								   size_t maxTaps){
+	This->room = *room;
+	This->sampleRate = sampleRate;
+	This->maxTaps = maxTaps;
+
+	BMImageSourceReflections_initImages(This);
+
+	for(size_t c=0; c<BMImageSource_numChannels; c++){
+		This->imageDelays[c] = malloc(sizeof(float) * This->numImages);
+		This->sortOrder[c] = malloc(sizeof(size_t) * This->numImages);
+		This->tapDelays[c] = malloc(sizeof(size_t) * maxTaps);
+		This->tapGains[c] = malloc(sizeof(float) * maxTaps);
+		This->numTaps[c] = 0;
+	}
+
+	// there is no previous order yet, so the first update sorts from scratch
+	BMImageSourceReflections_update(This, true);
+}
+
+
+
+
+void BMImageSourceReflections_free(BMImageSourceReflections *This){
+	free(This->imageSign);
+	This->imageSign = NULL;
+	free(This->imageOffset);
+	This->imageOffset = NULL;
+	free(This->imageGain);
+	This->imageGain = NULL;
+
+	for(size_t c=0; c<BMImageSource_numChannels; c++){
+		free(This->imageDelays[c]);
+		This->imageDelays[c] = NULL;
+		free(This->sortOrder[c]);
+		This->sortOrder[c] = NULL;
+		free(This->tapDelays[c]);
+		This->tapDelays[c] = NULL;
+		free(This->tapGains[c]);
+		This->tapGains[c] = NULL;
+	}
+}
+
+
+
+
+size_t BMImageSourceReflections_maxDelay(const BMImageSourceReflections *This){
+	return (size_t)ceilf(This->room.maxTimeMS * 0.001f * This->sampleRate);
+}
+
+
+
+
+/*!
+ *BMImageSourceReflections_initImages
+ *
+ * @abstract list every image source that could arrive within maxTimeMS for
+ * any position of the source and listener inside the room
+ */
+void BMImageSourceReflections_initImages(BMImageSourceReflections *This){
+	const BMImageSourceRoom *room = &This->room;
+
+	// The direct sound can't travel further than the diagonal of the room,
+	// so no reflection we keep is further away than this
+	float maxDistance = room->speedOfSound * room->maxTimeMS * 0.001f + simd_length(room->size);
+
+	// On an axis of length L, an image with lattice index m is at least
+	// 2|m|L - L from any point in the room if its parity is 0. With parity 1
+	// it is at least 2(m - 1)L away for m > 0 and 2|m|L for m <= 0, so the
+	// bound that covers both is 2|m|L - 2L
+	simd_float3 maxIndexF = simd_ceil((maxDistance + 2.0f * room->size) / (2.0f * room->size));
+	int maxIndex [3] = {(int)maxIndexF.x, (int)maxIndexF.y, (int)maxIndexF.z};
+
+	// reflection coefficients (amplitude) of each wall
+	float beta [6];
+	for(size_t w=0; w<6; w++){
+		assert(room->absorption[w] >= 0.0f && room->absorption[w] <= 1.0f);
+		beta[w] = sqrtf(1.0f - room->absorption[w]);
+	}
+
+	size_t capacity = 8 * (2*maxIndex[0] + 1) * (2*maxIndex[1] + 1) * (2*maxIndex[2] + 1);
+	This->imageSign = malloc(sizeof(simd_float3) * capacity);
+	This->imageOffset = malloc(sizeof(simd_float3) * capacity);
+	This->imageGain = malloc(sizeof(float) * capacity);
+	This->numImages = 0;
+
+	// On each axis, the image with index m and parity p is at
+	// (1 - 2p) * source + 2mL. The sound reaches it by |m - p| reflections
+	// from the wall at 0 and |m| reflections from the wall at L.
+	for(int mx=-maxIndex[0]; mx<=maxIndex[0]; mx++)
+		for(int my=-maxIndex[1]; my<=maxIndex[1]; my++)
+			for(int mz=-maxIndex[2]; mz<=maxIndex[2]; mz++)
+				for(int p=0; p<8; p++){
+					int px = p & 1, py = (p >> 1) & 1, pz = (p >> 2) & 1;
+
+					// skip the direct sound
+					if(mx == 0 && my == 0 && mz == 0 && p == 0)
+						continue;
+
+					float gain = powf(beta[BMImageSourceWall_left], abs(mx - px)) *
+								 powf(beta[BMImageSourceWall_right], abs(mx)) *
+								 powf(beta[BMImageSourceWall_front], abs(my - py)) *
+								 powf(beta[BMImageSourceWall_back], abs(my)) *
+								 powf(beta[BMImageSourceWall_floor], abs(mz - pz)) *
+								 powf(beta[BMImageSourceWall_ceiling], abs(mz));
+
+					// skip reflections from walls that absorb everything
+					if(gain == 0.0f)
+						continue;
+
+					size_t i = This->numImages++;
+					This->imageSign[i] = simd_make_float3(1 - 2*px, 1 - 2*py, 1 - 2*pz);
+					This->imageOffset[i] = 2.0f * simd_make_float3(mx, my, mz) * room->size;
+					This->imageGain[i] = gain;
+				}
+}
+
+
+
+
+// one image, used for sorting from scratch
+typedef struct BMImageSourceSortItem {
+	float delay;
+	size_t image;
+} BMImageSourceSortItem;
+
+
+
+static int BMImageSourceReflections_compareItems(const void *a, const void *b){
+	float delayA = ((const BMImageSourceSortItem*)a)->delay;
+	float delayB = ((const BMImageSourceSortItem*)b)->delay;
+	return (delayA > delayB) - (delayA < delayB);
+}
+
+
+
+
+/*!
+ *BMImageSourceReflections_sortChannelFull
+ *
+ * @abstract sort all the image indices by delay time with qsort, ignoring the previous order
+ */
+static void BMImageSourceReflections_sortChannelFull(const float *delays,
+													 size_t *order,
+													 size_t numImages){
+	BMImageSourceSortItem *items = malloc(sizeof(BMImageSourceSortItem) * numImages);
+	for(size_t i=0; i<numImages; i++){
+		items[i].delay = delays[i];
+		items[i].image = i;
+	}
+	qsort(items, numImages, sizeof(BMImageSourceSortItem), BMImageSourceReflections_compareItems);
+	for(size_t i=0; i<numImages; i++)
+		order[i] = items[i].image;
+	free(items);
+}
+
+
+
+
+/*!
+ *BMImageSourceReflections_sortChannel
+ *
+ * @abstract insertion sort of the image indices by delay time
+ *
+ * The order from the last update is the starting point. When the source and
+ * listener move a short distance only a few images change places, so this
+ * takes close to linear time.
+ */
+static void BMImageSourceReflections_sortChannel(const float *delays,
+												 size_t *order,
+												 size_t numImages){
+	for(size_t i=1; i<numImages; i++){
+		size_t image = order[i];
+		float delay = delays[image];
+		size_t j = i;
+		while(j > 0 && delays[order[j-1]] > delay){
+			order[j] = order[j-1];
+			j--;
+		}
+		order[j] = image;
+	}
+}
+
+
+
+
+/*!
+ *BMImageSourceReflections_update
+ *
+ * @abstract recompute delay times and gains for the current positions of
+ * the source and listener
+ *
+ * @param fullSort  true to sort the images from scratch with qsort; false to start from the order of the last update
+ */
+void BMImageSourceReflections_update(BMImageSourceReflections *This, bool fullSort){
+	const BMImageSourceRoom *room = &This->room;
+
+	// the receivers are on either side of the listener
+	simd_float3 receiver [BMImageSource_numChannels];
+	simd_float3 halfSpacing = simd_make_float3(0.5f * room->receiverSpacing, 0.0f, 0.0f);
+	receiver[0] = room->listenerPosition - halfSpacing;
+	receiver[1] = room->listenerPosition + halfSpacing;
+
+	// Delay times and gains are relative to the direct sound at the nearest
+	// receiver. Setting a minimum distance prevents the gain going to zero
+	// when the source is on top of the listener.
+	float directDistance = simd_distance(room->sourcePosition, receiver[0]);
+	for(size_t c=1; c<BMImageSource_numChannels; c++)
+		directDistance = BM_MIN(directDistance, simd_distance(room->sourcePosition, receiver[c]));
+	directDistance = BM_MAX(directDistance, 0.1f);
+
+	float samplesPerMetre = This->sampleRate / room->speedOfSound;
+	float maxDelay = (float)BMImageSourceReflections_maxDelay(This);
+
+	for(size_t c=0; c<BMImageSource_numChannels; c++){
+		float *delays = This->imageDelays[c];
+
+		for(size_t i=0; i<This->numImages; i++){
+			simd_float3 image = This->imageSign[i] * room->sourcePosition + This->imageOffset[i];
+			delays[i] = (simd_distance(image, receiver[c]) - directDistance) * samplesPerMetre;
+		}
+
+		if(fullSort)
+			BMImageSourceReflections_sortChannelFull(delays, This->sortOrder[c], This->numImages);
+		else
+			BMImageSourceReflections_sortChannel(delays, This->sortOrder[c], This->numImages);
+
+		// Write the taps in order of delay. Reflections that round to the
+		// same sample become a single tap.
+		size_t numTaps = 0;
+		for(size_t i=0; i<This->numImages; i++){
+			size_t image = This->sortOrder[c][i];
+			if(delays[image] > maxDelay)
+				break;
+
+			float distance = delays[image] / samplesPerMetre + directDistance;
+			float gain = This->imageGain[image] * directDistance / distance;
+			size_t delay = (size_t)roundf(BM_MAX(delays[image], 0.0f));
+
+			if(numTaps > 0 && This->tapDelays[c][numTaps-1] == delay){
+				This->tapGains[c][numTaps-1] += gain;
+			}
+			else {
+				if(numTaps == This->maxTaps)
+					break;
+				This->tapDelays[c][numTaps] = delay;
+				This->tapGains[c][numTaps] = gain;
+				numTaps++;
+			}
+		}
+		This->numTaps[c] = numTaps;
+	}
+}
+
+
+
+
+void BMImageSourceReflections_setPositions(BMImageSourceReflections *This,
+										   simd_float3 source,
+										   simd_float3 listener){
+	assert(simd_all(source >= 0.0f & source <= This->room.size));
+	assert(simd_all(listener >= 0.0f & listener <= This->room.size));
+
+	This->room.sourcePosition = source;
+	This->room.listenerPosition = listener;
+	BMImageSourceReflections_update(This, false);
+}
@@ -0,0 +1,143 @@
+//
+//  BMImageSourceReflections.h
+//  AudioFiltersXcodeProject
+//
+//  Computes the early reflections of a rectangular room with the image
+//  source method (Allen and Berkley, "Image method for efficiently simulating
+//  small-room acoustics", 1979). Each reflection becomes one tap with a delay
+//  time set by the distance from the image source to the listener and a gain
+//  set by that distance and the absorption of the walls it bounced from.
+//
+//  The set of image sources depends only on the size of the room and its
+//  absorption, so it is computed once. Moving the source or the listener
+//  only recomputes distances, and the taps are re-sorted starting from the
+//  order of the last update, which is nearly sorted already when the
+//  movement is small. The first sort at init uses qsort.
+//
+//  Delay times and gains are relative to the direct sound: a reflection that
+//  travels twice as far as the direct sound has half its gain. The direct
+//  sound itself is not included in the output.
+//
+//  This does not allocate memory after init but it is too slow to call on
+//  the audio thread when the number of image sources is large.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMImageSourceReflections_h
+#define BMImageSourceReflections_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <simd/simd.h>
+
+#define BMImageSource_numChannels 2
+
+// walls are numbered in this order in BMImageSourceRoom.absorption
+enum BMImageSourceWall {
+	BMImageSourceWall_left, BMImageSourceWall_right,
+	BMImageSourceWall_front, BMImageSourceWall_back,
+	BMImageSourceWall_floor, BMImageSourceWall_ceiling
+};
+
+
+typedef struct BMImageSourceRoom {
+	// size of the room in metres, on the x, y and z axes
+	simd_float3 size;
+	// fraction of the energy each wall absorbs, in [0,1]
+	float absorption [6];
+	// in metres from the corner of the room at the origin
+	simd_float3 sourcePosition, listenerPosition;
+	// the left and right receivers are this many metres apart on the x axis,
+	// centred on listenerPosition
+	float receiverSpacing;
+	// reflections that arrive later than this after the direct sound are
+	// ignored
+	float maxTimeMS;
+	// in metres per second
+	float speedOfSound;
+} BMImageSourceRoom;
+
+
+typedef struct BMImageSourceReflections {
+	BMImageSourceRoom room;
+	float sampleRate;
+
+	// one entry for each image source in the room. The position of an image
+	// is imageSign * sourcePosition + imageOffset. imageGain is the product
+	// of the reflection coefficients of the walls along its path.
+	simd_float3 *imageSign, *imageOffset;
+	float *imageGain;
+	size_t numImages;
+
+	// delay of each image in samples and the image indices sorted by delay,
+	// for each channel
+	float *imageDelays [BMImageSource_numChannels];
+	size_t *sortOrder [BMImageSource_numChannels];
+
+	// the output, sorted by delay time
+	size_t *tapDelays [BMImageSource_numChannels];
+	float *tapGains [BMImageSource_numChannels];
+	size_t numTaps [BMImageSource_numChannels];
+	size_t maxTaps;
+} BMImageSourceReflections;
+
+
+
+/*!
+ *BMImageSourceReflections_init
+ *
+ * Computes the image sources for the room and generates the taps.
+ *
+ * @param This        pointer to a struct
+ * @param room        room geometry and source and listener positions
+ * @param sampleRate  sample rate in Hz
+ * @param maxTaps     maximum taps per channel. If there are more reflections than this, the latest ones are dropped.
+ */
+void BMImageSourceReflections_init(BMImageSourceReflections *This,
+								   const BMImageSourceRoom *room,
+								   float sampleRate,
+								   size_t maxTaps);
+
+
+
+/*!
+ *BMImageSourceReflections_free
+ */
+void BMImageSourceReflections_free(BMImageSourceReflections *This);
+
+
+
+/*!
+ *BMImageSourceReflections_setPositions
+ *
+ * Moves the source and listener and updates the taps. This is much faster
+ * than changing the room because the image sources stay the same.
+ *
+ * @param This      pointer to an initialised struct
+ * @param source    position of the source in metres
+ * @param listener  position of the listener in metres
+ */
+void BMImageSourceReflections_setPositions(BMImageSourceReflections *This,
+										   simd_float3 source,
+										   simd_float3 listener);
+
+
+
+/*!
+ *BMImageSourceReflections_maxDelay
+ *
+ * @returns the longest delay time in samples of any tap this can generate
+ */
+size_t BMImageSourceReflections_maxDelay(const BMImageSourceReflections *This);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMImageSourceReflections_h */
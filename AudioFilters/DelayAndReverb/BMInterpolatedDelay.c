@@ -17,6 +17,8 @@ extern "C" {
 #include <math.h>
 #include <assert.h>
 #include "BMInterpolatedDelay.h"
+#include "BMVectorOps.h"
+#include "Constants.h"
     
 #define INTRP_DLY_CFCT_TBL_LENGTH 100
     
@@ -61,6 +63,42 @@ extern "C" {
         BMLagrangeInterpolationTable_init(&This->interpolationTable,
                                           interpolationOrder,
                                           INTRP_DLY_CFCT_TBL_LENGTH);
+        
+        // The interpolated read at delay time d uses the samples at integer
+        // delay times from d - (N+1)/2 to d + (N+1)/2. We can't read samples
+        // from the future and we need a bit of extra history at the far end.
+        This->minDelay = (float)(interpolationOrder + 1) / 2.0f;
+        This->maxDelay = (float)maxLengthSamples;
+        This->historyLength = maxLengthSamples + interpolationOrder + 1;
+        This->stereo = stereo;
+        
+        // denominators of the Lagrange basis polynomials
+        for(size_t m=0; m<numTaps; m++){
+            float d = 1.0f;
+            for(size_t j=0; j<numTaps; j++)
+                if(j != m) d *= (float)m - (float)j;
+            This->weightDenominators[m] = 1.0f / d;
+        }
+        
+        // init the delay memory the same way as in BMMultiTapDelay, so that
+        // after each chunk of input is written, the tail of the buffer holds
+        // historyLength samples of history followed by the new input
+        size_t bufferLength = (This->historyLength + BM_BUFFER_CHUNK_SIZE) * sizeof(float);
+        float* zeros = calloc(This->historyLength + BM_BUFFER_CHUNK_SIZE, sizeof(float));
+        TPCircularBufferInit(&This->bufferL, (uint32_t)bufferLength);
+        TPCircularBufferProduceBytes(&This->bufferL, zeros, (uint32_t)bufferLength);
+        TPCircularBufferConsume(&This->bufferL, BM_BUFFER_CHUNK_SIZE * sizeof(float));
+        if(stereo){
+            TPCircularBufferInit(&This->bufferR, (uint32_t)bufferLength);
+            TPCircularBufferProduceBytes(&This->bufferR, zeros, (uint32_t)bufferLength);
+            TPCircularBufferConsume(&This->bufferR, BM_BUFFER_CHUNK_SIZE * sizeof(float));
+        }
+        free(zeros);
+        
+        This->delayTimes = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
+        This->readIndices = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
+        This->weights = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * numTaps);
+        This->gathered = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
     }
     
     
@@ -69,7 +107,190 @@ extern "C" {
     
     
     void BMInterpolatedDelay_destroy(BMInterpolatedDelay *This){
-        //BMMultiTapDelay_destroy(&This->delayBuffer);
+        TPCircularBufferCleanup(&This->bufferL);
+        if(This->stereo)
+            TPCircularBufferCleanup(&This->bufferR);
+        
+        free(This->delayTimes);
+        free(This->readIndices);
+        free(This->weights);
+        free(This->gathered);
+        This->delayTimes = NULL;
+        This->readIndices = NULL;
+        This->weights = NULL;
+        This->gathered = NULL;
+        
+        BMLagrangeInterpolationTable_destroy(&This->interpolationTable);
+    }
+    
+    
+    
+    
+    
+    
+    void BMInterpolatedDelay_clearBuffers(BMInterpolatedDelay *This){
+        memset(This->bufferL.buffer, 0, This->bufferL.length);
+        if(This->stereo)
+            memset(This->bufferR.buffer, 0, This->bufferR.length);
+    }
+    
+    
+    
+    
+    
+    
+    /*!
+     *BMInterpolatedDelay_read
+     *
+     * @abstract Interpolated read from the delay buffer at the delay times in This->delayTimes. The read index and the Lagrange weights are computed for eight samples at a time. Then for each tap, vDSP_vindex gathers the samples under it and vDSP_vma adds them to the output with their weights.
+     *
+     * @param buffer  tail of the delay buffer. buffer[historyLength + k] is the input at sample k.
+     */
+    static void BMInterpolatedDelay_read(BMInterpolatedDelay *This,
+                                         const float* buffer,
+                                         float* output,
+                                         size_t numSamples){
+        size_t numTaps = This->interpolationOrder + 1;
+        
+        // The first tap is at floor(historyLength + k - delayTime - c) and
+        // the interpolation point is c + the fractional part of the same.
+        // To keep full precision in the fractional part we handle the integer
+        // part of the delay time separately, and we add 16 before truncating
+        // so that truncation works as floor.
+        float c = 0.5f * ((float)This->interpolationOrder - 1.0f);
+        float fractionOffset = 16.0f - c;
+        long tapOffset = (long)This->historyLength - 16;
+        
+        // the weights of tap m are in row m
+        float* weights = This->weights;
+        size_t rowLength = BM_BUFFER_CHUNK_SIZE;
+        
+        size_t k = 0;
+        const vSInt32_8 lane = {0, 1, 2, 3, 4, 5, 6, 7};
+        for(; k + 8 <= numSamples; k += 8){
+            vFloat32_8 delayTime = *(const vFloat32_8*)(This->delayTimes + k);
+            vSInt32_8 delayI = __builtin_convertvector(delayTime, vSInt32_8);
+            vFloat32_8 t = fractionOffset - (delayTime - __builtin_convertvector(delayI, vFloat32_8));
+            vSInt32_8 tI = __builtin_convertvector(t, vSInt32_8);
+            vFloat32_8 x = t - __builtin_convertvector(tI, vFloat32_8) + c;
+            
+            // The buffer index of the first tap. It is well inside the range
+            // where floats hold integers exactly.
+            vSInt32_8 firstTap = (int)(tapOffset + (long)k) + lane + tI - delayI;
+            *(vFloat32_8*)(This->readIndices + k) = __builtin_convertvector(firstTap, vFloat32_8);
+            
+            // The Lagrange weight for tap m is the product of (x - j) for all
+            // j != m, divided by a constant. We get the products in O(N) by
+            // multiplying a prefix product with a suffix product.
+            vFloat32_8 prefix [INTERP_DELAY_MAX_ORDER + 1];
+            vFloat32_8 p = 1.0f;
+            for(size_t m=0; m<numTaps; m++){
+                prefix[m] = p;
+                p *= x - (float)m;
+            }
+            vFloat32_8 suffix = 1.0f;
+            for(size_t m=numTaps; m-- > 0;){
+                *(vFloat32_8*)(weights + m*rowLength + k) = prefix[m] * suffix * This->weightDenominators[m];
+                suffix *= x - (float)m;
+            }
+        }
+        
+        // finish the last few samples one at a time
+        for(; k < numSamples; k++){
+            float delayTime = This->delayTimes[k];
+            long delayI = (long)delayTime;
+            float t = fractionOffset - (delayTime - (float)delayI);
+            long tI = (long)t;
+            float x = t - (float)tI + c;
+            This->readIndices[k] = (float)(tapOffset + (long)k + tI - delayI);
+            
+            float prefix [INTERP_DELAY_MAX_ORDER + 1];
+            float p = 1.0f;
+            for(size_t m=0; m<numTaps; m++){
+                prefix[m] = p;
+                p *= x - (float)m;
+            }
+            float suffix = 1.0f;
+            for(size_t m=numTaps; m-- > 0;){
+                weights[m*rowLength + k] = prefix[m] * suffix * This->weightDenominators[m];
+                suffix *= x - (float)m;
+            }
+        }
+        
+        // Gather the samples under each tap and sum them into the output.
+        // Tap m is m samples after the first tap so we gather it by offsetting
+        // the buffer rather than the indices.
+        for(size_t m=0; m<numTaps; m++){
+            vDSP_vindex(buffer + m, This->readIndices, 1, This->gathered, 1, numSamples);
+            if(m == 0)
+                vDSP_vmul(weights, 1, This->gathered, 1, output, 1, numSamples);
+            else
+                vDSP_vma(weights + m*rowLength, 1, This->gathered, 1, output, 1, output, 1, numSamples);
+        }
+    }
+    
+    
+    
+    
+    
+    
+    void BMInterpolatedDelay_processBufferMono(BMInterpolatedDelay *This,
+                                               const float* input,
+                                               const float* delayTimes,
+                                               float* output,
+                                               size_t numSamples){
+        uint32_t availableBytes;
+        size_t samplesProcessed = 0;
+        while(samplesProcessed < numSamples){
+            size_t samplesProcessing = BM_MIN(numSamples - samplesProcessed, BM_BUFFER_CHUNK_SIZE);
+            uint32_t bytesProcessing = (uint32_t)(samplesProcessing * sizeof(float));
+            
+            vDSP_vclip(delayTimes + samplesProcessed, 1, &This->minDelay, &This->maxDelay, This->delayTimes, 1, samplesProcessing);
+            
+            TPCircularBufferProduceBytes(&This->bufferL, input + samplesProcessed, bytesProcessing);
+            float* buffer = TPCircularBufferTail(&This->bufferL, &availableBytes);
+            BMInterpolatedDelay_read(This, buffer, output + samplesProcessed, samplesProcessing);
+            TPCircularBufferConsume(&This->bufferL, bytesProcessing);
+            
+            samplesProcessed += samplesProcessing;
+        }
+    }
+    
+    
+    
+    
+    
+    
+    void BMInterpolatedDelay_processBufferStereo(BMInterpolatedDelay *This,
+                                                 const float* inputL, const float* inputR,
+                                                 const float* delayTimes,
+                                                 float* outputL, float* outputR,
+                                                 size_t numSamples){
+        assert(This->stereo);
+        
+        uint32_t availableBytes;
+        size_t samplesProcessed = 0;
+        while(samplesProcessed < numSamples){
+            size_t samplesProcessing = BM_MIN(numSamples - samplesProcessed, BM_BUFFER_CHUNK_SIZE);
+            uint32_t bytesProcessing = (uint32_t)(samplesProcessing * sizeof(float));
+            
+            // both channels read from the same positions
+            vDSP_vclip(delayTimes + samplesProcessed, 1, &This->minDelay, &This->maxDelay, This->delayTimes, 1, samplesProcessing);
+            
+            // write both channels before reading in case the output is in place
+            TPCircularBufferProduceBytes(&This->bufferL, inputL + samplesProcessed, bytesProcessing);
+            TPCircularBufferProduceBytes(&This->bufferR, inputR + samplesProcessed, bytesProcessing);
+            
+            float* buffer = TPCircularBufferTail(&This->bufferL, &availableBytes);
+            BMInterpolatedDelay_read(This, buffer, outputL + samplesProcessed, samplesProcessing);
+            buffer = TPCircularBufferTail(&This->bufferR, &availableBytes);
+            BMInterpolatedDelay_read(This, buffer, outputR + samplesProcessed, samplesProcessing);
+            
+            TPCircularBufferConsume(&This->bufferL, bytesProcessing);
+            TPCircularBufferConsume(&This->bufferR, bytesProcessing);
+            
+            samplesProcessed += samplesProcessing;
+        }
     }
     
     
@@ -18,16 +18,33 @@ extern "C" {
 
 #include <stdio.h>
 #include <stdbool.h>
-#include "BMMultiTapDelay.h"
+#include "TPCircularBuffer.h"
 #include "BMLagrangeInterpolationTable.h"
     
     #define INTERP_DELAY_MAX_ORDER 9
     
     
     typedef struct BMInterpolatedDelay {
-        BMMultiTapDelay delayBuffer;
+        TPCircularBuffer bufferL, bufferR;
         BMLagrangeInterpolationTable interpolationTable;
         size_t interpolationOrder;
+        size_t historyLength;
+        float minDelay, maxDelay;
+        bool stereo;
+        
+        // 1 / prod_{j != m}(m - j) for each Lagrange basis polynomial m
+        float weightDenominators [INTERP_DELAY_MAX_ORDER + 1];
+        
+        // delay times for one chunk of the modulated read, clipped to the
+        // range we can read
+        float* delayTimes;
+        
+        // for one chunk of the modulated read: the buffer index of the first
+        // tap of each sample, the Lagrange weights of each tap (one row of
+        // BM_BUFFER_CHUNK_SIZE per tap) and the samples gathered under a tap
+        float* readIndices;
+        float* weights;
+        float* gathered;
         
         // arrays used for temp storage during updates
         float gL [INTERP_DELAY_MAX_ORDER + 1];
@@ -66,6 +83,49 @@ extern "C" {
     
     
     
+    /*!
+     *BMInterpolatedDelay_processBufferMono
+     *
+     * @abstract modulated delay with Lagrange interpolation of order interpolationOrder. The delay time is set separately for each sample.
+     *
+     * @param This        pointer to an initialised struct
+     * @param input       input array of length numSamples
+     * @param delayTimes  delay time in samples for each sample of output. Values outside [(order+1)/2, maxLengthSamples] are clipped.
+     * @param output      output array of length numSamples
+     * @param numSamples  any length
+     *
+     * @notes works in place
+     */
+    void BMInterpolatedDelay_processBufferMono(BMInterpolatedDelay *This,
+                                               const float* input,
+                                               const float* delayTimes,
+                                               float* output,
+                                               size_t numSamples);
+    
+    
+    
+    /*!
+     *BMInterpolatedDelay_processBufferStereo
+     *
+     * @abstract stereo version of BMInterpolatedDelay_processBufferMono. Both channels use the same delay times.
+     *
+     * @notes works in place
+     */
+    void BMInterpolatedDelay_processBufferStereo(BMInterpolatedDelay *This,
+                                                 const float* inputL, const float* inputR,
+                                                 const float* delayTimes,
+                                                 float* outputL, float* outputR,
+                                                 size_t numSamples);
+    
+    
+    
+    /*!
+     *BMInterpolatedDelay_clearBuffers
+     */
+    void BMInterpolatedDelay_clearBuffers(BMInterpolatedDelay *This);
+    
+    
+    
 
 #endif /* BMInterpolatedDelay_h */
 
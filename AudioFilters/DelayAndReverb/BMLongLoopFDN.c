@@ -10,12 +10,20 @@
 #include "BMLongLoopFDN.h"
 #include "BMReverb.h"
 #include "BMIntegerMath.h"
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
 
 #define BMLLFDN_MAX_BLOCK_SIZE 8
 
 void BMLongLoopFDN_randomShuffleBool(bool* A, size_t length);
 void BMLongLoopFDN_randomShuffleSizet(size_t* A, size_t length);
 void BMLongLoopFDN_FHTHelper(float **in, float **out, size_t length, size_t samplesProcessing);
+void BMLongLoopFDN_freeGroups(BMLongLoopFDN *This);
+size_t BMLongLoopFDN_getPointers(BMLongLoopFDN *This, size_t samplesProcessing, size_t numSamples);
+void BMLongLoopFDN_processGroups(BMLongLoopFDN *This, float *outputL, float *outputR);
+void* BMLongLoopFDN_workerLoop(void *context);
+static void BMLongLoopFDN_swapDelays(BMLongLoopFDN *This);
 
 void BMLongLoopFDN_init(BMLongLoopFDN *This,
 						size_t numDelays,
@@ -135,9 +143,11 @@ void BMLongLoopFDN_init(BMLongLoopFDN *This,
     This->decayTimeS = decayTimeS;
     if(!smoothDecay){
         This->feedbackCoefficients = malloc(sizeof(float)*numDelays);
+        This->smoothGains = NULL;
         BMLongLoopFDN_setRT60Decay(This, decayTimeS);
     }else{
         //Smooth decay
+        This->feedbackCoefficients = NULL;
         This->smoothGains = malloc(sizeof(BMSmoothGain)*numDelays);
         for(size_t i=0; i<numDelays; i++){
             BMSmoothGain_init(&This->smoothGains[i], sampleRate);
@@ -153,6 +163,37 @@ void BMLongLoopFDN_init(BMLongLoopFDN *This,
 	// randomise the order of the output tap signs in each channel
 	BMLongLoopFDN_randomShuffleBool(This->tapSigns, numDelays/2);
 	BMLongLoopFDN_randomShuffleBool(This->tapSigns + numDelays/2, numDelays/2);
+	
+	// The output mix used to call vDSP_vsub(output, tap, output) for negative
+	// taps, which computes tap - output and so flips the sign of everything
+	// mixed before it. Convert the signs to the ones that this actually
+	// applied so that the sound stays the same and the taps can be mixed in
+	// any order. The zero taps of BMLongLoopFDN_process were mixed before
+	// all the other taps, so they were flipped by every negative tap.
+	for(size_t c=0; c<2; c++){
+		bool flip = false;
+		for(size_t i=(c+1)*numDelays/2; i>c*numDelays/2; i--){
+			bool isPositive = This->tapSigns[i-1];
+			This->tapSigns[i-1] = !flip;
+			if(!isPositive)
+				flip = !flip;
+		}
+		This->zeroTapSigns[c] = !flip;
+	}
+	
+	// the tail can stay in the network for one round of the longest delay
+	// without reaching the output
+	BMTailSleep_init(&This->sleep, maxDelaySamples);
+	
+	// process on the calling thread until setNumThreads is called
+	This->groupOutputsL = NULL;
+	This->groupOutputsR = NULL;
+	This->numWorkers = 0;
+	This->workgroup = NULL;
+	BMLongLoopFDN_setNumThreads(This, 1);
+	
+	atomic_init(&This->nextDelays, NULL);
+	atomic_init(&This->retiredDelays, NULL);
     
 	free(delayLengths);
 	delayLengths = NULL;
@@ -222,21 +263,175 @@ void BMLongLoopFDN_free(BMLongLoopFDN *This){
     
     free(This->smoothGains);
     This->smoothGains = NULL;
+	
+	BMLongLoopFDN_freeGroups(This);
+	
+	if(This->workgroup){
+		os_release(This->workgroup);
+		This->workgroup = NULL;
+	}
+	
+	// free delays that were made for a new max delay time and the ones they
+	// replaced
+	BMLongLoopFDN *delays [2] = {atomic_exchange(&This->nextDelays, NULL),
+								 atomic_exchange(&This->retiredDelays, NULL)};
+	for(size_t i=0; i<2; i++)
+		if(delays[i]){
+			BMLongLoopFDN_free(delays[i]);
+			free(delays[i]);
+		}
+}
+
+
+
+void BMLongLoopFDN_freeGroups(BMLongLoopFDN *This){
+	if(This->numWorkers > 0){
+		// tell the workers to exit and wait till they do
+		atomic_store(&This->quit, true);
+		for(size_t i=0; i<This->numWorkers; i++)
+			dispatch_semaphore_signal(This->workSignal);
+		for(size_t i=0; i<This->numWorkers; i++)
+			pthread_join(This->workers[i], NULL);
+		dispatch_release(This->workSignal);
+		free(This->workers);
+		This->workers = NULL;
+		free(This->groupJobs);
+		This->groupJobs = NULL;
+		This->numWorkers = 0;
+	}
+	
+	if(This->groupOutputsL){
+		// the buffers for all groups but the first are in one allocation
+		if(This->numGroups > 1)
+			free(This->groupOutputsL[1]);
+		free(This->groupOutputsL);
+		free(This->groupOutputsR);
+		This->groupOutputsL = NULL;
+		This->groupOutputsR = NULL;
+	}
+}
+
+
+
+void BMLongLoopFDN_setNumThreads(BMLongLoopFDN *This, size_t numThreads){
+	assert(numThreads >= 1);
+	BMLongLoopFDN_freeGroups(This);
+	
+	// divide the mixing blocks as evenly as possible between the threads
+	size_t numBlocks = This->numDelays / This->blockSize;
+	This->numThreads = numThreads;
+	This->numGroups = BM_MIN(numThreads, numBlocks);
+	This->blocksPerGroup = (numBlocks + This->numGroups - 1) / This->numGroups;
+	This->numGroups = (numBlocks + This->blocksPerGroup - 1) / This->blocksPerGroup;
+	
+	This->groupOutputsL = calloc(This->numGroups, sizeof(float*));
+	This->groupOutputsR = calloc(This->numGroups, sizeof(float*));
+	if(This->numGroups > 1){
+		size_t bufferLength = This->minDelaySamples;
+		float *buffers = malloc(sizeof(float) * bufferLength * 2 * (This->numGroups - 1));
+		for(size_t i=1; i<This->numGroups; i++){
+			This->groupOutputsL[i] = buffers + bufferLength * 2 * (i - 1);
+			This->groupOutputsR[i] = This->groupOutputsL[i] + bufferLength;
+		}
+		
+		This->groupJobs = malloc(sizeof(_Atomic int) * This->numGroups);
+		for(size_t i=0; i<This->numGroups; i++)
+			atomic_init(&This->groupJobs[i], FDNJob_Idle);
+		atomic_store(&This->quit, false);
+		This->workSignal = dispatch_semaphore_create(0);
+		
+		// The workers wait for work for as long as the FDN exists so they
+		// get their own threads rather than a dispatch queue
+		This->numWorkers = This->numGroups - 1;
+		This->workers = malloc(sizeof(pthread_t) * This->numWorkers);
+		for(size_t i=0; i<This->numWorkers; i++){
+			int result = pthread_create(&This->workers[i], NULL, BMLongLoopFDN_workerLoop, This);
+			assert(result == 0);
+		}
+	}
+}
+
+
+
+void BMLongLoopFDN_setWorkgroup(BMLongLoopFDN *This, os_workgroup_t workgroup){
+	// stop the workers so they leave the old workgroup
+	BMLongLoopFDN_freeGroups(This);
+	
+	if(workgroup)
+		os_retain(workgroup);
+	if(This->workgroup)
+		os_release(This->workgroup);
+	This->workgroup = workgroup;
+	
+	// start them again in the new one
+	BMLongLoopFDN_setNumThreads(This, This->numThreads);
 }
 
 
 #pragma mark - Set
 void BMLongLoopFDN_setMaxDelay(BMLongLoopFDN* This,float maxDelayS){
-    This->maxDelayS = maxDelayS;
-    This->needReinit = true;
+	// free the delays that the last update replaced
+	BMLongLoopFDN *retired = atomic_exchange(&This->retiredDelays, NULL);
+	if(retired){
+		BMLongLoopFDN_free(retired);
+		free(retired);
+	}
+	
+	// Make the new delays in a temporary FDN with the same settings. It has
+	// no worker threads; the process functions only take its delays.
+	BMLongLoopFDN *next = malloc(sizeof(BMLongLoopFDN));
+	BMLongLoopFDN_init(next, This->numDelays, This->minDelayS, maxDelayS, This->hasZeroTaps, This->blockSize, This->feedbackShiftByBlock, This->decayTimeS, This->smoothDecay, This->sampleRate);
+	
+	// replace any update that the audio thread hasn't picked up yet
+	BMLongLoopFDN *replaced = atomic_exchange(&This->nextDelays, next);
+	if(replaced){
+		BMLongLoopFDN_free(replaced);
+		free(replaced);
+	}
 }
 
-void BMLongLoopFDN_needReinit(BMLongLoopFDN* This){
-    if(This->needReinit){
-        This->needReinit = false;
-        BMLongLoopFDN_free(This);
-        BMLongLoopFDN_init(This, This->numDelays, This->minDelayS, This->maxDelayS, This->hasZeroTaps, This->blockSize, This->feedbackShiftByBlock,This->decayTimeS,This->smoothDecay, This->sampleRate);
-    }
+
+
+#define BMLLFDN_SWAP(type, a, b) { type temp = a; a = b; b = temp; }
+
+/*!
+ *BMLongLoopFDN_swapDelays
+ *
+ * @abstract called by the process functions to switch to the delays made by
+ * setMaxDelay
+ *
+ * This only exchanges pointers, so it is safe on the audio thread. We wait
+ * until the setter has freed the previous retired delays so that there is
+ * never more than one set waiting to be freed.
+ */
+static void BMLongLoopFDN_swapDelays(BMLongLoopFDN *This){
+	if(atomic_load(&This->nextDelays) == NULL || atomic_load(&This->retiredDelays) != NULL)
+		return;
+	BMLongLoopFDN *next = atomic_exchange(&This->nextDelays, NULL);
+	if(!next)
+		return;
+	
+	BMLLFDN_SWAP(TPCircularBuffer*, This->delays, next->delays);
+	BMLLFDN_SWAP(float*, This->delayTimes, next->delayTimes);
+	BMLLFDN_SWAP(float*, This->feedbackCoefficients, next->feedbackCoefficients);
+	BMLLFDN_SWAP(BMSmoothGain*, This->smoothGains, next->smoothGains);
+	BMLLFDN_SWAP(bool*, This->tapSigns, next->tapSigns);
+	BMLLFDN_SWAP(bool, This->zeroTapSigns[0], next->zeroTapSigns[0]);
+	BMLLFDN_SWAP(bool, This->zeroTapSigns[1], next->zeroTapSigns[1]);
+	BMLLFDN_SWAP(BMTailSleep, This->sleep, next->sleep);
+	This->maxDelayS = next->maxDelayS;
+	
+	// the decay time may have changed since the new delays were made
+	float decayTimeS = This->decayTimeS;
+	if(next->decayTimeS != decayTimeS){
+		This->decayTimeS = next->decayTimeS;
+		if(This->smoothDecay)
+			BMLongLoopFDN_setRT60DecaySmooth(This, decayTimeS, true);
+		else
+			BMLongLoopFDN_setRT60Decay(This, decayTimeS);
+	}
+	
+	atomic_store(&This->retiredDelays, next);
 }
 
 
@@ -282,159 +477,329 @@ inline void BMLongLoopFDN_FHTHelper(float **in, float **out, size_t length, size
 
 
 
+/*!
+ *BMLongLoopFDN_getPointers
+ *
+ * @abstract get read and write pointers for each delay
+ *
+ * @returns samplesProcessing, reduced if the requested number of samples is
+ * not available in the delays
+ */
+size_t BMLongLoopFDN_getPointers(BMLongLoopFDN *This, size_t samplesProcessing, size_t numSamples){
+	for(size_t i=0; i<This->numDelays; i++){
+		uint32_t bytesAvailable;
+		uint32_t bytesProcessing = (uint32_t)sizeof(float)*(uint32_t)samplesProcessing;
+		// get a read pointer
+		This->readPointers[i] = TPCircularBufferTail(&This->delays[i], &bytesAvailable);
+		// reduce bytesProcessing to not exceed bytesAvailable
+		bytesProcessing = MIN(bytesProcessing,bytesAvailable);
+		// get a write pointer
+		This->writePointers[i] = TPCircularBufferHead(&This->delays[i], &bytesAvailable);
+		// reduce bytesProcessing to not exceed bytesAvailable
+		bytesProcessing = MIN(bytesProcessing,bytesAvailable);
+
+		// reduce samples processing if the requested number of samples in unavailable
+		samplesProcessing = bytesProcessing / sizeof(float);
+
+		if(samplesProcessing < This->minDelaySamples && numSamples > samplesProcessing)
+			printf("processing short: %zu\n", samplesProcessing);
+	}
+	return samplesProcessing;
+}
+
+
+
+
+/*!
+ *BMLongLoopFDN_processGroup
+ *
+ * @abstract process one chunk for the delays in one group
+ *
+ * Each group reads from its own delays and writes the mixed feedback to the
+ * delays of the block it feeds back to. No other group reads or writes those
+ * parts of the delay buffers until the next chunk so the groups can run in
+ * parallel. The output taps of each group go to groupOutputs[group].
+ */
+static void BMLongLoopFDN_processGroup(BMLongLoopFDN *This, size_t group){
+	size_t samplesProcessing = This->chunkLength;
+	size_t start = group * This->blocksPerGroup * This->blockSize;
+	size_t end = BM_MIN(start + This->blocksPerGroup * This->blockSize, This->numDelays);
+	float *outputL = This->groupOutputsL[group];
+	float *outputR = This->groupOutputsR[group];
+
+	// rename some buffers to shorten the code in the following sections:
+	float **wp, **rp, **mb;
+	wp = This->writePointers;
+	rp = This->readPointers;
+	mb = This->mixBuffers;
+
+	// set the outputs to zero
+	vDSP_vclr(outputL, 1, samplesProcessing);
+	vDSP_vclr(outputR, 1, samplesProcessing);
+
+	// 1. attenuate the output signal according to the RT60 decay time and the
+	// mixing matrix attenuation
+	// 2. mix output to outputL and outputR
+	for(size_t i=start; i<end; i++){
+		// attenuate the data at the read pointers to get desired decay time
+		if(This->smoothDecay){
+			BMSmoothGain_processBufferMono(&This->smoothGains[i], rp[i], rp[i], samplesProcessing);
+		}else{
+			vDSP_vsmul(rp[i], 1, &This->feedbackCoefficients[i], rp[i], 1, samplesProcessing);
+		}
+
+		if(!This->tapsAfterMixing){
+			// we will write the first half the delays to the left output and the second half to the right output
+			float *outputPointer = (i < This->numDelays/2) ? outputL : outputR;
+			// output mix: add the ith delay to the output if its tap sign is positive
+			if(This->tapSigns[i])
+				vDSP_vadd(outputPointer, 1, rp[i], 1, outputPointer, 1, samplesProcessing);
+			// or subtract it if negative
+			else
+				vDSP_vsub(rp[i], 1, outputPointer, 1, outputPointer, 1, samplesProcessing);
+		}
+	}
+
+
+	// apply the mixing matrix and write to write pointers
+	for(size_t i=start; i<end; i+=This->blockSize){
+		size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
+		if(This->blockSize == 1){
+			memcpy(wp[shift],rp[i],sizeof(float)*samplesProcessing);
+		}
+		if(This->blockSize == 2){
+			// fast hadamard transform stage 1
+			BMLongLoopFDN_FHTHelper(rp+i, wp+shift, 2, samplesProcessing);
+		}
+		if(This->blockSize == 4){
+			// fast hadamard transform stage 1
+			for(size_t j=0; j<4; j+=2)
+				BMLongLoopFDN_FHTHelper(rp+i+j, mb+i+j, 2, samplesProcessing);
+
+			// fast hadamard transform stage 2 with rotation
+			BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 4, samplesProcessing);
+		}
+		if(This->blockSize == 8){
+			// fast hadamard transform stage 1
+			for(size_t j=0; j<8; j+=2)
+				BMLongLoopFDN_FHTHelper(rp+i+j, wp+shift+j, 2, samplesProcessing);
+
+			// fast hadamard transform stage 2
+			for(size_t j=0; j<8; j+=4)
+				BMLongLoopFDN_FHTHelper(wp+shift+j, mb+i+j, 4, samplesProcessing);
+
+			// fast hadamard transform stage 3 with rotation
+			BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 8, samplesProcessing);
+		}
+
+
+		// mix inputs with feedback signals and write back into the delays
+		uint32_t bytesProcessing = (uint32_t)samplesProcessing * sizeof(float);
+		for(size_t j=shift; j<shift+This->blockSize; j++){
+			if(This->tapsAfterMixing){
+				float *outputPointer = (j < This->numDelays/2) ? outputL : outputR;
+				if(This->tapSigns[j])
+					vDSP_vadd(outputPointer, 1, wp[j], 1, outputPointer, 1, samplesProcessing);
+				else
+					vDSP_vsub(wp[j], 1, outputPointer, 1, outputPointer, 1, samplesProcessing);
+			}
+
+			// mix the input to the left channel delays or the right channel delays
+			float **input = (j < This->numDelays/2) ? This->chunkInputL : This->chunkInputR;
+			float *inputPointer = input[j % This->chunkNumInputs] + This->chunkOffset;
+			vDSP_vadd(inputPointer, 1, wp[j], 1, wp[j], 1, samplesProcessing);
+
+			// mark the delays written
+			TPCircularBufferProduce(&This->delays[j], bytesProcessing);
+		}
+	}
+
+
+	// mark the delays read
+	uint32_t bytesProcessing = (uint32_t)samplesProcessing * sizeof(float);
+	for(size_t i=start; i<end; i++)
+		TPCircularBufferConsume(&This->delays[i], bytesProcessing);
+}
+
+
+
+
+/*!
+ *BMLongLoopFDN_takeGroup
+ *
+ * @returns true if the group was still pending. The caller must process it
+ * and then set it to FDNJob_Done.
+ */
+static bool BMLongLoopFDN_takeGroup(BMLongLoopFDN *This, size_t group){
+	int expected = FDNJob_Pending;
+	return atomic_compare_exchange_strong(&This->groupJobs[group], &expected, FDNJob_Running);
+}
+
+
+
+
+/*!
+ *BMLongLoopFDN_setRealtime
+ *
+ * @abstract give the calling thread a real time scheduling policy
+ *
+ * The worker has to finish a group in less than one chunk, which is the
+ * period at which the audio thread hands out work. The kernel rejects
+ * computation times above 50 ms, so we ask for no more than 10 ms.
+ */
+static void BMLongLoopFDN_setRealtime(BMLongLoopFDN *This){
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	double nanosecondsPerTick = (double)timebase.numer / (double)timebase.denom;
+	double chunkNanoseconds = 1.0e9 * (double)This->minDelaySamples / This->sampleRate;
+	
+	thread_time_constraint_policy_data_t policy;
+	policy.period = (uint32_t)(chunkNanoseconds / nanosecondsPerTick);
+	policy.computation = (uint32_t)(BM_MIN(chunkNanoseconds * 0.5, 1.0e7) / nanosecondsPerTick);
+	policy.constraint = policy.period;
+	policy.preemptible = true;
+	kern_return_t result = thread_policy_set(pthread_mach_thread_np(pthread_self()),
+											 THREAD_TIME_CONSTRAINT_POLICY,
+											 (thread_policy_t)&policy,
+											 THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+	if(result != KERN_SUCCESS)
+		printf("BMLongLoopFDN: unable to set real time policy for worker thread\n");
+}
+
+
+
+
+void* BMLongLoopFDN_workerLoop(void *context){
+	BMLongLoopFDN *This = context;
+	BMLongLoopFDN_setRealtime(This);
+	
+	// join the audio workgroup if we have one. This fails if the host has
+	// cancelled it, in which case we carry on as a plain real time thread.
+	os_workgroup_join_token_s joinToken;
+	bool joined = This->workgroup && os_workgroup_join(This->workgroup, &joinToken) == 0;
+	
+	while(true){
+		dispatch_semaphore_wait(This->workSignal, DISPATCH_TIME_FOREVER);
+		if(atomic_load(&This->quit)){
+			if(joined)
+				os_workgroup_leave(This->workgroup, &joinToken);
+			return NULL;
+		}
+		
+		// take any group that nobody has started on yet
+		for(size_t i=1; i<This->numGroups; i++)
+			if(BMLongLoopFDN_takeGroup(This, i)){
+				BMLongLoopFDN_processGroup(This, i);
+				atomic_store(&This->groupJobs[i], FDNJob_Done);
+			}
+	}
+}
+
+
+
+
+/*!
+ *BMLongLoopFDN_processGroups
+ *
+ * @abstract process all groups and sum their outputs
+ *
+ * The read and write pointers and the chunk inputs must be set before
+ * calling this.
+ */
+void BMLongLoopFDN_processGroups(BMLongLoopFDN *This, float *outputL, float *outputR){
+	This->groupOutputsL[0] = outputL;
+	This->groupOutputsR[0] = outputR;
+
+	if(This->numGroups == 1)
+		BMLongLoopFDN_processGroup(This, 0);
+	else {
+		// offer the other groups to the workers and do the first one here
+		for(size_t i=1; i<This->numGroups; i++)
+			atomic_store(&This->groupJobs[i], FDNJob_Pending);
+		for(size_t i=0; i<This->numWorkers; i++)
+			dispatch_semaphore_signal(This->workSignal);
+		BMLongLoopFDN_processGroup(This, 0);
+
+		// Take back the groups that no worker has started on. The others are
+		// being processed right now by real time threads, so the wait is at
+		// most the time to process one group. All the feedback is in the
+		// delays after this, before the next chunk starts.
+		for(size_t i=1; i<This->numGroups; i++){
+			if(BMLongLoopFDN_takeGroup(This, i))
+				BMLongLoopFDN_processGroup(This, i);
+			else
+				while(atomic_load(&This->groupJobs[i]) != FDNJob_Done);
+			atomic_store(&This->groupJobs[i], FDNJob_Idle);
+
+			vDSP_vadd(outputL, 1, This->groupOutputsL[i], 1, outputL, 1, This->chunkLength);
+			vDSP_vadd(outputR, 1, This->groupOutputsR[i], 1, outputR, 1, This->chunkLength);
+		}
+	}
+}
+
+
+
+
 void BMLongLoopFDN_process(BMLongLoopFDN *This,
 						   const float* inputL, const float* inputR,
 						   float *outputL, float *outputR,
 						   size_t numSamples){
-	
-    BMLongLoopFDN_needReinit(This);
-    
+
+    BMLongLoopFDN_swapDelays(This);
+
+	// skip processing if the input is silent and the tail has decayed
+	bool inputSilent = BMTailSleep_isSilent(&This->sleep, inputL, numSamples) &&
+					   BMTailSleep_isSilent(&This->sleep, inputR, numSamples);
+	if(BMTailSleep_skip(&This->sleep, inputSilent)){
+		vDSP_vclr(outputL, 1, numSamples);
+		vDSP_vclr(outputR, 1, numSamples);
+		return;
+	}
+	float *outputStartL = outputL;
+	float *outputStartR = outputR;
+	size_t numSamplesTotal = numSamples;
+
+	// the input to every delay comes from the input buffers
+	This->chunkInputL = &This->inputBufferL;
+	This->chunkInputR = &This->inputBufferR;
+	This->chunkNumInputs = 1;
+	This->chunkOffset = 0;
+	This->tapsAfterMixing = true;
+
 	// limit the input to chunks of size <= minDelayLength
 	while(numSamples > 0){
 		size_t samplesProcessing = BM_MIN(numSamples, This->minDelaySamples);
-		
-		
+
+
 		// attenuate the input to keep the volume unitary between input and
 		// output and cache to buffers to allow in-place processing
 		vDSP_vsmul(inputL, 1, &This->inputAttenuation, This->inputBufferL, 1, samplesProcessing);
 		vDSP_vsmul(inputR, 1, &This->inputAttenuation, This->inputBufferR, 1, samplesProcessing);
-		
-		
-		// set the outputs to zero
-		vDSP_vclr(outputL, 1, samplesProcessing);
-		vDSP_vclr(outputR, 1, samplesProcessing);
-		
-		
+
+
 		// get read pointers for each delay and limit the number of samples processing
 		// according to what's available in the delays
-		for(size_t i=0; i<This->numDelays; i++){
-			uint32_t bytesAvailable;
-			uint32_t bytesProcessing = (uint32_t)sizeof(float)*(uint32_t)samplesProcessing;
-			// get a read pointer
-			This->readPointers[i] = TPCircularBufferTail(&This->delays[i], &bytesAvailable);
-			// reduce bytesProcessing to not exceed bytesAvailable
-			bytesProcessing = MIN(bytesProcessing,bytesAvailable);
-			// get a write pointer
-			This->writePointers[i] = TPCircularBufferHead(&This->delays[i], &bytesAvailable);
-			// reduce bytesProcessing to not exceed bytesAvailable
-			bytesProcessing = MIN(bytesProcessing,bytesAvailable);
-			
-			// reduce samples processing if the requested number of samples in unavailable
-			samplesProcessing = bytesProcessing / sizeof(float);
-			
-			if(samplesProcessing < This->minDelaySamples && numSamples > samplesProcessing)
-				printf("processing short: %zu\n", samplesProcessing);
-		}
-		
-		
-		// 1. attenuate the output signal according to the RT60 decay time and the
-		// mixing matrix attenuation
-		// 2. mix output to outputL and outputR
-		for(size_t i=0; i<This->numDelays; i++){
-            // attenuate the data at the read pointers to get desired decay time
-            if(This->smoothDecay){
-                BMSmoothGain_processBufferMono(&This->smoothGains[i], This->readPointers[i], This->readPointers[i], samplesProcessing);
-            }else{
-                vDSP_vsmul(This->readPointers[i], 1, &This->feedbackCoefficients[i], This->readPointers[i], 1, samplesProcessing);
-            }
-		}
-		
-		
-		// remove the matrix attenuation from the outputs by dividing it out
-		vDSP_vsmul(outputL, 1, &This->inverseMatrixAttenuation, outputL, 1, samplesProcessing);
-		vDSP_vsmul(outputR, 1, &This->inverseMatrixAttenuation, outputR, 1, samplesProcessing);
-		
-		
+		samplesProcessing = BMLongLoopFDN_getPointers(This, samplesProcessing, numSamples);
+		This->chunkLength = samplesProcessing;
+
+
+		// attenuate, mix and feed back the delays and tap the outputs
+		BMLongLoopFDN_processGroups(This, outputL, outputR);
+
+
 		// mix the zero taps to the output if we have them
 		if(This->hasZeroTaps){
-			vDSP_vadd(This->inputBufferL, 1, outputL, 1, outputL, 1, samplesProcessing);
-			vDSP_vadd(This->inputBufferR, 1, outputR, 1, outputR, 1, samplesProcessing);
-		}
-		
-		
-		// rename some buffers to shorten the code in the following sections:
-		float **wp, **rp, **mb;
-		wp = This->writePointers;
-		rp = This->readPointers;
-		mb = This->mixBuffers;
-		
-		
-		// apply the mixing matrix and write to write pointers
-		if(This->blockSize == 1){
-			for(size_t i=0; i<This->numDelays; i++){
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				memcpy(wp[shift],rp[i],sizeof(float)*samplesProcessing);
-			}
-		}
-		if(This->blockSize == 2){
-			for(size_t i=0; i<This->numDelays; i+=2){
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				// fast hadamard transform stage 1
-				BMLongLoopFDN_FHTHelper(rp+i, wp+shift, 2, samplesProcessing);
-			}
-		}
-		if(This->blockSize == 4){
-			for(size_t i=0; i<This->numDelays; i+=4){
-				// fast hadamard transform stage 1
-				for(size_t j=0; j<4; j+=2)
-					BMLongLoopFDN_FHTHelper(rp+i+j, mb+i+j, 2, samplesProcessing);
-				
-				// fast hadamard transform stage 2 with rotation
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 4, samplesProcessing);
-			}
-		}
-		if(This->blockSize == 8){
-			for(size_t i=0; i<This->numDelays; i+=8){
-                size_t shift = (i + This->feedbackShiftByDelay) % This->numDelays;
-				// fast hadamard transform stage 1
-				for(size_t j=0; j<8; j+=2)
-					BMLongLoopFDN_FHTHelper(rp+i+j, wp+shift+j, 2, samplesProcessing);
-				
-				// fast hadamard transform stage 2
-				for(size_t j=0; j<8; j+=4)
-					BMLongLoopFDN_FHTHelper(wp+shift+j, mb+i+j, 4, samplesProcessing);
-				
-				// fast hadamard transform stage 3 with rotation
-				BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 8, samplesProcessing);
-			}
-		}
-        
-        
-        // 1. attenuate the output signal according to the RT60 decay time and the
-        // mixing matrix attenuation
-        // 2. mix output to outputL and outputR
-        for(size_t i=0; i<This->numDelays; i++){
-            
-            // we will write the first half the delays to the left output and the second half to the right output
-            float *outputPointer = (i < This->numDelays/2) ? outputL : outputR;
-            // output mix: add the ith delay to the output if its tap sign is positive
-            if(This->tapSigns[i])
-                vDSP_vadd(outputPointer, 1, wp[i], 1, outputPointer, 1, samplesProcessing);
-            // or subtract it if negative
-            else
-                vDSP_vsub(outputPointer, 1, wp[i], 1, outputPointer, 1, samplesProcessing);
-        }
-		
-		
-		// mix inputs with feedback signals and write back into the delays
-		uint32_t bytesProcessing = (uint32_t)samplesProcessing * sizeof(float);
-		for(size_t i=0; i<This->numDelays; i++){
-			// mix the input to the left channel delays
-			if(i<This->numDelays/2)
-				vDSP_vadd(This->writePointers[i], 1, This->inputBufferL, 1, This->writePointers[i], 1, samplesProcessing);
-			// mix the input to the right channel delays
+			if(This->zeroTapSigns[0])
+				vDSP_vadd(This->inputBufferL, 1, outputL, 1, outputL, 1, samplesProcessing);
 			else
-				vDSP_vadd(This->writePointers[i], 1, This->inputBufferR, 1, This->writePointers[i], 1, samplesProcessing);
-			
-			// mark the delays read
-			TPCircularBufferConsume(&This->delays[i], bytesProcessing);
-			
-			// mark the delays written
-			TPCircularBufferProduce(&This->delays[i], bytesProcessing);
+				vDSP_vsub(This->inputBufferL, 1, outputL, 1, outputL, 1, samplesProcessing);
+			if(This->zeroTapSigns[1])
+				vDSP_vadd(This->inputBufferR, 1, outputR, 1, outputR, 1, samplesProcessing);
+			else
+				vDSP_vsub(This->inputBufferR, 1, outputR, 1, outputR, 1, samplesProcessing);
 		}
-		
-		
+
+
 		// advance pointers
 		numSamples -= samplesProcessing;
 		inputL  += samplesProcessing;
@@ -443,6 +808,7 @@ void BMLongLoopFDN_process(BMLongLoopFDN *This,
 		outputR += samplesProcessing;
 	}
 
+	BMTailSleep_update(&This->sleep, outputStartL, outputStartR, numSamplesTotal);
 }
 
 
@@ -456,150 +822,59 @@ void BMLongLoopFDN_processMultiChannelInput(BMLongLoopFDN *This,
 	// arrays but we only check this one error case because it's the one that is
 	// most likely to occur.
 	assert(inputL[0] != outputL && inputR[0] != outputR);
-	
+
 	// if the number of input channels exceeds half the number of delays then
 	// some inputs will go unused. That would cause unexpected output and
 	// waste CPU cycles.
 	assert(numInputChannels <= This->numDelays / 2);
-	
-    BMLongLoopFDN_needReinit(This);
-    
+
+    BMLongLoopFDN_swapDelays(This);
+
+	// skip processing if the input is silent and the tail has decayed
+	bool inputSilent = true;
+	for(size_t i=0; i<numInputChannels && inputSilent; i++)
+		inputSilent = BMTailSleep_isSilent(&This->sleep, inputL[i], numSamples) &&
+					  BMTailSleep_isSilent(&This->sleep, inputR[i], numSamples);
+	if(BMTailSleep_skip(&This->sleep, inputSilent)){
+		vDSP_vclr(outputL, 1, numSamples);
+		vDSP_vclr(outputR, 1, numSamples);
+		return;
+	}
+
+	This->chunkInputL = inputL;
+	This->chunkInputR = inputR;
+	This->chunkNumInputs = numInputChannels;
+	This->tapsAfterMixing = false;
+
 	// limit the input to chunks of size <= minDelayLength
     size_t samplesProccessed = 0;
     size_t samplesProcessing;
 	while(samplesProccessed < numSamples){
 		samplesProcessing = BM_MIN(numSamples - samplesProccessed, This->minDelaySamples);
-		
+
 		// attenuate the inputs
 		for(size_t i=0; i<numInputChannels; i++){
 			vDSP_vsmul(inputL[i]+samplesProccessed, 1, &This->inputAttenuation, inputL[i]+samplesProccessed, 1, samplesProcessing);
 			vDSP_vsmul(inputR[i]+samplesProccessed, 1, &This->inputAttenuation, inputR[i]+samplesProccessed, 1, samplesProcessing);
 		}
-		
-		// set the outputs to zero
-		vDSP_vclr(outputL+samplesProccessed, 1, samplesProcessing);
-		vDSP_vclr(outputR+samplesProccessed, 1, samplesProcessing);
-		
-		
+
+
 		// get read pointers for each delay and limit the number of samples processing
 		// according to what's available in the delays
-		for(size_t i=0; i<This->numDelays; i++){
-			uint32_t bytesAvailable;
-			uint32_t bytesProcessing = (uint32_t)sizeof(float)*(uint32_t)samplesProcessing;
-			// get a read pointer
-			This->readPointers[i] = TPCircularBufferTail(&This->delays[i], &bytesAvailable);
-			// reduce bytesProcessing to not exceed bytesAvailable
-			bytesProcessing = MIN(bytesProcessing,bytesAvailable);
-			// get a write pointer
-			This->writePointers[i] = TPCircularBufferHead(&This->delays[i], &bytesAvailable);
-			// reduce bytesProcessing to not exceed bytesAvailable
-			bytesProcessing = MIN(bytesProcessing,bytesAvailable);
-			
-			// reduce samples processing if the requested number of samples in unavailable
-			samplesProcessing = bytesProcessing / sizeof(float);
-			
-			if(samplesProcessing < This->minDelaySamples && numSamples > samplesProcessing)
-				printf("processing short: %zu\n", samplesProcessing);
-		}
-		
-		
-		// 1. attenuate the output signal according to the RT60 decay time and the
-		// mixing matrix attenuation
-		// 2. mix output to outputL and outputR
-		for(size_t i=0; i<This->numDelays; i++){
-			// attenuate the data at the read pointers to get desired decay time
-            if(This->smoothDecay){
-                BMSmoothGain_processBufferMono(&This->smoothGains[i], This->readPointers[i], This->readPointers[i], samplesProcessing);
-            }else{
-                vDSP_vsmul(This->readPointers[i], 1, &This->feedbackCoefficients[i], This->readPointers[i], 1, samplesProcessing);
-            }
-			
-			// we will write the first half the delays to the left output and the second half to the right output
-			float *outputPointer = (i < This->numDelays/2) ? outputL+samplesProccessed : outputR+samplesProccessed;
-			// output mix: add the ith delay to the output if its tap sign is positive
-			if(This->tapSigns[i])
-				vDSP_vadd(outputPointer, 1, This->readPointers[i], 1, outputPointer, 1, samplesProcessing);
-			// or subtract it if negative
-			else
-				vDSP_vsub(outputPointer, 1, This->readPointers[i], 1, outputPointer, 1, samplesProcessing);
-		}
-		
-		
+		samplesProcessing = BMLongLoopFDN_getPointers(This, samplesProcessing, numSamples);
+		This->chunkOffset = samplesProccessed;
+		This->chunkLength = samplesProcessing;
+
+
+		// attenuate, tap, mix and feed back the delays
+		BMLongLoopFDN_processGroups(This, outputL+samplesProccessed, outputR+samplesProccessed);
+
+
 		// remove the matrix attenuation from the outputs by dividing it out
 		vDSP_vsmul(outputL+samplesProccessed, 1, &This->inverseMatrixAttenuation, outputL+samplesProccessed, 1, samplesProcessing);
 		vDSP_vsmul(outputR+samplesProccessed, 1, &This->inverseMatrixAttenuation, outputR+samplesProccessed, 1, samplesProcessing);
-		
-		
-		
-		
-		
-		// rename some buffers to shorten the code in the following sections:
-		float **wp, **rp, **mb;
-		wp = This->writePointers;
-		rp = This->readPointers;
-		mb = This->mixBuffers;
-		
-		
-		// apply the mixing matrix and write to write pointers
-		if(This->blockSize == 1){
-			for(size_t i=0; i<This->numDelays; i++){
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				memcpy(wp[shift],rp[i],sizeof(float)*samplesProcessing);
-			}
-		}
-		if(This->blockSize == 2){
-			for(size_t i=0; i<This->numDelays; i+=2){
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				// fast hadamard transform stage 1
-				BMLongLoopFDN_FHTHelper(rp+i, wp+shift, 2, samplesProcessing);
-			}
-		}
-		if(This->blockSize == 4){
-			for(size_t i=0; i<This->numDelays; i+=4){
-				// fast hadamard transform stage 1
-				for(size_t j=0; j<4; j+=2)
-					BMLongLoopFDN_FHTHelper(rp+i+j, mb+i+j, 2, samplesProcessing);
-				
-				// fast hadamard transform stage 2 with rotation
-				size_t shift = (i+This->feedbackShiftByDelay) % This->numDelays;
-				BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 4, samplesProcessing);
-			}
-		}
-		if(This->blockSize == 8){
-			for(size_t i=0; i<This->numDelays; i+=8){
-                size_t shift = (i + This->feedbackShiftByDelay) % This->numDelays;
-				// fast hadamard transform stage 1
-				for(size_t j=0; j<8; j+=2)
-					BMLongLoopFDN_FHTHelper(rp+i+j, wp+shift+j, 2, samplesProcessing);
-				
-				// fast hadamard transform stage 2
-				for(size_t j=0; j<8; j+=4)
-					BMLongLoopFDN_FHTHelper(wp+shift+j, mb+i+j, 4, samplesProcessing);
-				
-				// fast hadamard transform stage 3 with rotation
-				BMLongLoopFDN_FHTHelper(mb+i, wp+shift, 8, samplesProcessing);
-			}
-		}
-		
-		
-		// mix inputs with feedback signals and write back into the delays
-		uint32_t bytesProcessing = (uint32_t)samplesProcessing * sizeof(float);
-		for(size_t i=0; i<This->numDelays; i++){
-			// mix the input to the left channel delays
-			if(i<This->numDelays/2)
-				vDSP_vadd(inputL[i%numInputChannels]+samplesProccessed, 1, This->writePointers[i], 1, This->writePointers[i], 1, samplesProcessing);
-			// mix the input to the right channel delays
-			else
-				vDSP_vadd(inputR[i%numInputChannels]+samplesProccessed, 1, This->writePointers[i], 1, This->writePointers[i], 1, samplesProcessing);
-			
-			// mark the delays read
-			TPCircularBufferConsume(&This->delays[i], bytesProcessing);
-			
-			// mark the delays written
-			TPCircularBufferProduce(&This->delays[i], bytesProcessing);
-		}
-		
-        
+
+
         // mix the zero taps to the output if we have them
         if(This->hasZeroTaps){
 			// attenuate the dry signal according to the number of input channels
@@ -611,9 +886,10 @@ void BMLongLoopFDN_processMultiChannelInput(BMLongLoopFDN *This,
                 vDSP_vsma(inputR[j]+samplesProccessed, 1, &mul, outputR+samplesProccessed, 1, outputR+samplesProccessed, 1, samplesProcessing);
             }
         }
-        
+
 		// advance pointers
 		samplesProccessed += samplesProcessing;
 	}
-    
+
+	BMTailSleep_update(&This->sleep, outputL, outputR, numSamples);
 }
@@ -10,10 +10,23 @@
 #define BMLongLoopFDN_h
 
 #include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dispatch/dispatch.h>
+#include <os/workgroup.h>
 #include "BMSimpleDelay.h"
 #include "TPCircularBuffer.h"
 #include "BMShortSimpleDelay.h"
 #include "BMSmoothGain.h"
+#include "BMTailSleep.h"
+
+
+// Progress of the job for one group of delays in one chunk. The audio thread
+// sets FDNJob_Pending and whichever thread moves it out of FDNJob_Pending
+// first processes the group.
+typedef enum BMLongLoopFDNJobState {
+	FDNJob_Idle, FDNJob_Pending, FDNJob_Running, FDNJob_Done
+} BMLongLoopFDNJobState;
 
 
 typedef struct BMLongLoopFDN{
@@ -27,11 +40,39 @@ typedef struct BMLongLoopFDN{
     float maxDelayS;
     float decayTimeS;
 	bool hasZeroTaps;
+	// sign of the zero tap in each output channel
+	bool zeroTapSigns [2];
     float sampleRate;
-    bool needReinit;
+    // delays for a new max delay time, made by BMLongLoopFDN_setMaxDelay and
+    // swapped in by the process functions. They hand the old delays back in
+    // retiredDelays for the next call to setMaxDelay to free.
+    _Atomic(struct BMLongLoopFDN*) nextDelays;
+    _Atomic(struct BMLongLoopFDN*) retiredDelays;
     //Decay smooth
     bool smoothDecay;
     BMSmoothGain* smoothGains;
+	
+	// the delays are split into groups of whole mixing blocks that can be
+	// processed in parallel. groupOutputsL[0] and groupOutputsR[0] point to
+	// the output and the other groups write into their own buffers.
+	size_t numThreads, numGroups, blocksPerGroup;
+	float **groupOutputsL, **groupOutputsR;
+	
+	// groups 1 and up are offered to persistent worker threads. The calling
+	// thread processes group 0 and then any group no worker has started on.
+	_Atomic int *groupJobs;
+	pthread_t *workers;
+	size_t numWorkers;
+	os_workgroup_t workgroup;
+	dispatch_semaphore_t workSignal;
+	_Atomic bool quit;
+	
+	// set during processing, for the parallel jobs
+	float **chunkInputL, **chunkInputR;
+	size_t chunkNumInputs, chunkOffset, chunkLength;
+	bool tapsAfterMixing;
+	
+	BMTailSleep sleep;
 } BMLongLoopFDN;
 
 
@@ -72,17 +113,73 @@ void BMLongLoopFDN_free(BMLongLoopFDN *This);
 void BMLongLoopFDN_setRT60Decay(BMLongLoopFDN *This, float timeSeconds);
 
 
+
+/*!
+ *BMLongLoopFDN_setMaxDelay
+ *
+ * Makes a new set of delays for maxDelayS on the calling thread. The process
+ * functions switch to them at the start of their next call, so this can be
+ * called while processing is running, but not from the audio thread and only
+ * from one thread at a time. The old delays are freed by the next call to
+ * this function or by BMLongLoopFDN_free.
+ */
 void BMLongLoopFDN_setMaxDelay(BMLongLoopFDN* This,float maxDelayS);
 
 void BMLongLoopFDN_setRT60DecaySmooth(BMLongLoopFDN *This, float timeSeconds,bool isInstant);
 
 
 
+/*!
+ *BMLongLoopFDN_setNumThreads
+ *
+ * Splits the delays into groups to be processed in parallel on up to
+ * numThreads cores. The feedback from each group reaches the others no
+ * sooner than minDelaySeconds later, so the groups only need to be synced
+ * once per chunk of minDelaySeconds. This is worthwhile for networks with
+ * many delays, where processing on one thread uses most of a core. Groups
+ * are always whole mixing blocks, so the number of threads is limited to
+ * numDelays / blockSize.
+ *
+ * Each group after the first gets a real time worker thread that waits for
+ * the calling thread to signal the start of each chunk. The calling thread
+ * takes back any group that a worker hasn't started on, so it only waits for
+ * groups that are already being processed. For that wait to be as reliable
+ * as the audio thread itself, pass the host's audio workgroup to
+ * BMLongLoopFDN_setWorkgroup.
+ *
+ * This allocates memory and starts or stops threads. Don't call it while processing is running.
+ *
+ * @param This pointer to an initialised struct
+ * @param numThreads 1 to process on the calling thread, as it does by default
+ */
+void BMLongLoopFDN_setNumThreads(BMLongLoopFDN *This, size_t numThreads);
+
+
+
+/*!
+ *BMLongLoopFDN_setWorkgroup
+ *
+ * The worker threads join workgroup so that the system schedules them with
+ * the audio thread that waits for them. In an audio unit, get it from
+ * kAudioOutputUnitProperty_OSWorkgroup. This restarts the workers, so the
+ * same restrictions apply as for BMLongLoopFDN_setNumThreads.
+ *
+ * @param This pointer to an initialised struct
+ * @param workgroup the audio workgroup of the host, or NULL to leave it
+ */
+void BMLongLoopFDN_setWorkgroup(BMLongLoopFDN *This, os_workgroup_t workgroup);
+
+
+
 /*!
  *BMLongLoopFDN_process
  *
  * That this process function is 100% wet. You must handle wet/dry mix
  * outside.
+ *
+ * When the input has been silent long enough for the tail to decay below
+ * -120 dB this stops processing and outputs zeros until the input is not
+ * silent.
  */
 void BMLongLoopFDN_process(BMLongLoopFDN *This,
 						   const float* inputL, const float* inputR,
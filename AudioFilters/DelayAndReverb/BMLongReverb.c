@@ -9,6 +9,8 @@
 #include "BMLongReverb.h"
 #include "BMReverb.h"
 #include "BMFastHadamard.h"
+#include <sys/qos.h>
+#include <pthread/qos.h>
 
 
 #define Filter_Level_Lowshelf 0
@@ -36,17 +38,28 @@
 #define AttackShaper_Depth 2.0f
 #define AttackShaper_Noisegate -45 //dB
 
+#define Analysis_RingBlocks 32
+
 void BMLongReverb_updateDiffusion(BMLongReverb* This);
 void BMLongReverb_prepareLoopDelay(BMLongReverb* This,int reverbIdx);
 void BMLongReverb_updateLoopGain(BMLongReverb* This,size_t* delayTimeL,size_t* delayTimeR,float* gainL,float* gainR);
 float BMLongReverb_calculateScaleVol(BMLongReverb* This,int reverbIdx);
 void BMLongReverb_updateVND(BMLongReverb* This);
+void BMLongReverb_initVNDBank(BMLongReverb* This,int reverbIdx);
 void BMLongReverb_setHighCutFreqAtIdx(BMLongReverb* This,int reverbIdx,float freq);
 void BMLongReverb_setLSGainAtIdx(BMLongReverb* This,int reverbIdx,float gainDb);
 void BMLongReverb_setDiffusionAtIdx(BMLongReverb* This,int reverbIdx,float diffusion);
 void BMLongReverb_setOutputMixerAtIdx(BMLongReverb* This,int reverbIdx,float wetMix);
 void BMLongReverb_setDelayPitchMixerAtIdx(BMLongReverb* This,int reverbIdx,float wetMix);
 void BMLongReverb_setLoopDecayTimeAtIdx(BMLongReverb* This,int reverbIdx,float decayTime);
+void BMLongReverb_startAnalysis(BMLongReverb* This);
+void BMLongReverb_stopAnalysis(BMLongReverb* This);
+void BMLongReverb_applyAnalysis(BMLongReverb* This);
+void BMLongReverb_readAhead(BMLongReverb* This,int reverbIdx,size_t numSamples,bool offlineRendering);
+void BMLongReverb_submitHelperJob(BMLongReverb* This,size_t numSamples,bool offlineRendering);
+void BMLongReverb_collectHelper(BMLongReverb* This);
+bool BMLongReverb_anyUnitLate(BMLongReverb* This);
+void BMLongReverb_stopHelper(BMLongReverb* This);
 // 0 is simplest spectrum and 1 is most complex
 float spectralComplexity(float *A, size_t length);
 
@@ -94,6 +107,8 @@ void BMLongReverb_init(BMLongReverb* This,float sr){
             if(This->reverb[i].vndDryTap)
                 BMVelvetNoiseDecorrelator_setWetMix(&This->reverb[i].vndArray[j], 1.0f);
         }
+        //Process all vnd in one pass
+        BMLongReverb_initVNDBank(This, i);
         
         //Pitch shifting
         size_t delayRange = (1000*sr)/48000.0f;
@@ -126,6 +141,15 @@ void BMLongReverb_init(BMLongReverb* This,float sr){
         //Fade
         BMSmoothFade_init(&This->reverb[i].smoothFade, This->fadeSamples);
         This->reverb[i].state = RS_InActive;
+        This->reverb[i].updateState = true;
+        
+        //Render ahead
+        This->reverb[i].renderAhead = false;
+        atomic_init(&This->reverb[i].aheadJob, AJ_Idle);
+        This->reverb[i].aheadLate = false;
+        This->reverb[i].aheadSamples = 0;
+        This->reverb[i].aheadBuffer.bufferL = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+        This->reverb[i].aheadBuffer.bufferR = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
         
         //Loop delay
         BMLongReverb_prepareLoopDelay(This,i);
@@ -165,7 +189,6 @@ void BMLongReverb_init(BMLongReverb* This,float sr){
     This->vnd2BufferR = malloc(sizeof(float*)*This->numInput);
     This->changeReverbCurrentSamples = 0;
     This->changeReverbDelaySamples = 0.5f * This->sampleRate;
-    This->updateReverbCount = 0;
     This->verifyReverbChangeCount = 0;
     
     for(int j=0;j<This->numVND;j++){
@@ -189,6 +212,12 @@ void BMLongReverb_init(BMLongReverb* This,float sr){
     This->reverb[2].state = RS_InActive;
     This->reverb[2].decayTime = 0.5f;
     
+    //Helper thread is off until BMLongReverb_setUseHelperThread is called
+    This->helper.started = false;
+    This->helper.enabled = false;
+    
+    BMLongReverb_startAnalysis(This);
+    
     This->initNo = ReadyNo;
 }
 
@@ -201,12 +230,16 @@ void BMLongReverb_prepareLoopDelay(BMLongReverb* This,int reverbIdx){
 }
 
 void BMLongReverb_destroy(BMLongReverb* This){
+    BMLongReverb_stopHelper(This);
+    BMLongReverb_stopAnalysis(This);
+    
     for(int j=0;j<ReverbCount;j++){
         BMMultiLevelBiquad_free(&This->reverb[j].biquadFilter);
         
         for(int i=0;i<This->numVND;i++){
             BMVelvetNoiseDecorrelator_free(&This->reverb[j].vndArray[i]);
         }
+        BMSparseFIR_free(&This->reverb[j].vndBank);
         
         
         BMPitchShiftDelay_destroy(&This->reverb[j].pitchShiftDelay);
@@ -225,6 +258,10 @@ void BMLongReverb_destroy(BMLongReverb* This){
         This->reverb[j].dryInput.bufferL = nil;
         free(This->reverb[j].dryInput.bufferR);
         This->reverb[j].dryInput.bufferR = nil;
+        free(This->reverb[j].aheadBuffer.bufferL);
+        This->reverb[j].aheadBuffer.bufferL = nil;
+        free(This->reverb[j].aheadBuffer.bufferR);
+        This->reverb[j].aheadBuffer.bufferR = nil;
         
         BMMultibandAttackShaper_free(&This->reverb[j].attackSoftener);
         BMSpectrum_free(&This->reverb[j].measureSpectrum);
@@ -263,26 +300,57 @@ void BMLongReverb_destroy(BMLongReverb* This){
 
 #pragma mark - Measurement
 //3 Reverb : 1 active - 1 decay slowsly - 1 inactive for waiting new sound
-void BMLongReverb_measureSpectrum(BMLongReverb* This,int reverbIdx,float* dryInputL,float* dryInputR,float* wetInputL,float* wetInputR,size_t numSamples){
+//The measurement runs on a low priority thread
+// Each block in the ring is a header followed by numSamples of mono dry
+// input and numSamples of mono wet output
+typedef struct BMLongReverbAnalysisBlock {
+    uint32_t numSamples;
+    int reverbIdx;
+    bool inputValidate;
+} BMLongReverbAnalysisBlock;
+
+void BMLongReverb_pushAnalysis(BMLongReverb* This,int reverbIdx,float* dryInputL,float* dryInputR,float* wetInputL,float* wetInputR,size_t numSamples){
+    uint32_t bytesAvailable;
+    BMLongReverbAnalysisBlock* block = TPCircularBufferHead(&This->analysis.ring, &bytesAvailable);
+    uint32_t blockBytes = (uint32_t)(sizeof(BMLongReverbAnalysisBlock) + 2*numSamples*sizeof(float));
+    
+    //If the analysis thread fell behind we drop this block. The measurement
+    //doesn't need every sample.
+    if(block==NULL || bytesAvailable<blockBytes)
+        return;
+    
+    float* dry = (float*)(block+1);
+    float* wet = dry + numSamples;
+    
     //Mix dry & wet to mono
     float mul = 0.5f;
     //check dry input vol
     float inputVol;
     vDSP_svesq(dryInputL, 1, &inputVol, numSamples);
     inputVol = sqrtf(inputVol);
-    bool inputValidate = false;
-    if(inputVol>=BM_DB_TO_GAIN(-60)){
-        vDSP_vasm(dryInputL, 1, dryInputR, 1, &mul, This->vnd1BufferL[0], 1, numSamples);
-        BMMeasurementBuffer_inputSamples(&This->reverb[reverbIdx].measureDryInput, This->vnd1BufferL[0], numSamples);
-        inputValidate = true;
-    }
+    block->inputValidate = inputVol>=BM_DB_TO_GAIN(-60);
+    if(block->inputValidate)
+        vDSP_vasm(dryInputL, 1, dryInputR, 1, &mul, dry, 1, numSamples);
     
     //Wet
-    vDSP_vasm(wetInputL, 1, wetInputR, 1, &mul, This->vnd1BufferL[0], 1, numSamples);
-    BMMeasurementBuffer_inputSamples(&This->reverb[reverbIdx].measureWetOutput, This->vnd1BufferL[0], numSamples);
+    vDSP_vasm(wetInputL, 1, wetInputR, 1, &mul, wet, 1, numSamples);
+    
+    block->numSamples = (uint32_t)numSamples;
+    block->reverbIdx = reverbIdx;
+    TPCircularBufferProduce(&This->analysis.ring, blockBytes);
+    dispatch_semaphore_signal(This->analysis.workSignal);
+}
+
+void BMLongReverb_measureSpectrum(BMLongReverb* This,int reverbIdx,float* dryMono,float* wetMono,bool inputValidate,size_t numSamples){
+    if(inputValidate)
+        BMMeasurementBuffer_inputSamples(&This->reverb[reverbIdx].measureDryInput, dryMono, numSamples);
+    BMMeasurementBuffer_inputSamples(&This->reverb[reverbIdx].measureWetOutput, wetMono, numSamples);
+    
+    //Wait for the audio thread to apply the last change before we make another
+    bool changePending = atomic_load(&This->analysis.fadingDecay) >= 0.0f;
         
     if(This->changeReverbCurrentSamples>=This->changeReverbDelaySamples&&
-       inputValidate){
+       inputValidate && !changePending){
         float* dryInput = BMMeasurementBuffer_getCurrentPointer(&This->reverb[reverbIdx].measureDryInput);
         float* wetInput = BMMeasurementBuffer_getCurrentPointer(&This->reverb[reverbIdx].measureWetOutput);
         
@@ -320,35 +388,16 @@ void BMLongReverb_measureSpectrum(BMLongReverb* This,int reverbIdx,float* dryInp
             if(This->verifyReverbChangeCount>=ReverbVerifyChange){
                 //Shoud change active index
                 This->verifyReverbChangeCount = 0;
-                This->updateReverbCount = 0;
                 
                 This->changeReverbCurrentSamples = 0;
                 
-                //Reverb active idx
-                This->reverbActiveIdx++;
-                if(This->reverbActiveIdx>=ReverbCount)
-                    This->reverbActiveIdx = 0;
-                
                 //Calculate active/ inactive decaytime
                 float v = (This->maxSensitive-result)/(This->maxSensitive-This->minSensitive);
                 float fadingDecay = (1-v) * (This->maxDecay - This->minDecay) + This->minDecay;
                 printf("change %f %f %f\n",result,fadingDecay,This->maxSensitive*factor);
                 
-                for(int i=0;i<ReverbCount;i++){
-                    if(i==This->reverbActiveIdx){
-                        This->reverb[i].state=RS_Active;
-                        This->reverb[i].decayTime = 40.0f;
-                    }else{
-                        if(This->reverb[i].state==RS_Active){
-                            //Reverb currently active -> change it to fading state
-                            This->reverb[i].state = RS_Fading;
-                            This->reverb[i].decayTime = fadingDecay;
-                        }else{
-                            This->reverb[i].state = RS_InActive;
-                            This->reverb[i].decayTime = 0.5f;
-                        }
-                    }
-                }
+                //Send the change to the audio thread
+                atomic_store(&This->analysis.fadingDecay, fadingDecay);
             }else
                 This->verifyReverbChangeCount++;
         }else{
@@ -360,9 +409,90 @@ void BMLongReverb_measureSpectrum(BMLongReverb* This,int reverbIdx,float* dryInp
     }
 }
 
+void* BMLongReverb_analysisLoop(void* context){
+    BMLongReverb* This = context;
+    while(true){
+        dispatch_semaphore_wait(This->analysis.workSignal, DISPATCH_TIME_FOREVER);
+        if(atomic_load(&This->analysis.quit))
+            return NULL;
+        
+        //The audio thread writes whole blocks so if a header is there the
+        //samples are too
+        uint32_t bytesAvailable;
+        BMLongReverbAnalysisBlock* block = TPCircularBufferTail(&This->analysis.ring, &bytesAvailable);
+        while(block!=NULL && bytesAvailable>=sizeof(BMLongReverbAnalysisBlock)){
+            float* dry = (float*)(block+1);
+            float* wet = dry + block->numSamples;
+            BMLongReverb_measureSpectrum(This, block->reverbIdx, dry, wet, block->inputValidate, block->numSamples);
+            
+            TPCircularBufferConsume(&This->analysis.ring, (uint32_t)(sizeof(BMLongReverbAnalysisBlock) + 2*block->numSamples*sizeof(float)));
+            block = TPCircularBufferTail(&This->analysis.ring, &bytesAvailable);
+        }
+    }
+}
+
+void BMLongReverb_applyAnalysis(BMLongReverb* This){
+    //Switching units changes the settings of every unit, so leave the result
+    //for the next buffer if the helper is still rendering one of them
+    if(BMLongReverb_anyUnitLate(This))
+        return;
+    
+    float fadingDecay = atomic_exchange(&This->analysis.fadingDecay, -1.0f);
+    if(fadingDecay>=0.0f){
+        //Reverb active idx
+        This->reverbActiveIdx++;
+        if(This->reverbActiveIdx>=ReverbCount)
+            This->reverbActiveIdx = 0;
+        
+        for(int i=0;i<ReverbCount;i++){
+            This->reverb[i].updateState = true;
+            if(i==This->reverbActiveIdx){
+                This->reverb[i].state=RS_Active;
+                This->reverb[i].decayTime = 40.0f;
+            }else{
+                if(This->reverb[i].state==RS_Active){
+                    //Reverb currently active -> change it to fading state
+                    This->reverb[i].state = RS_Fading;
+                    This->reverb[i].decayTime = fadingDecay;
+                }else{
+                    This->reverb[i].state = RS_InActive;
+                    This->reverb[i].decayTime = 0.5f;
+                }
+            }
+        }
+    }
+}
+
+void BMLongReverb_startAnalysis(BMLongReverb* This){
+    uint32_t blockBytes = (uint32_t)(sizeof(BMLongReverbAnalysisBlock) + 2*BM_BUFFER_CHUNK_SIZE*sizeof(float));
+    TPCircularBufferInit(&This->analysis.ring, Analysis_RingBlocks*blockBytes);
+    atomic_init(&This->analysis.fadingDecay, -1.0f);
+    atomic_init(&This->analysis.quit, false);
+    This->analysis.workSignal = dispatch_semaphore_create(0);
+    
+    //The analysis loop blocks for as long as the reverb exists so it gets
+    //its own thread instead of a dispatch queue
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_set_qos_class_np(&attr, QOS_CLASS_UTILITY, 0);
+    int result = pthread_create(&This->analysis.thread, &attr, BMLongReverb_analysisLoop, This);
+    assert(result==0);
+    pthread_attr_destroy(&attr);
+}
+
+void BMLongReverb_stopAnalysis(BMLongReverb* This){
+    atomic_store(&This->analysis.quit, true);
+    dispatch_semaphore_signal(This->analysis.workSignal);
+    pthread_join(This->analysis.thread, NULL);
+    dispatch_release(This->analysis.workSignal);
+    TPCircularBufferCleanup(&This->analysis.ring);
+}
+
+
+
 void BMLongReverb_updateReverbInput(BMLongReverb* This,int reverbIdx,float* inputL,float* inputR,float* dryInputL,float* dryInputR,size_t numSamples){
-    //Update 2 reverbs settings
-    if(This->updateReverbCount<ReverbCount){
+    //Update reverb settings once after each change of state
+    if(This->reverb[reverbIdx].updateState){
         if(This->reverb[reverbIdx].state==RS_Active){
             //fade in to avoid click
             BMSmoothFade_startFading(&This->reverb[reverbIdx].smoothFade, FT_In);
@@ -375,89 +505,107 @@ void BMLongReverb_updateReverbInput(BMLongReverb* This,int reverbIdx,float* inpu
         //Set decay
         BMLongLoopFDN_setRT60DecaySmooth(&This->reverb[reverbIdx].loopFDN, This->reverb[reverbIdx].decayTime,false);
         
-        This->updateReverbCount++;
+        This->reverb[reverbIdx].updateState = false;
     }
     
     //Apply setting
     BMSmoothFade_processBufferStereo(&This->reverb[reverbIdx].smoothFade, inputL, inputR,dryInputL, dryInputR, numSamples);
 }
 
+void BMLongReverb_processUnit(BMLongReverb* This,int reverbIdx,float* inputL,float* inputR,float* outputL,float* outputR,float** vnd1BufferL,float** vnd1BufferR,float** vnd2BufferL,float** vnd2BufferR,size_t numSamples,bool offlineRendering){
+    //Update input
+    BMLongReverb_updateReverbInput(This, reverbIdx, inputL, inputR, This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, numSamples);
+    
+    //1st layer VND
+    BMSparseFIR_processStereo(&This->reverb[reverbIdx].vndBank, This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, vnd1BufferL, vnd1BufferR, numSamples);
+    
+    if(This->numInput>4){
+        BMFastHadamardTransformBuffer(vnd1BufferL, vnd2BufferL, This->numInput, numSamples);
+        BMFastHadamardTransformBuffer(vnd1BufferR, vnd2BufferR, This->numInput, numSamples);
+    }else{
+        for(int j=0;j<This->numInput;j++){
+            memcpy(vnd2BufferL[j], vnd1BufferL[j], sizeof(float)*numSamples);
+            memcpy(vnd2BufferR[j], vnd1BufferR[j], sizeof(float)*numSamples);
+        }
+    }
+    
+    //Long FDN
+    BMLongLoopFDN_processMultiChannelInput(&This->reverb[reverbIdx].loopFDN, vnd2BufferL, vnd2BufferR, This->numInput, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
+
+    //Add vnd2Buffer[0] to the output of FDN to simulate the zero tap of fdn. Cant use zero tap setting
+    // becauz of the Fast Hadamard Transform mix all the input.
+    float mul = 1.0f;
+    vDSP_vsma(vnd2BufferL[0], 1, &mul, This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
+    vDSP_vsma(vnd2BufferR[0], 1, &mul, This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
+    
+    BMPitchShiftDelay_processStereoBuffer(&This->reverb[reverbIdx].pitchShiftDelay, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
+    
+    //Filters
+    BMMultiLevelBiquad_processBufferStereo(&This->reverb[reverbIdx].biquadFilter, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
+    
+    //Normalize vol
+    BMSmoothGain_processBuffer(&This->reverb[reverbIdx].smoothGain, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
+    
+    //Measurement
+    if(reverbIdx==This->reverbActiveIdx){
+        memcpy(This->reverb[reverbIdx].lastWetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferL, numSamples*sizeof(float));
+        memcpy(This->reverb[reverbIdx].lastWetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples*sizeof(float));
+    }
+    
+    
+    //LFO pan
+    // Input pan LFO
+    BMPanLFO_process(&This->reverb[reverbIdx].inputPan, This->reverb[reverbIdx].LFOBuffer.bufferL, This->reverb[reverbIdx].LFOBuffer.bufferR, numSamples);
+    vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].LFOBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
+    vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].LFOBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
+    BMPanLFO_process(&This->reverb[reverbIdx].outputPan, This->reverb[reverbIdx].LFOBuffer.bufferL, This->reverb[reverbIdx].LFOBuffer.bufferR, numSamples);
+    vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].LFOBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
+    vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].LFOBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
+    
+    //mix dry & wet reverb
+    if(offlineRendering){
+        float dryMix = 1 - This->reverb[reverbIdx].reverbMixer.mixTarget;
+        vDSP_vsmsma(This->reverb[reverbIdx].wetBuffer.bufferL, 1, &This->reverb[reverbIdx].reverbMixer.mixTarget, This->reverb[reverbIdx].dryInput.bufferL, 1, &dryMix, outputL, 1, numSamples);
+        vDSP_vsmsma(This->reverb[reverbIdx].wetBuffer.bufferR, 1, &This->reverb[reverbIdx].reverbMixer.mixTarget, This->reverb[reverbIdx].dryInput.bufferR, 1, &dryMix, outputR, 1, numSamples);
+    }else{
+        //Process reverb dry/wet mixer
+        BMWetDryMixer_processBufferInPhase(&This->reverb[reverbIdx].reverbMixer, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, outputL, outputR, numSamples);
+    }
+}
+
 void BMLongReverb_processStereo(BMLongReverb* This,float* inputL,float* inputR,float* outputL,float* outputR,size_t numSamples,bool offlineRendering){
     if(This->initNo==ReadyNo){
         assert(numSamples<=BM_BUFFER_CHUNK_SIZE);
+        
+        //Take back the units rendered ahead on the helper thread. Normally
+        //they finished long ago and this returns immediately. It never waits
+        //for the helper.
+        BMLongReverb_collectHelper(This);
+        
+        BMLongReverb_updateVND(This);
+        BMLongReverb_updateDiffusion(This);
+        
         for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
-            BMLongReverb_updateVND(This);
-            BMLongReverb_updateDiffusion(This);
-            
             //Process attack softener for wet input
             BMMultibandAttackShaper_processStereo(&This->reverb[reverbIdx].attackSoftener, inputL, inputR, This->attackSoftenerBuffer.bufferL, This->attackSoftenerBuffer.bufferR, numSamples);
             
             //Measurement
             if(reverbIdx==This->reverbActiveIdx){
                 //Only measure on active reverb
-                BMLongReverb_measureSpectrum(This,reverbIdx, This->attackSoftenerBuffer.bufferL, This->attackSoftenerBuffer.bufferR, This->reverb[reverbIdx].lastWetBuffer.bufferL, This->reverb[reverbIdx].lastWetBuffer.bufferR, numSamples);
-            }
-            
-            //Update input
-            BMLongReverb_updateReverbInput(This, reverbIdx, inputL, inputR, This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, numSamples);
-            
-            //1st layer VND
-            for(int i=0;i<This->numInput;i++){
-                //PitchShifting delay into wetbuffer
-                BMVelvetNoiseDecorrelator_processBufferStereo(&This->reverb[reverbIdx].vndArray[i],This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, This->vnd1BufferL[i], This->vnd1BufferR[i], numSamples);
-            }
-            
-            if(This->numInput>4){
-                BMFastHadamardTransformBuffer(This->vnd1BufferL, This->vnd2BufferL, This->numInput, numSamples);
-                BMFastHadamardTransformBuffer(This->vnd1BufferR, This->vnd2BufferR, This->numInput, numSamples);
-            }else{
-                for(int j=0;j<This->numInput;j++){
-                    memcpy(This->vnd2BufferL[j], This->vnd1BufferL[j], sizeof(float)*numSamples);
-                    memcpy(This->vnd2BufferR[j], This->vnd1BufferR[j], sizeof(float)*numSamples);
-                }
-            }
-            
-            //Long FDN
-            BMLongLoopFDN_processMultiChannelInput(&This->reverb[reverbIdx].loopFDN, This->vnd2BufferL, This->vnd2BufferR, This->numInput, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
-
-            //Add vnd2Buffer[0] to the output of FDN to simulate the zero tap of fdn. Cant use zero tap setting
-            // becauz of the Fast Hadamard Transform mix all the input.
-            float mul = 1.0f;
-            vDSP_vsma(This->vnd2BufferL[0], 1, &mul, This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
-            vDSP_vsma(This->vnd2BufferR[0], 1, &mul, This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
-            
-            BMPitchShiftDelay_processStereoBuffer(&This->reverb[reverbIdx].pitchShiftDelay, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
-            
-            //Filters
-            BMMultiLevelBiquad_processBufferStereo(&This->reverb[reverbIdx].biquadFilter, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
-            
-            //Normalize vol
-            BMSmoothGain_processBuffer(&This->reverb[reverbIdx].smoothGain, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples);
-            
-            //Measurement
-            if(reverbIdx==This->reverbActiveIdx){
-                memcpy(This->reverb[reverbIdx].lastWetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferL, numSamples*sizeof(float));
-                memcpy(This->reverb[reverbIdx].lastWetBuffer.bufferR, This->reverb[reverbIdx].wetBuffer.bufferR, numSamples*sizeof(float));
+                BMLongReverb_pushAnalysis(This,reverbIdx, This->attackSoftenerBuffer.bufferL, This->attackSoftenerBuffer.bufferR, This->reverb[reverbIdx].lastWetBuffer.bufferL, This->reverb[reverbIdx].lastWetBuffer.bufferR, numSamples);
             }
             
-            
-            //LFO pan
-            // Input pan LFO
-            BMPanLFO_process(&This->reverb[reverbIdx].inputPan, This->reverb[reverbIdx].LFOBuffer.bufferL, This->reverb[reverbIdx].LFOBuffer.bufferR, numSamples);
-            vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].LFOBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
-            vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].LFOBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
-            BMPanLFO_process(&This->reverb[reverbIdx].outputPan, This->reverb[reverbIdx].LFOBuffer.bufferL, This->reverb[reverbIdx].LFOBuffer.bufferR, numSamples);
-            vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferL, 1, This->reverb[reverbIdx].LFOBuffer.bufferL, 1, This->reverb[reverbIdx].wetBuffer.bufferL, 1, numSamples);
-            vDSP_vmul(This->reverb[reverbIdx].wetBuffer.bufferR, 1, This->reverb[reverbIdx].LFOBuffer.bufferR, 1, This->reverb[reverbIdx].wetBuffer.bufferR, 1, numSamples);
-            
-            //mix dry & wet reverb
-            if(offlineRendering){
-                float dryMix = 1 - This->reverb[reverbIdx].reverbMixer.mixTarget;
-                vDSP_vsmsma(This->reverb[reverbIdx].wetBuffer.bufferL, 1, &This->reverb[reverbIdx].reverbMixer.mixTarget, This->reverb[reverbIdx].dryInput.bufferL, 1, &dryMix, This->reverb[reverbIdx].outputL, 1, numSamples);
-                vDSP_vsmsma(This->reverb[reverbIdx].wetBuffer.bufferR, 1, &This->reverb[reverbIdx].reverbMixer.mixTarget, This->reverb[reverbIdx].dryInput.bufferR, 1, &dryMix, This->reverb[reverbIdx].outputR, 1, numSamples);
+            if(This->reverb[reverbIdx].aheadLate){
+                //The helper is still rendering this unit for the last buffer.
+                //We don't wait for it, so the faded out unit is silent for
+                //this buffer.
+                vDSP_vclr(This->reverb[reverbIdx].outputL, 1, numSamples);
+                vDSP_vclr(This->reverb[reverbIdx].outputR, 1, numSamples);
+            }else if(This->reverb[reverbIdx].renderAhead){
+                //Output of this unit was rendered on the helper thread
+                BMLongReverb_readAhead(This, reverbIdx, numSamples, offlineRendering);
             }else{
-                //Process reverb dry/wet mixer
-                BMWetDryMixer_processBufferInPhase(&This->reverb[reverbIdx].reverbMixer, This->reverb[reverbIdx].wetBuffer.bufferL, This->reverb[reverbIdx].wetBuffer.bufferR, This->reverb[reverbIdx].dryInput.bufferL, This->reverb[reverbIdx].dryInput.bufferR, This->reverb[reverbIdx].outputL, This->reverb[reverbIdx].outputR, numSamples);
+                BMLongReverb_processUnit(This, reverbIdx, inputL, inputR, This->reverb[reverbIdx].outputL, This->reverb[reverbIdx].outputR, This->vnd1BufferL, This->vnd1BufferR, This->vnd2BufferL, This->vnd2BufferR, numSamples, offlineRendering);
             }
         }
         
@@ -474,6 +622,210 @@ void BMLongReverb_processStereo(BMLongReverb* This,float* inputL,float* inputR,f
         float norm = 1.0f/sqrtf(2.0f);
         vDSP_vsmul(outputL, 1, &norm, outputL, 1, numSamples);
         vDSP_vsmul(outputR, 1, &norm, outputR, 1, numSamples);
+        
+        //Switch to the next reverb unit if the analysis thread says so. This
+        //has to happen before we submit the helper job: a unit that becomes
+        //active must not be rendered ahead with zero input or its first
+        //buffer of real input would be lost.
+        BMLongReverb_applyAnalysis(This);
+        
+        //Start rendering the next buffer of the faded out units
+        BMLongReverb_submitHelperJob(This, numSamples, offlineRendering);
+    }
+}
+
+
+
+#pragma mark - Helper thread
+bool BMLongReverb_canRenderAhead(BMLongReverb* This,int reverbIdx){
+    //A unit can be rendered ahead if its input is certain to be zero for the
+    //next buffer
+    return reverbIdx!=This->reverbActiveIdx &&
+           !This->reverb[reverbIdx].updateState &&
+           BMSmoothFade_isSilent(&This->reverb[reverbIdx].smoothFade);
+}
+
+void BMLongReverb_readAhead(BMLongReverb* This,int reverbIdx,size_t numSamples,bool offlineRendering){
+    BMLongReverbUnit* unit = &This->reverb[reverbIdx];
+    
+    //Copy what the helper rendered
+    size_t samplesReady = BM_MIN(unit->aheadSamples, numSamples);
+    memcpy(unit->outputL, unit->aheadBuffer.bufferL, sizeof(float)*samplesReady);
+    memcpy(unit->outputR, unit->aheadBuffer.bufferR, sizeof(float)*samplesReady);
+    
+    //If the buffer length increased since the last call, or the helper never
+    //got to this unit, we render the rest here. collectHelper made sure the
+    //helper isn't touching this unit so it's safe to do that.
+    if(samplesReady<numSamples){
+        BMLongReverb_processUnit(This, reverbIdx, This->helper.zeros, This->helper.zeros, unit->outputL+samplesReady, unit->outputR+samplesReady, This->vnd1BufferL, This->vnd1BufferR, This->vnd2BufferL, This->vnd2BufferR, numSamples-samplesReady, offlineRendering);
+    }
+    
+    //Keep any samples left over for next time
+    unit->aheadSamples -= samplesReady;
+    if(unit->aheadSamples>0){
+        memmove(unit->aheadBuffer.bufferL, unit->aheadBuffer.bufferL+samplesReady, sizeof(float)*unit->aheadSamples);
+        memmove(unit->aheadBuffer.bufferR, unit->aheadBuffer.bufferR+samplesReady, sizeof(float)*unit->aheadSamples);
+    }
+}
+
+void BMLongReverb_helperRender(BMLongReverb* This){
+    for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
+        BMLongReverbUnit* unit = &This->reverb[reverbIdx];
+        
+        //Only render the units that the audio thread hasn't taken back
+        int expected = AJ_Pending;
+        if(atomic_compare_exchange_strong(&unit->aheadJob, &expected, AJ_Rendering)){
+            if(unit->aheadSamples<This->helper.targetSamples){
+                size_t samplesProcessing = This->helper.targetSamples - unit->aheadSamples;
+                BMLongReverb_processUnit(This, reverbIdx, This->helper.zeros, This->helper.zeros, unit->aheadBuffer.bufferL+unit->aheadSamples, unit->aheadBuffer.bufferR+unit->aheadSamples, This->helper.vnd1BufferL, This->helper.vnd1BufferR, This->helper.vnd2BufferL, This->helper.vnd2BufferR, samplesProcessing, This->helper.offlineRendering);
+                unit->aheadSamples += samplesProcessing;
+            }
+            atomic_store(&unit->aheadJob, AJ_Done);
+        }
+    }
+}
+
+void* BMLongReverb_helperLoop(void* context){
+    BMLongReverb* This = context;
+    while(true){
+        dispatch_semaphore_wait(This->helper.workSignal, DISPATCH_TIME_FOREVER);
+        if(atomic_load(&This->helper.quit))
+            return NULL;
+        BMLongReverb_helperRender(This);
+    }
+}
+
+void BMLongReverb_submitHelperJob(BMLongReverb* This,size_t numSamples,bool offlineRendering){
+    bool anyUnitRendersAhead = false;
+    for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
+        BMLongReverbUnit* unit = &This->reverb[reverbIdx];
+        
+        //A late unit still belongs to the helper
+        if(unit->aheadLate)
+            continue;
+        
+        bool renderAhead = This->helper.enabled && BMLongReverb_canRenderAhead(This, reverbIdx);
+        
+        //When a unit goes back to processing on the audio thread, drop the
+        //samples it rendered ahead. Its output is silent by now.
+        if(!renderAhead)
+            unit->aheadSamples = 0;
+        
+        unit->renderAhead = renderAhead;
+        anyUnitRendersAhead |= renderAhead;
+    }
+    
+    if(anyUnitRendersAhead){
+        //No unit is pending here so the helper isn't reading these. It only
+        //reads them after it takes a job that we set pending below.
+        This->helper.targetSamples = numSamples;
+        This->helper.offlineRendering = offlineRendering;
+        for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++)
+            if(This->reverb[reverbIdx].renderAhead && !This->reverb[reverbIdx].aheadLate)
+                atomic_store(&This->reverb[reverbIdx].aheadJob, AJ_Pending);
+        dispatch_semaphore_signal(This->helper.workSignal);
+    }
+}
+
+void BMLongReverb_collectHelper(BMLongReverb* This){
+    for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
+        BMLongReverbUnit* unit = &This->reverb[reverbIdx];
+        
+        //If the helper hasn't started on this unit we take the job back.
+        //readAhead then finds no samples rendered ahead and renders the unit
+        //on the audio thread.
+        int expected = AJ_Pending;
+        if(atomic_compare_exchange_strong(&unit->aheadJob, &expected, AJ_Idle))
+            continue;
+        
+        if(expected==AJ_Done){
+            //If we gave up on this job, the samples it rendered are for a
+            //buffer that has already gone out. Drop them so that readAhead
+            //renders this buffer in time.
+            if(unit->aheadLate)
+                unit->aheadSamples = 0;
+            unit->aheadLate = false;
+            atomic_store(&unit->aheadJob, AJ_Idle);
+        }else if(expected==AJ_Rendering){
+            //The helper is rendering this unit right now. Rather than wait
+            //for it we leave the unit to the helper until the next call.
+            unit->aheadLate = true;
+        }
+    }
+}
+
+
+
+bool BMLongReverb_anyUnitLate(BMLongReverb* This){
+    for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++)
+        if(This->reverb[reverbIdx].aheadLate)
+            return true;
+    return false;
+}
+
+void BMLongReverb_setUseHelperThread(BMLongReverb* This,bool useHelperThread){
+    if(useHelperThread && !This->helper.started){
+        This->helper.vnd1BufferL = malloc(sizeof(float*)*This->numVND);
+        This->helper.vnd1BufferR = malloc(sizeof(float*)*This->numVND);
+        This->helper.vnd2BufferL = malloc(sizeof(float*)*This->numVND);
+        This->helper.vnd2BufferR = malloc(sizeof(float*)*This->numVND);
+        for(int j=0;j<This->numVND;j++){
+            This->helper.vnd1BufferL[j] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+            This->helper.vnd1BufferR[j] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+            This->helper.vnd2BufferL[j] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+            This->helper.vnd2BufferR[j] = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+        }
+        This->helper.zeros = calloc(BM_BUFFER_CHUNK_SIZE, sizeof(float));
+        
+        atomic_store(&This->helper.quit, false);
+        This->helper.workSignal = dispatch_semaphore_create(0);
+        
+        //The helper runs a loop that waits for work from the audio thread.
+        //It gets its own thread rather than a dispatch queue because it
+        //blocks for as long as the reverb exists.
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_set_qos_class_np(&attr, QOS_CLASS_USER_INTERACTIVE, 0);
+        int result = pthread_create(&This->helper.thread, &attr, BMLongReverb_helperLoop, This);
+        assert(result==0);
+        pthread_attr_destroy(&attr);
+        This->helper.started = true;
+    }
+    This->helper.enabled = useHelperThread;
+}
+
+void BMLongReverb_stopHelper(BMLongReverb* This){
+    if(This->helper.started){
+        BMLongReverb_collectHelper(This);
+        
+        //Tell the helper to exit and wait till it does
+        atomic_store(&This->helper.quit, true);
+        dispatch_semaphore_signal(This->helper.workSignal);
+        pthread_join(This->helper.thread, NULL);
+        dispatch_release(This->helper.workSignal);
+        
+        //The helper has finished any unit it was late with
+        for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
+            atomic_store(&This->reverb[reverbIdx].aheadJob, AJ_Idle);
+            This->reverb[reverbIdx].aheadLate = false;
+            This->reverb[reverbIdx].aheadSamples = 0;
+        }
+        
+        for(int j=0;j<This->numVND;j++){
+            free(This->helper.vnd1BufferL[j]);
+            free(This->helper.vnd1BufferR[j]);
+            free(This->helper.vnd2BufferL[j]);
+            free(This->helper.vnd2BufferR[j]);
+        }
+        free(This->helper.vnd1BufferL);
+        free(This->helper.vnd1BufferR);
+        free(This->helper.vnd2BufferL);
+        free(This->helper.vnd2BufferR);
+        free(This->helper.zeros);
+        This->helper.zeros = nil;
+        
+        This->helper.started = false;
+        This->helper.enabled = false;
     }
 }
 
@@ -610,12 +962,14 @@ void BMLongReverb_setDiffusionAtIdx(BMLongReverb* This,int reverbIdx,float diffu
 
 void BMLongReverb_updateDiffusion(BMLongReverb* This){
     for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
-        if(This->reverb[reverbIdx].updateDiffusion){
+        //Units that the helper is still rendering get the update next time
+        if(This->reverb[reverbIdx].updateDiffusion && !This->reverb[reverbIdx].aheadLate){
             This->reverb[reverbIdx].updateDiffusion = false;
             float numTaps = floorf(This->maxTapsEachVND * This->reverb[reverbIdx].diffusion);
             for(int i=0;i<This->numVND;i++){
                 BMVelvetNoiseDecorrelator_setNumTaps(&This->reverb[reverbIdx].vndArray[i], numTaps);
             }
+            BMVelvetNoiseDecorrelator_compileBank(This->reverb[reverbIdx].vndArray, This->numInput, &This->reverb[reverbIdx].vndBank, true);
         }
     }
 }
@@ -672,7 +1026,8 @@ void BMLongReverb_setFadeInVND(BMLongReverb* This,float timeInS){
 
 void BMLongReverb_updateVND(BMLongReverb* This){
     for(int reverbIdx=0;reverbIdx<ReverbCount;reverbIdx++){
-        if(This->reverb[reverbIdx].updateVND){
+        //Units that the helper is still rendering get the update next time
+        if(This->reverb[reverbIdx].updateVND && !This->reverb[reverbIdx].aheadLate){
             This->reverb[reverbIdx].updateVND = false;
             if(This->reverb[reverbIdx].desiredVNDLength!=This->reverb[reverbIdx].vndLength){
                 This->reverb[reverbIdx].vndLength = This->reverb[reverbIdx].desiredVNDLength;
@@ -686,6 +1041,9 @@ void BMLongReverb_updateVND(BMLongReverb* This){
                     //Update fade in
                     BMVelvetNoiseDecorrelator_setFadeIn(&This->reverb[reverbIdx].vndArray[i], This->reverb[reverbIdx].fadeInS);
                 }
+                //The bank needs a longer delay memory
+                BMSparseFIR_free(&This->reverb[reverbIdx].vndBank);
+                BMLongReverb_initVNDBank(This, reverbIdx);
 
                 BMLongReverb_setDiffusionAtIdx(This,reverbIdx, This->reverb[reverbIdx].diffusion);
             }else{
@@ -693,11 +1051,19 @@ void BMLongReverb_updateVND(BMLongReverb* This){
                     //Update fade in
                     BMVelvetNoiseDecorrelator_setFadeIn(&This->reverb[reverbIdx].vndArray[i], This->reverb[reverbIdx].fadeInS);
                 }
+                BMVelvetNoiseDecorrelator_compileBank(This->reverb[reverbIdx].vndArray, This->numInput, &This->reverb[reverbIdx].vndBank, true);
             }
         }
     }
 }
 
+void BMLongReverb_initVNDBank(BMLongReverb* This,int reverbIdx){
+    size_t maxDelay = ceil(This->reverb[reverbIdx].vndLength*This->sampleRate);
+    size_t maxTaps = This->numVND * This->maxTapsEachVND;
+    BMSparseFIR_init(&This->reverb[reverbIdx].vndBank, This->numVND, maxDelay, maxTaps, This->sampleRate);
+    BMVelvetNoiseDecorrelator_compileBank(This->reverb[reverbIdx].vndArray, This->numInput, &This->reverb[reverbIdx].vndBank, false);
+}
+
 float l2Norm(float *A, size_t length){
     float sumOfSquares;
     vDSP_svesq(A,1,&sumOfSquares,length);
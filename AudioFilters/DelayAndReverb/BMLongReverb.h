@@ -26,6 +26,9 @@
 #include "BMSpectrum.h"
 #include "BMMeasurementBuffer.h"
 #include "BMSmoothFade.h"
+#include <dispatch/dispatch.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 typedef struct BMStereoBuffer{
     void* bufferL;
@@ -36,9 +39,16 @@ typedef enum ReverbState{
     RS_Active,RS_Fading,RS_InActive
 } ReverbState;
 
+// Progress of the render-ahead job of one reverb unit. The audio thread sets
+// AJ_Pending and whichever thread moves it out of AJ_Pending first renders it.
+typedef enum AheadJobState{
+    AJ_Idle,AJ_Pending,AJ_Rendering,AJ_Done
+} AheadJobState;
+
 typedef struct BMLongReverbUnit {
     BMMultiLevelBiquad biquadFilter;
     BMVelvetNoiseDecorrelator* vndArray;
+    BMSparseFIR vndBank;
     
     float fadeInS;
     
@@ -86,9 +96,52 @@ typedef struct BMLongReverbUnit {
     BMStereoBuffer dryInput;
     
     ReverbState state;
+    bool updateState;
     BMSmoothFade smoothFade;
+    
+    //Render ahead on the helper thread
+    bool renderAhead;
+    //The helper was still rendering this unit when the audio thread needed
+    //it, so the unit belongs to the helper until its job is done
+    bool aheadLate;
+    _Atomic int aheadJob;
+    BMStereoBuffer aheadBuffer;
+    size_t aheadSamples;
 } BMLongReverbUnit;
 
+// Scratch memory and signals for rendering reverb units that have faded out
+// on a helper thread. Those units have zero input so their output for the
+// next buffer can be computed one buffer ahead of time. Each reverb has its
+// own helper thread.
+typedef struct BMLongReverbHelper {
+    bool started;
+    bool enabled;
+    _Atomic bool quit;
+    bool offlineRendering;
+    size_t targetSamples;
+    pthread_t thread;
+    dispatch_semaphore_t workSignal;
+    
+    float** vnd1BufferL;
+    float** vnd1BufferR;
+    float** vnd2BufferL;
+    float** vnd2BufferR;
+    float* zeros;
+} BMLongReverbHelper;
+
+// The spectral measurements that choose when to switch to the next reverb
+// unit run on a low priority thread. The audio thread writes mono dry and wet
+// signals into a lock-free ring buffer and the thread sends back the decay
+// time for the unit that starts fading out.
+typedef struct BMLongReverbAnalysis {
+    TPCircularBuffer ring;
+    pthread_t thread;
+    dispatch_semaphore_t workSignal;
+    _Atomic bool quit;
+    // < 0 when no change is pending
+    _Atomic float fadingDecay;
+} BMLongReverbAnalysis;
+
 
 
 typedef struct{
@@ -111,18 +164,22 @@ typedef struct{
     
     size_t measureLength;
     int reverbActiveIdx;
-    int updateReverbCount;
-    int verifyReverbChangeCount;
     
-    size_t fadeSamples;
+    //Only accessed on the analysis thread
+    int verifyReverbChangeCount;
     size_t changeReverbDelaySamples;
     size_t changeReverbCurrentSamples;
     
+    size_t fadeSamples;
+    
     float minSensitive;
     float maxSensitive;
     float minDecay;
     float maxDecay;
     
+    BMLongReverbHelper helper;
+    BMLongReverbAnalysis analysis;
+    
     int initNo;
 }BMLongReverb;
 
@@ -138,6 +195,28 @@ void BMLongReverb_setLSGain(BMLongReverb* This,float gainDb);
 void BMLongReverb_setHighCutFreq(BMLongReverb* This,float freq);
 void BMLongReverb_setFadeInVND(BMLongReverb* This,float timeInS);
 
+/*!
+ *BMLongReverb_setUseHelperThread
+ *
+ * Reverb units that are not active and whose input has faded out are rendered
+ * one buffer ahead on a helper thread, so that during a changeover the audio
+ * thread doesn't have to process two reverb units at once. The first call with
+ * useHelperThread = true allocates memory and starts the thread, so don't call
+ * it from the audio thread. The thread stops when the reverb is destroyed.
+ *
+ * The audio thread never waits for the helper. If the helper hasn't started
+ * on a unit by the next call to process, the audio thread takes the job back
+ * and renders that unit itself. If the helper is still rendering a unit, that
+ * unit is silent for one buffer and the audio thread catches it up once the
+ * helper has finished. Switching reverb units and VND or diffusion updates are
+ * put off until then.
+ *
+ * If the host changes buffer length between calls to process, samples that
+ * were rendered ahead but not used are dropped when the unit becomes active
+ * again. The unit is silent by then so this is not audible.
+ */
+void BMLongReverb_setUseHelperThread(BMLongReverb* This,bool useHelperThread);
+
 //Measurement
 void BMLongReverb_setMinSensitive(BMLongReverb* This,float threshold);
 void BMLongReverb_setMaxSensitive(BMLongReverb* This,float threshold);
@@ -9,11 +9,28 @@
 #include "BMMultiTapDelay.h"
 #include <Accelerate/Accelerate.h>
 #include <stdlib.h>
+#include <sched.h>
+#include <mach/mach_time.h>
 #include "Constants.h"
 
+// below this length, process sample by sample with vDSP_vgathr instead of
+// tap by tap with vDSP_vsma
+#define BMMultiTapDelay_GatherMaxLength 16
+
+// bits in setting.state
+#define BMMultiTapDelay_ActiveSetMask 0x1
+#define BMMultiTapDelay_UpdatePending 0x2
+#define BMMultiTapDelay_Fading 0x4
+
+// number of times publishTaps checks the Fading bit before it starts to yield
+#define BMMultiTapDelay_FadeWaitSpins 64
+
 void BMMultiTapDelay_initBuffer(BMMultiTapDelay* delay);
 void BMMultiTapDelay_PerformReInitBuffer(BMMultiTapDelay *This);
 void BMMultiTapDelay_initMultiBuffer(BMMultiTapDelay* delay);
+void BMMultiTapDelay_publishTaps(BMMultiTapDelay *This);
+BMMultiTapDelayTapSet* BMMultiTapDelay_acquireTapSet(BMMultiTapDelay *This, BMMultiTapDelayTapSet** fadeFrom);
+void BMMultiTapDelay_endFade(BMMultiTapDelay *This, BMMultiTapDelayTapSet* fadeFrom);
 
 
 
@@ -27,7 +44,6 @@ void BMMultiTapDelay_Init(BMMultiTapDelay *This,
     BMMultiTapDelaySetting* setting = &This->setting;
     setting->isStereo = isStereo;
     
-    This->_needUpdateGain = This->_needUpdateIndices = false;
     This->numberChannel = (isStereo? 2:1);
     This->maxTaps = maxTaps;
     This->numTaps = numTaps;
@@ -39,29 +55,47 @@ void BMMultiTapDelay_Init(BMMultiTapDelay *This,
     This->input = malloc(sizeof(float*) * This->numberChannel);
     This->output = malloc(sizeof(float*) * This->numberChannel);
     This->lastTapOutput = malloc(sizeof(float*) * This->numberChannel);
-    setting->gains = malloc(sizeof(float*) * This->numberChannel);
-    setting->indices = malloc(sizeof(size_t*) * This->numberChannel);
     setting->delayTimes = malloc(sizeof(size_t*) * This->numberChannel);
     This->tempGains = malloc(sizeof(float*) * This->numberChannel);
     This->tempIndices = malloc(sizeof(size_t*) * This->numberChannel);
+    This->fadeBuffer = malloc(sizeof(float*) * This->numberChannel);
+    This->crossfade = false;
     
     // alias the input arrays that have l and r channels into
     // multi-dimensional arrays so we can iterate the channels with a for
     // loop
     
+    // malloc the two tap sets
+    for (int k=0; k<2; k++) {
+        BMMultiTapDelayTapSet* tapSet = &setting->tapSets[k];
+        tapSet->indices = malloc(sizeof(size_t*) * This->numberChannel);
+        tapSet->gains = malloc(sizeof(float*) * This->numberChannel);
+        tapSet->lastTapPosition = calloc(This->numberChannel, sizeof(size_t));
+        tapSet->numTaps = 0;
+        for (int i=0; i < This->numberChannel; i++) {
+            tapSet->indices[i] = calloc(maxTaps, sizeof(size_t));
+            tapSet->gains[i] = calloc(maxTaps, sizeof(float));
+        }
+    }
+    atomic_init(&setting->state, 0);
+    This->sortBuffer = malloc(sizeof(BMMultiTapDelayTap) * maxTaps);
+    This->gatherBuffer = malloc(sizeof(float) * maxTaps);
+    
     // malloc and set indices & gain
     for (int i=0; i < This->numberChannel; i++) {
-        setting->indices[i] = malloc(sizeof(size_t) * maxTaps);
-        setting->gains[i] = malloc(sizeof(float) * maxTaps);
         This->tempIndices[i] = malloc(sizeof(size_t) * maxTaps);
         This->tempGains[i] = malloc(sizeof(float) * maxTaps);
         This->tempBuffer[i] = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
+        This->fadeBuffer[i] = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE);
     }
     
     BMMultiTapDelay_setDelayTimes(This, delayTimesL, delayTimesR);
     BMMultiTapDelay_setGains(This, gainL, gainR);
     
     BMMultiTapDelay_initBuffer(This);
+    
+    // nothing stays in the delay for longer than the longest tap
+    BMTailSleep_init(&This->sleep, maxDelayTime);
 }
 
 void BMMultiTapDelay_destroyBuffer(BMMultiTapDelay* delay){
@@ -82,16 +116,12 @@ void BMMultiTapDelay_free(BMMultiTapDelay *This){
         free(This->tempBuffer[i]);
         This->tempBuffer[i] = NULL;
         
+        free(This->fadeBuffer[i]);
+        This->fadeBuffer[i] = NULL;
+        
         This->input[i] = NULL;
         This->output[i] = NULL;
         
-        
-        free(setting->indices[i]);
-        setting->indices[i] = NULL;
-        
-        free(setting->gains[i]);
-        setting->gains[i] = NULL;
-        
         free(This->tempIndices[i]);
         This->tempIndices[i] = NULL;
         
@@ -110,6 +140,9 @@ void BMMultiTapDelay_free(BMMultiTapDelay *This){
     free(This->tempBuffer);
     This->tempBuffer = NULL;
     
+    free(This->fadeBuffer);
+    This->fadeBuffer = NULL;
+    
     free(This->input);
     This->input = NULL;
     
@@ -119,13 +152,27 @@ void BMMultiTapDelay_free(BMMultiTapDelay *This){
     free(This->zeroArray);
     This->zeroArray = NULL;
     
-    //Memory leak
-    free(setting->indices);
-    setting->indices = NULL;
+    for (int k=0; k<2; k++) {
+        BMMultiTapDelayTapSet* tapSet = &setting->tapSets[k];
+        for (int i=0; i<This->numberChannel; i++) {
+            free(tapSet->indices[i]);
+            free(tapSet->gains[i]);
+        }
+        free(tapSet->indices);
+        tapSet->indices = NULL;
+        free(tapSet->gains);
+        tapSet->gains = NULL;
+        free(tapSet->lastTapPosition);
+        tapSet->lastTapPosition = NULL;
+    }
     
-    free(setting->gains);
-    setting->gains = NULL;
+    free(This->sortBuffer);
+    This->sortBuffer = NULL;
     
+    free(This->gatherBuffer);
+    This->gatherBuffer = NULL;
+    
+    //Memory leak
     free(setting->delayTimes);
     setting->delayTimes = NULL;
     
@@ -186,6 +233,115 @@ void BMMultiTapDelay_initBuffer(BMMultiTapDelay* delay){
 
 
 
+/*
+ *  Sum the output of all the taps in one channel. The taps are sorted by
+ *  index, so the reads move forward through the buffer.
+ */
+static void BMMultiTapDelay_sumTaps(BMMultiTapDelay* delay,
+                                    const float* buffer,
+                                    const size_t* indices,
+                                    const float* gains,
+                                    size_t numTaps,
+                                    float* output,
+                                    size_t numSamples){
+    // For very short buffers the overhead of calling vDSP for each tap is
+    // large, so we gather all the taps for one sample and take the dot
+    // product with the gains. vDSP_vgathr uses 1-based indices, so we shift
+    // the buffer by one.
+    if(numSamples < BMMultiTapDelay_GatherMaxLength){
+        for(size_t k=0; k<numSamples; k++){
+            vDSP_vgathr(buffer + k + 1, indices, 1, delay->gatherBuffer, 1, numTaps);
+            vDSP_dotpr(delay->gatherBuffer, 1, gains, 1, output + k, numTaps);
+        }
+        return;
+    }
+    
+    memset(output, 0, numSamples * sizeof(float));
+    
+    // Process four taps at a time so that we load and store the output once
+    // for every four taps instead of once for every tap.
+    size_t j=0;
+    for(; j+4 <= numTaps; j+=4){
+        const float* b0 = buffer + indices[j];
+        const float* b1 = buffer + indices[j+1];
+        const float* b2 = buffer + indices[j+2];
+        const float* b3 = buffer + indices[j+3];
+        float g0 = gains[j], g1 = gains[j+1], g2 = gains[j+2], g3 = gains[j+3];
+        for(size_t k=0; k<numSamples; k++)
+            output[k] += g0*b0[k] + g1*b1[k] + g2*b2[k] + g3*b3[k];
+    }
+    
+    // remaining taps
+    for(; j<numTaps; j++)
+        vDSP_vsma(buffer + indices[j], 1, &gains[j], output, 1, output, 1, numSamples);
+}
+
+
+
+
+/*
+ *  Process one channel for up to BM_BUFFER_CHUNK_SIZE samples. If fadeFrom
+ *  is not NULL the output fades from the taps in fadeFrom to the taps in
+ *  tapSet, with the gain of the new taps starting at fadeStart and going up
+ *  by fadeStep each sample.
+ */
+static void BMMultiTapDelay_processChunk(BMMultiTapDelay* delay,
+                                         BMMultiTapDelayTapSet* tapSet,
+                                         BMMultiTapDelayTapSet* fadeFrom,
+                                         float fadeStart, float fadeStep,
+                                         size_t channel,
+                                         const float* input,
+                                         float* output,
+                                         float* lastTapOutput,
+                                         size_t numSamples){
+    assert(numSamples <= BM_BUFFER_CHUNK_SIZE);
+    
+    uint32_t availableBytes;
+    uint32_t bytesThisTime = (uint32_t)(numSamples * sizeof(float));
+    
+    TPCircularBufferProduceBytes(&delay->buffer[channel], input, bytesThisTime);
+    
+    //from each read point, we read numSamples frames to process
+    float* buffer = TPCircularBufferTail(&delay->buffer[channel], &availableBytes);
+    
+    // sum into the temp buffer so that we can work in place
+    BMMultiTapDelay_sumTaps(delay,
+                            buffer,
+                            tapSet->indices[channel],
+                            tapSet->gains[channel],
+                            tapSet->numTaps,
+                            delay->tempBuffer[channel],
+                            numSamples);
+    
+    // crossfade: old + ramp * (new - old)
+    if(fadeFrom){
+        BMMultiTapDelay_sumTaps(delay,
+                                buffer,
+                                fadeFrom->indices[channel],
+                                fadeFrom->gains[channel],
+                                fadeFrom->numTaps,
+                                delay->fadeBuffer[channel],
+                                numSamples);
+        vDSP_vsub(delay->fadeBuffer[channel], 1, delay->tempBuffer[channel], 1, delay->tempBuffer[channel], 1, numSamples);
+        vDSP_vrampmuladd(delay->tempBuffer[channel], 1, &fadeStart, &fadeStep, delay->fadeBuffer[channel], 1, numSamples);
+        memcpy(delay->tempBuffer[channel], delay->fadeBuffer[channel], bytesThisTime);
+    }
+    
+    //last tap -> store to lasttap output
+    if(lastTapOutput && tapSet->numTaps > 0){
+        size_t lastTapIndex = tapSet->indices[channel][tapSet->lastTapPosition[channel]];
+        memcpy(lastTapOutput, buffer + lastTapIndex, bytesThisTime);
+    }
+    
+    TPCircularBufferConsume(&delay->buffer[channel], bytesThisTime);
+    
+    //we overwrite data to the output
+    memcpy(output, delay->tempBuffer[channel], bytesThisTime);
+}
+
+
+
+
 /*
  * works in place
  */
@@ -194,53 +350,35 @@ void BMMultiTapDelay_ProcessBufferMono(BMMultiTapDelay* delay,
                                        size_t frames){
     assert(delay->numberChannel == 1);
     
-    if(delay->_needUpdateIndices)
-        BMMultiTapDelay_PerformUpdateIndices(delay);
-    if(delay->_needUpdateGain)
-        BMMultiTapDelay_PerformUpdateGains(delay);
-    
-    // this function is stereo in, stereo out; fail if the delay was
-    // not initialised for that configuration
+    BMMultiTapDelayTapSet* fadeFrom;
+    BMMultiTapDelayTapSet* tapSet = BMMultiTapDelay_acquireTapSet(delay, &fadeFrom);
     
-    BMMultiTapDelaySetting* setting = &delay->setting;
-    //this will bridge my code with Sir Hans's style ^_^
-    delay->input[0] = input;
-    delay->output[0] = output;
-
-    size_t frameThisTime;
+    // skip processing if the input is silent and the delay has emptied
+    bool inputSilent = BMTailSleep_isSilent(&delay->sleep, input, frames);
+    if(BMTailSleep_skip(&delay->sleep, inputSilent)){
+        vDSP_vclr(output, 1, frames);
+        BMMultiTapDelay_endFade(delay, fadeFrom);
+        return;
+    }
     
+    float fadeStep = 1.0f / (float)frames;
     size_t framesProcessed = 0;
     while(framesProcessed < frames){
-        size_t framesProcessing = frames - framesProcessed;
-        framesProcessing = (framesProcessing < BM_BUFFER_CHUNK_SIZE)? framesProcessing:BM_BUFFER_CHUNK_SIZE;
+        size_t framesProcessing = BM_MIN(frames - framesProcessed, BM_BUFFER_CHUNK_SIZE);
         
-        frameThisTime = framesProcessing;
-        
-        //
-        uint32_t availableBytes;
-        uint32_t bytesThisTime;
-        
-        bytesThisTime = (int32_t)frameThisTime * sizeof(float);
-
-        //set 0 to the tempbuffer
-        memset(delay->tempBuffer[0], 0, BM_BUFFER_CHUNK_SIZE * sizeof(float));
-        TPCircularBufferProduceBytes(&delay->buffer[0], delay->input[0]+framesProcessed, bytesThisTime);
+        BMMultiTapDelay_processChunk(delay, tapSet,
+                                     fadeFrom, (framesProcessed + 1) * fadeStep, fadeStep,
+                                     0,
+                                     input + framesProcessed,
+                                     output + framesProcessed,
+                                     NULL,
+                                     framesProcessing);
         
-        //from each read point, we read FrameThisTime frames to process
-        //our aim is to get the buffer with FrameThisTime length
-        //this buffer will add directly to the output
-        float* buffer = TPCircularBufferTail(&delay->buffer[0], &availableBytes);
-        
-        for (int j=0; j<delay->numTaps; j++) {
-            vDSP_vsma(buffer + setting->indices[0][j], 1, &setting->gains[0][j], delay->tempBuffer[0], 1, delay->tempBuffer[0], 1, frameThisTime);
-        }
-        TPCircularBufferConsume(&delay->buffer[0], bytesThisTime);
-        
-        //we overwrite data to the output
-        memcpy(delay->output[0]+framesProcessed, delay->tempBuffer[0], bytesThisTime);
-
         framesProcessed += framesProcessing;
     }
+    
+    BMMultiTapDelay_endFade(delay, fadeFrom);
+    BMTailSleep_update(&delay->sleep, output, NULL, frames);
 }
 
 
@@ -251,58 +389,11 @@ void BMMultiTapDelay_processBufferStereo(BMMultiTapDelay* delay,
                                          const float* inputL, const float* inputR,
                                          float* outputL, float* outputR,
                                          size_t numSamples){
-    assert(delay->numberChannel == 2);
-    
-    if(delay->_needUpdateIndices)
-        BMMultiTapDelay_PerformUpdateIndices(delay);
-    if(delay->_needUpdateGain)
-        BMMultiTapDelay_PerformUpdateGains(delay);
-	
-    
-    BMMultiTapDelaySetting* setting = &delay->setting;
-    //this will bridge my code with Sir Hans's style ^_^
-    delay->input[0] = (float*)inputL;
-    delay->input[1] = (float*)inputR;
-    delay->output[0] = outputL;
-    delay->output[1] = outputR;
-    
-    size_t frameThisTime;
-    
-    size_t framesProcessed = 0;
-    while(framesProcessed < numSamples){
-        size_t framesProcessing = numSamples - framesProcessed;
-        framesProcessing = (framesProcessing < BM_BUFFER_CHUNK_SIZE)? framesProcessing:BM_BUFFER_CHUNK_SIZE;
-        
-        frameThisTime = framesProcessing;
-        
-        //
-        uint32_t availableBytes;
-        uint32_t bytesThisTime;
-        
-        bytesThisTime = (int32_t)frameThisTime * sizeof(float);
-        
-        for(size_t i=0; i<delay->numberChannel; i++){
-            //set 0 to the tempbuffer
-            memset(delay->tempBuffer[i], 0, BM_BUFFER_CHUNK_SIZE * sizeof(float));
-            TPCircularBufferProduceBytes(&delay->buffer[i], delay->input[i]+framesProcessed, bytesThisTime);
-            
-            //from each read point, we read FrameThisTime frames to process
-            //our aim is to get the buffer with FrameThisTime length
-            //this buffer will add directly to the output
-            float* buffer = TPCircularBufferTail(&delay->buffer[i], &availableBytes);
-            
-            for (int j=0; j<delay->numTaps; j++) {
-                vDSP_vsma(buffer + setting->indices[i][j], 1, &setting->gains[i][j], delay->tempBuffer[i], 1, delay->tempBuffer[i], 1, frameThisTime);
-            }
-            TPCircularBufferConsume(&delay->buffer[i], bytesThisTime);
-            
-            //we overwrite data to the output
-            memcpy(delay->output[i]+framesProcessed, delay->tempBuffer[i], bytesThisTime);
-        }
-        
-        //
-        framesProcessed += framesProcessing;
-    }
+    BMMultiTapDelay_processStereoWithFinalOutput(delay,
+                                                 inputL, inputR,
+                                                 outputL, outputR,
+                                                 NULL, NULL,
+                                                 numSamples);
 }
 
 void BMMultiTapDelay_processStereoWithFinalOutput(BMMultiTapDelay* delay,
@@ -312,13 +403,9 @@ void BMMultiTapDelay_processStereoWithFinalOutput(BMMultiTapDelay* delay,
                                          size_t numSamples){
     assert(delay->numberChannel == 2);
     
-    if(delay->_needUpdateIndices)
-        BMMultiTapDelay_PerformUpdateIndices(delay);
-    if(delay->_needUpdateGain)
-        BMMultiTapDelay_PerformUpdateGains(delay);
+    BMMultiTapDelayTapSet* fadeFrom;
+    BMMultiTapDelayTapSet* tapSet = BMMultiTapDelay_acquireTapSet(delay, &fadeFrom);
     
-    
-    BMMultiTapDelaySetting* setting = &delay->setting;
     //this will bridge my code with Sir Hans's style ^_^
     delay->input[0] = (float*)inputL;
     delay->input[1] = (float*)inputR;
@@ -327,94 +414,50 @@ void BMMultiTapDelay_processStereoWithFinalOutput(BMMultiTapDelay* delay,
     delay->lastTapOutput[0] = lastTapL;
     delay->lastTapOutput[1] = lastTapR;
     
-    size_t frameThisTime;
+    // skip processing if the input is silent and the delay has emptied
+    bool inputSilent = BMTailSleep_isSilent(&delay->sleep, inputL, numSamples) &&
+                       BMTailSleep_isSilent(&delay->sleep, inputR, numSamples);
+    if(BMTailSleep_skip(&delay->sleep, inputSilent)){
+        for(size_t i=0; i<delay->numberChannel; i++){
+            vDSP_vclr(delay->output[i], 1, numSamples);
+            if(delay->lastTapOutput[i])
+                vDSP_vclr(delay->lastTapOutput[i], 1, numSamples);
+        }
+        BMMultiTapDelay_endFade(delay, fadeFrom);
+        return;
+    }
     
+    float fadeStep = 1.0f / (float)numSamples;
     size_t framesProcessed = 0;
     while(framesProcessed < numSamples){
-        size_t framesProcessing = numSamples - framesProcessed;
-        framesProcessing = (framesProcessing < BM_BUFFER_CHUNK_SIZE)? framesProcessing:BM_BUFFER_CHUNK_SIZE;
-        
-        frameThisTime = framesProcessing;
-        
-        //
-        uint32_t availableBytes;
-        uint32_t bytesThisTime;
-        
-        bytesThisTime = (int32_t)frameThisTime * sizeof(float);
+        size_t framesProcessing = BM_MIN(numSamples - framesProcessed, BM_BUFFER_CHUNK_SIZE);
         
         for(size_t i=0; i<delay->numberChannel; i++){
-            //set 0 to the tempbuffer
-            memset(delay->tempBuffer[i], 0, BM_BUFFER_CHUNK_SIZE * sizeof(float));
-            TPCircularBufferProduceBytes(&delay->buffer[i], delay->input[i]+framesProcessed, bytesThisTime);
-            
-            //from each read point, we read FrameThisTime frames to process
-            //our aim is to get the buffer with FrameThisTime length
-            //this buffer will add directly to the output
-            float* buffer = TPCircularBufferTail(&delay->buffer[i], &availableBytes);
-            
-            for (int j=0; j<delay->numTaps; j++) {
-                if(j==delay->numTaps-1){
-                    //last tap -> store to lasttap output
-                    float gain = 1;
-                    vDSP_vsmul(buffer + setting->indices[i][j], 1, &gain, delay->lastTapOutput[i]+framesProcessed, 1, frameThisTime);
-                }
-                vDSP_vsma(buffer + setting->indices[i][j], 1, &setting->gains[i][j], delay->tempBuffer[i], 1, delay->tempBuffer[i], 1, frameThisTime);
-//                printf("indices %zu\n",setting->indices[i][j]);
-            }
-            TPCircularBufferConsume(&delay->buffer[i], bytesThisTime);
-            
-            //we overwrite data to the output
-            memcpy(delay->output[i]+framesProcessed, delay->tempBuffer[i], bytesThisTime);
+            float* lastTapOutput = delay->lastTapOutput[i] ? delay->lastTapOutput[i] + framesProcessed : NULL;
+            BMMultiTapDelay_processChunk(delay, tapSet,
+                                         fadeFrom, (framesProcessed + 1) * fadeStep, fadeStep,
+                                         i,
+                                         delay->input[i] + framesProcessed,
+                                         delay->output[i] + framesProcessed,
+                                         lastTapOutput,
+                                         framesProcessing);
         }
         
-        //
         framesProcessed += framesProcessing;
     }
+    
+    BMMultiTapDelay_endFade(delay, fadeFrom);
+    BMTailSleep_update(&delay->sleep, outputL, outputR, numSamples);
 }
 
 
 
+
+
 void BMMultiTapDelay_ProcessOneSampleStereo(BMMultiTapDelay* delay,
                                             float* inputL, float* inputR,
                                             float* outputL, float* outputR){
-    if(delay->_needUpdateIndices)
-        BMMultiTapDelay_PerformUpdateIndices(delay);
-    if(delay->_needUpdateGain)
-        BMMultiTapDelay_PerformUpdateGains(delay);
-    
-    // this function is stereo in, stereo out; fail if the delay was
-    // not initialised for that configuration
-    //sir Hans'style
-    BMMultiTapDelaySetting* setting = &delay->setting;
-    delay->input[0] = inputL;
-    delay->input[1] = inputR;
-    delay->output[0] = outputL;
-    delay->output[1] = outputR;
-    
-    uint32_t availableBytes;
-    
-    for(size_t i=0; i<delay->numberChannel; i++){
-        //set 0 to the tempbuffer
-        //memset(delay->tempBuffer[i], 0, BMUS_CORE_BUFFER_LENGTH * sizeof(float));
-        TPCircularBufferProduceBytes(&delay->buffer[i], delay->input[i], sizeof(float));
-        
-        //from each read point, we read FrameThisTime frames to process
-        //our aim is to get the buffer with FrameThisTime length
-        //this buffer will add directly to the output
-        float* buffer = TPCircularBufferTail(&delay->buffer[i], &availableBytes);
-        //
-        vDSP_vgathr(buffer,
-                    setting->indices[i], 1,
-                    delay->tempBuffer[i], 1,
-                    delay->numTaps);
-        
-        vDSP_dotpr(delay->tempBuffer[i], 1,
-                   setting->gains[i], 1,
-                   delay->output[i],
-                   delay->numTaps);
-        
-        TPCircularBufferConsume(&delay->buffer[i], sizeof(float));
-    }
+    BMMultiTapDelay_processBufferStereo(delay, inputL, inputR, outputL, outputR, 1);
 }
 
 
@@ -435,82 +478,179 @@ void BMMultiTapDelay_clearBuffers(BMMultiTapDelay* delay){
  */
 
 
-void BMMultiTapDelay_PerformUpdateIndices(BMMultiTapDelay *This){
-    //write data from tempArray
+/*
+ *  Called by the process functions to switch to the latest tap set if there
+ *  is an update waiting. If crossfade is on and fadeFrom is not NULL, the old
+ *  set is returned in *fadeFrom when we switch, and the fading flag keeps
+ *  publishTaps from writing to it until BMMultiTapDelay_endFade. Otherwise
+ *  *fadeFrom is NULL.
+ */
+BMMultiTapDelayTapSet* BMMultiTapDelay_acquireTapSet(BMMultiTapDelay *This, BMMultiTapDelayTapSet** fadeFrom){
     BMMultiTapDelaySetting* setting = &This->setting;
-    for (int i=0; i<This->numberChannel; i++) {
-        for (int j=0; j<This->numTaps; j++) {
-            setting->indices[i][j] = This->tempIndices[i][j];
+    bool fade = This->crossfade && fadeFrom;
+    if(fadeFrom) *fadeFrom = NULL;
+    
+    int state = atomic_load(&setting->state);
+    if(state & BMMultiTapDelay_UpdatePending){
+        int active = state & BMMultiTapDelay_ActiveSetMask;
+        int swapped = (active ^ 1) | (fade ? BMMultiTapDelay_Fading : 0);
+        // if this fails, the update was withdrawn while we were looking at it
+        // and state is set to the current value, which has the same active set
+        if(atomic_compare_exchange_strong(&setting->state, &state, swapped)){
+            state = swapped;
+            if(fade) *fadeFrom = &setting->tapSets[active];
         }
     }
-    This->_needUpdateIndices = false;
+    return &setting->tapSets[state & BMMultiTapDelay_ActiveSetMask];
+}
+
+
+
+/*
+ *  Called by the process functions when they have finished reading the old
+ *  tap set returned by BMMultiTapDelay_acquireTapSet
+ */
+void BMMultiTapDelay_endFade(BMMultiTapDelay *This, BMMultiTapDelayTapSet* fadeFrom){
+    if(fadeFrom)
+        atomic_fetch_and(&This->setting.state, ~BMMultiTapDelay_Fading);
+}
+
+
+
+void BMMultiTapDelay_PerformUpdateIndices(BMMultiTapDelay *This){
+    BMMultiTapDelay_acquireTapSet(This, NULL);
 }
 
 
 
 void BMMultiTapDelay_PerformUpdateGains(BMMultiTapDelay *This){
-    //write data from tempArray
+    BMMultiTapDelay_acquireTapSet(This, NULL);
+}
+
+
+
+void BMMultiTapDelay_setCrossfade(BMMultiTapDelay *This, bool crossfade){
+    This->crossfade = crossfade;
+}
+
+
+
+static int BMMultiTapDelay_compareTaps(const void* a, const void* b){
+    size_t indexA = ((const BMMultiTapDelayTap*)a)->index;
+    size_t indexB = ((const BMMultiTapDelayTap*)b)->index;
+    return (indexA > indexB) - (indexA < indexB);
+}
+
+
+
+/*
+ *  Sort the taps in tempIndices and tempGains into the tap set that isn't in
+ *  use and hand it to the audio thread
+ */
+void BMMultiTapDelay_publishTaps(BMMultiTapDelay *This){
     BMMultiTapDelaySetting* setting = &This->setting;
+    
+    // withdraw any update that the audio thread hasn't picked up yet so that
+    // it can't switch to the inactive set while we are writing to it. If the
+    // audio thread is fading out of the inactive set we wait for it to
+    // finish, which takes at most one process call. Spin briefly, then give
+    // up the CPU between checks so we don't compete with the audio thread.
+    int state = atomic_load(&setting->state);
+    do {
+        for(size_t spins = 0; state & BMMultiTapDelay_Fading; spins++){
+            if(spins >= BMMultiTapDelay_FadeWaitSpins)
+                sched_yield();
+            state = atomic_load(&setting->state);
+        }
+    } while(!atomic_compare_exchange_weak(&setting->state, &state, state & BMMultiTapDelay_ActiveSetMask));
+    int active = state & BMMultiTapDelay_ActiveSetMask;
+    BMMultiTapDelayTapSet* tapSet = &setting->tapSets[active ^ 1];
+    
+    tapSet->numTaps = This->numTaps;
     for (int i=0; i<This->numberChannel; i++) {
-        for (int j=0; j<This->numTaps; j++) {
-            setting->gains[i][j] = This->tempGains[i][j];
+        // sort by index, remembering the original position of each tap
+        for (size_t j=0; j<This->numTaps; j++) {
+            This->sortBuffer[j].index = This->tempIndices[i][j];
+            This->sortBuffer[j].gain = This->tempGains[i][j];
+            This->sortBuffer[j].position = j;
+        }
+        qsort(This->sortBuffer, This->numTaps, sizeof(BMMultiTapDelayTap), BMMultiTapDelay_compareTaps);
+        
+        for (size_t j=0; j<This->numTaps; j++) {
+            tapSet->indices[i][j] = This->sortBuffer[j].index;
+            tapSet->gains[i][j] = This->sortBuffer[j].gain;
+            if(This->sortBuffer[j].position == This->numTaps - 1)
+                tapSet->lastTapPosition[i] = j;
         }
     }
-    This->_needUpdateGain = false;
+    
+    atomic_store(&setting->state, active | BMMultiTapDelay_UpdatePending);
 }
 
 
 
 void BMMultiTapDelay_setDelayTimes(BMMultiTapDelay *This,
                                    size_t* delayTimesL, size_t* delayTimesR){
-    
-    This->_needUpdateIndices = false;
     BMMultiTapDelaySetting* setting = &This->setting;
     setting->delayTimes[0] = delayTimesL;
-    setting->delayTimes[1] = delayTimesR;
+    if(This->numberChannel > 1)
+        setting->delayTimes[1] = delayTimesR;
     for (int i=0; i< This->numberChannel; i++) {
         for (int j=0; j<This->numTaps; j++) {
+            assert(setting->delayTimes[i][j] <= This->maxDelayTime);
             This->tempIndices[i][j] = This->maxDelayTime - setting->delayTimes[i][j];
         }
     }
-    This->_needUpdateIndices = true;
+    BMMultiTapDelay_publishTaps(This);
 }
 
+
+
 void BMMultiTapDelay_setDelayTimeNumTap(BMMultiTapDelay *This,
                                         size_t* delayTimesL, size_t* delayTimesR,
                                         size_t numTaps){
     assert(numTaps <= This->maxTaps);
-    BMMultiTapDelaySetting* setting = &This->setting;
-    setting->delayTimes[0] = delayTimesL;
-    setting->delayTimes[1] = delayTimesR;
-    
-    // confirm that none of the delay taps exceeds the max delay time
-    for (int i=0; i< This->numberChannel; i++)
-        for (int j=0; j<This->numTaps; j++)
-            assert(setting->delayTimes[i][j] <= This->maxDelayTime);
-    
-    
-    This->_needUpdateIndices = false;
     This->numTaps = numTaps;
-    for (int i=0; i< This->numberChannel; i++) {
-        for (int j=0; j<This->numTaps; j++) {
-            This->tempIndices[i][j] = This->maxDelayTime - setting->delayTimes[i][j];
-        }
-    }
-    This->_needUpdateIndices = true;
+    BMMultiTapDelay_setDelayTimes(This, delayTimesL, delayTimesR);
 }
 
 
 
+
 void BMMultiTapDelay_setGains(BMMultiTapDelay *This, float* gainL, float* gainR){
-    This->_needUpdateGain = false;
-    
     for (int i=0; i< This->numberChannel; i++) {
         for (int j=0; j < This->numTaps; j++) {
             This->tempGains[i][j] = (i == 0)? gainL[j]:gainR[j];
         }
     }
-    This->_needUpdateGain = true;
+    BMMultiTapDelay_publishTaps(This);
+}
+
+
+
+/*
+ *  Set delay times, gains and the number of taps with a single update so
+ *  that the audio thread never sees new delay times with old gains
+ */
+void BMMultiTapDelay_setTaps(BMMultiTapDelay *This,
+                             size_t* delayTimesL, size_t* delayTimesR,
+                             float* gainL, float* gainR,
+                             size_t numTaps){
+    assert(numTaps <= This->maxTaps);
+    BMMultiTapDelaySetting* setting = &This->setting;
+    This->numTaps = numTaps;
+    setting->delayTimes[0] = delayTimesL;
+    if(This->numberChannel > 1)
+        setting->delayTimes[1] = delayTimesR;
+    for (int i=0; i< This->numberChannel; i++) {
+        float* gains = (i == 0)? gainL:gainR;
+        for (int j=0; j<This->numTaps; j++) {
+            assert(setting->delayTimes[i][j] <= This->maxDelayTime);
+            This->tempIndices[i][j] = This->maxDelayTime - setting->delayTimes[i][j];
+            This->tempGains[i][j] = gains[j];
+        }
+    }
+    BMMultiTapDelay_publishTaps(This);
 }
 
 
@@ -523,9 +663,7 @@ void BMMultiTapDelay_impulseResponse(BMMultiTapDelay *This){
     bool includeRightChannel = This->setting.isStereo;
     
     // check that the indices are initialized
-    assert(This->setting.indices[0] != NULL);
-    if(includeRightChannel)
-        assert(This->setting.indices[1] != NULL);
+    assert(This->setting.tapSets[0].indices != NULL);
     
     // find the longest delay time
     size_t maxDelayTime = This->maxDelayTime;
@@ -598,3 +736,56 @@ void BMMultiTapDelay_impulseResponse(BMMultiTapDelay *This){
 
 
 
+double BMMultiTapDelay_measureLoad(size_t numTaps, size_t maxDelayTime, float sampleRate, size_t bufferLength){
+    // random taps spread over the whole delay
+    size_t* delayTimes [2] = {malloc(sizeof(size_t)*numTaps), malloc(sizeof(size_t)*numTaps)};
+    float* gains [2] = {malloc(sizeof(float)*numTaps), malloc(sizeof(float)*numTaps)};
+    for(size_t i=0; i<2; i++)
+        for(size_t j=0; j<numTaps; j++){
+            delayTimes[i][j] = 1 + arc4random_uniform((uint32_t)maxDelayTime);
+            gains[i][j] = 1.0f / (float)numTaps;
+        }
+    
+    BMMultiTapDelay delay;
+    BMMultiTapDelay_Init(&delay, true,
+                         delayTimes[0], delayTimes[1],
+                         maxDelayTime,
+                         gains[0], gains[1],
+                         numTaps, numTaps);
+    
+    // white noise input so that the tail sleep never skips a buffer
+    float* inputL = malloc(sizeof(float)*bufferLength);
+    float* inputR = malloc(sizeof(float)*bufferLength);
+    float* outputL = malloc(sizeof(float)*bufferLength);
+    float* outputR = malloc(sizeof(float)*bufferLength);
+    for(size_t i=0; i<bufferLength; i++){
+        inputL[i] = (float)arc4random() / (float)UINT32_MAX - 0.5f;
+        inputR[i] = (float)arc4random() / (float)UINT32_MAX - 0.5f;
+    }
+    
+    // fill the delay before we start timing, then time ten seconds of audio
+    size_t numBuffers = (size_t)(10.0f * sampleRate) / bufferLength;
+    for(size_t i=0; i<=maxDelayTime/bufferLength; i++)
+        BMMultiTapDelay_processBufferStereo(&delay, inputL, inputR, outputL, outputR, bufferLength);
+    uint64_t startTime = mach_absolute_time();
+    for(size_t i=0; i<numBuffers; i++)
+        BMMultiTapDelay_processBufferStereo(&delay, inputL, inputR, outputL, outputR, bufferLength);
+    uint64_t endTime = mach_absolute_time();
+    
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double processingSeconds = 1.0e-9 * (double)(endTime - startTime) * (double)timebase.numer / (double)timebase.denom;
+    double audioSeconds = (double)(numBuffers * bufferLength) / sampleRate;
+    
+    BMMultiTapDelay_free(&delay);
+    for(size_t i=0; i<2; i++){
+        free(delayTimes[i]);
+        free(gains[i]);
+    }
+    free(inputL);
+    free(inputR);
+    free(outputL);
+    free(outputR);
+    
+    return processingSeconds / audioSeconds;
+}
@@ -10,16 +10,48 @@
 #define BMMultiTapDelay_h
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include "TPCircularBuffer.h"
+#include "BMTailSleep.h"
 
 
 /*
- *  Settings struct for BMMultiTapDelay class
+ *  A complete set of taps for all channels. The taps in each channel are
+ *  sorted by read index so that processing moves steadily forward through
+ *  the delay memory.
  */
 typedef struct{
-    size_t** delayTimes;
     size_t** indices;
     float** gains;
+    size_t* lastTapPosition; // where the last tap went after sorting, for each channel
+    size_t numTaps;
+} BMMultiTapDelayTapSet;
+
+
+/*
+ *  one tap, used for sorting
+ */
+typedef struct{
+    size_t index;
+    float gain;
+    size_t position;
+} BMMultiTapDelayTap;
+
+
+/*
+ *  Settings struct for BMMultiTapDelay class
+ *
+ *  The audio thread reads from one tap set while the other one is updated.
+ *  The state holds the index of the active set in bit 0 and a flag in bit 1
+ *  that indicates that the other set has an update waiting to be swapped in.
+ *  Bit 2 is set while a process call crossfades from the old set to the new
+ *  one, and the old set must not be overwritten until it clears.
+ */
+typedef struct{
+    size_t** delayTimes;
+    BMMultiTapDelayTapSet tapSets [2];
+    _Atomic int state;
     bool isStereo;
 } BMMultiTapDelaySetting;
 
@@ -44,8 +76,13 @@ typedef struct{
     
     size_t** tempIndices;
     float** tempGains;
-    bool _needUpdateIndices;
-    bool _needUpdateGain;
+    BMMultiTapDelayTap* sortBuffer;
+    float* gatherBuffer;
+    
+    bool crossfade;
+    float** fadeBuffer;
+    
+    BMTailSleep sleep;
 } BMMultiTapDelay;
 
 
@@ -127,17 +164,56 @@ void BMMultiTapDelay_free(BMMultiTapDelay *This);
  */
 void BMMultiTapDelay_clearBuffers(BMMultiTapDelay* delay);
 
+/*
+ *  The functions below prepare a new set of taps and hand it to the process
+ *  functions, which switch to it at the start of the next buffer. Delay times
+ *  and gains always change together. They may be called from a thread other
+ *  than the audio thread, but only from one thread at a time.
+ */
 void BMMultiTapDelay_setDelayTimes(BMMultiTapDelay *This,
                                    size_t* delayTimesL, size_t* delayTimesR);
 void BMMultiTapDelay_setDelayTimeNumTap(BMMultiTapDelay *This,
                                    size_t* delayTimesL, size_t* delayTimesR,size_t numTaps);
 void BMMultiTapDelay_setGains(BMMultiTapDelay *This,
                               float* gainL, float* gainR);
+void BMMultiTapDelay_setTaps(BMMultiTapDelay *This,
+                             size_t* delayTimesL, size_t* delayTimesR,
+                             float* gainL, float* gainR,
+                             size_t numTaps);
 
+/*
+ *  When crossfade is on, the process call that picks up a new tap set fades
+ *  from the old taps to the new ones over the length of that buffer instead
+ *  of switching at the first sample. During that buffer the old taps are
+ *  summed as well, and the last tap output comes from the new set. A thread
+ *  that publishes taps during that buffer waits for it to finish. Off by
+ *  default.
+ */
+void BMMultiTapDelay_setCrossfade(BMMultiTapDelay *This, bool crossfade);
+
+/*
+ *  Switch to the latest tap settings immediately. The process functions do
+ *  this automatically so there is normally no need to call these.
+ */
 void BMMultiTapDelay_PerformUpdateIndices(BMMultiTapDelay *This);
 void BMMultiTapDelay_PerformUpdateGains(BMMultiTapDelay *This);
         
 
 void BMMultiTapDelay_impulseResponse(BMMultiTapDelay *This);
 
+
+/*!
+ *BMMultiTapDelay_measureLoad
+ *
+ * @abstract time a stereo delay with numTaps random taps per channel on white noise
+ *
+ * @param numTaps       number of taps in each channel
+ * @param maxDelayTime  the taps are spread over delay times in [1, maxDelayTime]
+ * @param sampleRate    sample rate used to convert the processing time to CPU load
+ * @param bufferLength  length of each process call
+ *
+ * @returns the processing time as a fraction of the duration of the audio, so 0.05 is 5% of one core
+ */
+double BMMultiTapDelay_measureLoad(size_t numTaps, size_t maxDelayTime, float sampleRate, size_t bufferLength);
+
 #endif /* BMMultiTapDelay_h */
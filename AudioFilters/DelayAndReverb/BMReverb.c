@@ -84,6 +84,10 @@ extern "C" {
         BMReverbSetWetMix(This, BMREVERB_WETMIX);
         BMReverbSetStereoWidth(This, BMREVERB_STEREOWIDTH);
         
+        // sleep when the tail has decayed. The hold time is set with the
+        // delay times.
+        BMTailSleep_init(&This->sleep, 0);
+        
         // initialize all the delays and delay-dependent settings
         BMReverbUpdateNumDelayUnits(This);
     }
@@ -106,43 +110,55 @@ extern "C" {
         }
         
         
-        // chunked processing
-        while (numSamples > 0) {
-			size_t numSamplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, numSamples);
+        // skip processing if the input is silent and the tail has decayed
+        bool inputSilent = BMTailSleep_isSilent(&This->sleep, inputL, numSamples) &&
+                           BMTailSleep_isSilent(&This->sleep, inputR, numSamples);
+        if (BMTailSleep_skip(&This->sleep, inputSilent)) {
+            memset(outputL, 0, sizeof(float)*numSamples);
+            memset(outputR, 0, sizeof(float)*numSamples);
+        }
+        else {
+            // chunked processing
+            while (numSamples > 0) {
+				size_t numSamplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, numSamples);
             
-            // backup the input to allow in place processing
-            memcpy(This->dryL, inputL, sizeof(float)*numSamplesProcessing);
-            memcpy(This->dryR, inputR, sizeof(float)*numSamplesProcessing);
+                // backup the input to allow in place processing
+                memcpy(This->dryL, inputL, sizeof(float)*numSamplesProcessing);
+                memcpy(This->dryR, inputR, sizeof(float)*numSamplesProcessing);
             
-            // process the reverb to get the wet signal
-            for (size_t i=0; i < numSamplesProcessing; i++)
-                BMReverbProcessWetSample(This, inputL[i], inputR[i], &outputL[i], &outputR[i]);
+                // process the reverb to get the wet signal
+                for (size_t i=0; i < numSamplesProcessing; i++)
+                    BMReverbProcessWetSample(This, inputL[i], inputR[i], &outputL[i], &outputR[i]);
 			
-			// narrow the stereo width
-			BMStereoWidener_processAudio(&This->stereoWidth,
-										 outputL, outputR,
-										 outputL, outputR,
-										 numSamplesProcessing);
+				// narrow the stereo width
+				BMStereoWidener_processAudio(&This->stereoWidth,
+											 outputL, outputR,
+											 outputL, outputR,
+											 numSamplesProcessing);
 
-			// filter the wet signal
-			BMMultiLevelBiquad_processBufferStereo(&This->mainFilter,
-												   outputL, outputR,
-												   outputL, outputR,
-												   numSamplesProcessing);
+				// filter the wet signal
+				BMMultiLevelBiquad_processBufferStereo(&This->mainFilter,
+													   outputL, outputR,
+													   outputL, outputR,
+													   numSamplesProcessing);
 
-			// mix wet and dry signals
-			BMWetDryMixer_processBufferRandomPhase(&This->wetDryMixer,
-												   outputL, outputR,
-												   This->dryL, This->dryR,
-												   outputL, outputR,
-												   numSamplesProcessing);
+				// check the tail before the dry signal is mixed in
+				BMTailSleep_update(&This->sleep, outputL, outputR, numSamplesProcessing);
+
+				// mix wet and dry signals
+				BMWetDryMixer_processBufferRandomPhase(&This->wetDryMixer,
+													   outputL, outputR,
+													   This->dryL, This->dryR,
+													   outputL, outputR,
+													   numSamplesProcessing);
             
-			// advance pointers
-			inputL += numSamplesProcessing;
-			inputR += numSamplesProcessing;
-			outputL += numSamplesProcessing;
-			outputR += numSamplesProcessing;
-			numSamples -= numSamplesProcessing;
+				// advance pointers
+				inputL += numSamplesProcessing;
+				inputR += numSamplesProcessing;
+				outputL += numSamplesProcessing;
+				outputR += numSamplesProcessing;
+				numSamples -= numSamplesProcessing;
+            }
         }
         
 		
@@ -516,6 +532,10 @@ extern "C" {
 		for(size_t i=0; i<This->numDelays; i++)
 			assert(This->bufferLengths[i] >= minDelay && This->bufferLengths[i] <= maxDelay);
 		
+		// the tail can stay in the network for one round of the longest delay
+		// without reaching the output
+		BMTailSleep_setHoldSamples(&This->sleep, maxDelay);
+		
 		// count the total number of samples in all delays
 		This->totalSamples = 0;
 		for(size_t i=0; i < This->numDelays; i++)
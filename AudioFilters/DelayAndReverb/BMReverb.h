@@ -16,6 +16,7 @@
 #include "BMMultiLevelBiquad.h"
 #include "BMWetDryMixer.h"
 #include "BMStereoWidener.h"
+#include "BMTailSleep.h"
 #include <math.h>
 
 #ifdef __APPLE__
@@ -68,6 +69,7 @@ typedef struct BMReverb {
 	BMMultiLevelBiquad mainFilter;
 	BMWetDryMixer wetDryMixer;
 	BMStereoWidener stereoWidth;
+	BMTailSleep sleep;
 } BMReverb;
 
 
@@ -12,6 +12,7 @@
 #include <Accelerate/Accelerate.h>
 #include "BMFastHadamard.h"
 #include "BMIntegerMath.h"
+#include "Constants.h"
 
 
 #define UNIQUESUMS_ATTEMPTS_LIMIT 5000
@@ -669,6 +670,13 @@ void BMSimpleFDN_init(BMSimpleFDN *This,
         float rt60attenuation = BMSimpleFDN_gainFromRT60(This->RT60DecayTime, delayTime);
         This->attenuationCoefficients[i] = matrixAttenuation * rt60attenuation;
     }
+    
+    // the tail can stay in the network for one round of the longest delay
+    // without reaching the output
+    size_t maxDelayLength = 0;
+    for(size_t i=0; i<This->numDelays; i++)
+        maxDelayLength = BM_MAX(maxDelayLength, This->delayLengths[i]);
+    BMTailSleep_init(&This->sleep, maxDelayLength);
 }
 
 
@@ -722,8 +730,17 @@ void BMSimpleFDN_processBuffer(BMSimpleFDN *This,
                                float* output,
                                size_t numSamples){
     
+    // skip processing if the input is silent and the tail has decayed
+    bool inputSilent = BMTailSleep_isSilent(&This->sleep, input, numSamples);
+    if(BMTailSleep_skip(&This->sleep, inputSilent)){
+        vDSP_vclr(output, 1, numSamples);
+        return;
+    }
+    
     for(size_t i=0; i<numSamples; i++)
         output[i] = BMSimpleFDN_processSample(This, input[i]);
+    
+    BMTailSleep_update(&This->sleep, output, NULL, numSamples);
 }
 
 
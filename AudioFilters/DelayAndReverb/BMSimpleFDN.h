@@ -10,6 +10,7 @@
 #define BMSimpleFDN_h
 
 #include <stdio.h>
+#include "BMTailSleep.h"
 
 enum delayTimeMethod {DTM_VELVETNOISE, DTM_RANDOM, DTM_RELATIVEPRIME, DTM_LOGVELVETNOISE, DTM_UNIQUESUMS, DTM_RANDOMPRIMES, DTM_SCALEDPRIMES, DTM_PSEUDORANDOM, DTM_RANDOMFIXEDTOTAL};
 
@@ -19,6 +20,7 @@ typedef struct BMSimpleFDN {
     float *attenuationCoefficients, *buffer1, *buffer2, *buffer3, *outputTapSigns;
     size_t numDelays;
     float sampleRate, RT60DecayTime, maxDelayS, minDelayS;
+    BMTailSleep sleep;
 } BMSimpleFDN;
 
 
@@ -42,6 +44,13 @@ void BMSimpleFDN_init(BMSimpleFDN *This,
                       float RT60DecayTimeSeconds);
 
 
+/*!
+ *BMSimpleFDN_processBuffer
+ *
+ * When the input has been silent long enough for the tail to decay below
+ * -120 dB this stops processing and outputs zeros until the input is not
+ * silent.
+ */
 void BMSimpleFDN_processBuffer(BMSimpleFDN *This,
                                const float* input,
                                float* output,
@@ -7,11 +7,12 @@
 //
 
 #include "BMSmoothDelay.h"
+#include <assert.h>
 #include "Constants.h"
 #include <Accelerate/Accelerate.h>
 
-void BMSmoothDelay_prepareLGIBuffer(BMSmoothDelay* This,size_t bufferSize);
 void BMSmoothDelay_updateDelaySpeed(BMSmoothDelay* This,float speed);
+void BMSmoothDelay_readStride(BMSmoothDelay* This,const float* inBuffer, float* outBuffer,const float* strideBuffer,float strideOffset,float sampleToConsume,size_t numSamples);
 
 void BMSmoothDelay_init(BMSmoothDelay* This,size_t defaultDS,float speed,size_t delayRange,size_t sampleRate){
     //init buffer
@@ -24,64 +25,36 @@ void BMSmoothDelay_init(BMSmoothDelay* This,size_t defaultDS,float speed,size_t
     This->storeSamples = LGI_Order+2;
     This->delaySampleRange = (uint32_t)delayRange;
     
-    //Left channel start at 0 delaytime
-    TPCircularBufferInit(&This->buffer, (This->delaySampleRange + BM_BUFFER_CHUNK_SIZE)*sizeof(float));
-    //Produce
-    uint32_t availableByte;
-    float* head = TPCircularBufferHead(&This->buffer, &availableByte);
-    memset(head, 0, This->delaySamples*sizeof(float));
-    TPCircularBufferProduce(&This->buffer, This->delaySamples*sizeof(float));
-    
-    void* tail = TPCircularBufferTail(&This->buffer, &availableByte);
-    memset(tail, 0, availableByte);
+    //Left channel start at 0 delaytime. The buffer holds the delay and the
+    //history samples, and one buffer of input can be produced before the
+    //read so the delay time can be up to that much longer
+    This->bufferedSamples = This->delaySamples + This->storeSamples;
+    size_t maxDelaySamples = This->delaySampleRange + This->storeSamples + BM_BUFFER_CHUNK_SIZE;
+    BMInterpolatedDelay_init(&This->delay, false, This->bufferedSamples, LGI_Order, maxDelaySamples);
     
     This->shouldUpdateDS = false;
     This->strideIdx = 0;
     
     This->speed = 1;
     This->strideBuffer = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
-    
-    BMSmoothDelay_prepareLGIBuffer(This, AudioBufferLength);
+    This->delayTimes = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
 //    BMSmoothDelay_updateDelaySpeed(This, speed);
 
 }
 
 void BMSmoothDelay_resetToDelaySample(BMSmoothDelay* This,size_t defaultDS){
     This->delaySamples = defaultDS;
-    TPCircularBufferClear(&This->buffer);
-    //Produce
-    uint32_t availableByte;
-    float* head = TPCircularBufferHead(&This->buffer, &availableByte);
-    memset(head, 0, This->delaySamples*sizeof(float));
-    TPCircularBufferProduce(&This->buffer, This->delaySamples*sizeof(float));
-    
-    uint32_t bytesAvailableForRead;
-    float* tail = TPCircularBufferTail(&This->buffer, &bytesAvailableForRead);
-    memset(tail, 0, bytesAvailableForRead);
-//    size_t correctDS = bytesAvailableForRead/sizeof(float);
-//    printf("reset %zu\n",correctDS);
-}
-
-void BMSmoothDelay_prepareLGIBuffer(BMSmoothDelay* This,size_t bufferSize){
-    BMLagrangeInterpolation_init(&This->lgInterpolation, LGI_Order);
-    
-    //Temp buffer
-    This->lgiBuffer = calloc(bufferSize + This->storeSamples, sizeof(float));
-    float d = 0;
-    vDSP_vfill(&d, This->lgiBuffer, 1, bufferSize + This->storeSamples);
+    This->bufferedSamples = This->delaySamples + This->storeSamples;
+    BMInterpolatedDelay_clearBuffers(&This->delay);
 }
 
 void BMSmoothDelay_destroy(BMSmoothDelay* This){
-    TPCircularBufferCleanup(&This->buffer);
+    BMInterpolatedDelay_destroy(&This->delay);
     
     free(This->strideBuffer);
     This->strideBuffer = nil;
-    
-    
-    free(This->lgiBuffer);
-    This->lgiBuffer = nil;
-    
-    BMLagrangeInterpolation_destroy(&This->lgInterpolation);
+    free(This->delayTimes);
+    This->delayTimes = nil;
 }
 
 #pragma mark - Set
@@ -165,39 +138,11 @@ void BMSmoothDelay_processBuffer(BMSmoothDelay* This,float* inBuffer, float* out
             This->strideIdx -= floorf(This->strideIdx);
         }
         
-        //Produce buffer
-        uint32_t bytesAvailableForWrite;
-        void* head = TPCircularBufferHead(&This->buffer, &bytesAvailableForWrite);
-        
-        // copy from input to the buffer head
-        uint32_t byteProcessing = (uint32_t)(samplesProcessing * sizeof(float));
-        memcpy(head, inBuffer + samplesProcessed, byteProcessing);
-        
-        // mark the written region of the buffer as written
-        TPCircularBufferProduce(&This->buffer, byteProcessing);
-        
-        //Tail
-        uint32_t bytesAvailableForRead;
-        float* tail = TPCircularBufferTail(&This->buffer, &bytesAvailableForRead);
-        
-        //Copy input to lgi buffer - skip 10 first order because we will reuse the last buffer data
-        size_t inputLength = BM_MIN(bytesAvailableForRead/sizeof(float), ceilf(samplesProcessing * This->speed + This->strideIdx + samplesProcessing));
-        memcpy(This->lgiBuffer + This->storeSamples, tail, sizeof(float)*inputLength);
-        
-        //Proccess
-        BMLagrangeInterpolation_processUpSample(&This->lgInterpolation, This->lgiBuffer, This->strideBuffer, outBuffer + samplesProcessed, 1, inputLength + This->storeSamples, samplesProcessing);
-        
-        //        printf("%f\n",sampleToConsume);
-        //Save 10 last samples into lgiUpBuffer 10 first samples
-        int samplesToStoreFromTail = sampleToConsume - This->storeSamples;
-        memcpy(This->lgiBuffer, tail  + samplesToStoreFromTail, sizeof(float)*This->storeSamples);
-        
-        // mark the read bytes as used
-        TPCircularBufferConsume(&This->buffer, BM_MIN(sampleToConsume*sizeof(float),bytesAvailableForRead));
+        //Read at the stride positions
+        BMSmoothDelay_readStride(This, inBuffer + samplesProcessed, outBuffer + samplesProcessed, This->strideBuffer, 0.0f, sampleToConsume, samplesProcessing);
         
         //Check
-        TPCircularBufferTail(&This->buffer, &bytesAvailableForRead);
-        size_t correctDS = bytesAvailableForRead/sizeof(float);
+        size_t correctDS = This->bufferedSamples - This->storeSamples;
         if(This->delaySamples!=correctDS){
             printf("next %f %lu\n",This->delaySamples,correctDS);
         }
@@ -207,48 +152,33 @@ void BMSmoothDelay_processBuffer(BMSmoothDelay* This,float* inBuffer, float* out
 }
 
 #pragma mark - Process by stride
+/*!
+ *BMSmoothDelay_readStride
+ *
+ * @abstract write the input to the delay and read from the fractional positions strideBuffer[i] + strideOffset, then consume sampleToConsume samples from the start of the buffer
+ *
+ * @notes works in place
+ */
+void BMSmoothDelay_readStride(BMSmoothDelay* This,const float* inBuffer, float* outBuffer,const float* strideBuffer,float strideOffset,float sampleToConsume,size_t numSamples){
+    assert(numSamples <= BM_BUFFER_CHUNK_SIZE);
+    
+    // Input sample i lands at position bufferedSamples + i in the buffer so
+    // reading it at position strideBuffer[i] + strideOffset delays it by
+    // (bufferedSamples - strideOffset + i) - strideBuffer[i].
+    float start = This->bufferedSamples - strideOffset;
+    float one = 1.0f;
+    vDSP_vramp(&start, &one, This->delayTimes, 1, numSamples);
+    vDSP_vsub(strideBuffer, 1, This->delayTimes, 1, This->delayTimes, 1, numSamples);
+    
+    BMInterpolatedDelay_processBufferMono(&This->delay, inBuffer, This->delayTimes, outBuffer, numSamples);
+    
+    // we can't consume more samples than the buffer holds
+    float samplesInBuffer = This->bufferedSamples + (float)numSamples;
+    This->bufferedSamples = samplesInBuffer - BM_MIN(sampleToConsume, samplesInBuffer);
+}
+
 void BMSmoothDelay_processBufferByStride(BMSmoothDelay* This,float* inBuffer, float* outBuffer,float* strideBuffer,float sampleToConsume,size_t numSamples){
-    
-    vDSP_vsadd(strideBuffer, 1, &This->baseIdx, strideBuffer, 1, numSamples);
-    
-    size_t samplesProcessing = numSamples;
-    size_t samplesProcessed = 0;
-    
-    //Produce buffer
-    uint32_t bytesAvailableForWrite;
-    void* head = TPCircularBufferHead(&This->buffer, &bytesAvailableForWrite);
-    
-    // copy from input to the buffer head
-    uint32_t byteProcessing = (uint32_t)(samplesProcessing * sizeof(float));
-    memcpy(head, inBuffer + samplesProcessed, byteProcessing);
-    
-    // mark the written region of the buffer as written
-    TPCircularBufferProduce(&This->buffer, byteProcessing);
-    
-    //Tail
-    uint32_t bytesAvailableForRead;
-    float* tail = TPCircularBufferTail(&This->buffer, &bytesAvailableForRead);
-    
-    //Copy input to lgi buffer - skip 10 first order because we will reuse the last buffer data
-    size_t inputLength = BM_MIN(bytesAvailableForRead/sizeof(float), sampleToConsume);
-    memcpy(This->lgiBuffer + This->storeSamples, tail, sizeof(float)*inputLength);
-    
-    //Proccess
-    BMLagrangeInterpolation_processUpSample(&This->lgInterpolation, This->lgiBuffer, strideBuffer, outBuffer + samplesProcessed, 1, inputLength + This->storeSamples, samplesProcessing);
-    
-    //        printf("%f\n",sampleToConsume);
-    //Save 10 last samples into lgiUpBuffer 10 first samples
-    size_t samplesToStoreFromTail = sampleToConsume - This->storeSamples;
-    memcpy(This->lgiBuffer, tail  + samplesToStoreFromTail, sizeof(float)*This->storeSamples);
-    
-    // mark the read bytes as used
-    TPCircularBufferConsume(&This->buffer, (uint32_t)BM_MIN(sampleToConsume*sizeof(float),bytesAvailableForRead));
-    
-//    This->delaySamples += samplesProcessing - sampleToConsume;
-//    //Check
-//    TPCircularBufferTail(&This->buffer, &bytesAvailableForRead);
-//    size_t correctDS = bytesAvailableForRead/sizeof(float);
-//    if(This->delaySamples!=correctDS){
-//        printf("next %f %lu\n",This->delaySamples,correctDS);
-//    }
+    //baseIdx is added to the read positions so the caller's strideBuffer
+    //is left unchanged
+    BMSmoothDelay_readStride(This, inBuffer, outBuffer, strideBuffer, This->baseIdx, sampleToConsume, numSamples);
 }
@@ -10,15 +10,14 @@
 #define BMSmoothDelay_h
 
 #include <stdio.h>
-#import "BMLagrangeInterpolation.h"
-#include "TPCircularBuffer.h"
+#include "BMInterpolatedDelay.h"
 
 
 #define LGI_Order 4
 #define AudioBufferLength 2048
 
 typedef struct BMSmoothDelay {
-    TPCircularBuffer buffer;
+    BMInterpolatedDelay delay;
     size_t sampleRate;
     uint32_t delaySampleRange;
     float delaySpeed;
@@ -29,12 +28,16 @@ typedef struct BMSmoothDelay {
     
     bool shouldUpdateDS;
     
-    float* lgiBuffer;
     float strideIdx;
     float* strideBuffer;
+    float* delayTimes;
     float baseIdx;
+    // The stride positions are read positions in a buffer that holds
+    // bufferedSamples samples before the input of the current call, the
+    // first storeSamples of them history. We convert them to delay times
+    // for the block read of BMInterpolatedDelay.
     size_t storeSamples;
-    BMLagrangeInterpolation lgInterpolation;
+    float bufferedSamples;
 
     float speed;
     size_t sampleToReachTarget;
@@ -47,6 +47,10 @@ void BMSmoothFade_startFading(BMSmoothFade* This,FadeType type){
     This->fadeIdx = 0;
 }
 
+bool BMSmoothFade_isSilent(BMSmoothFade* This){
+    return This->fadeType==FT_Stop && This->fadeBuffer[0]==0.0f;
+}
+
 void BMSmoothFade_processBufferStereo(BMSmoothFade* This, float* inL,float* inR,float* outL,float* outR,size_t frameCount){
     if(This->fadeType!=FT_Stop){
         if(This->fadeType==FT_In){
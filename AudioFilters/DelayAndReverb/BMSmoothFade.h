@@ -13,6 +13,7 @@ extern "C" {
 #define BMSmoothFade_h
 
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef enum FadeType{
     FT_In,FT_Out,FT_Stop
@@ -32,6 +33,13 @@ void BMSmoothFade_free(BMSmoothFade* This);
 void BMSmoothFade_processBufferMono(BMSmoothFade* This, float* inData,float* outData,size_t frameCount);
 void BMSmoothFade_processBufferStereo(BMSmoothFade* This, float* inL,float* inR,float* outL,float* outR,size_t frameCount);
 void BMSmoothFade_startFading(BMSmoothFade* This,FadeType type);
+
+/*!
+ *BMSmoothFade_isSilent
+ *
+ * @returns true if a fade out has finished so that the output is zero until the next fade in
+ */
+bool BMSmoothFade_isSilent(BMSmoothFade* This);
 #endif /* BMSmoothFade_h */
 
 #ifdef __cplusplus
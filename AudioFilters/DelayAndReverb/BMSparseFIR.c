@@ -0,0 +1,367 @@
+//
+//  BMSparseFIR.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMSparseFIR.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <Accelerate/Accelerate.h>
+#include "Constants.h"
+
+
+// Length of the sub-blocks the process function works on. With eight outputs
+// this keeps the output buffers for one channel within 2 kb.
+#define BMSPARSEFIR_SUBBLOCK 64
+
+
+// forward declarations
+void BMSparseKernel_sortAndMerge(BMSparseKernel *This);
+void BMSparseFIR_loadPendingTaps(BMSparseFIR *This);
+int BMSparseFIR_compareTaps(const void *a, const void *b);
+
+
+
+void BMSparseKernel_init(BMSparseKernel *This, size_t maxTaps){
+	This->delays = malloc(sizeof(size_t) * maxTaps);
+	This->gains = malloc(sizeof(float) * maxTaps);
+	This->maxTaps = maxTaps;
+	This->numTaps = 0;
+}
+
+
+
+
+void BMSparseKernel_free(BMSparseKernel *This){
+	free(This->delays);
+	This->delays = NULL;
+	free(This->gains);
+	This->gains = NULL;
+}
+
+
+
+
+/*!
+ *BMSparseKernel_sortAndMerge
+ *
+ * @abstract sort taps by delay time and combine taps with equal delay times
+ *
+ * @notes Insertion sort works in place without allocating memory. Velvet noise
+ * taps are generated in nearly sorted order so it's fast in the common case.
+ */
+void BMSparseKernel_sortAndMerge(BMSparseKernel *This){
+	// sort
+	for(size_t i=1; i<This->numTaps; i++){
+		size_t d = This->delays[i];
+		float g = This->gains[i];
+		size_t j = i;
+		while(j > 0 && This->delays[j-1] > d){
+			This->delays[j] = This->delays[j-1];
+			This->gains[j] = This->gains[j-1];
+			j--;
+		}
+		This->delays[j] = d;
+		This->gains[j] = g;
+	}
+
+	// merge
+	if(This->numTaps > 0){
+		size_t last = 0;
+		for(size_t i=1; i<This->numTaps; i++){
+			if(This->delays[i] == This->delays[last])
+				This->gains[last] += This->gains[i];
+			else {
+				last++;
+				This->delays[last] = This->delays[i];
+				This->gains[last] = This->gains[i];
+			}
+		}
+		This->numTaps = last + 1;
+	}
+}
+
+
+
+
+void BMSparseKernel_setTaps(BMSparseKernel *This,
+							const size_t *delays,
+							const float *gains,
+							size_t numTaps){
+	assert(numTaps <= This->maxTaps);
+
+	memcpy(This->delays, delays, sizeof(size_t) * numTaps);
+	memcpy(This->gains, gains, sizeof(float) * numTaps);
+	This->numTaps = numTaps;
+
+	BMSparseKernel_sortAndMerge(This);
+}
+
+
+
+
+void BMSparseFIR_init(BMSparseFIR *This,
+					  size_t numOutputs,
+					  size_t maxDelay,
+					  size_t maxTaps,
+					  float sampleRate){
+	This->numOutputs = numOutputs;
+	This->maxDelay = maxDelay;
+	This->maxTaps = maxTaps;
+	This->numTapsL = This->numTapsR = 0;
+	This->numPendingTapsL = This->numPendingTapsR = 0;
+	This->hasPendingUpdate = false;
+
+	This->tapsL = malloc(sizeof(BMSparseFIRTap) * maxTaps);
+	This->tapsR = malloc(sizeof(BMSparseFIRTap) * maxTaps);
+	This->pendingTapsL = malloc(sizeof(BMSparseFIRTap) * maxTaps);
+	This->pendingTapsR = malloc(sizeof(BMSparseFIRTap) * maxTaps);
+	This->sortBuffer = malloc(sizeof(BMSparseFIRTap) * maxTaps);
+	This->switchBuffers = malloc(sizeof(float*) * 2 * numOutputs);
+
+	// delay memory. This is set up the same way as in BMMultiTapDelay so that
+	// the tail pointer is maxDelay samples behind the most recent input.
+	size_t numBytes = (maxDelay + 1 + BM_BUFFER_CHUNK_SIZE) * sizeof(float);
+	TPCircularBufferInit(&This->bufferL, (uint32_t)numBytes);
+	TPCircularBufferInit(&This->bufferR, (uint32_t)numBytes);
+	BMSparseFIR_clearBuffers(This);
+
+	// this switch fades the output out and back in when the taps change
+	BMSmoothSwitch_initWithRate(&This->offSwitch, sampleRate, 10.0f);
+}
+
+
+
+
+void BMSparseFIR_free(BMSparseFIR *This){
+	TPCircularBufferCleanup(&This->bufferL);
+	TPCircularBufferCleanup(&This->bufferR);
+
+	free(This->tapsL);
+	This->tapsL = NULL;
+	free(This->tapsR);
+	This->tapsR = NULL;
+	free(This->pendingTapsL);
+	This->pendingTapsL = NULL;
+	free(This->pendingTapsR);
+	This->pendingTapsR = NULL;
+	free(This->sortBuffer);
+	This->sortBuffer = NULL;
+	free(This->switchBuffers);
+	This->switchBuffers = NULL;
+}
+
+
+
+
+void BMSparseFIR_clearBuffers(BMSparseFIR *This){
+	TPCircularBuffer *buffers [2] = {&This->bufferL, &This->bufferR};
+	for(size_t i=0; i<2; i++){
+		TPCircularBufferClear(buffers[i]);
+
+		// fill the delay with zeros so that the tail is maxDelay samples
+		// behind the head
+		uint32_t bytesAvailable;
+		float *head = TPCircularBufferHead(buffers[i], &bytesAvailable);
+		size_t numSamples = This->maxDelay + 1 + BM_BUFFER_CHUNK_SIZE;
+		assert(bytesAvailable >= numSamples * sizeof(float));
+		vDSP_vclr(head, 1, numSamples);
+		TPCircularBufferProduce(buffers[i], (uint32_t)(numSamples * sizeof(float)));
+		TPCircularBufferConsume(buffers[i], (uint32_t)((BM_BUFFER_CHUNK_SIZE + 1) * sizeof(float)));
+	}
+}
+
+
+
+
+/*!
+ *BMSparseFIR_replaceOutputTaps
+ *
+ * @abstract remove the taps for output from the sorted list and merge in new ones
+ *
+ * The list stays sorted by position in the delay memory, which is the reverse
+ * of sorting by delay time. This way the reads move forward through memory
+ * and the sorting happens here rather than in commit.
+ */
+size_t BMSparseFIR_replaceOutputTaps(BMSparseFIR *This,
+									 BMSparseFIRTap *taps,
+									 size_t numTaps,
+									 size_t output,
+									 const size_t *delays,
+									 const float *gains,
+									 size_t numNewTaps){
+	// remove the old taps for this output
+	size_t j = 0;
+	for(size_t i=0; i<numTaps; i++)
+		if(taps[i].output != output)
+			taps[j++] = taps[i];
+
+	// sort the new ones
+	assert(j + numNewTaps <= This->maxTaps);
+	BMSparseFIRTap *newTaps = This->sortBuffer;
+	for(size_t i=0; i<numNewTaps; i++){
+		assert(delays[i] <= This->maxDelay);
+		newTaps[i].readIndex = This->maxDelay - delays[i];
+		newTaps[i].gain = gains[i];
+		newTaps[i].output = (uint32_t)output;
+	}
+	qsort(newTaps, numNewTaps, sizeof(BMSparseFIRTap), BMSparseFIR_compareTaps);
+
+	// merge them in, starting from the end so we can work in place
+	size_t a = j, b = numNewTaps, k = j + numNewTaps;
+	while(b > 0){
+		if(a > 0 && BMSparseFIR_compareTaps(&taps[a-1], &newTaps[b-1]) > 0)
+			taps[--k] = taps[--a];
+		else
+			taps[--k] = newTaps[--b];
+	}
+
+	return j + numNewTaps;
+}
+
+
+
+
+void BMSparseFIR_setOutputTaps(BMSparseFIR *This,
+							   size_t output,
+							   const size_t *delaysL, const float *gainsL,
+							   const size_t *delaysR, const float *gainsR,
+							   size_t numTaps){
+	assert(output < This->numOutputs);
+
+	This->numPendingTapsL = BMSparseFIR_replaceOutputTaps(This, This->pendingTapsL, This->numPendingTapsL, output, delaysL, gainsL, numTaps);
+	This->numPendingTapsR = BMSparseFIR_replaceOutputTaps(This, This->pendingTapsR, This->numPendingTapsR, output, delaysR, gainsR, numTaps);
+}
+
+
+
+
+void BMSparseFIR_setOutputKernels(BMSparseFIR *This,
+								  size_t output,
+								  const BMSparseKernel *kernelL,
+								  const BMSparseKernel *kernelR){
+	assert(output < This->numOutputs);
+
+	This->numPendingTapsL = BMSparseFIR_replaceOutputTaps(This, This->pendingTapsL, This->numPendingTapsL, output, kernelL->delays, kernelL->gains, kernelL->numTaps);
+	This->numPendingTapsR = BMSparseFIR_replaceOutputTaps(This, This->pendingTapsR, This->numPendingTapsR, output, kernelR->delays, kernelR->gains, kernelR->numTaps);
+}
+
+
+
+
+int BMSparseFIR_compareTaps(const void *a, const void *b){
+	const BMSparseFIRTap *tapA = a;
+	const BMSparseFIRTap *tapB = b;
+	if(tapA->readIndex < tapB->readIndex) return -1;
+	if(tapA->readIndex > tapB->readIndex) return 1;
+	return (int)tapA->output - (int)tapB->output;
+}
+
+
+
+
+void BMSparseFIR_loadPendingTaps(BMSparseFIR *This){
+	memcpy(This->tapsL, This->pendingTapsL, sizeof(BMSparseFIRTap) * This->numPendingTapsL);
+	memcpy(This->tapsR, This->pendingTapsR, sizeof(BMSparseFIRTap) * This->numPendingTapsR);
+	This->numTapsL = This->numPendingTapsL;
+	This->numTapsR = This->numPendingTapsR;
+	This->hasPendingUpdate = false;
+}
+
+
+
+
+void BMSparseFIR_commit(BMSparseFIR *This, bool smooth){
+	// the pending taps were sorted when they were set
+	if(smooth){
+		// the new taps load when the switch finishes turning off
+		This->hasPendingUpdate = true;
+		BMSmoothSwitch_setState(&This->offSwitch, false);
+	} else {
+		BMSparseFIR_loadPendingTaps(This);
+	}
+}
+
+
+
+
+/*!
+ *BMSparseFIR_processChannel
+ *
+ * @param taps        merged tap list sorted by readIndex
+ * @param delay       tail of the delay memory
+ * @param outputs     array of numOutputs buffers
+ * @param numSamples  <= BM_BUFFER_CHUNK_SIZE
+ */
+static void BMSparseFIR_processChannel(const BMSparseFIRTap *taps,
+									   size_t numTaps,
+									   const float *delay,
+									   float **outputs,
+									   size_t outputOffset,
+									   size_t numOutputs,
+									   size_t numSamples){
+	for(size_t i=0; i<numOutputs; i++)
+		vDSP_vclr(outputs[i] + outputOffset, 1, numSamples);
+
+	// Process in sub-blocks so the outputs of all kernels stay in cache while
+	// we add up all of the taps
+	for(size_t s=0; s<numSamples; s += BMSPARSEFIR_SUBBLOCK){
+		size_t samplesProcessing = BM_MIN(BMSPARSEFIR_SUBBLOCK, numSamples - s);
+		for(size_t j=0; j<numTaps; j++){
+			float *out = outputs[taps[j].output] + outputOffset + s;
+			vDSP_vsma(delay + taps[j].readIndex + s, 1, &taps[j].gain, out, 1, out, 1, samplesProcessing);
+		}
+	}
+}
+
+
+
+
+void BMSparseFIR_processStereo(BMSparseFIR *This,
+							   const float *inputL, const float *inputR,
+							   float **outputsL, float **outputsR,
+							   size_t numSamples){
+	// if the old taps have faded out, switch to the new ones and fade in
+	if(This->hasPendingUpdate &&
+	   BMSmoothSwitch_getState(&This->offSwitch) == BMSwitchOff){
+		BMSparseFIR_loadPendingTaps(This);
+		BMSmoothSwitch_setState(&This->offSwitch, true);
+	}
+
+	size_t samplesProcessed = 0;
+	while(samplesProcessed < numSamples){
+		size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, numSamples - samplesProcessed);
+		uint32_t bytesProcessing = (uint32_t)(samplesProcessing * sizeof(float));
+		uint32_t bytesAvailable;
+
+		// left
+		TPCircularBufferProduceBytes(&This->bufferL, inputL + samplesProcessed, bytesProcessing);
+		float *delayL = TPCircularBufferTail(&This->bufferL, &bytesAvailable);
+		BMSparseFIR_processChannel(This->tapsL, This->numTapsL, delayL, outputsL, samplesProcessed, This->numOutputs, samplesProcessing);
+		TPCircularBufferConsume(&This->bufferL, bytesProcessing);
+
+		// right
+		TPCircularBufferProduceBytes(&This->bufferR, inputR + samplesProcessed, bytesProcessing);
+		float *delayR = TPCircularBufferTail(&This->bufferR, &bytesAvailable);
+		BMSparseFIR_processChannel(This->tapsR, This->numTapsR, delayR, outputsR, samplesProcessed, This->numOutputs, samplesProcessing);
+		TPCircularBufferConsume(&This->bufferR, bytesProcessing);
+
+		samplesProcessed += samplesProcessing;
+	}
+
+	// fade in / out if the taps are changing
+	if(BMSmoothSwitch_getState(&This->offSwitch) != BMSwitchOn){
+		for(size_t i=0; i<This->numOutputs; i++){
+			This->switchBuffers[i] = outputsL[i];
+			This->switchBuffers[i + This->numOutputs] = outputsR[i];
+		}
+		BMSmoothSwitch_processBuffers(&This->offSwitch,
+									  (const float**)This->switchBuffers,
+									  This->switchBuffers,
+									  2 * This->numOutputs,
+									  numSamples);
+	}
+}
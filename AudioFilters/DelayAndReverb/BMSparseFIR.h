@@ -0,0 +1,197 @@
+//
+//  BMSparseFIR.h
+//  AudioFiltersXcodeProject
+//
+//  A sparse FIR filter bank that processes several sparse kernels, all reading
+//  from the same input, in a single pass. The input is stored only once and
+//  the taps of all kernels are merged into one list sorted by delay time so
+//  that reads from the delay memory move steadily through the buffer.
+//  Processing is done in short sub-blocks so that the outputs of all kernels
+//  stay in L1 cache while the taps are added up.
+//
+//  This replaces a parallel bank of BMVelvetNoiseDecorrelators that share the
+//  same input, where each of them would otherwise keep its own copy of the
+//  input in a separate BMMultiTapDelay and write its output to a separate
+//  intermediate buffer in a separate pass.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMSparseFIR_h
+#define BMSparseFIR_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "TPCircularBuffer.h"
+#include "BMSmoothSwitch.h"
+
+
+// A single sparse kernel, sorted by delay time
+typedef struct BMSparseKernel {
+	size_t *delays;
+	float *gains;
+	size_t numTaps, maxTaps;
+} BMSparseKernel;
+
+
+// one tap in the merged tap list of a BMSparseFIR
+typedef struct BMSparseFIRTap {
+	size_t readIndex;
+	float gain;
+	uint32_t output;
+} BMSparseFIRTap;
+
+
+typedef struct BMSparseFIR {
+	TPCircularBuffer bufferL, bufferR;
+	BMSparseFIRTap *tapsL, *tapsR, *pendingTapsL, *pendingTapsR, *sortBuffer;
+	size_t numTapsL, numTapsR, numPendingTapsL, numPendingTapsR;
+	size_t numOutputs, maxDelay, maxTaps;
+	bool hasPendingUpdate;
+	BMSmoothSwitch offSwitch;
+	float **switchBuffers;
+} BMSparseFIR;
+
+
+
+/*!
+ *BMSparseKernel_init
+ *
+ * @param This     pointer to a struct
+ * @param maxTaps  capacity of the kernel
+ */
+void BMSparseKernel_init(BMSparseKernel *This, size_t maxTaps);
+
+
+
+/*!
+ *BMSparseKernel_free
+ */
+void BMSparseKernel_free(BMSparseKernel *This);
+
+
+
+/*!
+ *BMSparseKernel_setTaps
+ *
+ * Copies the taps into the kernel, sorts them by delay time and merges taps
+ * that have the same delay time.
+ *
+ * @param This      pointer to an initialised struct
+ * @param delays    delay time of each tap in samples
+ * @param gains     gain of each tap
+ * @param numTaps   length of delays and gains. Must not exceed This->maxTaps
+ */
+void BMSparseKernel_setTaps(BMSparseKernel *This,
+							const size_t *delays,
+							const float *gains,
+							size_t numTaps);
+
+
+
+/*!
+ *BMSparseFIR_init
+ *
+ * @param This          pointer to a struct
+ * @param numOutputs    number of kernels in the bank. There is one output buffer per kernel on each channel
+ * @param maxDelay      longest delay time in samples of any tap
+ * @param maxTaps       maximum number of taps per channel, total for all kernels
+ * @param sampleRate    sample rate, used for the smooth switch that prevents clicks when the taps change
+ */
+void BMSparseFIR_init(BMSparseFIR *This,
+					  size_t numOutputs,
+					  size_t maxDelay,
+					  size_t maxTaps,
+					  float sampleRate);
+
+
+
+/*!
+ *BMSparseFIR_free
+ */
+void BMSparseFIR_free(BMSparseFIR *This);
+
+
+
+/*!
+ *BMSparseFIR_setOutputTaps
+ *
+ * Sets the taps of one kernel in the bank. The change doesn't take effect
+ * until BMSparseFIR_commit is called. The taps are sorted here, so commit
+ * doesn't have to.
+ *
+ * @param This      pointer to an initialised struct
+ * @param output    index of the kernel in [0, numOutputs)
+ * @param delaysL   delay times of the left channel taps in samples
+ * @param gainsL    gains of the left channel taps
+ * @param delaysR   delay times of the right channel taps in samples
+ * @param gainsR    gains of the right channel taps
+ * @param numTaps   length of each of the arrays above
+ */
+void BMSparseFIR_setOutputTaps(BMSparseFIR *This,
+							   size_t output,
+							   const size_t *delaysL, const float *gainsL,
+							   const size_t *delaysR, const float *gainsR,
+							   size_t numTaps);
+
+
+
+/*!
+ *BMSparseFIR_setOutputKernels
+ *
+ * Like BMSparseFIR_setOutputTaps but takes the taps from a pair of kernels
+ */
+void BMSparseFIR_setOutputKernels(BMSparseFIR *This,
+								  size_t output,
+								  const BMSparseKernel *kernelL,
+								  const BMSparseKernel *kernelR);
+
+
+
+/*!
+ *BMSparseFIR_commit
+ *
+ * Loads the taps set since the last call to commit for processing. If smooth is true, the output fades out, the taps change, and
+ * the output fades back in, all inside the process function.
+ *
+ * Call this from the same thread as the process function.
+ *
+ * @param This    pointer to an initialised struct
+ * @param smooth  set false to change the taps immediately
+ */
+void BMSparseFIR_commit(BMSparseFIR *This, bool smooth);
+
+
+
+/*!
+ *BMSparseFIR_processStereo
+ *
+ * @param This        pointer to an initialised struct
+ * @param inputL      left channel input, length numSamples
+ * @param inputR      right channel input, length numSamples
+ * @param outputsL    array of numOutputs left channel output buffers
+ * @param outputsR    array of numOutputs right channel output buffers
+ * @param numSamples  may be larger than BM_BUFFER_CHUNK_SIZE
+ */
+void BMSparseFIR_processStereo(BMSparseFIR *This,
+							   const float *inputL, const float *inputR,
+							   float **outputsL, float **outputsR,
+							   size_t numSamples);
+
+
+
+/*!
+ *BMSparseFIR_clearBuffers
+ */
+void BMSparseFIR_clearBuffers(BMSparseFIR *This);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMSparseFIR_h */
@@ -33,6 +33,7 @@ void BMStaticDelay_init(BMStaticDelay *This,
 	This->needsDelayTimeUpdate = false;
 	
 	BMSimpleDelayStereo_init(&This->delay, delayTimeInSamples);
+	BMTailSleep_init(&This->sleep, delayTimeInSamples);
 	
 	BMWetDryMixer_init(&This->bypassSwitch, sampleRate);
 	
@@ -115,6 +116,7 @@ void BMStaticDelay_processBufferStereo(BMStaticDelay *This,
 		size_t newDelayTimeSamples = This->sampleRate * This->delayTimeTargetInSeconds;
 		BMSimpleDelayStereo_free(&This->delay);
 		BMSimpleDelayStereo_init(&This->delay, newDelayTimeSamples);
+		BMTailSleep_setHoldSamples(&This->sleep, newDelayTimeSamples);
 		
 		// update the delay time variable so that feedback time calculations work
 		This->delayTimeInSeconds = This->delayTimeTargetInSeconds;
@@ -123,6 +125,15 @@ void BMStaticDelay_processBufferStereo(BMStaticDelay *This,
 		This->needsDelayTimeUpdate = false;
 	}
 	
+	// skip processing if the input is silent and the echoes have decayed
+	bool inputSilent = BMTailSleep_isSilent(&This->sleep, inL, numSamplesIn) &&
+					   BMTailSleep_isSilent(&This->sleep, inR, numSamplesIn);
+	if(BMTailSleep_skip(&This->sleep, inputSilent)){
+		vDSP_vclr(outL, 1, numSamplesIn);
+		vDSP_vclr(outR, 1, numSamplesIn);
+		return;
+	}
+	
 	// Chunked processing
 	size_t samplesToProcess = numSamplesIn;
 	size_t samplesProcessed = 0;
@@ -181,6 +192,9 @@ void BMStaticDelay_processBufferStereo(BMStaticDelay *This,
 												   This->outputBufferL, This->outputBufferR,
 												   samplesProcessing);
 			
+			// check the echoes before the wet gain and the dry signal
+			BMTailSleep_update(&This->sleep, This->outputBufferL, This->outputBufferR, samplesProcessing);
+			
 			// Adjust wet gain
 			BMSmoothGain_processBuffer(&This->wetGain, This->outputBufferL, This->outputBufferR, This->outputBufferL, This->outputBufferR, samplesProcessing);
 			
@@ -202,6 +216,7 @@ void BMStaticDelay_processBufferStereo(BMStaticDelay *This,
 		else {
 			vDSP_vclr(This->mixingBufferL, 1, samplesProcessing);
 			BMSimpleDelayStereo_process(&This->delay, This->mixingBufferL, This->mixingBufferL, This->outputBufferL, This->outputBufferR, samplesProcessing);
+			BMTailSleep_update(&This->sleep, This->outputBufferL, This->outputBufferR, samplesProcessing);
 		}
 		
 		// Bypass switch
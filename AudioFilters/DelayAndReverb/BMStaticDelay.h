@@ -62,6 +62,7 @@ extern "C" {
 #include "BMSimpleDelay.h"
 #include "BM2x2MatrixMixer.h"
 #include "BMMultiLevelBiquad.h"
+#include "BMTailSleep.h"
     
 //#define Filter_LP_Level 0
 //#define Filter_HP_Level 1
@@ -95,6 +96,7 @@ typedef struct BMStaticDelay {
 	float feedbackGain, delayTimeInSeconds, delayTimeTargetInSeconds, sampleRate;
 	float *feedbackBufferL, *feedbackBufferR, *mixingBufferL, *mixingBufferR, *outputBufferL, *outputBufferR;
 	bool needsDelayTimeUpdate;
+	BMTailSleep sleep;
 } BMStaticDelay;
     
 /*
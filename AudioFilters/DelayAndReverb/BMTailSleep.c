@@ -0,0 +1,79 @@
+//
+//  BMTailSleep.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#include "BMTailSleep.h"
+#include <Accelerate/Accelerate.h>
+#include "Constants.h"
+
+
+
+void BMTailSleep_init(BMTailSleep *This, size_t holdSamples){
+	This->holdSamples = holdSamples;
+	This->quietSamples = 0;
+	This->inputSilent = false;
+	This->asleep = false;
+	BMTailSleep_setThreshold(This, BMTailSleep_defaultThresholdDb);
+}
+
+
+
+
+void BMTailSleep_setHoldSamples(BMTailSleep *This, size_t holdSamples){
+	This->holdSamples = holdSamples;
+}
+
+
+
+
+void BMTailSleep_setThreshold(BMTailSleep *This, float thresholdDb){
+	This->threshold = BM_DB_TO_GAIN(thresholdDb);
+}
+
+
+
+
+bool BMTailSleep_isSilent(const BMTailSleep *This, const float *buffer, size_t numSamples){
+	float peak;
+	vDSP_maxmgv(buffer, 1, &peak, numSamples);
+	return peak <= This->threshold;
+}
+
+
+
+
+bool BMTailSleep_skip(BMTailSleep *This, bool inputSilent){
+	This->inputSilent = inputSilent;
+	if(!inputSilent)
+		This->asleep = false;
+	return This->asleep;
+}
+
+
+
+
+void BMTailSleep_update(BMTailSleep *This, const float *outputL, const float *outputR, size_t numSamples){
+	// count the samples since the input or the output was last above the
+	// threshold
+	bool outputSilent = BMTailSleep_isSilent(This, outputL, numSamples);
+	if(outputR)
+		outputSilent = outputSilent && BMTailSleep_isSilent(This, outputR, numSamples);
+	if(This->inputSilent && outputSilent)
+		This->quietSamples += numSamples;
+	else
+		This->quietSamples = 0;
+
+	if(This->quietSamples > This->holdSamples)
+		This->asleep = true;
+}
+
+
+
+
+bool BMTailSleep_isAsleep(const BMTailSleep *This){
+	return This->asleep;
+}
@@ -0,0 +1,137 @@
+//
+//  BMTailSleep.h
+//  AudioFiltersXcodeProject
+//
+//  Lets a reverb or delay stop processing when its input is silent and its
+//  tail has decayed below a threshold. While asleep it skips processing and
+//  outputs zeros. It wakes up as soon as the input is not silent.
+//
+//  The owner checks the input before processing and the wet output
+//  afterwards. The wet signal is measured before any wet/dry mix or output
+//  gain so that a quiet mix setting doesn't cut off a tail that would be
+//  audible at a higher one:
+//
+//      bool silent = BMTailSleep_isSilent(&This->sleep, inputL, numSamples) &&
+//                    BMTailSleep_isSilent(&This->sleep, inputR, numSamples);
+//      if(BMTailSleep_skip(&This->sleep, silent)){
+//          // clear the outputs and return
+//      }
+//      // process the wet signal
+//      BMTailSleep_update(&This->sleep, wetL, wetR, numSamples);
+//      // mix wet and dry
+//
+//  A signal inside a delay doesn't reach the output until the delay time
+//  has passed, so a quiet output only shows that the tail has decayed after
+//  the longest delay time. The owner sets that time as holdSamples and goes
+//  to sleep after the input has been silent and the output below the
+//  threshold for at least that long.
+//
+//  The state of the owner is left as it is while asleep. Everything in it
+//  is below the threshold at that point, so processing can resume on wake
+//  up without a click and without clearing any buffers.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file. No restritions.
+//
+
+#ifndef BMTailSleep_h
+#define BMTailSleep_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#define BMTailSleep_defaultThresholdDb -120.0f
+
+
+typedef struct BMTailSleep {
+	float threshold;
+	size_t holdSamples, quietSamples;
+	bool inputSilent, asleep;
+} BMTailSleep;
+
+
+
+/*!
+ *BMTailSleep_init
+ *
+ * @param This         pointer to a struct
+ * @param holdSamples  the longest time in samples a signal can stay inside the owner without reaching the output
+ */
+void BMTailSleep_init(BMTailSleep *This, size_t holdSamples);
+
+
+
+/*!
+ *BMTailSleep_setHoldSamples
+ *
+ * Call this when the delay times of the owner change.
+ */
+void BMTailSleep_setHoldSamples(BMTailSleep *This, size_t holdSamples);
+
+
+
+/*!
+ *BMTailSleep_setThreshold
+ *
+ * @param This         pointer to an initialised struct
+ * @param thresholdDb  signals below this level count as silence. The default is BMTailSleep_defaultThresholdDb.
+ */
+void BMTailSleep_setThreshold(BMTailSleep *This, float thresholdDb);
+
+
+
+/*!
+ *BMTailSleep_isSilent
+ *
+ * @returns true if every sample in buffer is below the threshold
+ */
+bool BMTailSleep_isSilent(const BMTailSleep *This, const float *buffer, size_t numSamples);
+
+
+
+/*!
+ *BMTailSleep_skip
+ *
+ * Call this at the start of each buffer.
+ *
+ * @param This         pointer to an initialised struct
+ * @param inputSilent  true if all inputs to the owner are silent in this buffer
+ * @returns true if the owner should skip processing and output zeros
+ */
+bool BMTailSleep_skip(BMTailSleep *This, bool inputSilent);
+
+
+
+/*!
+ *BMTailSleep_update
+ *
+ * Call this after processing each buffer that wasn't skipped. It can be
+ * called once for each chunk of a buffer.
+ *
+ * @param This        pointer to an initialised struct
+ * @param outputL     left wet output, before mixing with the dry signal
+ * @param outputR     right wet output, or NULL for mono
+ * @param numSamples  length of the outputs
+ */
+void BMTailSleep_update(BMTailSleep *This, const float *outputL, const float *outputR, size_t numSamples);
+
+
+
+/*!
+ *BMTailSleep_isAsleep
+ *
+ * @returns true if the owner is asleep, so its output is silent. Effects
+ * that take the output as input can use this to skip their own silence
+ * detection.
+ */
+bool BMTailSleep_isAsleep(const BMTailSleep *This);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BMTailSleep_h */
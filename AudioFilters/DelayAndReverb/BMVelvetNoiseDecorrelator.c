@@ -18,8 +18,15 @@
 
 
 #define BM_VND_WET_MIX 0.40f
+#define VND_FFTMinPartitionLength 128
+#define VND_FFTMaxPartitionLength 1024
 
 void BMVelvetNoiseDecorrelator_genRandGains(BMVelvetNoiseDecorrelator *This);
+void BMVelvetNoiseDecorrelator_allocTapArrays(BMVelvetNoiseDecorrelator *This, size_t numTaps);
+void BMVelvetNoiseDecorrelator_chooseMethod(BMVelvetNoiseDecorrelator *This);
+void BMVelvetNoiseDecorrelator_loadTaps(BMVelvetNoiseDecorrelator *This);
+void BMVelvetNoiseDecorrelator_freeDelay(BMVelvetNoiseDecorrelator *This);
+void BMVelvetNoiseDecorrelator_startCrossfade(BMVelvetNoiseDecorrelator *This);
 
 void BMVelvetNoiseDecorrelator_initFullSettings(BMVelvetNoiseDecorrelator *This,
 												float maxDelaySeconds,
@@ -84,14 +91,22 @@ void BMVelvetNoiseDecorrelator_initFullSettings(BMVelvetNoiseDecorrelator *This,
 	This->evenTapDensity = evenTapDensity;
     This->resetNumTaps = false;
     This->resetRT60DecayTime = false;
+    This->resetFadeIn = false;
     This->fadeInSamples = 0;
 	if (hasDryTap) This->numWetTaps--;
 	
 	// allocate memory for calculating delay setups
-	This->delayLengthsL = calloc(numTaps, sizeof(size_t));
-	This->delayLengthsR = calloc(numTaps, sizeof(size_t));
-	This->gainsL = calloc(numTaps, sizeof(float));
-	This->gainsR = calloc(numTaps, sizeof(float));
+	This->delayLengthsL = NULL;
+	This->delayLengthsR = NULL;
+	This->gainsL = NULL;
+	This->gainsR = NULL;
+	This->splitDelaysL = NULL;
+	This->splitDelaysR = NULL;
+	This->splitGainsL = NULL;
+	This->splitGainsR = NULL;
+	This->tapCapacity = 0;
+	This->compiledToBank = false;
+	BMVelvetNoiseDecorrelator_allocTapArrays(This, numTaps);
     This->tempBuffer = calloc(BM_BUFFER_CHUNK_SIZE, sizeof(float));
 	This->numInput = 0;
     
@@ -109,8 +124,207 @@ void BMVelvetNoiseDecorrelator_initFullSettings(BMVelvetNoiseDecorrelator *This,
 							   maxDelayLenth,
 							   numTaps);
 	
+	// decide whether to use FFT convolution for the later taps
+	This->useFFT = false;
+	This->fftInitialised = false;
+	This->fftPartitionLength = 0;
+	BMVelvetNoiseDecorrelator_chooseMethod(This);
+	
 	// setup the delay for processing
 	BMVelvetNoiseDecorrelator_randomiseAll(This);
+	BMVelvetNoiseDecorrelator_startCrossfade(This);
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_allocTapArrays
+ *
+ * @abstract make sure the arrays for calculating delay setups have space for numTaps
+ */
+void BMVelvetNoiseDecorrelator_allocTapArrays(BMVelvetNoiseDecorrelator *This, size_t numTaps){
+	if(numTaps <= This->tapCapacity) return;
+	
+	free(This->delayLengthsL);
+	free(This->delayLengthsR);
+	free(This->gainsL);
+	free(This->gainsR);
+	free(This->splitDelaysL);
+	free(This->splitDelaysR);
+	free(This->splitGainsL);
+	free(This->splitGainsR);
+	
+	This->delayLengthsL = calloc(numTaps, sizeof(size_t));
+	This->delayLengthsR = calloc(numTaps, sizeof(size_t));
+	This->gainsL = calloc(numTaps, sizeof(float));
+	This->gainsR = calloc(numTaps, sizeof(float));
+	This->splitDelaysL = calloc(numTaps, sizeof(size_t));
+	This->splitDelaysR = calloc(numTaps, sizeof(size_t));
+	This->splitGainsL = calloc(numTaps, sizeof(float));
+	This->splitGainsR = calloc(numTaps, sizeof(float));
+	This->tapCapacity = numTaps;
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_chooseMethod
+ *
+ * @abstract Decide whether to process all taps with the multi-tap delay or to
+ * process only the taps in the first fftPartitionLength samples with the
+ * multi-tap delay and the rest with FFT convolution. The decision depends only
+ * on the number of taps and the delay length, so it doesn't change when the
+ * taps are randomised. Call this only when the output is switched off.
+ */
+void BMVelvetNoiseDecorrelator_chooseMethod(BMVelvetNoiseDecorrelator *This){
+	size_t numTaps = This->numWetTaps + (This->hasDryTap ? 1 : 0);
+	size_t maxDelayLength = ceil(This->maxDelayTimeS*This->sampleRate);
+	
+	// the cost of direct convolution is one multiply-add per tap
+	float bestCost = numTaps;
+	bool wasUsingFFT = This->useFFT;
+	This->useFFT = false;
+	
+	for(size_t B = VND_FFTMinPartitionLength; B <= VND_FFTMaxPartitionLength && B < maxDelayLength; B *= 2){
+		// The taps in the first B samples, and the last tap, which has its own
+		// output, stay in the time domain. The taps are spread evenly over the
+		// delay length on average.
+		float numHeadTaps = 1.0f + (float)numTaps * (float)B / (float)maxDelayLength;
+		float cost = numHeadTaps + BMPartitionedConv_costPerSample(B, maxDelayLength + 1 - B);
+		if(cost < bestCost){
+			bestCost = cost;
+			This->useFFT = true;
+			This->fftPartitionLength = B;
+		}
+	}
+	
+	if(!This->useFFT) return;
+	
+	// init the convolvers if we don't already have them at the right size
+	if(!This->fftInitialised || This->fftConvL.partitionLength != This->fftPartitionLength){
+		if(This->fftInitialised){
+			BMPartitionedConv_free(&This->fftConvL);
+			BMPartitionedConv_free(&This->fftConvR);
+		} else {
+			This->fftBufferL = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+			This->fftBufferR = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+		}
+		size_t tailLength = maxDelayLength + 1 - This->fftPartitionLength;
+		BMPartitionedConv_init(&This->fftConvL, This->fftPartitionLength, tailLength);
+		BMPartitionedConv_init(&This->fftConvR, This->fftPartitionLength, tailLength);
+		BMPartitionedConv_setCrossfade(&This->fftConvL, true);
+		BMPartitionedConv_setCrossfade(&This->fftConvR, true);
+		This->fftInitialised = true;
+	}
+	// if the convolvers were idle, they have old input in their buffers
+	else if(!wasUsingFFT){
+		BMPartitionedConv_clearBuffers(&This->fftConvL);
+		BMPartitionedConv_clearBuffers(&This->fftConvR);
+	}
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_startCrossfade
+ *
+ * @abstract switch the new multi-tap delay to its first taps and crossfade all later changes
+ *
+ * The multi-tap delay starts in bypass mode, so without the immediate switch
+ * it would fade in from the dry signal.
+ */
+void BMVelvetNoiseDecorrelator_startCrossfade(BMVelvetNoiseDecorrelator *This){
+	BMMultiTapDelay_PerformUpdateIndices(&This->multiTapDelay);
+	BMMultiTapDelay_setCrossfade(&This->multiTapDelay, true);
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_splitTaps
+ *
+ * @abstract copy the taps before or after splitPoint, except the last tap, to the output arrays
+ *
+ * @returns the number of taps copied
+ */
+static size_t BMVelvetNoiseDecorrelator_splitTaps(const size_t *delays,
+												  const float *gains,
+												  size_t numTaps,
+												  size_t splitPoint,
+												  bool tail,
+												  size_t *delaysOut,
+												  float *gainsOut){
+	size_t j = 0;
+	for(size_t i=0; i+1<numTaps; i++){
+		if(tail && delays[i] >= splitPoint){
+			delaysOut[j] = delays[i] - splitPoint;
+			gainsOut[j++] = gains[i];
+		}
+		if(!tail && delays[i] < splitPoint){
+			delaysOut[j] = delays[i];
+			gainsOut[j++] = gains[i];
+		}
+	}
+	return j;
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_loadTaps
+ *
+ * @abstract send the delay times and gains to the multi-tap delay and, if we are using it, to FFT convolution
+ */
+void BMVelvetNoiseDecorrelator_loadTaps(BMVelvetNoiseDecorrelator *This){
+	// a BMSparseFIR reads the taps straight from the tap arrays
+	if(This->compiledToBank) return;
+	
+	size_t numTaps = This->numWetTaps + (This->hasDryTap ? 1 : 0);
+	
+	// direct convolution: the multi-tap delay does everything
+	if(!This->useFFT){
+		BMMultiTapDelay_setTaps(&This->multiTapDelay, This->delayLengthsL, This->delayLengthsR, This->gainsL, This->gainsR, numTaps);
+		return;
+	}
+	
+	size_t B = This->fftPartitionLength;
+	
+	// the taps after the first B samples go to FFT convolution, shifted back
+	// by B samples to compensate for the latency of the convolver
+	size_t numTailL = BMVelvetNoiseDecorrelator_splitTaps(This->delayLengthsL, This->gainsL, numTaps, B, true, This->splitDelaysL, This->splitGainsL);
+	size_t numTailR = BMVelvetNoiseDecorrelator_splitTaps(This->delayLengthsR, This->gainsR, numTaps, B, true, This->splitDelaysR, This->splitGainsR);
+	BMPartitionedConv_setSparseKernel(&This->fftConvL, This->splitDelaysL, This->splitGainsL, numTailL);
+	BMPartitionedConv_setSparseKernel(&This->fftConvR, This->splitDelaysR, This->splitGainsR, numTailR);
+	
+	// the taps in the first B samples go to the multi-tap delay
+	size_t numHeadL = BMVelvetNoiseDecorrelator_splitTaps(This->delayLengthsL, This->gainsL, numTaps, B, false, This->splitDelaysL, This->splitGainsL);
+	size_t numHeadR = BMVelvetNoiseDecorrelator_splitTaps(This->delayLengthsR, This->gainsR, numTaps, B, false, This->splitDelaysR, This->splitGainsR);
+	
+	// both channels of the multi-tap delay have the same number of taps so we
+	// pad the shorter one with taps that have zero gain
+	size_t numHead = BM_MAX(numHeadL, numHeadR);
+	for(size_t i=numHeadL; i<numHead; i++){
+		This->splitDelaysL[i] = 0;
+		This->splitGainsL[i] = 0.0f;
+	}
+	for(size_t i=numHeadR; i<numHead; i++){
+		This->splitDelaysR[i] = 0;
+		This->splitGainsR[i] = 0.0f;
+	}
+	
+	// the last tap always stays in the multi-tap delay because it has its own
+	// output in BMVelvetNoiseDecorrelator_processBufferStereoWithFinalOutput
+	This->splitDelaysL[numHead] = This->delayLengthsL[numTaps-1];
+	This->splitGainsL[numHead] = This->gainsL[numTaps-1];
+	This->splitDelaysR[numHead] = This->delayLengthsR[numTaps-1];
+	This->splitGainsR[numHead] = This->gainsR[numTaps-1];
+	
+	BMMultiTapDelay_setTaps(&This->multiTapDelay, This->splitDelaysL, This->splitDelaysR, This->splitGainsL, This->splitGainsR, numHead + 1);
 }
 
 
@@ -165,7 +379,7 @@ void BMVelvetNoiseDecorrelator_genRandGains(BMVelvetNoiseDecorrelator *This){
 	else {
 		BMVectorNormalise(This->gainsL, This->numWetTaps);
 		BMVectorNormalise(This->gainsR, This->numWetTaps);
-		BMMultiTapDelay_setGains(&This->multiTapDelay, This->gainsL, This->gainsR);
+		BMVelvetNoiseDecorrelator_loadTaps(This);
 	}
 }
 
@@ -223,7 +437,7 @@ void BMVelvetNoiseDecorrelator_genRandTapTimes(BMVelvetNoiseDecorrelator *This){
 		BMReverbRandomsInRange(min, max, This->delayLengthsR + shift, This->numWetTaps);
 	}
 	
-	BMMultiTapDelay_setDelayTimes(&This->multiTapDelay, This->delayLengthsL, This->delayLengthsR);
+	// the new delay times are loaded by BMVelvetNoiseDecorrelator_genRandGains
 }
 
 
@@ -234,7 +448,7 @@ void BMVelvetNoiseDecorrelator_randomiseAll(BMVelvetNoiseDecorrelator *This){
 	// randomise times
 	BMVelvetNoiseDecorrelator_genRandTapTimes(This);
 	
-	// randomise gains
+	// randomise gains and load the taps into the delay
 	BMVelvetNoiseDecorrelator_genRandGains(This);
 }
 
@@ -281,7 +495,7 @@ void BMVelvetNoiseDecorrelator_setWetMix(BMVelvetNoiseDecorrelator *This, float
 	vDSP_vsmul(This->gainsR+1, 1, &wetGainCorrected, This->gainsR+1, 1, This->numWetTaps);
 
 	// set the gains to the multitap delay
-	BMMultiTapDelay_setGains(&This->multiTapDelay, This->gainsL, This->gainsR);
+	BMVelvetNoiseDecorrelator_loadTaps(This);
 }
 
 
@@ -295,22 +509,38 @@ void BMVelvetNoiseDecorrelator_setNumTaps(BMVelvetNoiseDecorrelator *This, size_
     
 }
 
+void BMVelvetNoiseDecorrelator_rebuildTaps(BMVelvetNoiseDecorrelator *This){
+    size_t numTaps = This->numWetTaps + (This->hasDryTap ? 1 : 0);
+    BMVelvetNoiseDecorrelator_allocTapArrays(This, numTaps);
+    if(!This->compiledToBank){
+        //Free it first
+        BMMultiTapDelay_free(&This->multiTapDelay);
+        // init the multi-tap delay in bypass mode
+        size_t maxDelayLenth = ceil(This->maxDelayTimeS*This->sampleRate);
+        BMMultiTapDelay_initBypass(&This->multiTapDelay,
+                                   true,
+                                   maxDelayLenth,
+                                   numTaps);
+        // the number of taps changed so the cheapest method may have changed too
+        BMVelvetNoiseDecorrelator_chooseMethod(This);
+    }
+    // setup the delay for processing. This picks up any new RT60 or fade-in
+    // time too.
+    This->resetRT60DecayTime = false;
+    This->resetFadeIn = false;
+    BMVelvetNoiseDecorrelator_randomiseAll(This);
+    if(!This->compiledToBank)
+        BMVelvetNoiseDecorrelator_startCrossfade(This);
+}
+
 void BMVelvetNoiseDecorrelator_resetNumTaps(BMVelvetNoiseDecorrelator *This){
     if(BMSmoothSwitch_getState(&This->offSwitchL)==BMSwitchOff){
         if(This->resetNumTaps){
+            // clear the flag after rebuilding so that the setters leave the
+            // taps alone until we are done with them
+            BMVelvetNoiseDecorrelator_rebuildTaps(This);
             This->resetNumTaps = false;
             
-            //Free it first
-            BMMultiTapDelay_free(&This->multiTapDelay);
-            // init the multi-tap delay in bypass mode
-            size_t maxDelayLenth = ceil(This->maxDelayTimeS*This->sampleRate);
-            BMMultiTapDelay_initBypass(&This->multiTapDelay,
-                                       true,
-                                       maxDelayLenth,
-                                       This->numWetTaps);
-            // setup the delay for processing
-            BMVelvetNoiseDecorrelator_randomiseAll(This);
-            
             //Enable off switch
             BMSmoothSwitch_setState(&This->offSwitchL, true);
             BMSmoothSwitch_setState(&This->offSwitchR, true);
@@ -318,43 +548,39 @@ void BMVelvetNoiseDecorrelator_resetNumTaps(BMVelvetNoiseDecorrelator *This){
     }
 }
 
-void BMVelvetNoiseDecorrelator_setRT60DecayTime(BMVelvetNoiseDecorrelator *This, float rt60DT){
-    This->rt60 = rt60DT;
-    This->resetRT60DecayTime = true;
+/*!
+ *BMVelvetNoiseDecorrelator_updateGains
+ *
+ * @abstract regenerate the gains on the caller's thread after a change to the RT60 or fade-in time
+ *
+ * The multi-tap delay and the FFT convolvers build the new taps here and
+ * crossfade to them in the next process call. A decorrelator that was compiled
+ * to a bank gets the change at the next call to compileBank, and one that is
+ * waiting to change the number of taps gets it when the taps are rebuilt.
+ *
+ * @returns false if the change is left for later
+ */
+static bool BMVelvetNoiseDecorrelator_updateGains(BMVelvetNoiseDecorrelator *This){
+    if(This->compiledToBank || This->resetNumTaps) return false;
+    BMVelvetNoiseDecorrelator_genRandGains(This);
+    return true;
 }
 
-void BMVelvetNoiseDecorrelator_resetRT60DecayTime(BMVelvetNoiseDecorrelator *This){
-    if(This->resetRT60DecayTime){
-        This->resetRT60DecayTime = false;
-        BMVelvetNoiseDecorrelator_genRandGains(This);
-    }
+void BMVelvetNoiseDecorrelator_setRT60DecayTime(BMVelvetNoiseDecorrelator *This, float rt60DT){
+    This->rt60 = rt60DT;
+    This->resetRT60DecayTime = !BMVelvetNoiseDecorrelator_updateGains(This);
 }
 
 void BMVelvetNoiseDecorrelator_setFadeIn(BMVelvetNoiseDecorrelator *This,float fadeInS){
-    //Start off switch
-    BMSmoothSwitch_setState(&This->offSwitchL, false);
-    BMSmoothSwitch_setState(&This->offSwitchR, false);
     This->fadeInSamples = fadeInS * This->sampleRate;
-    This->resetFadeIn = true;
-}
-
-void BMVelvetNoiseDecorrelator_resetFadeIn(BMVelvetNoiseDecorrelator *This){
-    if(BMSmoothSwitch_getState(&This->offSwitchL)==BMSwitchOff){
-        if(This->resetFadeIn){
-            This->resetFadeIn = false;
-            BMVelvetNoiseDecorrelator_genRandGains(This);
-            
-            BMSmoothSwitch_setState(&This->offSwitchL, true);
-            BMSmoothSwitch_setState(&This->offSwitchR, true);
-        }
-    }
+    This->resetFadeIn = !BMVelvetNoiseDecorrelator_updateGains(This);
 }
 
 /*!
  *BMVelvetNoiseDecorrelator_free
  */
 void BMVelvetNoiseDecorrelator_free(BMVelvetNoiseDecorrelator *This){
-	BMMultiTapDelay_free(&This->multiTapDelay);
+	BMVelvetNoiseDecorrelator_freeDelay(This);
 	
 	free(This->delayLengthsL);
 	This->delayLengthsL = NULL;
@@ -366,6 +592,104 @@ void BMVelvetNoiseDecorrelator_free(BMVelvetNoiseDecorrelator *This){
 	This->gainsR = NULL;
     free(This->tempBuffer);
     This->tempBuffer = NULL;
+	free(This->splitDelaysL);
+	This->splitDelaysL = NULL;
+	free(This->splitDelaysR);
+	This->splitDelaysR = NULL;
+	free(This->splitGainsL);
+	This->splitGainsL = NULL;
+	free(This->splitGainsR);
+	This->splitGainsR = NULL;
+	This->tapCapacity = 0;
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_freeDelay
+ *
+ * @abstract free the multi-tap delay and FFT convolvers, unless compileBank already did
+ */
+void BMVelvetNoiseDecorrelator_freeDelay(BMVelvetNoiseDecorrelator *This){
+	if(This->compiledToBank) return;
+	
+	BMMultiTapDelay_free(&This->multiTapDelay);
+	
+	if(This->fftInitialised){
+		BMPartitionedConv_free(&This->fftConvL);
+		BMPartitionedConv_free(&This->fftConvR);
+		free(This->fftBufferL);
+		This->fftBufferL = NULL;
+		free(This->fftBufferR);
+		This->fftBufferR = NULL;
+		This->fftInitialised = false;
+	}
+	This->useFFT = false;
+}
+
+
+
+
+/*!
+ *BMVelvetNoiseDecorrelator_processDelay
+ *
+ * @abstract process the multi-tap delay and, if it's in use, FFT convolution
+ *
+ * @param lastTapL  output of the last tap without gain, or NULL if not needed
+ */
+static void BMVelvetNoiseDecorrelator_processDelay(BMVelvetNoiseDecorrelator *This,
+												   const float* inputL, const float* inputR,
+												   float* outputL, float* outputR,
+												   float* lastTapL, float* lastTapR,
+												   size_t length){
+	// after compileBank the decorrelator has no delay memory
+	assert(!This->compiledToBank);
+	
+	// direct convolution
+	if(!This->useFFT){
+		if(lastTapL)
+			BMMultiTapDelay_processStereoWithFinalOutput(&This->multiTapDelay,
+														 inputL, inputR,
+														 outputL, outputR,
+														 lastTapL, lastTapR,
+														 length);
+		else
+			BMMultiTapDelay_processBufferStereo(&This->multiTapDelay,
+												inputL, inputR,
+												outputL, outputR,
+												length);
+		return;
+	}
+	
+	// FFT convolution for the tail, direct convolution for the head
+	size_t samplesProcessed = 0;
+	while(samplesProcessed < length){
+		size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, length - samplesProcessed);
+		
+		// do the convolution first because the multi-tap delay may
+		// overwrite the input if processing in place
+		BMPartitionedConv_process(&This->fftConvL, inputL + samplesProcessed, This->fftBufferL, samplesProcessing);
+		BMPartitionedConv_process(&This->fftConvR, inputR + samplesProcessed, This->fftBufferR, samplesProcessing);
+		
+		if(lastTapL)
+			BMMultiTapDelay_processStereoWithFinalOutput(&This->multiTapDelay,
+														 inputL + samplesProcessed, inputR + samplesProcessed,
+														 outputL + samplesProcessed, outputR + samplesProcessed,
+														 lastTapL + samplesProcessed, lastTapR + samplesProcessed,
+														 samplesProcessing);
+		else
+			BMMultiTapDelay_processBufferStereo(&This->multiTapDelay,
+												inputL + samplesProcessed, inputR + samplesProcessed,
+												outputL + samplesProcessed, outputR + samplesProcessed,
+												samplesProcessing);
+		
+		// mix the tail into the output
+		vDSP_vadd(This->fftBufferL, 1, outputL + samplesProcessed, 1, outputL + samplesProcessed, 1, samplesProcessing);
+		vDSP_vadd(This->fftBufferR, 1, outputR + samplesProcessed, 1, outputR + samplesProcessed, 1, samplesProcessing);
+		
+		samplesProcessed += samplesProcessing;
+	}
 }
 
 
@@ -380,13 +704,12 @@ void BMVelvetNoiseDecorrelator_processBufferStereo(BMVelvetNoiseDecorrelator *Th
                                                    size_t length){
     //Reset numtap if needed
     BMVelvetNoiseDecorrelator_resetNumTaps(This);
-    BMVelvetNoiseDecorrelator_resetRT60DecayTime(This);
-    BMVelvetNoiseDecorrelator_resetFadeIn(This);
-	// all processing is done by the multi-tap delay class
-    BMMultiTapDelay_processBufferStereo(&This->multiTapDelay,
-										inputL, inputR,
-										outputL, outputR,
-										length);
+	// all processing is done by the multi-tap delay and FFT convolution
+    BMVelvetNoiseDecorrelator_processDelay(This,
+										   inputL, inputR,
+										   outputL, outputR,
+										   NULL, NULL,
+										   length);
     //Off switch
     if(BMSmoothSwitch_getState(&This->offSwitchL)!=BMSwitchOn){
         BMSmoothSwitch_processBufferMono(&This->offSwitchL, outputL, outputL, length);
@@ -404,12 +727,10 @@ void BMVelvetNoiseDecorrelator_processBufferStereoWithFinalOutput(BMVelvetNoiseD
                                                    size_t length){
     //Reset numtap if needed
     BMVelvetNoiseDecorrelator_resetNumTaps(This);
-    BMVelvetNoiseDecorrelator_resetRT60DecayTime(This);
-    BMVelvetNoiseDecorrelator_resetFadeIn(This);
-    // all processing is done by the multi-tap delay class
-    BMMultiTapDelay_processStereoWithFinalOutput(&This->multiTapDelay,
-                                                 inputL, inputR,
-                                                 outputL, outputR, finalOutputL, finalOutputR, length);
+    // all processing is done by the multi-tap delay and FFT convolution
+    BMVelvetNoiseDecorrelator_processDelay(This,
+                                           inputL, inputR,
+                                           outputL, outputR, finalOutputL, finalOutputR, length);
     //Apply lasttap gain
     vDSP_vsmul(finalOutputL, 1, &This->lastTapGainL, finalOutputL, 1, length);
     vDSP_vsmul(finalOutputR, 1, &This->lastTapGainR, finalOutputR, 1, length);
@@ -431,13 +752,12 @@ void BMVelvetNoiseDecorrelator_processBufferMonoToStereo(BMVelvetNoiseDecorrelat
 														 size_t length){
     //Reset numtap if needed
     BMVelvetNoiseDecorrelator_resetNumTaps(This);
-    BMVelvetNoiseDecorrelator_resetRT60DecayTime(This);
-    BMVelvetNoiseDecorrelator_resetFadeIn(This);
-	// all processing is done by the multi-tap delay class
-	BMMultiTapDelay_processBufferStereo(&This->multiTapDelay,
-										inputL, inputL,
-										outputL, outputR,
-										length);
+	// all processing is done by the multi-tap delay and FFT convolution
+	BMVelvetNoiseDecorrelator_processDelay(This,
+										   inputL, inputL,
+										   outputL, outputR,
+										   NULL, NULL,
+										   length);
     
     //Off switch
     if(BMSmoothSwitch_getState(&This->offSwitchL)!=BMSwitchOn){
@@ -445,3 +765,51 @@ void BMVelvetNoiseDecorrelator_processBufferMonoToStereo(BMVelvetNoiseDecorrelat
         BMSmoothSwitch_processBufferMono(&This->offSwitchR, outputR, outputR, length);
     }
 }
+
+
+
+
+void BMVelvetNoiseDecorrelator_compileBank(BMVelvetNoiseDecorrelator *vndArray,
+										   size_t numVND,
+										   BMSparseFIR *bank,
+										   bool smooth){
+	assert(numVND <= bank->numOutputs);
+	
+	for(size_t i=0; i<numVND; i++){
+		BMVelvetNoiseDecorrelator *vnd = &vndArray[i];
+		
+		// the bank does the processing, so the delay memory of the
+		// decorrelator isn't needed any more
+		if(!vnd->compiledToBank){
+			BMVelvetNoiseDecorrelator_freeDelay(vnd);
+			vnd->compiledToBank = true;
+		}
+		
+		// apply pending changes now. The bank fades out and in around the
+		// change so we don't have to wait for the off switch here.
+		if(vnd->resetNumTaps){
+			vnd->resetNumTaps = false;
+			BMVelvetNoiseDecorrelator_rebuildTaps(vnd);
+		}
+		if(vnd->resetFadeIn || vnd->resetRT60DecayTime){
+			vnd->resetFadeIn = false;
+			vnd->resetRT60DecayTime = false;
+			BMVelvetNoiseDecorrelator_genRandGains(vnd);
+		}
+		BMSmoothSwitch_setState(&vnd->offSwitchL, true);
+		BMSmoothSwitch_setState(&vnd->offSwitchR, true);
+		
+		// the tap settings of the decorrelator are in delayLengths and gains,
+		// including the dry tap if there is one
+		BMSparseFIR_setOutputTaps(bank, i,
+								  vnd->delayLengthsL, vnd->gainsL,
+								  vnd->delayLengthsR, vnd->gainsR,
+								  vnd->numWetTaps + (vnd->hasDryTap ? 1 : 0));
+	}
+	
+	// outputs that aren't in use have no taps
+	for(size_t i=numVND; i<bank->numOutputs; i++)
+		BMSparseFIR_setOutputTaps(bank, i, NULL, NULL, NULL, NULL, 0);
+	
+	BMSparseFIR_commit(bank, smooth);
+}
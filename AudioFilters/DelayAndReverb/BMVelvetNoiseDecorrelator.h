@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include "BMMultiTapDelay.h"
 #include "BMSmoothSwitch.h"
+#include "BMSparseFIR.h"
+#include "BMPartitionedConv.h"
 
 typedef struct BMVelvetNoiseDecorrelator {
     BMMultiTapDelay multiTapDelay;
@@ -31,6 +33,21 @@ typedef struct BMVelvetNoiseDecorrelator {
     size_t numInput;
     BMSmoothSwitch offSwitchL;
     BMSmoothSwitch offSwitchR;
+    size_t tapCapacity;
+    
+    // With many taps, the taps after the first fftPartitionLength samples are
+    // processed by FFT convolution
+    bool useFFT, fftInitialised;
+    size_t fftPartitionLength;
+    BMPartitionedConv fftConvL, fftConvR;
+    float *fftBufferL, *fftBufferR;
+    size_t *splitDelaysL, *splitDelaysR;
+    float *splitGainsL, *splitGainsR;
+    
+    // true after BMVelvetNoiseDecorrelator_compileBank. The taps are then
+    // processed by a BMSparseFIR and the struct only generates tap settings,
+    // so it has no delay memory of its own.
+    bool compiledToBank;
 } BMVelvetNoiseDecorrelator;
 
 
@@ -76,6 +93,15 @@ void BMVelvetNoiseDecorrelator_initWithEvenTapDensity(BMVelvetNoiseDecorrelator
 void BMVelvetNoiseDecorrelator_setWetMix(BMVelvetNoiseDecorrelator *This, float wetMix01);
 
 
+/*!
+ *BMVelvetNoiseDecorrelator_setRT60DecayTime
+ *
+ * @abstract regenerate the tap gains with a new decay time
+ *
+ * The new taps, including the FFT convolution kernel, are built on the
+ * calling thread and the process functions crossfade to them over one
+ * buffer. Call this and setFadeIn from one thread at a time.
+ */
 void BMVelvetNoiseDecorrelator_setRT60DecayTime(BMVelvetNoiseDecorrelator *This, float rt60DT);
 
 /*!
@@ -83,6 +109,11 @@ void BMVelvetNoiseDecorrelator_setRT60DecayTime(BMVelvetNoiseDecorrelator *This,
  */
 void BMVelvetNoiseDecorrelator_randomiseAll(BMVelvetNoiseDecorrelator *This);
 
+/*!
+ *BMVelvetNoiseDecorrelator_setFadeIn
+ *
+ * @abstract regenerate the tap gains with a new fade-in time, the same way as setRT60DecayTime
+ */
 void BMVelvetNoiseDecorrelator_setFadeIn(BMVelvetNoiseDecorrelator *This,float fadeInS);
 
 /*!
@@ -129,4 +160,34 @@ void BMVelvetNoiseDecorrelator_processBufferMonoToStereo(BMVelvetNoiseDecorrelat
 
 void BMVelvetNoiseDecorrelator_setNumTaps(BMVelvetNoiseDecorrelator *This, size_t numTaps);
 
+
+/*!
+ *BMVelvetNoiseDecorrelator_compileBank
+ *
+ * Loads the taps of a parallel bank of decorrelators that all take the same
+ * input into a BMSparseFIR, so that the whole bank can be processed in one
+ * pass with BMSparseFIR_processStereo instead of calling the process function
+ * of each decorrelator. The output of vndArray[i] goes to output i of the
+ * sparse FIR. If numVND < bank->numOutputs the remaining outputs are silent.
+ *
+ * Call this again after any call to setNumTaps, setFadeIn, setRT60DecayTime
+ * or setWetMix. Those changes are applied immediately, without waiting for
+ * the off switch of each decorrelator, because the sparse FIR has its own
+ * switch to prevent clicks.
+ *
+ * The decorrelators stay allocated because they still generate the taps:
+ * random tap times, gains with the RT60 and fade-in envelopes, and the wet
+ * mix. The first call frees their multi-tap delays and FFT convolvers, which
+ * the bank replaces, so don't call their process functions after that.
+ *
+ * @param vndArray  array of numVND initialised decorrelators
+ * @param numVND    length of vndArray; must not exceed bank->numOutputs
+ * @param bank      sparse FIR initialised with maxDelay >= the longest delay of any decorrelator
+ * @param smooth    set true to fade out, change taps, and fade in; false to switch immediately
+ */
+void BMVelvetNoiseDecorrelator_compileBank(BMVelvetNoiseDecorrelator *vndArray,
+										   size_t numVND,
+										   BMSparseFIR *bank,
+										   bool smooth);
+
 #endif /* BMVelvetNoiseDecorrelator_h */
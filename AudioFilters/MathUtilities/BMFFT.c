@@ -47,6 +47,28 @@ void BMFFT_init(BMFFT *This, size_t maxInputLength){
     This->window = malloc(sizeof(float)*maxInputLength);
     vDSP_hamm_window(This->window, maxInputLength, 0);
     This->windowCurrentLength = maxInputLength;
+    
+    // BMFFT_initBatch allocates the buffer for BMFFT_absFFTBatch
+    This->batchBuffer.realp = NULL;
+    This->batchBuffer.imagp = NULL;
+    This->batchFrames = 0;
+}
+
+
+
+
+void BMFFT_initBatch(BMFFT *This, size_t maxFrames){
+    assert(maxFrames > 0);
+    free(This->batchBuffer.realp);
+    
+    // as many frames of maxInputLength as fit in BMFFT_BATCH_BUFFER_BYTES,
+    // and at least one
+    size_t framesThatFit = BMFFT_BATCH_BUFFER_BYTES / (sizeof(float) * This->maxInputLength);
+    This->batchFrames = maxFrames < framesThatFit ? maxFrames : framesThatFit;
+    if(This->batchFrames == 0) This->batchFrames = 1;
+    size_t batchBufferLength = This->batchFrames * This->maxInputLength / 2;
+    This->batchBuffer.realp = malloc(sizeof(float) * batchBufferLength * 2);
+    This->batchBuffer.imagp = This->batchBuffer.realp + batchBufferLength;
 }
 
 
@@ -64,6 +86,7 @@ void BMFFT_free(BMFFT *This){
     free(This->fft_buffer_buffer_i);
     free(This->fft_buffer_buffer_r);
     free(This->window);
+    free(This->batchBuffer.realp);
     
     This->fft_input_buffer_i = NULL;
     This->fft_input_buffer_r = NULL;
@@ -72,6 +95,8 @@ void BMFFT_free(BMFFT *This){
     This->fft_buffer_buffer_i = NULL;
     This->fft_buffer_buffer_r = NULL;
     This->window = NULL;
+    This->batchBuffer.realp = NULL;
+    This->batchBuffer.imagp = NULL;
 }
 
 
@@ -183,6 +208,67 @@ float BMFFT_absFFTReturnNyquist(BMFFT *This,
 
 
 
+
+void BMFFT_absFFTBatch(BMFFT *This,
+					   const float * const *inputs,
+					   float * const *outputs,
+					   const float *window,
+					   size_t inputLength,
+					   size_t numFrames){
+	assert(inputLength <= This->maxInputLength);
+	assert(isPowerOfTwo(inputLength));
+	assert(inputLength > 1);
+	assert(This->batchBuffer.realp != NULL); // call BMFFT_initBatch first
+	
+	size_t halfLength = inputLength / 2;
+	size_t recursionLevels = log2i((uint32_t)inputLength);
+	
+	// shorter frames fit more of them in the buffer
+	size_t maxBatchFrames = This->batchFrames * (This->maxInputLength / inputLength);
+	
+	while(numFrames > 0){
+		size_t batchFrames = numFrames < maxBatchFrames ? numFrames : maxBatchFrames;
+		DSPSplitComplex *buffer = &This->batchBuffer;
+		
+		// Window and pack each frame into the split complex format the real
+		// fft uses, with the frames interleaved. Sample pair k of frame m
+		// goes to index k*batchFrames + m.
+		for(size_t m=0; m<batchFrames; m++){
+			if(window){
+				vDSP_vmul(inputs[m], 2, window, 2, buffer->realp + m, batchFrames, halfLength);
+				vDSP_vmul(inputs[m]+1, 2, window+1, 2, buffer->imagp + m, batchFrames, halfLength);
+			} else {
+				DSPSplitComplex frame = {buffer->realp + m, buffer->imagp + m};
+				vDSP_ctoz((const DSPComplex *)inputs[m], 2, &frame, batchFrames, halfLength);
+			}
+		}
+		
+		// transform all the frames in place
+		vDSP_fftm_zrip(This->setup, buffer, batchFrames, 1, recursionLevels, batchFrames, FFT_FORWARD);
+		
+		// The nyquist terms are in the imaginary part of bin 0, which is the
+		// first batchFrames elements of imagp. Save them and clear them so
+		// that bin 0 is just the DC term.
+		for(size_t m=0; m<batchFrames; m++)
+			outputs[m][halfLength] = fabsf(buffer->imagp[m]);
+		vDSP_vclr(buffer->imagp, 1, batchFrames);
+		
+		// take the absolute value of each frame
+		for(size_t m=0; m<batchFrames; m++){
+			DSPSplitComplex frame = {buffer->realp + m, buffer->imagp + m};
+			vDSP_zvabs(&frame, batchFrames, outputs[m], 1, halfLength);
+		}
+		
+		// advance pointers
+		inputs += batchFrames;
+		outputs += batchFrames;
+		numFrames -= batchFrames;
+	}
+}
+
+
+
+
 void BMFFT_hammingWindow(BMFFT *This,
                          const float* input,
                          float* output,
@@ -244,14 +330,24 @@ void BMFFT_kaiserWindow(BMFFT *This,
 						size_t numSamples){
 	assert(numSamples <= This->maxInputLength);
     
-    // if the window cached in the buffer does not have the specified length, or isn't a kaiser window recompute it.
-    if(This->windowCurrentLength != numSamples || This->windowType != BMFFT_KAISER){
-        BMFFT_generateKaiserCoefficients(This->window, beta, numSamples);
-        This->windowCurrentLength = numSamples;
+    const float *window = BMFFT_kaiserCoefficients(This, beta, numSamples);
+    vDSP_vmul(input,1,window,1,output,1,numSamples);
+}
+
+
+
+
+const float* BMFFT_kaiserCoefficients(BMFFT *This, double beta, size_t numSamples){
+	assert(numSamples <= This->maxInputLength);
+	
+	// if the window cached in the buffer does not have the specified length, or isn't a kaiser window recompute it.
+	if(This->windowCurrentLength != numSamples || This->windowType != BMFFT_KAISER){
+		BMFFT_generateKaiserCoefficients(This->window, beta, numSamples);
+		This->windowCurrentLength = numSamples;
 		This->windowType = BMFFT_KAISER;
-    }
-    
-    vDSP_vmul(input,1,This->window,1,output,1,numSamples);
+	}
+	
+	return This->window;
 }
 
 
@@ -14,6 +14,9 @@
 
 enum BMFFTWindowType {BMFFT_NONE,BMFFT_BLACKMANHARRIS,BMFFT_HAMMING,BMFFT_KAISER,BMFFT_HANN};
 
+// the frame-interleaved buffer for batch processing holds at most this many bytes
+#define BMFFT_BATCH_BUFFER_BYTES 262144
+
 typedef struct BMFFT {
 	size_t maxInputLength;
 	
@@ -35,6 +38,10 @@ typedef struct BMFFT {
 	size_t windowCurrentLength;
 	
 	enum BMFFTWindowType windowType;
+	
+	// for BMFFT_absFFTBatch
+	DSPSplitComplex batchBuffer;
+	size_t batchFrames;
 } BMFFT;
 
 
@@ -49,6 +56,18 @@ void BMFFT_init(BMFFT *This, size_t maxInputLength);
 void BMFFT_free(BMFFT *This);
 
 
+/*!
+ *BMFFT_initBatch
+ *
+ * @abstract allocate the buffer for BMFFT_absFFTBatch. BMFFT_init doesn't, so
+ * FFTs that never run batches don't carry it.
+ *
+ * @param This       pointer to an initialised struct
+ * @param maxFrames  the largest number of frames of maxInputLength you expect to pass in one call. The buffer is limited to BMFFT_BATCH_BUFFER_BYTES; larger calls are done in several batches.
+ */
+void BMFFT_initBatch(BMFFT *This, size_t maxFrames);
+
+
 /*!
  *BMFFT_complexFFT
  *
@@ -137,6 +156,46 @@ float BMFFT_absFFTReturnNyquist(BMFFT *This,
 
 
 
+/*!
+ *BMFFT_absFFTBatch
+ *
+ * @abstract compute the absolute value of the FFT of numFrames frames of the same length
+ *
+ * @discussion The frames are windowed and packed into a frame-interleaved
+ * buffer, with sample k of every frame next to each other, and transformed
+ * together with vDSP_fftm_zrip. Interleaving the frames lets the FFT run
+ * its vector lanes across frames and load each twiddle factor once per
+ * batch rather than once per frame. The buffer holds a batch of up to
+ * BMFFT_BATCH_BUFFER_BYTES; larger numFrames are done in several batches.
+ * Call BMFFT_initBatch once before using this.
+ *
+ * @param This         pointer to an initialized BMFFT struct
+ * @param inputs       numFrames pointers to frames of real valued input, each with length = inputLength. Frames may overlap.
+ * @param outputs      numFrames pointers to output arrays, each with length = 1 + inputLength/2. output[m][inputLength/2] is the Nyquist term.
+ * @param window       window coefficients with length = inputLength, or NULL for no window
+ * @param inputLength  a power of 2 <= This->maxInputLength
+ * @param numFrames    number of frames
+ */
+void BMFFT_absFFTBatch(BMFFT *This,
+					   const float * const *inputs,
+					   float * const *outputs,
+					   const float *window,
+					   size_t inputLength,
+					   size_t numFrames);
+
+
+
+
+/*!
+ *BMFFT_kaiserCoefficients
+ *
+ * @returns the Kaiser window that BMFFT_kaiserWindow applies, computing it if the cached window has a different length or type
+ */
+const float* BMFFT_kaiserCoefficients(BMFFT *This, double beta, size_t numSamples);
+
+
+
+
 /*!
  *BMFFT_hammingWindow
  *
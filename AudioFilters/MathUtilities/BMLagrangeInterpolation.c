@@ -11,117 +11,93 @@
 #include <Accelerate/Accelerate.h>
 #include "Constants.h"
 
+#include <dispatch/dispatch.h>
+
 float calculateH(float fractionalDelay, float n,float order);
 //static inline int BMLI_getStartIdx(float orderF,float strideIdx);
 
+static BMLagrangePolyphaseTable BMLGI_polyphaseTables [BMLGI_MAX_ORDER + 1];
+static dispatch_once_t BMLGI_polyphaseTableOnce [BMLGI_MAX_ORDER + 1];
+
 void BMLagrangeInterpolation_init(BMLagrangeInterpolation* This, int order){
     assert(order%2==0);
+    assert(order <= BMLGI_MAX_ORDER);
     
     This->order = order;
-    This->totalStepPerSample = 20000;//order*20;
     This->startIdxFactor = (order* 0.5f - 1.0f);
-    This->deltaStep = 1.0/This->totalStepPerSample;
-    This->deltaRange = This->totalStepPerSample * This->order * 0.5;
-    
-    This->sampleRange = order+1;
-    This->startIdxBuffer = malloc(sizeof(int)*BM_BUFFER_CHUNK_SIZE);
-    This->deltaX = malloc(sizeof(int)*BM_BUFFER_CHUNK_SIZE);
-    This->floatBuffer1 = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
-    This->floatBuffer2 = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
-    This->sizeTBuffer1 = malloc(sizeof(size_t)*BM_BUFFER_CHUNK_SIZE);
-    This->sizeTBuffer2 = malloc(sizeof(size_t)*BM_BUFFER_CHUNK_SIZE);
-    
-    This->table = malloc(sizeof(float*)*This->sampleRange);
-    for(int i=0;i<This->sampleRange;i++){
-        This->table[i] = malloc(sizeof(float)*This->deltaRange);
-    }
-    This->temp = malloc(sizeof(float)* This->sampleRange);
-    
-    //
-    for(int i=0;i<This->deltaRange;i++){
-        for(int j=0;j<This->sampleRange;j++){
-            This->table[j][i] = calculateH(i * This->deltaStep, j,This->order);
-//            printf("%f\n",This->table[i][j]);
-        }
-    }
-    
+    This->table = BMLagrangeInterpolation_getPolyphaseTable(order);
 }
 
 void BMLagrangeInterpolation_destroy(BMLagrangeInterpolation* This){
-    free(This->startIdxBuffer);
-    free(This->deltaX);
-    free(This->floatBuffer1);
-    free(This->floatBuffer2);
-    free(This->sizeTBuffer1);
-    free(This->sizeTBuffer2);
-    
-    for(int i=0;i<This->sampleRange;i++){
-        free(This->table[i]);
-    }
-    
-    free(This->table);
-    free(This->temp);
+    // the table is shared so we don't free it
+    This->table = NULL;
 }
 
-typedef unsigned vUint64_2 __attribute__((ext_vector_type(2),aligned(4)));
-typedef signed vSint32_2 __attribute__((ext_vector_type(2),aligned(4)));
 
-void vectorConvertIntToSize_t(const int* input, size_t* output, size_t length){
-    for(size_t i=0; i<length; i++)
-        output[i] = (size_t)input[i];
+
+/*
+ * Fill the table for one interpolation order. The read position is always
+ * in [startIdxFactor, startIdxFactor + 1) relative to the first tap.
+ */
+static void BMLagrangeInterpolation_initPolyphaseTable(void* context){
+    BMLagrangePolyphaseTable* table = context;
+    size_t order = table - BMLGI_polyphaseTables;
+    float startIdxFactor = order * 0.5f - 1.0f;
     
-//    size_t n=length;
-//    while(n>2){
-//        *(vSint32_2*)output = __builtin_convertvector(*(vUint64_2*)input,vSint32_2);
-//        output -= 2;
-//        input -= 2;
-//        n -= 2;
-//    }
-//    if(n>0)
-//        *output = *input;
+    table->order = order;
+    table->coefficients = malloc(sizeof(simd_float8) * (BMLGI_NUM_PHASES + 1));
+    table->slopes = malloc(sizeof(simd_float8) * BMLGI_NUM_PHASES);
+    for(size_t p=0; p<=BMLGI_NUM_PHASES; p++){
+        float delta = startIdxFactor + (float)p / (float)BMLGI_NUM_PHASES;
+        table->coefficients[p] = 0.0f;
+        for(size_t j=0; j<=order; j++)
+            table->coefficients[p][j] = calculateH(delta, j, order);
+    }
+    for(size_t p=0; p<BMLGI_NUM_PHASES; p++)
+        table->slopes[p] = table->coefficients[p+1] - table->coefficients[p];
 }
 
 
-void BMLagrangeInterpolation_processUpSample(BMLagrangeInterpolation* This, const float* input, const float* strideInput, float* output, int outputStride, size_t inputLength,size_t outputLength){
-    
-    // get the start index for the input data used to calculate each sample of output
-    float negStartIdxFactor = - This->startIdxFactor;
-    float* startIdxBufferF = (float*) This->startIdxBuffer;
-    vDSP_vsadd(strideInput, 1, &negStartIdxFactor, startIdxBufferF, 1, outputLength);
-    int frameCount = (int)outputLength;
-    vvfloorf(startIdxBufferF, startIdxBufferF,&frameCount);
-
-    //Calculate the delta
-    float* deltaXF = (float*) This->deltaX;
-    vDSP_vsub(startIdxBufferF, 1, strideInput, 1, deltaXF, 1, outputLength);
-    vDSP_vsmul(deltaXF, 1, &This->totalStepPerSample, deltaXF, 1, outputLength);
-    
-    vDSP_vfix32(deltaXF, 1, This->deltaX, 1, outputLength);
-    vectorConvertIntToSize_t(This->deltaX, This->sizeTBuffer2, outputLength);
 
-    //Convert startIdxBuffer float to int
-    vDSP_vfix32(startIdxBufferF, 1, This->startIdxBuffer, 1, outputLength);
+const BMLagrangePolyphaseTable* BMLagrangeInterpolation_getPolyphaseTable(size_t order){
+    assert(order <= BMLGI_MAX_ORDER);
+    dispatch_once_f(&BMLGI_polyphaseTableOnce[order],
+                    &BMLGI_polyphaseTables[order],
+                    BMLagrangeInterpolation_initPolyphaseTable);
+    return &BMLGI_polyphaseTables[order];
+}
 
-    // calculate the locations from which we need to read
-    int offset = 1;
-    vDSP_vsaddi(This->startIdxBuffer, 1, &offset, This->startIdxBuffer, 1, outputLength);
-    vectorConvertIntToSize_t(This->startIdxBuffer, This->sizeTBuffer1, outputLength);
 
-    for(int i=0; i<This->sampleRange; i++){
 
-        // copy from the specified locations in the input buffer to a temp buffer
-        vDSP_vgathr(input+i, This->sizeTBuffer1, 1, This->floatBuffer1, 1, outputLength);
+void BMLagrangeInterpolation_processStride(BMLagrangeInterpolation* This, const float* input, const float* strideInput, float strideOffset, float* output, size_t length){
+    const simd_float8* coefficients = This->table->coefficients;
+    const simd_float8* slopes = This->table->slopes;
+    
+    // shift the read position so that its integer part is the first tap
+    float offset = strideOffset - This->startIdxFactor;
+    
+    for(size_t i=0; i<length; i++){
+        // the read positions are positive so truncation works as floor
+        float position = strideInput[i] + offset;
+        size_t startIdx = (size_t)position;
+        
+        // find the table phase and interpolate between adjacent phases
+        float phaseF = (position - (float)startIdx) * (float)BMLGI_NUM_PHASES;
+        size_t phase = (size_t)phaseF;
+        float t = phaseF - (float)phase;
+        simd_float8 h = coefficients[phase] + t * slopes[phase];
+        
+        // all taps of one output sample are contiguous in the input
+        simd_float8 x = *(const simd_packed_float8*)(input + startIdx);
+        output[i] = simd_reduce_add(h * x);
+    }
+}
 
-        // get the ith interpolation coefficients and store into a buffer
-        vDSP_vgathr(This->table[i],This->sizeTBuffer2,1,This->floatBuffer2, 1, outputLength);
 
-        // multiply the coefficients by the input buffer data
-        if (i==0) // first row of coefficients: write straight to output
-           vDSP_vmul(This->floatBuffer1,1,This->floatBuffer2,1,output,1,outputLength);
 
-        else // subsequent rows, sum to output
-            vDSP_vma(This->floatBuffer1, 1, This->floatBuffer2, 1, output, 1, output, 1, outputLength);
-    }
+void BMLagrangeInterpolation_processUpSample(BMLagrangeInterpolation* This, const float* input, const float* strideInput, float* output, int outputStride, size_t inputLength,size_t outputLength){
+    assert(outputStride == 1);
+    BMLagrangeInterpolation_processStride(This, input, strideInput, 0.0f, output, outputLength);
 }
 
 //float BMLagrangeInterpolation_processOneSample(BMLagrangeInterpolation* This, const float* input, const float strideInput,size_t inputLength){
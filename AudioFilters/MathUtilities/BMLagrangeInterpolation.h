@@ -10,23 +10,30 @@
 #define BMLagrangeInterpolation_h
 
 #include <stdio.h>
+#include <simd/simd.h>
+
+// the shared coefficient table has this many phases between adjacent samples
+#define BMLGI_NUM_PHASES 256
+
+// the taps for one output sample fit into a single simd_float8
+#define BMLGI_MAX_ORDER 6
+
+/*
+ * Coefficients for Lagrange interpolation at BMLGI_NUM_PHASES + 1 evenly
+ * spaced fractional positions. Row p holds the coefficients of all taps at
+ * phase p, padded with zeros to 8 taps. slopes[p] = coefficients[p+1] -
+ * coefficients[p], for linear interpolation between phases.
+ */
+typedef struct BMLagrangePolyphaseTable {
+    simd_float8* coefficients;
+    simd_float8* slopes;
+    size_t order;
+} BMLagrangePolyphaseTable;
 
 typedef struct BMLagrangeInterpolation {
-    float** table;
+    const BMLagrangePolyphaseTable* table;
     size_t order;
     float startIdxFactor;
-    int* startIdxBuffer;
-    int* deltaX;
-    size_t* sizeTBuffer1;
-    size_t* sizeTBuffer2;
-    float* floatBuffer1;
-    float* floatBuffer2;
-    size_t deltaRange;
-    size_t sampleRange;
-    float* temp;
-    float deltaStep;
-    float totalStepPerSample;
-    
 }BMLagrangeInterpolation;
 
 void BMLagrangeInterpolation_init(BMLagrangeInterpolation* This, int order);
@@ -37,6 +44,20 @@ Provide upsample output. The number of upsample base on the order.
  */
 void BMLagrangeInterpolation_processUpSample(BMLagrangeInterpolation* This, const float* input, const float* strideInput, float* output, int outputStride,size_t inputLength,size_t length);
 
+/*!
+ *BMLagrangeInterpolation_processStride
+ *
+ * @abstract Read from input at the fractional positions strideInput[i] + strideOffset. The index calculation, coefficient lookup and dot product are done in a single pass.
+ *
+ * @param This          pointer to an initialised struct
+ * @param input         input array. Reads may go up to 8 samples past the last position.
+ * @param strideInput   fractional read positions
+ * @param strideOffset  added to each read position
+ * @param output        output array of length length
+ * @param length        number of samples to read
+ */
+void BMLagrangeInterpolation_processStride(BMLagrangeInterpolation* This, const float* input, const float* strideInput, float strideOffset, float* output, size_t length);
+
 /*
  Down sample base on the order. Process this to get the sample back after upsample
  */
@@ -45,4 +66,11 @@ void BMLagrangeInterpolation_processDownSample(BMLagrangeInterpolation* This, co
 float BMLagrangeInterpolation_processOneSample(BMLagrangeInterpolation* This, const float* input, const float strideInput,size_t inputLength);
 /* Process 1 sample */
 
+/*!
+ *BMLagrangeInterpolation_getPolyphaseTable
+ *
+ * @abstract returns the coefficient table for the given order. There is one table for each order, shared by all instances. It is created the first time it is requested and never freed.
+ */
+const BMLagrangePolyphaseTable* BMLagrangeInterpolation_getPolyphaseTable(size_t order);
+
 #endif /* BMLagrangeInterpolation_h */
@@ -0,0 +1,524 @@
+//
+//  BMMultichannelLevelMeter.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "BMMultichannelLevelMeter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <Accelerate/Accelerate.h>
+#include "Constants.h"
+
+#define BM_MULTICHANNEL_LEVEL_METER_DEFAULT_BUFFER_LENGTH 256
+#define BM_MULTICHANNEL_LEVEL_METER_FAST_RELEASE_TIME 0.25
+#define BM_MULTICHANNEL_LEVEL_METER_SLOW_RELEASE_TIME 5.0
+
+
+
+/*!
+ *BMLevelMeterReleaseLanes_init
+ */
+static void BMLevelMeterReleaseLanes_init(BMLevelMeterReleaseLanes *This, float fc, float sampleRate, size_t numLanes){
+	BMReleaseFilter_init(&This->coefficients, fc, sampleRate);
+
+	This->ic1 = calloc(numLanes, sizeof(simd_float4));
+	This->ic2 = calloc(numLanes, sizeof(simd_float4));
+	This->previousOutputValue = calloc(numLanes, sizeof(simd_float4));
+	This->attackMode = calloc(numLanes, sizeof(simd_int4));
+}
+
+
+
+
+/*!
+ *BMLevelMeterReleaseLanes_free
+ */
+static void BMLevelMeterReleaseLanes_free(BMLevelMeterReleaseLanes *This){
+	free(This->ic1);
+	free(This->ic2);
+	free(This->previousOutputValue);
+	free(This->attackMode);
+	This->ic1 = NULL;
+	This->ic2 = NULL;
+	This->previousOutputValue = NULL;
+	This->attackMode = NULL;
+}
+
+
+
+
+/*!
+ *BMLevelMeterReleaseLanes_process
+ *
+ * @abstract one step of BMReleaseFilter_processBuffer on every lane. Works in place.
+ */
+static void BMLevelMeterReleaseLanes_process(BMLevelMeterReleaseLanes *This,
+											 const simd_float4 *input,
+											 simd_float4 *output,
+											 size_t numLanes){
+	float a1 = This->coefficients.a1;
+	float a2 = This->coefficients.a2;
+	float a3 = This->coefficients.a3;
+	simd_float4 zero = 0.0f;
+
+	for(size_t i=0; i<numLanes; i++){
+		simd_float4 x = input[i];
+		simd_float4 previous = This->previousOutputValue[i];
+		simd_int4 attack = x > previous;
+
+		// on the first sample in release mode, set the gradient to zero and
+		// start from the previous output to keep the output continuous
+		simd_int4 restart = This->attackMode[i] & ~attack;
+		simd_float4 ic1 = simd_select(This->ic1[i], zero, restart);
+		simd_float4 ic2 = simd_select(This->ic2[i], previous, restart);
+
+		// process the state variable filter. In attack mode the state is
+		// reset before it is used again, so it's safe to update it anyway.
+		simd_float4 v3 = x - ic2;
+		simd_float4 v1 = a1 * ic1 + a2 * v3;
+		simd_float4 v2 = ic2 + a2 * ic1 + a3 * v3;
+		This->ic1[i] = 2.0f * v1 - ic1;
+		This->ic2[i] = 2.0f * v2 - ic2;
+
+		// in attack mode, copy the input to the output
+		simd_float4 y = simd_select(v2, x, attack);
+		This->attackMode[i] = attack;
+		This->previousOutputValue[i] = y;
+		output[i] = y;
+	}
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_setKWeighting
+ *
+ * @abstract set the two stages of the BS.1770 K-weighting filter on all channels
+ *
+ * @discussion The coefficients are from the analog prototype of the BS.1770
+ * filters, so they are correct at any sample rate, not only 48 kHz.
+ */
+static void BMMultichannelLevelMeter_setKWeighting(BMMultichannelLevelMeter *This){
+	double sampleRate = This->sampleRate;
+
+	// stage 1: high shelf, +4 dB above 1.7 kHz
+	double f0 = 1681.974450955533;
+	double G = 3.999843853973347;
+	double Q = 0.7071752369554196;
+	double K = tan(M_PI * f0 / sampleRate);
+	double Vh = pow(10.0, G / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+	for(size_t i=0; i<This->numChannelsOver4; i++){
+		This->shelf.b0[i] = (Vh + Vb * K / Q + K * K) / a0;
+		This->shelf.b1[i] = 2.0 * (K * K - Vh) / a0;
+		This->shelf.b2[i] = (Vh - Vb * K / Q + K * K) / a0;
+		This->shelf.a1neg[i] = -2.0 * (K * K - 1.0) / a0;
+		This->shelf.a2neg[i] = -(1.0 - K / Q + K * K) / a0;
+	}
+
+	// stage 2: high pass at 38 Hz
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(M_PI * f0 / sampleRate);
+	a0 = 1.0 + K / Q + K * K;
+	for(size_t i=0; i<This->numChannelsOver4; i++){
+		This->highPass.b0[i] = 1.0f;
+		This->highPass.b1[i] = -2.0f;
+		This->highPass.b2[i] = 1.0f;
+		This->highPass.a1neg[i] = -2.0 * (K * K - 1.0) / a0;
+		This->highPass.a2neg[i] = -(1.0 - K / Q + K * K) / a0;
+	}
+}
+
+
+
+
+void BMMultichannelLevelMeter_init(BMMultichannelLevelMeter *This, size_t numChannels, float sampleRate){
+	assert(numChannels > 0);
+
+	This->sampleRate = sampleRate;
+	This->numChannels = numChannels;
+	This->numChannelsOver4 = (numChannels + 3) / 4;
+	This->expectedBufferLength = BM_MULTICHANNEL_LEVEL_METER_DEFAULT_BUFFER_LENGTH;
+	size_t numLanes = This->numChannelsOver4;
+	size_t numChannelsPadded = 4 * numLanes;
+
+	// K-weighting
+	BMBiquadArray4_init(&This->shelf, numChannelsPadded, sampleRate);
+	BMBiquadArray4_init(&This->highPass, numChannelsPadded, sampleRate);
+	BMMultichannelLevelMeter_setKWeighting(This);
+
+	// true peak
+	This->upsamplers = malloc(sizeof(BMUpsampler) * numChannels);
+	for(size_t i=0; i<numChannels; i++)
+		BMUpsampler_init(&This->upsamplers[i], false, BMMLM_TRUE_PEAK_OVERSAMPLING, BMRESAMPLER_FULL_SPECTRUM);
+	This->upsampled = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * BMMLM_TRUE_PEAK_OVERSAMPLING);
+	This->maxTruePeak = calloc(numChannels, sizeof(float));
+
+	// release filters for the true peak display
+	float buffersPerSecond = sampleRate / (float)This->expectedBufferLength;
+	float fastReleaseFc = ARTimeToCutoffFrequency(BM_MULTICHANNEL_LEVEL_METER_FAST_RELEASE_TIME, 1);
+	float slowReleaseFc = ARTimeToCutoffFrequency(BM_MULTICHANNEL_LEVEL_METER_SLOW_RELEASE_TIME, BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS);
+	BMLevelMeterReleaseLanes_init(&This->fastRelease, fastReleaseFc, buffersPerSecond, numLanes);
+	for(size_t i=0; i<BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS; i++)
+		BMLevelMeterReleaseLanes_init(&This->slowRelease[i], slowReleaseFc, buffersPerSecond, numLanes);
+	This->truePeak_dB = malloc(sizeof(simd_float4) * numLanes);
+	This->fastPeak_dB = malloc(sizeof(simd_float4) * numLanes);
+	This->slowPeak_dB = malloc(sizeof(simd_float4) * numLanes);
+	vDSP_vfill(&(float){BMMLM_SILENCE_DB}, (float*)This->truePeak_dB, 1, numChannelsPadded);
+
+	// The channels are packed into lanes by interleaving them. The padding
+	// channels, if any, read from a buffer of zeros.
+	BMInterleaver_init(&This->interleaver, numChannelsPadded, BMSampleFormat_float32);
+	This->channelPointers = malloc(sizeof(float*) * numChannelsPadded);
+	This->zeros = calloc(BM_BUFFER_CHUNK_SIZE, sizeof(float));
+	for(size_t i=numChannels; i<numChannelsPadded; i++)
+		This->channelPointers[i] = This->zeros;
+	This->frames = malloc(sizeof(simd_float4) * numLanes * BM_BUFFER_CHUNK_SIZE);
+	This->shelfOutput = malloc(sizeof(simd_float4) * numLanes);
+	This->kWeighted = malloc(sizeof(simd_float4) * numLanes);
+
+	// loudness
+	This->sumOfSquares = calloc(numLanes, sizeof(simd_float4));
+	This->channelWeights = calloc(numLanes, sizeof(simd_float4));
+	for(size_t i=0; i<numChannels; i++)
+		BMMultichannelLevelMeter_setChannelWeight(This, i, 1.0f);
+	This->subblockLength = (size_t)round(sampleRate * BMMLM_SUBBLOCK_TIME);
+	BMMultichannelLevelMeter_reset(This);
+}
+
+
+
+
+void BMMultichannelLevelMeter_free(BMMultichannelLevelMeter *This){
+	BMBiquadArray4_free(&This->shelf);
+	BMBiquadArray4_free(&This->highPass);
+
+	for(size_t i=0; i<This->numChannels; i++)
+		BMUpsampler_free(&This->upsamplers[i]);
+	free(This->upsamplers);
+	free(This->upsampled);
+	free(This->maxTruePeak);
+	This->upsamplers = NULL;
+	This->upsampled = NULL;
+	This->maxTruePeak = NULL;
+
+	BMLevelMeterReleaseLanes_free(&This->fastRelease);
+	for(size_t i=0; i<BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS; i++)
+		BMLevelMeterReleaseLanes_free(&This->slowRelease[i]);
+	free(This->truePeak_dB);
+	free(This->fastPeak_dB);
+	free(This->slowPeak_dB);
+	This->truePeak_dB = NULL;
+	This->fastPeak_dB = NULL;
+	This->slowPeak_dB = NULL;
+
+	free(This->channelPointers);
+	free(This->zeros);
+	free(This->frames);
+	free(This->shelfOutput);
+	free(This->kWeighted);
+	This->channelPointers = NULL;
+	This->zeros = NULL;
+	This->frames = NULL;
+	This->shelfOutput = NULL;
+	This->kWeighted = NULL;
+
+	free(This->sumOfSquares);
+	free(This->channelWeights);
+	This->sumOfSquares = NULL;
+	This->channelWeights = NULL;
+}
+
+
+
+
+void BMMultichannelLevelMeter_setChannelWeight(BMMultichannelLevelMeter *This, size_t channel, float weight){
+	assert(channel < This->numChannels);
+	((float*)This->channelWeights)[channel] = weight;
+}
+
+
+
+
+void BMMultichannelLevelMeter_reset(BMMultichannelLevelMeter *This){
+	memset(This->maxTruePeak, 0, sizeof(float) * This->numChannels);
+
+	memset(This->sumOfSquares, 0, sizeof(simd_float4) * This->numChannelsOver4);
+	memset(This->subblockEnergy, 0, sizeof(This->subblockEnergy));
+	This->samplesInSubblock = 0;
+	This->subblockIndex = 0;
+	This->numSubblocks = 0;
+
+	memset(This->histogramCount, 0, sizeof(This->histogramCount));
+	memset(This->histogramEnergy, 0, sizeof(This->histogramEnergy));
+	This->gatedCount = 0;
+	This->gatedEnergy = 0.0;
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_setBufferSize
+ *
+ * @abstract update the release filters for a new buffer size. See BMLevelMeter_setBufferSize.
+ */
+static void BMMultichannelLevelMeter_setBufferSize(BMMultichannelLevelMeter *This, size_t bufferSize){
+	float buffersPerSecond = This->sampleRate / (float)bufferSize;
+	BMReleaseFilter_updateSampleRate(&This->fastRelease.coefficients, buffersPerSecond);
+	for(size_t i=0; i<BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS; i++)
+		BMReleaseFilter_updateSampleRate(&This->slowRelease[i].coefficients, buffersPerSecond);
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_energyToLoudness
+ *
+ * @returns the loudness in LUFS of a weighted sum of mean squares
+ */
+static double BMMultichannelLevelMeter_energyToLoudness(double energy){
+	if(energy > 0.0)
+		return -0.691 + 10.0 * log10(energy);
+	return BMMLM_SILENCE_DB;
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_addGatingBlock
+ *
+ * @abstract add a 400 ms block to the histogram for the integrated loudness
+ */
+static void BMMultichannelLevelMeter_addGatingBlock(BMMultichannelLevelMeter *This, double energy){
+	// absolute gate
+	double loudness = BMMultichannelLevelMeter_energyToLoudness(energy);
+	if(loudness < BMMLM_ABSOLUTE_GATE_LUFS)
+		return;
+
+	size_t bin = (size_t)((loudness - BMMLM_ABSOLUTE_GATE_LUFS) * BMMLM_HISTOGRAM_BINS_PER_LU);
+	bin = BM_MIN(bin, BMMLM_HISTOGRAM_LENGTH - 1);
+	This->histogramCount[bin]++;
+	This->histogramEnergy[bin] += energy;
+
+	// keep totals of everything above the absolute gate so that we can find
+	// the relative gate without scanning the histogram
+	This->gatedCount++;
+	This->gatedEnergy += energy;
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_meanEnergy
+ *
+ * @returns the mean energy of the last numSubblocks sub-blocks
+ */
+static double BMMultichannelLevelMeter_meanEnergy(const BMMultichannelLevelMeter *This, size_t numSubblocks){
+	double sum = 0.0;
+	size_t index = This->subblockIndex;
+	for(size_t i=0; i<numSubblocks; i++){
+		index = (index == 0) ? BMMLM_SHORT_TERM_SUBBLOCKS - 1 : index - 1;
+		sum += This->subblockEnergy[index];
+	}
+	return sum / (double)numSubblocks;
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_finishSubblock
+ *
+ * @abstract sum the channels of a complete 100 ms sub-block into its energy and update the gating blocks
+ */
+static void BMMultichannelLevelMeter_finishSubblock(BMMultichannelLevelMeter *This){
+	// weighted sum of the mean squares of the channels
+	double energy = 0.0;
+	for(size_t i=0; i<This->numChannelsOver4; i++)
+		energy += simd_reduce_add(This->channelWeights[i] * This->sumOfSquares[i]);
+	energy /= (double)This->subblockLength;
+	memset(This->sumOfSquares, 0, sizeof(simd_float4) * This->numChannelsOver4);
+
+	// add it to the ring of recent sub-blocks
+	This->subblockEnergy[This->subblockIndex] = energy;
+	This->subblockIndex = (This->subblockIndex + 1) % BMMLM_SHORT_TERM_SUBBLOCKS;
+	This->numSubblocks++;
+	This->samplesInSubblock = 0;
+
+	// gating blocks are 400 ms long and start every 100 ms
+	if(This->numSubblocks >= BMMLM_MOMENTARY_SUBBLOCKS)
+		BMMultichannelLevelMeter_addGatingBlock(This, BMMultichannelLevelMeter_meanEnergy(This, BMMLM_MOMENTARY_SUBBLOCKS));
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_processLoudness
+ *
+ * @abstract K-weight the input and add its mean square to the sub-blocks
+ */
+static void BMMultichannelLevelMeter_processLoudness(BMMultichannelLevelMeter *This,
+													 const float * const *inputs,
+													 size_t bufferLength){
+	size_t numLanes = This->numChannelsOver4;
+	size_t offset = 0;
+
+	while(offset < bufferLength){
+		// don't cross the end of a sub-block
+		size_t samplesProcessing = BM_MIN(bufferLength - offset, BM_BUFFER_CHUNK_SIZE);
+		samplesProcessing = BM_MIN(samplesProcessing, This->subblockLength - This->samplesInSubblock);
+
+		// pack the channels into frames of lanes
+		for(size_t i=0; i<This->numChannels; i++)
+			This->channelPointers[i] = inputs[i] + offset;
+		BMInterleaver_interleave(&This->interleaver, This->channelPointers, This->frames, samplesProcessing);
+
+		// filter one frame at a time and sum the squares in each lane
+		for(size_t i=0; i<samplesProcessing; i++){
+			simd_float4 *frame = This->frames + i * numLanes;
+			BMBiquadArray4_processSample(&This->shelf, frame, This->shelfOutput, numLanes);
+			BMBiquadArray4_processSample(&This->highPass, This->shelfOutput, This->kWeighted, numLanes);
+			for(size_t j=0; j<numLanes; j++)
+				This->sumOfSquares[j] += This->kWeighted[j] * This->kWeighted[j];
+		}
+
+		This->samplesInSubblock += samplesProcessing;
+		if(This->samplesInSubblock == This->subblockLength)
+			BMMultichannelLevelMeter_finishSubblock(This);
+
+		offset += samplesProcessing;
+	}
+}
+
+
+
+
+/*!
+ *BMMultichannelLevelMeter_processTruePeak
+ *
+ * @abstract find the true peak of each channel in dB and update the max true peak
+ */
+static void BMMultichannelLevelMeter_processTruePeak(BMMultichannelLevelMeter *This,
+													 const float * const *inputs,
+													 size_t bufferLength){
+	float *truePeak_dB = (float*)This->truePeak_dB;
+
+	for(size_t i=0; i<This->numChannels; i++){
+		float peak = 0.0f;
+		for(size_t offset=0; offset<bufferLength; offset += BM_BUFFER_CHUNK_SIZE){
+			size_t samplesProcessing = BM_MIN(bufferLength - offset, BM_BUFFER_CHUNK_SIZE);
+			size_t lengthOS = samplesProcessing * BMMLM_TRUE_PEAK_OVERSAMPLING;
+			float chunkPeak;
+			BMUpsampler_processBufferMono(&This->upsamplers[i], inputs[i] + offset, This->upsampled, samplesProcessing);
+			vDSP_maxmgv(This->upsampled, 1, &chunkPeak, lengthOS);
+			peak = BM_MAX(peak, chunkPeak);
+		}
+
+		This->maxTruePeak[i] = BM_MAX(This->maxTruePeak[i], peak);
+		truePeak_dB[i] = (peak > 0.0f) ? BM_GAIN_TO_DB(peak) : BMMLM_SILENCE_DB;
+	}
+}
+
+
+
+
+void BMMultichannelLevelMeter_process(BMMultichannelLevelMeter *This,
+									  const float * const *inputs,
+									  float *fastPeak_dB,
+									  float *slowPeak_dB,
+									  size_t bufferLength){
+	// if the buffer size has changed, update the filters to keep the release
+	// times correct
+	if(bufferLength != This->expectedBufferLength){
+		This->expectedBufferLength = bufferLength;
+		BMMultichannelLevelMeter_setBufferSize(This, bufferLength);
+	}
+
+	BMMultichannelLevelMeter_processTruePeak(This, inputs, bufferLength);
+	BMMultichannelLevelMeter_processLoudness(This, inputs, bufferLength);
+
+	// release filter the true peak with fast release time
+	size_t numLanes = This->numChannelsOver4;
+	BMLevelMeterReleaseLanes_process(&This->fastRelease, This->truePeak_dB, This->fastPeak_dB, numLanes);
+
+	// release filter in multiple stages to get the peak with slow release time
+	BMLevelMeterReleaseLanes_process(&This->slowRelease[0], This->truePeak_dB, This->slowPeak_dB, numLanes);
+	for(size_t i=1; i<BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS; i++)
+		BMLevelMeterReleaseLanes_process(&This->slowRelease[i], This->slowPeak_dB, This->slowPeak_dB, numLanes);
+
+	if(fastPeak_dB)
+		memcpy(fastPeak_dB, This->fastPeak_dB, sizeof(float) * This->numChannels);
+	if(slowPeak_dB)
+		memcpy(slowPeak_dB, This->slowPeak_dB, sizeof(float) * This->numChannels);
+}
+
+
+
+
+float BMMultichannelLevelMeter_getMomentaryLoudness(const BMMultichannelLevelMeter *This){
+	return BMMultichannelLevelMeter_energyToLoudness(BMMultichannelLevelMeter_meanEnergy(This, BMMLM_MOMENTARY_SUBBLOCKS));
+}
+
+
+
+
+float BMMultichannelLevelMeter_getShortTermLoudness(const BMMultichannelLevelMeter *This){
+	return BMMultichannelLevelMeter_energyToLoudness(BMMultichannelLevelMeter_meanEnergy(This, BMMLM_SHORT_TERM_SUBBLOCKS));
+}
+
+
+
+
+float BMMultichannelLevelMeter_getIntegratedLoudness(const BMMultichannelLevelMeter *This){
+	if(This->gatedCount == 0)
+		return BMMLM_SILENCE_DB;
+
+	// the relative gate is 10 LU below the loudness of the blocks that pass
+	// the absolute gate
+	double relativeGate = BMMultichannelLevelMeter_energyToLoudness(This->gatedEnergy / (double)This->gatedCount) + BMMLM_RELATIVE_GATE_LU;
+	size_t firstBin = 0;
+	if(relativeGate > BMMLM_ABSOLUTE_GATE_LUFS)
+		firstBin = (size_t)((relativeGate - BMMLM_ABSOLUTE_GATE_LUFS) * BMMLM_HISTOGRAM_BINS_PER_LU);
+	firstBin = BM_MIN(firstBin, BMMLM_HISTOGRAM_LENGTH - 1);
+
+	// mean energy of the blocks that pass both gates
+	uint64_t count = 0;
+	double energy = 0.0;
+	for(size_t i=firstBin; i<BMMLM_HISTOGRAM_LENGTH; i++){
+		count += This->histogramCount[i];
+		energy += This->histogramEnergy[i];
+	}
+
+	if(count == 0)
+		return BMMLM_SILENCE_DB;
+	return BMMultichannelLevelMeter_energyToLoudness(energy / (double)count);
+}
+
+
+
+
+void BMMultichannelLevelMeter_getMaxTruePeak(const BMMultichannelLevelMeter *This, float *truePeak_dB){
+	for(size_t i=0; i<This->numChannels; i++)
+		truePeak_dB[i] = (This->maxTruePeak[i] > 0.0f) ? BM_GAIN_TO_DB(This->maxTruePeak[i]) : BMMLM_SILENCE_DB;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
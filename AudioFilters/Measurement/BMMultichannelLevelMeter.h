@@ -0,0 +1,196 @@
+//
+//  BMMultichannelLevelMeter.h
+//  AudioFiltersXcodeProject
+//
+//  A level meter for any number of channels, with EBU R128 loudness and
+//  true peak.
+//
+//  The channels are processed side by side in SIMD lanes, four channels per
+//  simd_float4, rather than one at a time as in BMLevelMeter. Each buffer
+//  is interleaved into frames of lanes and then:
+//
+//    - K-weighted by a pair of BMBiquadArray4 filters, one lane per channel,
+//      and summed into 100 ms sub-blocks. Momentary loudness is the mean of
+//      the last 4 sub-blocks (400 ms) and short-term loudness is the mean
+//      of the last 30 (3 s), as in ITU-R BS.1770 and EBU R128.
+//
+//    - Every 100 ms, the 400 ms gating block that just ended goes into a
+//      histogram with 0.1 LU bins. Adding a block is O(1) and the
+//      integrated loudness is found from the histogram without storing the
+//      blocks, however long the programme is.
+//
+//    - Each channel is upsampled 4x with BMUpsampler to find the true peak.
+//      The per-buffer true peak is smoothed with fast and slow release
+//      filters for display, like the peak levels of BMLevelMeter, but with
+//      all the channels filtered together in SIMD lanes.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BMMultichannelLevelMeter_h
+#define BMMultichannelLevelMeter_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <simd/simd.h>
+#include "BMBiquadArray.h"
+#include "BMUpsampler.h"
+#include "BMInterleaver.h"
+#include "BMEnvelopeFollower.h"
+#include "BMLevelMeter.h"
+
+#define BMMLM_TRUE_PEAK_OVERSAMPLING 4
+#define BMMLM_SUBBLOCK_TIME 0.1
+#define BMMLM_MOMENTARY_SUBBLOCKS 4
+#define BMMLM_SHORT_TERM_SUBBLOCKS 30
+#define BMMLM_ABSOLUTE_GATE_LUFS -70.0
+#define BMMLM_RELATIVE_GATE_LU -10.0
+#define BMMLM_HISTOGRAM_BINS_PER_LU 10
+#define BMMLM_HISTOGRAM_LENGTH 1000
+#define BMMLM_SILENCE_DB -128.0f
+
+
+/*
+ * Release filters for a group of channels, as in BMReleaseFilter, with the
+ * state of each channel in one lane. The coefficients are the same for
+ * every channel so they are kept in a single BMReleaseFilter.
+ */
+typedef struct BMLevelMeterReleaseLanes {
+	BMReleaseFilter coefficients;
+	simd_float4 *ic1, *ic2, *previousOutputValue;
+	simd_int4 *attackMode;
+} BMLevelMeterReleaseLanes;
+
+
+typedef struct BMMultichannelLevelMeter {
+	// K-weighting filters
+	BMBiquadArray4 shelf, highPass;
+
+	// true peak
+	BMUpsampler *upsamplers;
+	BMLevelMeterReleaseLanes fastRelease;
+	BMLevelMeterReleaseLanes slowRelease [BM_PEAK_METER_NUM_SLOW_RELEASE_FILTERS];
+	float *upsampled, *maxTruePeak;
+	simd_float4 *truePeak_dB, *fastPeak_dB, *slowPeak_dB;
+
+	// packing the channels into lanes
+	BMInterleaver interleaver;
+	const float **channelPointers;
+	float *zeros;
+	simd_float4 *frames, *shelfOutput, *kWeighted;
+
+	// loudness
+	simd_float4 *sumOfSquares, *channelWeights;
+	double subblockEnergy [BMMLM_SHORT_TERM_SUBBLOCKS];
+	size_t subblockLength, samplesInSubblock, subblockIndex, numSubblocks;
+	uint64_t histogramCount [BMMLM_HISTOGRAM_LENGTH];
+	double histogramEnergy [BMMLM_HISTOGRAM_LENGTH];
+	uint64_t gatedCount;
+	double gatedEnergy;
+
+	float sampleRate;
+	size_t numChannels, numChannelsOver4, expectedBufferLength;
+} BMMultichannelLevelMeter;
+
+
+
+/*!
+ *BMMultichannelLevelMeter_init
+ *
+ * @param This         pointer to an uninitialised struct
+ * @param numChannels  number of channels. Need not be a multiple of 4.
+ * @param sampleRate   audio sample rate
+ */
+void BMMultichannelLevelMeter_init(BMMultichannelLevelMeter *This, size_t numChannels, float sampleRate);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_free
+ */
+void BMMultichannelLevelMeter_free(BMMultichannelLevelMeter *This);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_setChannelWeight
+ *
+ * @abstract set the weight of a channel in the loudness sum. The default is 1. BS.1770 uses 1.41 for the surround channels and 0 for the LFE channel.
+ */
+void BMMultichannelLevelMeter_setChannelWeight(BMMultichannelLevelMeter *This, size_t channel, float weight);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_process
+ *
+ * @abstract measure a buffer of audio on all channels
+ *
+ * @param This          pointer to an initialised struct
+ * @param inputs        array of numChannels pointers to buffers of length bufferLength
+ * @param fastPeak_dB   output array of length numChannels. The true peak level of each channel, with fast release. May be NULL.
+ * @param slowPeak_dB   output array of length numChannels. The true peak level of each channel, with slow release. May be NULL.
+ * @param bufferLength  length of each input buffer. As in BMLevelMeter, if this changes from one call to the next, the release filters are adjusted to keep the release times constant.
+ */
+void BMMultichannelLevelMeter_process(BMMultichannelLevelMeter *This,
+									  const float * const *inputs,
+									  float *fastPeak_dB,
+									  float *slowPeak_dB,
+									  size_t bufferLength);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_getMomentaryLoudness
+ *
+ * @returns the loudness of the last 400 ms in LUFS
+ */
+float BMMultichannelLevelMeter_getMomentaryLoudness(const BMMultichannelLevelMeter *This);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_getShortTermLoudness
+ *
+ * @returns the loudness of the last 3 seconds in LUFS
+ */
+float BMMultichannelLevelMeter_getShortTermLoudness(const BMMultichannelLevelMeter *This);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_getIntegratedLoudness
+ *
+ * @returns the gated loudness in LUFS of everything since init or the last reset. The relative gate is applied at the resolution of the histogram, 0.1 LU.
+ */
+float BMMultichannelLevelMeter_getIntegratedLoudness(const BMMultichannelLevelMeter *This);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_getMaxTruePeak
+ *
+ * @param This         pointer to an initialised struct
+ * @param truePeak_dB  output array of length numChannels. The highest true peak of each channel since init or the last reset, in dBTP.
+ */
+void BMMultichannelLevelMeter_getMaxTruePeak(const BMMultichannelLevelMeter *This, float *truePeak_dB);
+
+
+
+/*!
+ *BMMultichannelLevelMeter_reset
+ *
+ * @abstract start a new programme: clear the integrated loudness and the max true peaks
+ */
+void BMMultichannelLevelMeter_reset(BMMultichannelLevelMeter *This);
+
+#endif /* BMMultichannelLevelMeter_h */
+
+#ifdef __cplusplus
+}
+#endif
@@ -43,7 +43,7 @@ float BMGeometricMean(const float *input, float *temp, size_t length){
 	int length_i = (int)length;
     vvlog2f(temp, input, &length_i);
     float meanExp;
-    vDSP_meanv(input,1,&meanExp,length);
+    vDSP_meanv(temp,1,&meanExp,length);
     return powf(2.0f, meanExp);
 	
 }
@@ -69,8 +69,9 @@ float BMGeometricArithmeticMean(const float *X, float *temp, size_t length){
     float smallNumber = BM_DB_TO_GAIN(-140.0f);
 	vDSP_vthr(X, 1, &smallNumber, temp, 1, length);
 	
-	// find the geometric mean
-	float geometricMean = BMGeometricMean(X, temp, length);
+	// find the geometric mean of the values without zeros. vvlog2f works in
+	// place so temp can be both input and output.
+	float geometricMean = BMGeometricMean(temp, temp, length);
     
     // find the arithmetic mean
     float arithmeticMean;
@@ -84,7 +85,7 @@ float BMGeometricArithmeticMean(const float *X, float *temp, size_t length){
 
 
 
-float BMSFM_process(BMSFM *This, float* input, size_t inputLength){
+float BMSFM_process(BMSFM *This, const float* input, size_t inputLength){
     //ignore the element 0 of input cepstrum & lower inputLength to 2/3
     //Set input 0 to some number to make the sfm go to 0 when no sound
     
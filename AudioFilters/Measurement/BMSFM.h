@@ -48,7 +48,7 @@ void BMSFM_free(BMSFM *This);
  * @param input  an array of floats with length = inputLength
  * @param inputLength   length of input
  */
-float BMSFM_process(BMSFM *This, float* input, size_t inputLength);
+float BMSFM_process(BMSFM *This, const float* input, size_t inputLength);
 
 
 /*!
@@ -0,0 +1,220 @@
+//
+//  BMSlidingWindow.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#include "BMSlidingWindow.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <Accelerate/Accelerate.h>
+#include "Constants.h"
+
+
+// forward declarations
+static void BMSlidingWindow_resync(BMSlidingWindow *This);
+
+
+
+void BMSlidingWindow_init(BMSlidingWindow *This, bool stereo, size_t windowLength){
+	assert(windowLength >= 2);
+
+	This->stereo = stereo;
+	This->windowLength = windowLength;
+	This->writeIndex = 0;
+	This->samplesSinceResync = 0;
+
+	// the ring is twice the window length so that the window is contiguous
+	This->ringL = calloc(2 * windowLength, sizeof(float));
+	This->ringR = stereo ? calloc(2 * windowLength, sizeof(float)) : NULL;
+
+	// the largest power of two that fits in the window
+	This->sfmLength = 1;
+	while(This->sfmLength * 2 <= windowLength)
+		This->sfmLength *= 2;
+	BMSFM_init(&This->sfm, This->sfmLength);
+
+	BMSlidingWindow_resync(This);
+}
+
+
+
+
+void BMSlidingWindow_free(BMSlidingWindow *This){
+	BMSFM_free(&This->sfm);
+
+	free(This->ringL);
+	free(This->ringR);
+	This->ringL = NULL;
+	This->ringR = NULL;
+}
+
+
+
+
+/*!
+ *BMSlidingWindow_resync
+ *
+ * @abstract recompute the running sums exactly from the window
+ */
+static void BMSlidingWindow_resync(BMSlidingWindow *This){
+	const float *windowL = This->ringL + This->writeIndex;
+	float sum, sumSq, sumLR;
+
+	vDSP_sve(windowL, 1, &sum, This->windowLength);
+	vDSP_svesq(windowL, 1, &sumSq, This->windowLength);
+	This->sumL = sum;
+	This->sumSqL = sumSq;
+
+	if(This->stereo){
+		const float *windowR = This->ringR + This->writeIndex;
+		vDSP_sve(windowR, 1, &sum, This->windowLength);
+		vDSP_svesq(windowR, 1, &sumSq, This->windowLength);
+		vDSP_dotpr(windowL, 1, windowR, 1, &sumLR, This->windowLength);
+		This->sumR = sum;
+		This->sumSqR = sumSq;
+		This->sumLR = sumLR;
+	}
+	else {
+		This->sumR = This->sumSqR = This->sumLR = 0.0;
+	}
+
+	This->samplesSinceResync = 0;
+}
+
+
+
+
+/*!
+ *BMSlidingWindow_input
+ *
+ * @abstract write new samples to the ring and update the running sums
+ *
+ * @param inputR  NULL if mono
+ */
+static void BMSlidingWindow_input(BMSlidingWindow *This, const float *inputL, const float *inputR, size_t numSamples){
+	while(numSamples > 0){
+		// don't write past the end of the ring in one step
+		size_t samplesProcessing = BM_MIN(numSamples, This->windowLength - This->writeIndex);
+
+		// the samples leaving the window are the oldest ones, where the new
+		// samples will go
+		float *oldL = This->ringL + This->writeIndex;
+		float *oldR = inputR ? This->ringR + This->writeIndex : NULL;
+
+		// subtract the old samples from the sums and add the new ones
+		float oldSum, oldSumSq, newSum, newSumSq;
+		vDSP_sve(oldL, 1, &oldSum, samplesProcessing);
+		vDSP_svesq(oldL, 1, &oldSumSq, samplesProcessing);
+		vDSP_sve(inputL, 1, &newSum, samplesProcessing);
+		vDSP_svesq(inputL, 1, &newSumSq, samplesProcessing);
+		This->sumL += (double)newSum - (double)oldSum;
+		This->sumSqL += (double)newSumSq - (double)oldSumSq;
+		if(inputR){
+			float oldSumLR, newSumLR;
+			vDSP_dotpr(oldL, 1, oldR, 1, &oldSumLR, samplesProcessing);
+			vDSP_dotpr(inputL, 1, inputR, 1, &newSumLR, samplesProcessing);
+			vDSP_sve(oldR, 1, &oldSum, samplesProcessing);
+			vDSP_svesq(oldR, 1, &oldSumSq, samplesProcessing);
+			vDSP_sve(inputR, 1, &newSum, samplesProcessing);
+			vDSP_svesq(inputR, 1, &newSumSq, samplesProcessing);
+			This->sumR += (double)newSum - (double)oldSum;
+			This->sumSqR += (double)newSumSq - (double)oldSumSq;
+			This->sumLR += (double)newSumLR - (double)oldSumLR;
+		}
+
+		// write the new samples in both halves of the ring
+		size_t bytes = sizeof(float) * samplesProcessing;
+		memcpy(oldL, inputL, bytes);
+		memcpy(oldL + This->windowLength, inputL, bytes);
+		if(inputR){
+			memcpy(oldR, inputR, bytes);
+			memcpy(oldR + This->windowLength, inputR, bytes);
+		}
+
+		// advance pointers
+		This->writeIndex = (This->writeIndex + samplesProcessing) % This->windowLength;
+		inputL += samplesProcessing;
+		if(inputR) inputR += samplesProcessing;
+		numSamples -= samplesProcessing;
+
+		// recompute the sums once per window length to stop rounding errors
+		// from accumulating. This costs O(1) per sample on average.
+		This->samplesSinceResync += samplesProcessing;
+		if(This->samplesSinceResync >= This->windowLength)
+			BMSlidingWindow_resync(This);
+	}
+}
+
+
+
+
+void BMSlidingWindow_inputMono(BMSlidingWindow *This, const float *input, size_t numSamples){
+	assert(!This->stereo);
+	BMSlidingWindow_input(This, input, NULL, numSamples);
+}
+
+
+
+
+void BMSlidingWindow_inputStereo(BMSlidingWindow *This, const float *inputL, const float *inputR, size_t numSamples){
+	assert(This->stereo);
+	BMSlidingWindow_input(This, inputL, inputR, numSamples);
+}
+
+
+
+
+float BMSlidingWindow_getRMS(const BMSlidingWindow *This, size_t channel){
+	assert(channel == 0 || This->stereo);
+	double sumSq = (channel == 0) ? This->sumSqL : This->sumSqR;
+
+	// the running sum can be slightly negative after rounding
+	return sqrt(BM_MAX(sumSq, 0.0) / (double)This->windowLength);
+}
+
+
+
+
+/*
+ * The pearson correlation coefficient of X and Y is
+ *    covariance(X,Y) / (stdDev(X) * stdDev(y))
+ */
+float BMSlidingWindow_getCorrelation(const BMSlidingWindow *This){
+	assert(This->stereo);
+	double n = (double)This->windowLength;
+
+	double meanL = This->sumL / n;
+	double meanR = This->sumR / n;
+	double varianceL = This->sumSqL / n - meanL * meanL;
+	double varianceR = This->sumSqR / n - meanR * meanR;
+	double covariance = This->sumLR / n - meanL * meanR;
+
+	// a constant channel has no correlation with anything
+	if(varianceL <= 0.0 || varianceR <= 0.0)
+		return 0.0f;
+
+	// rounding can push the result slightly outside [-1,1]
+	double correlation = covariance / sqrt(varianceL * varianceR);
+	return BM_MIN(BM_MAX(correlation, -1.0), 1.0);
+}
+
+
+
+
+float BMSlidingWindow_getSpectralFlatness(BMSlidingWindow *This, size_t channel){
+	const float *window = BMSlidingWindow_getWindow(This, channel);
+	return BMSFM_process(&This->sfm, window + This->windowLength - This->sfmLength, This->sfmLength);
+}
+
+
+
+
+const float* BMSlidingWindow_getWindow(const BMSlidingWindow *This, size_t channel){
+	assert(channel == 0 || This->stereo);
+	const float *ring = (channel == 0) ? This->ringL : This->ringR;
+	return ring + This->writeIndex;
+}
@@ -0,0 +1,141 @@
+//
+//  BMSlidingWindow.h
+//  AudioFiltersXcodeProject
+//
+//  Streaming measurements over the last windowLength samples of a mono or
+//  stereo signal, for displays that poll much more often than the window
+//  length.
+//
+//  BMRMSPower_process and BMPearsonCorrelation scan the whole window on
+//  every call. This keeps running sums of x, y, x^2, y^2 and x*y instead.
+//  Each call to BMSlidingWindow_inputMono or _inputStereo adds the new
+//  samples to the sums and subtracts the samples leaving the window, so the
+//  cost is O(new samples) however long the window is. Rounding errors in
+//  the running sums would accumulate, so the sums are recomputed exactly
+//  from the window each time windowLength samples have gone through.
+//
+//  All the measurements read from one input ring. Each sample is written
+//  twice, windowLength samples apart, so the window is always a contiguous
+//  array. BMSlidingWindow_getWindow gives a pointer to it for measurements
+//  that don't have running sums, such as BMSpectralCentroid_process.
+//
+//  Spectral flatness has no running sum. BMSlidingWindow_getSpectralFlatness
+//  runs BMSFM on the window when it is called, so its cost is per call
+//  rather than per sample.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BMSlidingWindow_h
+#define BMSlidingWindow_h
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "BMSFM.h"
+
+
+typedef struct BMSlidingWindow {
+	BMSFM sfm;
+	float *ringL, *ringR;
+	double sumL, sumR, sumSqL, sumSqR, sumLR;
+	size_t windowLength, writeIndex, samplesSinceResync, sfmLength;
+	bool stereo;
+} BMSlidingWindow;
+
+
+
+/*!
+ *BMSlidingWindow_init
+ *
+ * @abstract the window starts out filled with zeros
+ *
+ * @param This          pointer to an uninitialised struct
+ * @param stereo        true for stereo, false for mono
+ * @param windowLength  length of the window in samples. Need not be a power of two. Must be at least 2.
+ */
+void BMSlidingWindow_init(BMSlidingWindow *This, bool stereo, size_t windowLength);
+
+
+
+/*!
+ *BMSlidingWindow_free
+ */
+void BMSlidingWindow_free(BMSlidingWindow *This);
+
+
+
+/*!
+ *BMSlidingWindow_inputMono
+ *
+ * @param This        pointer to an initialised mono struct
+ * @param input       length = numSamples
+ * @param numSamples  any length
+ */
+void BMSlidingWindow_inputMono(BMSlidingWindow *This, const float *input, size_t numSamples);
+
+
+
+/*!
+ *BMSlidingWindow_inputStereo
+ *
+ * @param This        pointer to an initialised stereo struct
+ * @param inputL      length = numSamples
+ * @param inputR      length = numSamples
+ * @param numSamples  any length
+ */
+void BMSlidingWindow_inputStereo(BMSlidingWindow *This, const float *inputL, const float *inputR, size_t numSamples);
+
+
+
+/*!
+ *BMSlidingWindow_getRMS
+ *
+ * @param This     pointer to an initialised struct
+ * @param channel  0 for left or mono, 1 for right
+ * @returns the RMS power of the window. O(1).
+ */
+float BMSlidingWindow_getRMS(const BMSlidingWindow *This, size_t channel);
+
+
+
+/*!
+ *BMSlidingWindow_getCorrelation
+ *
+ * @param This  pointer to an initialised stereo struct
+ * @returns the Pearson correlation of left and right over the window, as in BMPearsonCorrelation, or 0 if either channel is constant. O(1).
+ */
+float BMSlidingWindow_getCorrelation(const BMSlidingWindow *This);
+
+
+
+/*!
+ *BMSlidingWindow_getSpectralFlatness
+ *
+ * @abstract the spectral flatness measure, as in BMSFM_process, of the most recent samples. The FFT length is the largest power of two that fits in the window.
+ *
+ * @param This     pointer to an initialised struct
+ * @param channel  0 for left or mono, 1 for right
+ */
+float BMSlidingWindow_getSpectralFlatness(BMSlidingWindow *This, size_t channel);
+
+
+
+/*!
+ *BMSlidingWindow_getWindow
+ *
+ * @param This     pointer to an initialised struct
+ * @param channel  0 for left or mono, 1 for right
+ * @returns the current window, oldest sample first, length = windowLength. Valid until the next input call.
+ */
+const float* BMSlidingWindow_getWindow(const BMSlidingWindow *This, size_t channel);
+
+#endif /* BMSlidingWindow_h */
+
+#ifdef __cplusplus
+}
+#endif
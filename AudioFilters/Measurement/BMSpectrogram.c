@@ -13,7 +13,7 @@
 #include <sys/qos.h>
 
 #define BMSG_BYTES_PER_PIXEL 4
-#define BMSG_FLOATS_PER_COLOUR 3
+#define BMSG_FFT_BIN_INTERPOLATION_PADDING 3
 #define SG_MIN(a,b) (((a)<(b))?(a):(b))
 #define SG_MAX(a,b) (((a)>(b))?(a):(b))
 
@@ -36,19 +36,19 @@ void BMSpectrogram_init(BMSpectrogram *This,
 	// we need some extra samples at the end of the fftBin array because the
 	// interpolating function that converts from linear scale to bark scale
 	// reads beyond the interpolation index
-	This->fftBinInterpolationPadding = 3;
+	This->fftBinInterpolationPadding = BMSG_FFT_BIN_INTERPOLATION_PADDING;
 	
 	size_t maxFFTOutput = 1 + maxFFTSize/2;
 	for(size_t i=0; i<BMSG_NUM_THREADS; i++){
 		This->b1[i] = malloc(sizeof(float)*(maxFFTOutput+This->fftBinInterpolationPadding));
 		This->b2[i] = malloc(sizeof(float)*maxImageHeight);
-		This->t1[i] = malloc(sizeof(float)*maxImageHeight*BMSG_FLOATS_PER_COLOUR);
-		This->t2[i] = malloc(sizeof(float)*maxImageHeight);
 	}
 	This->b3 = malloc(sizeof(float)*maxImageHeight);
 	This->b4 = malloc(sizeof(size_t)*maxImageHeight);
 	This->b5 = malloc(sizeof(size_t)*maxImageHeight);
 	This->colours = malloc(sizeof(simd_float3)*maxImageHeight);
+	This->colourTable = malloc(sizeof(uint32_t)*BMSG_COLOUR_TABLE_LENGTH);
+	BMSpectrogram_setColourScheme(This, BMSpectrogram_defaultColour);
 	
 	if(BMSG_NUM_THREADS > 1){
 		// get the global concurrent dispatch queue with highest priority
@@ -64,12 +64,8 @@ void BMSpectrogram_free(BMSpectrogram *This){
 	for(size_t i=0; i<BMSG_NUM_THREADS; i++){
 		free(This->b1[i]);
 		free(This->b2[i]);
-		free(This->t1[i]);
-		free(This->t2[i]);
 		This->b1[i] = NULL;
 		This->b2[i] = NULL;
-		This->t1[i] = NULL;
-		This->t2[i] = NULL;
 		BMSpectrum_free(&This->spectrum[i]);
 	}
 	
@@ -81,10 +77,12 @@ void BMSpectrogram_free(BMSpectrogram *This){
 	free(This->b4);
 	free(This->b5);
 	free(This->colours);
+	free(This->colourTable);
 	This->b3 = NULL;
 	This->b4 = NULL;
 	This->b5 = NULL;
 	This->colours = NULL;
+	This->colourTable = NULL;
 }
 
 
@@ -176,83 +174,131 @@ void BMSpectrogram_fftBinsToBarkScale(const float* fftBins,
 
 
 
-void BMSpectrogram_toRGBAColour(float* input, float *temp1, float *temp2, uint8_t *output, size_t pixelWidth, size_t pixelHeight){
-	
-	// fill the temp buffer with the rgb colour of the 100% saturated pixels
-	float r = 0.0f;
-	float g = 0.433f;
-	float b = 1.0f;
-	vDSP_vfill(&r, temp1, BMSG_FLOATS_PER_COLOUR, pixelHeight);
-	vDSP_vfill(&g, temp1+1, BMSG_FLOATS_PER_COLOUR, pixelHeight);
-	vDSP_vfill(&b, temp1+2, BMSG_FLOATS_PER_COLOUR, pixelHeight);
+simd_float3 BMSpectrogram_defaultColour(float value){
+	// the rgb colour of the 100% saturated pixels
+	simd_float3 saturated = {0.0f, 0.433f, 1.0f};
 	
 	// find out how much we need to scale down the saturated pixel to apply the
 	// saturation and make headroom for the lightness
-	//    float s = 0.5f;
-	//    float c = (fabsf(2.0f * v - 1.0f) - 1.0f) * (-s);
 	float s = 0.5f;
-	float negS = -0.5f;
-	float negOne = -1.0f;
-	float two = 2.0f;
-	// 2.0f * v - 1.0f
-	vDSP_vsmsa(input, 1, &two, &negOne, temp2, 1, pixelHeight);
-	// fabsf
-	vDSP_vabs(temp2, 1, temp2, 1, pixelHeight);
-	// (result - 1.0f) * -s
-	// => result * -s + s
-	vDSP_vsmsa(temp2, 1, &negS, &s, temp2, 1, pixelHeight);
+	float c = (fabsf(2.0f * value - 1.0f) - 1.0f) * (-s);
 	
 	// scale the rgb pixel and mix with the lightness
-	//    rgb = (rgb - 0.5f) * c + v;
-	//
-	// rgb - 0.5f
-	float negHalf = -0.5f;
-	vDSP_vsadd(temp1, 1, &negHalf, temp1, 1, pixelHeight*BMSG_FLOATS_PER_COLOUR);
-	// result * c + v
-	vDSP_vma(temp1, BMSG_FLOATS_PER_COLOUR, temp2, 1, input, 1, temp1, BMSG_FLOATS_PER_COLOUR, pixelHeight);
-	vDSP_vma(temp1+1, BMSG_FLOATS_PER_COLOUR, temp2, 1, input, 1, temp1+1, BMSG_FLOATS_PER_COLOUR, pixelHeight);
-	vDSP_vma(temp1+2, BMSG_FLOATS_PER_COLOUR, temp2, 1, input, 1, temp1+2, BMSG_FLOATS_PER_COLOUR, pixelHeight);
-	
-	// convert to 8 bit RGBA colour
-	float two55 = 255.0;
-	vDSP_vsmul(temp1, 1, &two55, temp1, 1, BMSG_FLOATS_PER_COLOUR*pixelHeight);
-	vDSP_vfixru8(temp1, BMSG_FLOATS_PER_COLOUR, output, BMSG_BYTES_PER_PIXEL, pixelHeight);
-	vDSP_vfixru8(temp1+1, BMSG_FLOATS_PER_COLOUR, output+1, BMSG_BYTES_PER_PIXEL, pixelHeight);
-	vDSP_vfixru8(temp1+2, BMSG_FLOATS_PER_COLOUR, output+2, BMSG_BYTES_PER_PIXEL, pixelHeight);
+	return (saturated - 0.5f) * c + value;
+}
+
+
+
+
+void BMSpectrogram_setColourScheme(BMSpectrogram *This, BMSpectrogramColourFunction colourFunction){
+	for(size_t i=0; i<BMSG_COLOUR_TABLE_LENGTH; i++){
+		float value = (float)i / (float)(BMSG_COLOUR_TABLE_LENGTH - 1);
+		simd_float3 rgb = simd_clamp(colourFunction(value), 0.0f, 1.0f);
+		
+		// write the bytes in RGBA order, whatever the endianness
+		uint8_t pixel [BMSG_BYTES_PER_PIXEL] = {
+			(uint8_t)lrintf(rgb.x * 255.0f),
+			(uint8_t)lrintf(rgb.y * 255.0f),
+			(uint8_t)lrintf(rgb.z * 255.0f),
+			255};
+		memcpy(&This->colourTable[i], pixel, sizeof(uint32_t));
+	}
+}
+
+
+
+
+/*!
+ *BMSpectrogram_toRGBAColour
+ *
+ * Clamps each level to [0,1], quantises it to an index in the colour table
+ * and writes the colour to the output. The output is written in reverse
+ * order so that low frequencies end up at the bottom of the image.
+ *
+ * @param input        levels in [0,1] with length = pixelHeight
+ * @param colourTable  table of BMSG_COLOUR_TABLE_LENGTH RGBA colours
+ * @param output       RGBA pixels with length = pixelHeight
+ * @param pixelHeight  number of pixels
+ */
+void BMSpectrogram_toRGBAColour(const float* input, const uint32_t *colourTable, uint8_t *output, size_t pixelHeight){
+	uint32_t *outputPixels = (uint32_t*)output;
+	float scale = (float)(BMSG_COLOUR_TABLE_LENGTH - 1);
 	
-	// write the alpha values
-	size_t outputSizeInBytes = BMSG_BYTES_PER_PIXEL * pixelHeight;
-	for(size_t i=3; i<outputSizeInBytes; i+= BMSG_BYTES_PER_PIXEL)
-		output[i] = 255;
+	size_t i = 0;
+	for(; i + 4 <= pixelHeight; i += 4){
+		simd_float4 v = *(const simd_packed_float4*)(input + i);
+		simd_int4 index = simd_int(simd_clamp(v, 0.0f, 1.0f) * scale + 0.5f);
+		uint32_t *o = outputPixels + pixelHeight - 1 - i;
+		o[0] = colourTable[index.x];
+		o[-1] = colourTable[index.y];
+		o[-2] = colourTable[index.z];
+		o[-3] = colourTable[index.w];
+	}
+	for(; i < pixelHeight; i++){
+		float v = simd_clamp(input[i], 0.0f, 1.0f);
+		outputPixels[pixelHeight - 1 - i] = colourTable[(int)(v * scale + 0.5f)];
+	}
 }
 
 
 
 
 
+/*!
+ *BMSpectrogram_fastLog2
+ *
+ * log2(x) for normal positive x, to within 2e-5. The exponent comes from
+ * the float bits and a polynomial does the mantissa.
+ */
+static inline simd_float4 BMSpectrogram_fastLog2(simd_float4 x){
+	simd_int4 bits = (simd_int4)x;
+	simd_float4 exponent = simd_float((bits >> 23) - 127);
+	
+	// mantissa in [1,2), as t in [0,1)
+	simd_float4 t = (simd_float4)((bits & 0x007FFFFF) | 0x3F800000) - 1.0f;
+	
+	// least squares fit of log2(1+t) / t
+	simd_float4 p = 0.045266899f;
+	p = p * t - 0.193513459f;
+	p = p * t + 0.415243262f;
+	p = p * t - 0.708864548f;
+	p = p * t + 1.44187984f;
+	return exponent + p * t;
+}
+
+
+
+
 void BMSpectrogram_toDbScaleAndClip(const float* input, float* output, size_t fftSize, size_t length){
 	// compensate for the scaling of the vDSP FFT
 	float scale = 32.0f / (float)fftSize;
-	vDSP_vsmul(input, 1, &scale, output, 1, length);
 	
 	// eliminate zeros and negative values
 	float threshold = BM_DB_TO_GAIN(-110);
-	vDSP_vthr(output, 1, &threshold, output, 1, length);
 	
-	// convert to db
+	// 20*log10(x / zeroDb) = dbPerOctave*log2(x) - dbPerOctave*log2(zeroDb)
 	float zeroDb = sqrt((float)fftSize)/2.0f;
-	uint32_t use20not10 = 1;
-	vDSP_vdbcon(output, 1, &zeroDb, output, 1, length, use20not10);
+	float dbPerOctave = 20.0f * log10f(2.0f);
+	float dbOffset = -dbPerOctave * log2f(zeroDb);
 	
-	// clip to [-105,100]
+	// clip to [-105,100], then shift and scale [-105,0] to [0,1]
 	float min = -105.0f;
 	float max = 100.0f;
-	vDSP_vclip(output, 1, &min, &max, output, 1, length);
+	float outputScale = 1.0f/fabsf(min);
 	
-	// shift and scale [-105,0] to [0,1]
-	scale = 1.0f/fabsf(min);
-	float shift = 1.0f;
-	vDSP_vsmsa(output, 1, &scale, &shift, output, 1, length);
+	// do all of the above in a single pass
+	size_t i = 0;
+	for(; i + 4 <= length; i += 4){
+		simd_float4 x = *(const simd_packed_float4*)(input + i);
+		x = simd_max(x * scale, threshold);
+		simd_float4 db = simd_clamp(dbPerOctave * BMSpectrogram_fastLog2(x) + dbOffset, min, max);
+		*(simd_packed_float4*)(output + i) = db * outputScale + 1.0f;
+	}
+	for(; i < length; i++){
+		float x = BM_MAX(input[i] * scale, threshold);
+		float db = BM_MIN(BM_MAX(dbPerOctave * BMSpectrogram_fastLog2(x).x + dbOffset, min), max);
+		output[i] = db * outputScale + 1.0f;
+	}
 }
 
 
@@ -278,6 +324,45 @@ float BMSpectrogram_getPaddingRight(size_t fftSize){
 
 
 
+/*!
+ *BMSpectrogram_drawColumn
+ *
+ * @abstract convert one column of dB scaled fft bins to bark scale and write it to the image in RGBA colour
+ */
+void BMSpectrogram_drawColumn(const float *fftBinsDb,
+							  uint8_t *columnOutput,
+							  SInt32 fftSize,
+							  SInt32 pixelWidth,
+							  SInt32 pixelHeight,
+							  size_t fftBinInterpolationPadding,
+							  float minFrequency,
+							  float maxFrequency,
+							  size_t upsampledPixels,
+							  float *b2,
+							  const uint32_t *colourTable,
+							  const float *b3,
+							  const size_t *b4,
+							  const size_t *b5){
+	// interpolate the output from linear scale frequency to Bark Scale
+	BMSpectrogram_fftBinsToBarkScale(fftBinsDb,
+									 b2,
+									 fftSize,
+									 pixelHeight,
+									 minFrequency,
+									 maxFrequency,
+									 fftBinInterpolationPadding,
+									 upsampledPixels,
+									 b3,
+									 b4,
+									 b5);
+	
+	// clamp to [0,1], convert to RGBA colours and write to output in reverse order
+	BMSpectrogram_toRGBAColour(b2, colourTable, columnOutput, pixelHeight);
+}
+
+
+
+
 void BMSpectrogram_genColumn(SInt32 i,
 							 uint8_t *imageOutput,
 							 float fftStride,
@@ -295,8 +380,7 @@ void BMSpectrogram_genColumn(SInt32 i,
 							 const float *inputAudio,
 							 float *b1,
 							 float *b2,
-							 float *t1,
-							 float *t2,
+							 const uint32_t *colourTable,
 							 const float *b3,
 							 const size_t *b4,
 							 const size_t *b5){
@@ -320,29 +404,17 @@ void BMSpectrogram_genColumn(SInt32 i,
 	// convert to dB, scale to [0,1] and clip values outside that range
 	BMSpectrogram_toDbScaleAndClip(b1, b1, fftSize, fftOutputSize);
 	
-	// interpolate the output from linear scale frequency to Bark Scale
-	BMSpectrogram_fftBinsToBarkScale(b1,
-									 b2,
-									 fftSize,
-									 pixelHeight,
-									 minFrequency,
-									 maxFrequency,
-									 fftBinInterpolationPadding,
-									 upsampledPixels,
-									 b3,
-									 b4,
-									 b5);
-	
-	// clamp the outputs to [0,1]
-	float lowerLimit = 0;
-	float upperLimit = 1;
-	vDSP_vclip(b2, 1, &lowerLimit, &upperLimit, b2, 1, pixelHeight);
-	
-	// reverse
-	vDSP_vrvrs(b2, 1, pixelHeight);
-	
-	// convert to RGBA colours and write to output
-	BMSpectrogram_toRGBAColour(b2, t1, t2, &imageOutput[i*BMSG_BYTES_PER_PIXEL*pixelHeight],pixelWidth, pixelHeight);
+	// draw the column
+	BMSpectrogram_drawColumn(b1,
+							 &imageOutput[i*BMSG_BYTES_PER_PIXEL*pixelHeight],
+							 fftSize,
+							 pixelWidth,
+							 pixelHeight,
+							 fftBinInterpolationPadding,
+							 minFrequency,
+							 maxFrequency,
+							 upsampledPixels,
+							 b2, colourTable, b3, b4, b5);
 }
 
 
@@ -464,8 +536,7 @@ void BMSpectrogram_process(BMSpectrogram *This,
 											inputAudio,
 											This->b1[j],
 											This->b2[j],
-											This->t1[j],
-											This->t2[j],
+											This->colourTable,
 											This->b3,
 											This->b4,
 											This->b5);
@@ -495,8 +566,7 @@ void BMSpectrogram_process(BMSpectrogram *This,
 									inputAudio,
 									This->b1[0],
 									This->b2[0],
-									This->t1[0],
-									This->t2[0],
+									This->colourTable,
 									This->b3,
 									This->b4,
 									This->b5);
@@ -509,6 +579,284 @@ void BMSpectrogram_process(BMSpectrogram *This,
 	}
 }
 
+void BMSTFTColumnCache_init(BMSTFTColumnCache *This, size_t maxFFTSize, size_t capacity){
+	assert(capacity > 0);
+	This->maxFFTSize = maxFFTSize;
+	This->capacity = capacity;
+	This->fftSize = This->hop = This->numBins = 0;
+	
+	BMSpectrum_initWithLength(&This->spectrum, maxFFTSize);
+	BMFFT_initBatch(&This->spectrum.fft, BMSTFT_BATCH_SIZE);
+	
+	// each column has the fft bins and padding for the bark scale interpolation
+	This->columnStride = 1 + maxFFTSize/2 + BMSG_FFT_BIN_INTERPOLATION_PADDING;
+	This->columns = malloc(sizeof(float)*This->columnStride*capacity);
+	This->scratchColumn = malloc(sizeof(float)*This->columnStride);
+	This->scratchAudio = malloc(sizeof(float)*maxFFTSize);
+	This->slotColumnIndex = malloc(sizeof(int32_t)*capacity);
+	
+	BMSTFTColumnCache_clear(This);
+}
+
+
+
+
+void BMSTFTColumnCache_free(BMSTFTColumnCache *This){
+	BMSpectrum_free(&This->spectrum);
+	free(This->columns);
+	free(This->scratchColumn);
+	free(This->scratchAudio);
+	free(This->slotColumnIndex);
+	This->columns = NULL;
+	This->scratchColumn = NULL;
+	This->scratchAudio = NULL;
+	This->slotColumnIndex = NULL;
+}
+
+
+
+
+void BMSTFTColumnCache_clear(BMSTFTColumnCache *This){
+	for(size_t i=0; i<This->capacity; i++)
+		This->slotColumnIndex[i] = BMSTFT_EMPTY_SLOT;
+}
+
+
+
+
+void BMSTFTColumnCache_setResolution(BMSTFTColumnCache *This, size_t fftSize, size_t hop){
+	assert(4 <= fftSize && fftSize <= This->maxFFTSize);
+	assert(isPowerOfTwo(fftSize));
+	assert(hop > 0);
+	
+	if(fftSize != This->fftSize || hop != This->hop){
+		This->fftSize = fftSize;
+		This->hop = hop;
+		This->numBins = 1 + fftSize/2;
+		BMSTFTColumnCache_clear(This);
+	}
+}
+
+
+
+
+/*!
+ *BMSTFTColumnCache_slot
+ *
+ * @returns the slot where column number columnIndex is stored
+ */
+static size_t BMSTFTColumnCache_slot(const BMSTFTColumnCache *This, int32_t columnIndex){
+	int64_t capacity = (int64_t)This->capacity;
+	return (size_t)(((columnIndex % capacity) + capacity) % capacity);
+}
+
+
+
+
+/*!
+ *BMSTFTColumnCache_windowStart
+ *
+ * @returns the index in the audio array where the fft window of the column starts. As in BMSpectrogram_process, the window centred at sample n covers [n-(fftSize/2)+1, n+(fftSize/2)]
+ */
+static int64_t BMSTFTColumnCache_windowStart(const BMSTFTColumnCache *This, int32_t columnIndex, int32_t audioStartTime){
+	int64_t centre = (int64_t)columnIndex * (int64_t)This->hop;
+	return centre - (int64_t)This->fftSize/2 + 1 - audioStartTime;
+}
+
+
+
+
+/*!
+ *BMSTFTColumnCache_finishColumn
+ *
+ * @abstract pad a column of fft magnitudes and convert it to dB
+ */
+static void BMSTFTColumnCache_finishColumn(BMSTFTColumnCache *This, float *column){
+	memset(column + This->numBins, 0, sizeof(float)*BMSG_FFT_BIN_INTERPOLATION_PADDING);
+	BMSpectrogram_toDbScaleAndClip(column, column, This->fftSize, This->numBins);
+}
+
+
+
+
+/*!
+ *BMSTFTColumnCache_computeBatch
+ *
+ * @abstract compute a batch of columns straight into their slots
+ */
+static void BMSTFTColumnCache_computeBatch(BMSTFTColumnCache *This,
+										   const float * const *inputs,
+										   float * const *outputs,
+										   const int32_t *columnIndices,
+										   size_t batchSize){
+	if(batchSize == 0) return;
+	
+	BMSpectrum_processDataBasicBatch(&This->spectrum, inputs, outputs, true, This->fftSize, batchSize);
+	for(size_t j=0; j<batchSize; j++){
+		BMSTFTColumnCache_finishColumn(This, outputs[j]);
+		This->slotColumnIndex[BMSTFTColumnCache_slot(This, columnIndices[j])] = columnIndices[j];
+	}
+}
+
+
+
+
+void BMSTFTColumnCache_prefetch(BMSTFTColumnCache *This,
+								const int32_t *columnIndices,
+								size_t numColumns,
+								const float *audio,
+								size_t audioLength,
+								int32_t audioStartTime){
+	assert(This->fftSize > 0);
+	
+	const float *inputs [BMSTFT_BATCH_SIZE];
+	float *outputs [BMSTFT_BATCH_SIZE];
+	int32_t batchColumns [BMSTFT_BATCH_SIZE];
+	size_t batchSize = 0;
+	
+	for(size_t i=0; i<numColumns; i++){
+		int32_t columnIndex = columnIndices[i];
+		size_t slot = BMSTFTColumnCache_slot(This, columnIndex);
+		int64_t windowStart = BMSTFTColumnCache_windowStart(This, columnIndex, audioStartTime);
+		
+		// skip columns we have, repeats and columns we wouldn't store
+		bool complete = windowStart >= 0 && windowStart + (int64_t)This->fftSize <= (int64_t)audioLength;
+		bool repeated = batchSize > 0 && batchColumns[batchSize-1] == columnIndex;
+		if(!complete || repeated || This->slotColumnIndex[slot] == columnIndex)
+			continue;
+		
+		// Two columns in one batch must not share a slot. The indices are
+		// increasing, so it's enough to check the span of the batch.
+		bool sharesSlot = batchSize > 0 && (size_t)(columnIndex - batchColumns[0]) >= This->capacity;
+		if(sharesSlot || batchSize == BMSTFT_BATCH_SIZE){
+			BMSTFTColumnCache_computeBatch(This, inputs, outputs, batchColumns, batchSize);
+			batchSize = 0;
+		}
+		
+		batchColumns[batchSize] = columnIndex;
+		inputs[batchSize] = audio + windowStart;
+		outputs[batchSize] = This->columns + slot*This->columnStride;
+		batchSize++;
+	}
+	
+	BMSTFTColumnCache_computeBatch(This, inputs, outputs, batchColumns, batchSize);
+}
+
+
+
+
+const float* BMSTFTColumnCache_getColumn(BMSTFTColumnCache *This,
+										 int32_t columnIndex,
+										 const float *audio,
+										 size_t audioLength,
+										 int32_t audioStartTime){
+	assert(This->fftSize > 0);
+	
+	// if we have the column, return it
+	size_t slot = BMSTFTColumnCache_slot(This, columnIndex);
+	float *storedColumn = This->columns + slot*This->columnStride;
+	if(This->slotColumnIndex[slot] == columnIndex)
+		return storedColumn;
+	
+	// find the fft window in the audio array
+	int64_t fftSize = (int64_t)This->fftSize;
+	int64_t windowStart = BMSTFTColumnCache_windowStart(This, columnIndex, audioStartTime);
+	bool complete = windowStart >= 0 && windowStart + fftSize <= (int64_t)audioLength;
+	
+	// if part of the window is outside the audio, use zeros there
+	const float *input = audio + windowStart;
+	if(!complete){
+		memset(This->scratchAudio, 0, sizeof(float)*This->fftSize);
+		int64_t copyStart = SG_MAX(windowStart, 0);
+		int64_t copyEnd = SG_MIN(windowStart + fftSize, (int64_t)audioLength);
+		if(copyEnd > copyStart)
+			memcpy(This->scratchAudio + (copyStart - windowStart),
+				   audio + copyStart,
+				   sizeof(float)*(copyEnd - copyStart));
+		input = This->scratchAudio;
+	}
+	
+	// only store the column if it won't change when more audio arrives
+	float *column = complete ? storedColumn : This->scratchColumn;
+	
+	// take abs(fft(windowFunctin*windowSamples)), pad and convert to dB
+	column[This->numBins-1] = BMSpectrum_processDataBasic(&This->spectrum, input, column, true, This->fftSize);
+	BMSTFTColumnCache_finishColumn(This, column);
+	
+	if(complete)
+		This->slotColumnIndex[slot] = columnIndex;
+	
+	return column;
+}
+
+
+
+
+void BMSpectrogram_processWithColumnCache(BMSpectrogram *This,
+										  BMSTFTColumnCache *cache,
+										  const float* audio,
+										  size_t audioLength,
+										  int32_t audioStartTime,
+										  double startTime,
+										  double samplesPerPixel,
+										  SInt32 fftSize,
+										  uint8_t *imageOutput,
+										  SInt32 pixelWidth,
+										  SInt32 pixelHeight,
+										  float minFrequency,
+										  float maxFrequency){
+	assert(2 <= pixelHeight && pixelHeight < This->maxImageHeight);
+	assert(samplesPerPixel > 0.0);
+	
+	// Use the largest power of two hop that gives at least one column per
+	// pixel. The hop only changes when the zoom crosses a power of two, so
+	// the cached columns survive smaller changes in zoom.
+	size_t hop = 1;
+	if(samplesPerPixel >= 2.0)
+		hop = (size_t)1 << (size_t)floor(log2(samplesPerPixel));
+	BMSTFTColumnCache_setResolution(cache, fftSize, hop);
+	
+	// if the configuration has changed, update some stuff
+	BMSpectrogram_updateImageHeight(This, fftSize, pixelHeight, minFrequency, maxFrequency);
+	
+	int32_t columnIndices [BMSTFT_BATCH_SIZE];
+	for(SInt32 i=0; i<pixelWidth; i++){
+		// use the column nearest to the pixel
+		double pixelTime = startTime + (double)i*samplesPerPixel;
+		int32_t columnIndex = (int32_t)floor(pixelTime/(double)hop + 0.5);
+		
+		// at the start of each group of pixels, compute the columns the
+		// cache doesn't have together in one batch
+		size_t indexInGroup = (size_t)i % BMSTFT_BATCH_SIZE;
+		if(indexInGroup == 0){
+			size_t groupSize = SG_MIN(BMSTFT_BATCH_SIZE, (size_t)(pixelWidth - i));
+			for(size_t j=0; j<groupSize; j++)
+				columnIndices[j] = (int32_t)floor((startTime + (double)(i+j)*samplesPerPixel)/(double)hop + 0.5);
+			BMSTFTColumnCache_prefetch(cache, columnIndices, groupSize, audio, audioLength, audioStartTime);
+		}
+		
+		const float *column = BMSTFTColumnCache_getColumn(cache, columnIndex, audio, audioLength, audioStartTime);
+		
+		BMSpectrogram_drawColumn(column,
+								 &imageOutput[i*BMSG_BYTES_PER_PIXEL*pixelHeight],
+								 fftSize,
+								 pixelWidth,
+								 pixelHeight,
+								 This->fftBinInterpolationPadding,
+								 minFrequency,
+								 maxFrequency,
+								 This->upsampledPixels,
+								 This->b2[0],
+								 This->colourTable,
+								 This->b3,
+								 This->b4,
+								 This->b5);
+	}
+}
+
+
+
+
 size_t nearestPowerOfTwo(float x){
 	float lower = pow(2.0f,floor(log2(x)));
 	float upper = pow(2.0f,ceil(log2(x)));
@@ -16,16 +16,19 @@
 #include "TPCircularBuffer.h"
 
 #define BMSG_NUM_THREADS 1
+#define BMSTFT_EMPTY_SLOT INT32_MIN
+#define BMSG_COLOUR_TABLE_LENGTH 4096
+#define BMSTFT_BATCH_SIZE 64
 
 typedef struct BMSpectrogram {
     BMSpectrum spectrum [BMSG_NUM_THREADS];
 	float *b1 [BMSG_NUM_THREADS];
 	float *b2 [BMSG_NUM_THREADS];
-	float *t1 [BMSG_NUM_THREADS];
-	float *t2 [BMSG_NUM_THREADS];
 	float *b3;
     size_t *b4, *b5;
 	simd_float3 *colours;
+	// RGBA colour for each of BMSG_COLOUR_TABLE_LENGTH levels in [0,1]
+	uint32_t *colourTable;
     float prevMinF, prevMaxF, sampleRate;
     size_t prevImageHeight, prevFFTSize, maxImageHeight, maxFFTSize, fftBinInterpolationPadding, upsampledPixels;
 	dispatch_queue_global_t globalQueue;
@@ -45,6 +48,37 @@ typedef struct {
 } BMSpectrogramCache;
 
 
+/*
+ * BMSTFTColumnCache
+ *
+ * Keeps the FFT magnitude columns of a recording so that the spectrogram can
+ * be redrawn without recomputing them. Column k is the FFT centred at sample
+ * k*hop, stored in dB scale as BMSpectrogram draws it. The columns are kept
+ * in a ring with one slot for each column index modulo capacity, so panning
+ * reuses the columns that stay on screen and zooming out reuses columns until
+ * the hop changes. A change of fftSize or hop clears the cache.
+ */
+typedef struct BMSTFTColumnCache {
+	BMSpectrum spectrum;
+	// capacity columns of columnStride floats each
+	float *columns;
+	// for columns that aren't stored, and for copying partial windows of audio
+	float *scratchColumn, *scratchAudio;
+	// the column index held in each slot, or BMSTFT_EMPTY_SLOT
+	int32_t *slotColumnIndex;
+	size_t fftSize, hop, numBins, columnStride, capacity, maxFFTSize;
+} BMSTFTColumnCache;
+
+
+/*!
+ *BMSpectrogramColourFunction
+ *
+ * @param value  level in [0,1], where 0 is -105 dB and 1 is 0 dB
+ * @returns the RGB colour of the level, each component in [0,1]
+ */
+typedef simd_float3 (*BMSpectrogramColourFunction)(float value);
+
+
 typedef simd_float3 BMHSBPixel;
 typedef struct BMRGBPixel {
     uint8_t r,g,b;
@@ -70,6 +104,28 @@ void BMSpectrogram_init(BMSpectrogram *This,
 void BMSpectrogram_free(BMSpectrogram *This);
 
 
+/*!
+ *BMSpectrogram_setColourScheme
+ *
+ * Fills the colour table with BMSG_COLOUR_TABLE_LENGTH samples of
+ * colourFunction. The image is drawn by looking up each pixel in the table,
+ * so colourFunction may be as slow as it needs to be. Don't call this while
+ * BMSpectrogram_process is running on another thread.
+ *
+ * @param This            pointer to an initialised struct
+ * @param colourFunction  maps levels in [0,1] to RGB. BMSpectrogram_defaultColour is the default.
+ */
+void BMSpectrogram_setColourScheme(BMSpectrogram *This, BMSpectrogramColourFunction colourFunction);
+
+
+/*!
+ *BMSpectrogram_defaultColour
+ *
+ * Blue, fading from black at 0 through saturated blue to white at 1
+ */
+simd_float3 BMSpectrogram_defaultColour(float value);
+
+
 /*!
  * returns the padding, which is the number of extra pixels that must be
  * included in the input audio array before startSampleIndex
@@ -120,6 +176,124 @@ void BMSpectrogram_process(BMSpectrogram *This,
 
 
 
+/*!
+ *BMSpectrogram_processWithColumnCache
+ *
+ * Draws the spectrogram like BMSpectrogram_process, taking the FFT columns
+ * from a BMSTFTColumnCache and computing only the columns it doesn't have.
+ * The hop is the largest power of two <= samplesPerPixel and each pixel
+ * uses the column nearest to its time. When the view doesn't move, no FFTs
+ * are computed.
+ *
+ * @param This             pointer to an initialised struct
+ * @param cache            pointer to an initialised column cache
+ * @param audio            audio array with length = audioLength
+ * @param audioLength      length of audio
+ * @param audioStartTime   time index of audio[0]. The cache identifies columns by time, so this must be consistent between calls.
+ * @param startTime        time of the first pixel, in samples
+ * @param samplesPerPixel  width of each pixel, in samples
+ * @param fftSize          length of fft. must be an integer power of two
+ * @param imageOutput      an array of RGBA pixels with 32 bits per pixel, in column major order, having height = pixelHeight and width = pixelWidth
+ * @param pixelWidth       width of image output in pixels
+ * @param pixelHeight      height of image output in pixels
+ */
+void BMSpectrogram_processWithColumnCache(BMSpectrogram *This,
+										  BMSTFTColumnCache *cache,
+										  const float* audio,
+										  size_t audioLength,
+										  int32_t audioStartTime,
+										  double startTime,
+										  double samplesPerPixel,
+										  SInt32 fftSize,
+										  uint8_t *imageOutput,
+										  SInt32 pixelWidth,
+										  SInt32 pixelHeight,
+										  float minFrequency,
+										  float maxFrequency);
+
+
+
+/*!
+ *BMSTFTColumnCache_init
+ *
+ * @param This        pointer to an uninitialised struct
+ * @param maxFFTSize  the largest fft size that will be used
+ * @param capacity    number of columns to keep. A few screen widths is a good choice.
+ */
+void BMSTFTColumnCache_init(BMSTFTColumnCache *This, size_t maxFFTSize, size_t capacity);
+
+
+/*!
+ *BMSTFTColumnCache_free
+ */
+void BMSTFTColumnCache_free(BMSTFTColumnCache *This);
+
+
+/*!
+ *BMSTFTColumnCache_setResolution
+ *
+ * Sets the key of the cache. If either value changes, the cache is cleared.
+ *
+ * @param fftSize  power of two in [4, maxFFTSize]
+ * @param hop      distance between columns, in samples
+ */
+void BMSTFTColumnCache_setResolution(BMSTFTColumnCache *This, size_t fftSize, size_t hop);
+
+
+/*!
+ *BMSTFTColumnCache_clear
+ *
+ * Forget all stored columns. Call this if the audio changes.
+ */
+void BMSTFTColumnCache_clear(BMSTFTColumnCache *This);
+
+
+/*!
+ *BMSTFTColumnCache_prefetch
+ *
+ * Computes the listed columns that aren't stored and whose windows lie
+ * within the audio, in batches with BMSpectrum_processDataBasicBatch.
+ *
+ * @param This            pointer to an initialised struct
+ * @param columnIndices   indices of the columns in increasing order, with length = numColumns. Repeats are ignored.
+ * @param numColumns      number of column indices
+ * @param audio           audio array with length = audioLength
+ * @param audioLength     length of audio
+ * @param audioStartTime  time index of audio[0]
+ */
+void BMSTFTColumnCache_prefetch(BMSTFTColumnCache *This,
+								const int32_t *columnIndices,
+								size_t numColumns,
+								const float *audio,
+								size_t audioLength,
+								int32_t audioStartTime);
+
+
+/*!
+ *BMSTFTColumnCache_getColumn
+ *
+ * Returns the magnitude column centred at sample columnIndex*hop, in dB scaled
+ * to [0,1], with 1 + fftSize/2 bins followed by zero padding for the bark
+ * scale interpolation. The column is computed if it isn't stored. It is only
+ * stored if its whole window lies within the audio; otherwise the missing
+ * samples are taken as zero and it's computed again next time.
+ *
+ * The result is valid until the next call.
+ *
+ * @param This            pointer to an initialised struct
+ * @param columnIndex     index of the column
+ * @param audio           audio array with length = audioLength
+ * @param audioLength     length of audio
+ * @param audioStartTime  time index of audio[0]
+ */
+const float* BMSTFTColumnCache_getColumn(BMSTFTColumnCache *This,
+										 int32_t columnIndex,
+										 const float *audio,
+										 size_t audioLength,
+										 int32_t audioStartTime);
+
+
+
 /*!
  *BMSpectrogram_transposeImage
  *
@@ -95,6 +95,29 @@ float BMSpectrum_processDataBasic(BMSpectrum* This,
 
 
 
+void BMSpectrum_processDataBasicBatch(BMSpectrum* This,
+									  const float * const *inputs,
+									  float * const *outputs,
+									  bool applyWindow,
+									  size_t inputLength,
+									  size_t numFrames){
+	assert(inputLength > 0);
+	assert(isPowerOfTwo(inputLength));
+	assert(inputLength <= This->maxInputLength);
+	
+	// use the same Kaiser window as BMSpectrum_processDataBasic
+	const float *window = NULL;
+	if(applyWindow){
+		double beta = 15.0;
+		window = BMFFT_kaiserCoefficients(&This->fft, beta, inputLength);
+	}
+	
+	BMFFT_absFFTBatch(&This->fft, inputs, outputs, window, inputLength, numFrames);
+}
+
+
+
+
 void BMSpectrum_barkScaleFFTBinIndices(float *A, size_t fftSize, float minHz, float maxHz, float sampleRate, size_t length){
 	// find the min and max frequency in barks
 	float minBark = BMConv_hzToBark(minHz);
@@ -69,6 +69,28 @@ bool BMSpectrum_processData(BMSpectrum* This,
                                      bool applyWindow,
                                      size_t inputLength);
 
+
+/*!
+ *BMSpectrum_processDataBasicBatch
+ *
+ * calculates abs(fft(input)) for numFrames frames of the same length in one
+ * call. See BMFFT_absFFTBatch. Call BMFFT_initBatch on This->fft once
+ * before using this.
+ *
+ * @param This pointer to an initialised struct
+ * @param inputs numFrames pointers to real-valued time-series data of length inputLength
+ * @param outputs numFrames pointers to real-valued output of length 1 + inputLength/2, with abs(fft[nyquist]) at the end
+ * @param applyWindow set true to apply the same window as BMSpectrum_processDataBasic before doing the fft
+ * @param inputLength length of each frame
+ * @param numFrames number of frames
+ */
+void BMSpectrum_processDataBasicBatch(BMSpectrum* This,
+                                      const float * const *inputs,
+                                      float * const *outputs,
+                                      bool applyWindow,
+                                      size_t inputLength,
+                                      size_t numFrames);
+
 /*!
  *BMSpectrum_barkScaleFFTBinIndices
  *
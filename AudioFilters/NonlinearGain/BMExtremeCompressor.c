@@ -11,6 +11,10 @@
 #define BMEC_GAIN_REDUCTION_BEFORE_SATURATOR -16.0f
 
 
+// forward declarations
+void BMExtremeCompressor_processOversampled(void *context, float *bufferL, float *bufferR, size_t lengthOS);
+
+
 
 void BMExtremeCompressor_init(BMExtremeCompressor *This, float sampleRate, bool isStereo, size_t oversampleFactor){
 	This->osFactor = oversampleFactor;
@@ -25,19 +29,17 @@ void BMExtremeCompressor_init(BMExtremeCompressor *This, float sampleRate, bool
 	BMLowpassedLimiter_init(&This->llL, sampleRateOS);
 	if (isStereo) BMLowpassedLimiter_init(&This->llR, sampleRateOS);
 	
-	// init sample rate converters
+	// init the oversampler. It calls BMExtremeCompressor_processOversampled
+	// to do the processing at the oversampled rate.
 	enum resamplerType rsType = sampleRate > 50000.0f ? BMRESAMPLER_INPUT_96KHZ : BMRESAMPLER_FULL_SPECTRUM;
-	BMUpsampler_init(&This->upsampler, isStereo, oversampleFactor, rsType);
-	BMDownsampler_init(&This->downsampler, isStereo, oversampleFactor, rsType);
+	BMOversampler_init(&This->oversampler, isStereo, oversampleFactor, rsType);
+	BMOversampler_setBlockKernel(&This->oversampler, BMExtremeCompressor_processOversampled, This);
 	
-	// allocate buffers
-	size_t bufferSize = sizeof(float)*BM_BUFFER_CHUNK_SIZE*oversampleFactor;
-	This->b1L = malloc(bufferSize);
+	// allocate buffers for one tile of the oversampler
+	size_t bufferSize = sizeof(float)*This->oversampler.tileLength*oversampleFactor;
 	This->b2L = malloc(bufferSize);
-	if(isStereo){
-		This->b1R = malloc(bufferSize);
+	if(isStereo)
 		This->b2R = malloc(bufferSize);
-	}
 }
 
 
@@ -48,15 +50,7 @@ void BMExtremeCompressor_free(BMExtremeCompressor *This){
 	BMLowpassedLimiter_free(&This->llL);
 	if(This->isStereo) BMLowpassedLimiter_free(&This->llR);
 	
-	BMUpsampler_free(&This->upsampler);
-	BMDownsampler_free(&This->downsampler);
-		
-	free(This->b1L);
-	This->b1L = NULL;
-	if (This->isStereo){
-		free(This->b1R);
-		This->b1R = NULL;
-	}
+	BMOversampler_free(&This->oversampler);
 	
 	free(This->b2L);
 	This->b2L = NULL;
@@ -69,43 +63,64 @@ void BMExtremeCompressor_free(BMExtremeCompressor *This){
 
 
 
-void BMExtremeCompressor_procesMono(BMExtremeCompressor *This,
-									const float *in,
-									float *out,
-									size_t numSamples){
-	assert(!This->isStereo);
-	
-	while(numSamples > 0){
-		size_t samplesProcessing = BM_MIN(numSamples, BM_BUFFER_CHUNK_SIZE);
-	
-		// upsample
-		BMUpsampler_processBufferMono(&This->upsampler, in, This->b1L, samplesProcessing);
-		
-		// find the upsampled chunk length
-		size_t lengthOS = This->osFactor * samplesProcessing;
+/*!
+ *BMExtremeCompressor_processOversampled
+ *
+ * @abstract the part of the processing that runs at the oversampled rate, in place. bufferR is NULL for mono.
+ */
+void BMExtremeCompressor_processOversampled(void *context, float *bufferL, float *bufferR, size_t lengthOS){
+	BMExtremeCompressor *This = context;
 	
+	if(!bufferR){
 		// apply attack transient shaper to smooth the attack transients
-		BMMultibandAttackShaper_processMono(&This->as, This->b1L, This->b1L, samplesProcessing);
-
+		BMMultibandAttackShaper_processMono(&This->as, bufferL, bufferL, lengthOS);
+		
 		// apply lowpassed limiter to get compression without saturation
-//		BMLowpassedLimiter_process(&This->llL, This->b1L, This->b1L, lengthOS);
-
+//		BMLowpassedLimiter_process(&This->llL, bufferL, bufferL, lengthOS);
+		
 		// apply a gain reduction
 //		float gainReduction = BM_DB_TO_GAIN(BMEC_GAIN_REDUCTION_BEFORE_SATURATOR);
-//		vDSP_vsmul(This->b1L, 1, &gainReduction, This->b1L, 1, lengthOS);
-
-		// apply a soft clipping limiter to tame the clipping level of the attack transients
-//		BMAsymptoticLimitNoSag(This->b1L, This->b2L, lengthOS);
-		memcpy(This->b2L, This->b1L, sizeof(float)*lengthOS);
-		
-		// downsample
-		BMDownsampler_processBufferMono(&This->downsampler, This->b2L, out, lengthOS);
+//		vDSP_vsmul(bufferL, 1, &gainReduction, bufferL, 1, lengthOS);
 		
-		// advance pointers
-		in += samplesProcessing;
-		out += samplesProcessing;
-		numSamples -= samplesProcessing;
+		// apply a soft clipping limiter to tame the clipping level of the attack transients
+//		BMAsymptoticLimitNoSag(bufferL, This->b2L, lengthOS);
+//		memcpy(bufferL, This->b2L, sizeof(float)*lengthOS);
+		return;
 	}
+	
+	// apply attack transient shaper to smooth the attack transients
+	BMMultibandAttackShaper_processStereo(&This->as,
+										  bufferL, bufferR,
+										  bufferL, bufferR,
+										  lengthOS);
+	
+	// apply lowpassed limiter to get compression without saturation
+	BMLowpassedLimiter_process(&This->llL, bufferL, bufferL, lengthOS);
+	BMLowpassedLimiter_process(&This->llR, bufferR, bufferR, lengthOS);
+	
+	// apply a gain reduction
+	float gainReduction = BM_DB_TO_GAIN(BMEC_GAIN_REDUCTION_BEFORE_SATURATOR);
+	vDSP_vsmul(bufferL, 1, &gainReduction, bufferL, 1, lengthOS);
+	vDSP_vsmul(bufferR, 1, &gainReduction, bufferR, 1, lengthOS);
+	
+	// apply a soft clipping limiter to tame the clipping level of the attack
+	// transients. This doesn't work in place so we copy back afterwards.
+	BMAsymptoticLimitNoSag(bufferL, This->b2L, lengthOS);
+	BMAsymptoticLimitNoSag(bufferR, This->b2R, lengthOS);
+	memcpy(bufferL, This->b2L, sizeof(float)*lengthOS);
+	memcpy(bufferR, This->b2R, sizeof(float)*lengthOS);
+}
+
+
+
+
+void BMExtremeCompressor_procesMono(BMExtremeCompressor *This,
+									const float *in,
+									float *out,
+									size_t numSamples){
+	assert(!This->isStereo);
+	
+	BMOversampler_processMono(&This->oversampler, in, out, numSamples);
 }
 
 
@@ -119,48 +134,5 @@ void BMExtremeCompressor_procesStereo(BMExtremeCompressor *This,
 									size_t numSamples){
 	assert(This->isStereo);
 	
-	while(numSamples > 0){
-		size_t samplesProcessing = BM_MIN(numSamples, BM_BUFFER_CHUNK_SIZE);
-	
-		// upsample
-		BMUpsampler_processBufferStereo(&This->upsampler,
-										inL, inR,
-										This->b1L, This->b1R,
-										samplesProcessing);
-		
-		// what is the chunk length now that we have upsampled
-		size_t lengthOS = This->osFactor * samplesProcessing;
-	
-		// apply attack transient shaper to smooth the attack transients
-		BMMultibandAttackShaper_processStereo(&This->as,
-											  This->b1L, This->b1R,
-											  This->b1L, This->b1R,
-											  lengthOS);
-
-		// apply lowpassed limiter to get compression without saturation
-		BMLowpassedLimiter_process(&This->llL, This->b1L, This->b1L, lengthOS);
-		BMLowpassedLimiter_process(&This->llR, This->b1R, This->b1R, lengthOS);
-		
-		// apply a gain reduction
-		float gainReduction = BM_DB_TO_GAIN(BMEC_GAIN_REDUCTION_BEFORE_SATURATOR);
-		vDSP_vsmul(This->b1L, 1, &gainReduction, This->b1L, 1, lengthOS);
-		vDSP_vsmul(This->b1R, 1, &gainReduction, This->b1R, 1, lengthOS);
-	
-		// apply a soft clipping limiter to tame the clipping level of the attack transients
-		BMAsymptoticLimitNoSag(This->b1L, This->b2L, lengthOS);
-		BMAsymptoticLimitNoSag(This->b1R, This->b2R, lengthOS);
-	
-		// downsample
-		BMDownsampler_processBufferStereo(&This->downsampler,
-										  This->b2L, This->b2R,
-										  outL, outR,
-										  lengthOS);
-		
-		// advance pointers
-		inL += samplesProcessing;
-		inR += samplesProcessing;
-		outL += samplesProcessing;
-		outR += samplesProcessing;
-		numSamples -= samplesProcessing;
-	}
+	BMOversampler_processStereo(&This->oversampler, inL, inR, outL, outR, numSamples);
 }
@@ -13,16 +13,14 @@
 #include "BMAttackShaper.h"
 #include "BMAsymptoticLimiter.h"
 #include "BMLowpassedLimiter.h"
-#include "BMUpsampler.h"
-#include "BMDownsampler.h"
+#include "BMOversampler.h"
 #include "BMAttackShaper.h"
 
 typedef struct BMExtremeCompressor {
 	BMMultibandAttackShaper as;
 	BMLowpassedLimiter llL, llR;
-	BMUpsampler	 upsampler;
-	BMDownsampler downsampler;
-	float *b1L, *b1R, *b2L, *b2R;
+	BMOversampler oversampler;
+	float *b2L, *b2R;
 	size_t osFactor;
 	bool isStereo;
 } BMExtremeCompressor;
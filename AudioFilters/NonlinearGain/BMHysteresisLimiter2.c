@@ -153,7 +153,8 @@ void BMHysteresisLimiter2_processMonoSignedDualRes(BMHysteresisLimiter2 *This,
 //										 input,
 //										 limited,
 //										 numSamples);
-	memcpy(limited, input, sizeof(float)*numSamples);
+	if(limited != input)
+		memcpy(limited, input, sizeof(float)*numSamples);
 
 	// apply asymptotic limit
 	BMAsymptoticLimit(limited, limited, This->sampleRate, This->sag, numSamples);
@@ -531,6 +532,40 @@ void BMHysteresisLimiter2_init(BMHysteresisLimiter2 *This,
 	
 	This->c = 0.0f;
 	This->cs = 0.0f;
+	This->oversampleFactor = 1;
+}
+
+
+
+
+
+/*!
+ *BMHysteresisLimiter2_processOversampled
+ *
+ * @abstract the oversampler kernel. Runs the limiter in place on one tile of the oversampled signal.
+ */
+void BMHysteresisLimiter2_processOversampled(void *context, float *buffer, float *unused, size_t numSamples){
+	BMHysteresisLimiter2 *This = context;
+	BMHysteresisLimiter2_processMonoSignedDualRes(This, buffer, buffer, numSamples);
+}
+
+
+
+
+
+void BMHysteresisLimiter2_initOversampled(BMHysteresisLimiter2 *This,
+										  float sampleRate,
+										  size_t oversampleFactor,
+										  size_t aaFilterNumLevels,
+										  float lpFilterFc,
+										  float hpFilterFc){
+	// the limiter and its filters run at the oversampled rate
+	size_t numChannels = 1;
+	BMHysteresisLimiter2_init(This, sampleRate * (float)oversampleFactor, aaFilterNumLevels, lpFilterFc, hpFilterFc, numChannels);
+	
+	This->oversampleFactor = oversampleFactor;
+	BMOversampler_init(&This->oversampler, false, oversampleFactor, BMRESAMPLER_FULL_SPECTRUM);
+	BMOversampler_setBlockKernel(&This->oversampler, BMHysteresisLimiter2_processOversampled, This);
 }
 
 
@@ -540,4 +575,28 @@ void BMHysteresisLimiter2_init(BMHysteresisLimiter2 *This,
 void BMHysteresisLimiter2_free(BMHysteresisLimiter2 *This){
 	BMMultiLevelBiquad_free(&This->filter1);
 	BMMultiLevelBiquad_free(&This->filter2);
+	if(This->oversampleFactor > 1)
+		BMOversampler_free(&This->oversampler);
+}
+
+
+
+
+
+void BMHysteresisLimiter2_processMonoOversampled(BMHysteresisLimiter2 *This,
+												 const float *input,
+												 float* output,
+												 size_t numSamples){
+	assert(This->oversampleFactor > 1);
+	BMOversampler_processMono(&This->oversampler, input, output, numSamples);
+}
+
+
+
+
+
+float BMHysteresisLimiter2_getLatencyInSamples(BMHysteresisLimiter2 *This){
+	if(This->oversampleFactor > 1)
+		return BMOversampler_getLatencyInSamples(&This->oversampler);
+	return 0.0f;
 }
@@ -33,11 +33,14 @@
 #include <stdio.h>
 #include <simd/simd.h>
 #include "BMMultiLevelBiquad.h"
+#include "BMOversampler.h"
 
 typedef struct BMHysteresisLimiter2 {
 	BMMultiLevelBiquad filter1, filter2;
+	BMOversampler oversampler;
 	float c, R, oneOverR, sampleRate, sag, s, sR, halfSR;
 	simd_float2 cs;
+	size_t oversampleFactor;
 } BMHysteresisLimiter2;
 
 
@@ -60,6 +63,28 @@ void BMHysteresisLimiter2_init(BMHysteresisLimiter2 *This,
 
 
 
+
+/*!
+ *BMHysteresisLimiter2_initOversampled
+ *
+ * @abstract init a mono limiter that runs at an oversampled rate. Use BMHysteresisLimiter2_processMonoOversampled with this.
+ *
+ * @param This pointer to an uninitialised struct
+ * @param sampleRate audio system sample rate
+ * @param oversampleFactor supported values: 2^n, n>0
+ * @param aaFilterNumLevels number of biquad sections in the antialiasing filter
+ * @param aaFilterFc cutoff frequency of antialiasing filter
+ * @param hpFilterFc cutoff frequency of highpass filter
+ */
+void BMHysteresisLimiter2_initOversampled(BMHysteresisLimiter2 *This,
+										  float sampleRate,
+										  size_t oversampleFactor,
+										  size_t aaFilterNumLevels,
+										  float aaFilterFc,
+										  float hpFilterFc);
+
+
+
 /*!
  *BMHysteresisLimiter2_free
  */
@@ -135,6 +160,32 @@ void BMHysteresisLimiter2_processMonoSignedDualRes(BMHysteresisLimiter2 *This,
 
 
 
+/*!
+ *BMHysteresisLimiter2_processMonoOversampled
+ *
+ * @abstract upsample, process with BMHysteresisLimiter2_processMonoSignedDualRes and downsample
+ *
+ * @param This pointer to a struct initialised with BMHysteresisLimiter2_initOversampled
+ * @param input array of length numSamples
+ * @param output array of length numSamples. may be the same as input.
+ * @param numSamples length of input and output at the audio system sample rate
+ */
+void BMHysteresisLimiter2_processMonoOversampled(BMHysteresisLimiter2 *This,
+												 const float *input,
+												 float* output,
+												 size_t numSamples);
+
+
+
+/*!
+ *BMHysteresisLimiter2_getLatencyInSamples
+ *
+ * @returns the latency of the oversampler, or zero if the limiter is not oversampled
+ */
+float BMHysteresisLimiter2_getLatencyInSamples(BMHysteresisLimiter2 *This);
+
+
+
 /*!
 *BMHysteresisLimiter2_processMonoClassA
 *
@@ -11,6 +11,10 @@
 #include "Constants.h"
 
 
+// forward declarations
+void BMBlipOscillator_processOversampled(void *context, float *outputOS, float *unused, size_t lengthOS);
+
+
 void BMBlipOscillator_init(BMBlipOscillator *This, float sampleRate, size_t oversampleFactor, size_t filterOrder, size_t numBlips){
 	This->numBlips = numBlips;
 	This->nextBlip = 0;
@@ -20,12 +24,21 @@ void BMBlipOscillator_init(BMBlipOscillator *This, float sampleRate, size_t over
 	This->dcOffset = 0.0f;
 	This->lastImpulseIndex_i = 0;
 	This->lastImpulseIndexOS_f = 0.0f;
+	This->tileStart = 0;
+    
+    // init the oversampler. The phase increments are upsampled with a
+    // gaussian filter so that they don't ring.
+    size_t numPasses = 3;
+    BMOversampler_initGaussian(&This->oversampler, oversampleFactor, numPasses, BMRESAMPLER_FULL_SPECTRUM);
+    BMOversampler_setBlockKernel(&This->oversampler, BMBlipOscillator_processOversampled, This);
     
-    size_t bufferSize = BM_BUFFER_CHUNK_SIZE*oversampleFactor;
-    This->b1 = malloc(sizeof(float)*bufferSize);
-    This->b2 = malloc(sizeof(float)*bufferSize);
-	This->b3 = malloc(sizeof(float)*bufferSize);
-    This->b3i = malloc(sizeof(size_t)*bufferSize);
+    // b1 and b3 hold one chunk at the original rate. b2 and b3i hold one
+    // tile at the oversampled rate.
+    size_t bufferSizeOS = This->oversampler.tileLength*oversampleFactor;
+    This->b1 = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+    This->b2 = malloc(sizeof(float)*bufferSizeOS);
+	This->b3 = malloc(sizeof(float)*BM_BUFFER_CHUNK_SIZE);
+    This->b3i = malloc(sizeof(size_t)*bufferSizeOS);
     
     // init the structs that generate the band-limited impulses
     float lowpassFc = sampleRate * 0.25f;
@@ -37,13 +50,6 @@ void BMBlipOscillator_init(BMBlipOscillator *This, float sampleRate, size_t over
     BMMultiLevelBiquad_init(&This->lowpass, 2, sampleRate, false, true, false);
 	BMMultiLevelBiquad_setLowPass6db(&This->lowpass, 30.0f, 0);
 	BMMultiLevelBiquad_setLowPass6db(&This->lowpass, 30.0f, 1);
-    
-    // init the gaussian upsampler
-    size_t numPasses = 3;
-    BMGaussianUpsampler_init(&This->upsampler, oversampleFactor, numPasses);
-    
-    // init the downsampler
-    BMDownsampler_init(&This->downsampler, false, oversampleFactor, BMRESAMPLER_FULL_SPECTRUM);
 }
 
 
@@ -51,6 +57,9 @@ void BMBlipOscillator_init(BMBlipOscillator *This, float sampleRate, size_t over
 
 
 void BMBlipOscillator_free(BMBlipOscillator *This){
+    for(size_t i=0; i<This->numBlips; i++)
+        BMBlip_free(&This->blips[i]);
+    
     free(This->b1);
     free(This->b2);
 	free(This->b3);
@@ -62,12 +71,8 @@ void BMBlipOscillator_free(BMBlipOscillator *This){
     This->b3i = NULL;
     This->blips = NULL;
     
-    for(size_t i=0; i<This->numBlips; i++)
-        BMBlip_free(&This->blips[i]);
-    
     BMMultiLevelBiquad_free(&This->lowpass);
-    BMGaussianUpsampler_free(&This->upsampler);
-    BMDownsampler_free(&This->downsampler);
+    BMOversampler_free(&This->oversampler);
 }
 
 
@@ -90,35 +95,24 @@ float fractionalPart(float f){
 
 
 
-void BMBlipOscillator_processChunk(BMBlipOscillator *This, const float *log2Frequencies, float* output, size_t length){
-    
-    // convert logFrequencies to linear scale frequencies
-    float *frequencies = This->b2;
-    int length_i = (int)length;
-    vvexp2f(frequencies, log2Frequencies, &length_i);
-    
-	// convert frequencies to phase increments, accounting for upsampling
-    float *phaseIncrements = This->b1;
-	float scale = 1.0 / (This->sampleRate * (float)This->upsampler.upsampleFactor);
-	vDSP_vsmul(frequencies, 1, &scale, phaseIncrements, 1, length);
-	
-	// upsample the phase increments
-	size_t lengthOS = length * This->upsampler.upsampleFactor;
-    float *phaseIncrementsOS = This->b2;
-	BMGaussianUpsampler_processMono(&This->upsampler, phaseIncrements, phaseIncrementsOS, length);
-    
-//    // check phase increments
-//    float pi = phaseIncrementsOS[2];
-//    for(size_t i=0; i<lengthOS; i++){
-//        if(phaseIncrementsOS[i] != pi)
-//            printf("%f, ",phaseIncrementsOS[i]);
-//
-//printf("%f, ",phaseIncrementsOS[i]);
-//    }
+/*!
+ *BMBlipOscillator_processOversampled
+ *
+ * @abstract the oversampler kernel. Generates one tile of output at the oversampled rate.
+ *
+ * @param context   pointer to the BMBlipOscillator
+ * @param outputOS  the phase increments, upsampled. Replaced with the output of the oscillator.
+ * @param unused    NULL. The oscillator is mono.
+ * @param lengthOS  number of samples at the oversampled rate
+ */
+void BMBlipOscillator_processOversampled(void *context, float *outputOS, float *unused, size_t lengthOS){
+	BMBlipOscillator *This = context;
+	size_t oversampleFactor = This->oversampler.oversampleFactor;
 	
 	// take running sum of the phase increments, taking note of integer and
 	// fractional index of each place where the phase wraps around to zero
-    float *fractionalOffsetsOS = This->b1;
+	const float *phaseIncrementsOS = outputOS;
+    float *fractionalOffsetsOS = This->b2;
 	size_t *impulseIndicesOS = This->b3i;
 	float phase = This->lastPhase;
 	size_t j = 0;
@@ -140,7 +134,6 @@ void BMBlipOscillator_processChunk(BMBlipOscillator *This, const float *log2Freq
 	This->lastPhase = phase;
 	
 	// set the output to zero
-    float *outputOS = This->b2;
 	memset(outputOS,0,sizeof(float)*lengthOS);
 	
 	// process all the blips from start to end of the current buffer and sum into the output
@@ -155,15 +148,17 @@ void BMBlipOscillator_processChunk(BMBlipOscillator *This, const float *log2Freq
         BMBlip_restart(&This->blips[This->nextBlip], fractionalOffsetsOS[i]);
         BMBlip_process(&This->blips[This->nextBlip], outputOS + impulseIndicesOS[i], lengthOS - impulseIndicesOS[i]);
 		
-		// write the DC offset from the last impulse to the current impulse
-		size_t impulseIndex_i = impulseIndicesOS[i] / This->downsampler.downsampleFactor;
+		// write the DC offset from the last impulse to the current impulse.
+		// The DC offset buffer covers the whole chunk at the original rate
+		// so the index is relative to the start of the chunk.
+		size_t impulseIndex_i = This->tileStart + impulseIndicesOS[i] / oversampleFactor;
 		size_t samplesWritingDCOffset = impulseIndex_i - This->lastImpulseIndex_i;
 		vDSP_vfill(&This->dcOffset, dcOffsetBuffer + This->lastImpulseIndex_i, 1, samplesWritingDCOffset);
 		
 		// update the impulse index and dc offset for next time
 		This->lastImpulseIndex_i = impulseIndex_i;
 		float impulseIndexOS_f = (float)impulseIndicesOS[i] + fractionalOffsetsOS[i];
-		float wavelength = (impulseIndexOS_f - This->lastImpulseIndexOS_f) / (float)This->downsampler.downsampleFactor;
+		float wavelength = (impulseIndexOS_f - This->lastImpulseIndexOS_f) / (float)oversampleFactor;
 		This->dcOffset = -This->blips[This->nextBlip].filterConf->integral / wavelength;
 		This->lastImpulseIndexOS_f = impulseIndexOS_f;
         
@@ -171,17 +166,41 @@ void BMBlipOscillator_processChunk(BMBlipOscillator *This, const float *log2Freq
         This->nextBlip = (This->nextBlip+1) % This->numBlips;
 	}
 	
+	// update the last impulse index and the start of the next tile
+	This->lastImpulseIndexOS_f -= lengthOS;
+	This->tileStart += lengthOS / oversampleFactor;
+}
+
+
+
+
+void BMBlipOscillator_processChunk(BMBlipOscillator *This, const float *log2Frequencies, float* output, size_t length){
+    
+    // convert logFrequencies to linear scale frequencies
+    float *frequencies = This->b1;
+    int length_i = (int)length;
+    vvexp2f(frequencies, log2Frequencies, &length_i);
+    
+	// convert frequencies to phase increments, accounting for upsampling
+    float *phaseIncrements = This->b1;
+	float scale = 1.0 / (This->sampleRate * (float)This->oversampler.oversampleFactor);
+	vDSP_vsmul(frequencies, 1, &scale, phaseIncrements, 1, length);
+	
+	// upsample the phase increments, generate the impulses and downsample.
+	// The kernel also fills the DC offset buffer as it goes.
+	This->tileStart = 0;
+	BMOversampler_processMono(&This->oversampler, phaseIncrements, output, length);
+	
+	// rename b3 for readability
+	float *dcOffsetBuffer = This->b3;
+	
 	// write the DC offset to the end of the buffer
 	size_t samplesWritingDCOffset = length - This->lastImpulseIndex_i;
 	vDSP_vfill(&This->dcOffset, dcOffsetBuffer + This->lastImpulseIndex_i, 1, samplesWritingDCOffset);
 	
 	// update the last impulse index
-	This->lastImpulseIndexOS_f -= lengthOS;
 	This->lastImpulseIndex_i = 0;
 	
-	// downsample
-	BMDownsampler_processBufferMono(&This->downsampler, outputOS, output, lengthOS);
-	
 	// lowpass filter the DC offset buffer to smooth it out
 	BMMultiLevelBiquad_processBufferMono(&This->lowpass, dcOffsetBuffer, dcOffsetBuffer, length);
 	
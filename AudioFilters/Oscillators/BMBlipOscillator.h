@@ -15,17 +15,15 @@
 #define BMBlipOscillator_h
 
 #include <stdio.h>
-#include "BMGaussianUpsampler.h"
-#include "BMDownsampler.h"
+#include "BMOversampler.h"
 #include "BMMultilevelBiquad.h"
 #include "BMBlip.h"
 
 
 typedef struct BMBlipOscillator{
-	BMGaussianUpsampler upsampler;
-	BMDownsampler downsampler;
+	BMOversampler oversampler;
 	BMMultiLevelBiquad lowpass;
-	size_t numBlips, nextBlip, filterOrder, lastImpulseIndex_i;
+	size_t numBlips, nextBlip, filterOrder, lastImpulseIndex_i, tileStart;
 	BMBlip *blips;
 	float sampleRate, lastPhase, dcOffset, lastImpulseIndexOS_f;
     float *b1, *b2, *b3;
@@ -14,6 +14,8 @@
 #include <Accelerate/Accelerate.h>
 
 
+// forward declarations
+void BMCDBlepOscillator_processOversampled(void *context, float *outputOS, float *unused, size_t lengthOS);
 
 
 
@@ -78,9 +80,17 @@ void BMCDBlepOscillator_init(BMCDBlepOscillator *This, size_t numBleps, size_t f
 		This->blepInputInitialValue[i] = sampleRate * 10;
 	
 	
+	// init the oversampler. The frequencies are upsampled with a gaussian
+	// filter so that they don't ring.
+	BMOversampler_initGaussian(&This->oversampler, oversampleFactor, 3, BMRESAMPLER_FULL_SPECTRUM);
+	BMOversampler_setBlockKernel(&This->oversampler, BMCDBlepOscillator_processOversampled, This);
+	
+	// the internal buffers hold one tile of the oversampled signal
+	size_t bufferLength = This->oversampler.tileLength * oversampleFactor;
+	
 	// allocate space for the blep ramp buffers
 	for(size_t i=0; i<numBleps; i++)
-		This->blepInputBuffers[i] = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
+		This->blepInputBuffers[i] = malloc(sizeof(float) * bufferLength);
     
     // start the offset for writing to blep input buffers at zero
     for(size_t i=0; i<numBleps; i++)
@@ -89,30 +99,23 @@ void BMCDBlepOscillator_init(BMCDBlepOscillator *This, size_t numBleps, size_t f
 	// compute the step response coefficients
 	intPolyCoefList(This->stepResponseCoefficients, filterOrder, sampleRate * (float)oversampleFactor);
 	
-	// init the upsampler
-	BMGaussianUpsampler_init(&This->upsampler, oversampleFactor, 3);
-	
-	// init the downsampler
-	bool stereo = false;
-	BMDownsampler_init(&This->downsampler, stereo, oversampleFactor, BMRESAMPLER_FULL_SPECTRUM);
-	
 	// init the DC blocking filter
+	bool stereo = false;
 	BMMultiLevelBiquad_init(&This->highpass, 1, sampleRate, stereo, true, false);
 	BMMultiLevelBiquad_setHighPass6db(&This->highpass, 40.0f, 0);
 	
 	// allocate some buffers
-	This->b1 = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
-	This->b2 = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
-    This->b3 = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
-	This->b4 = malloc(sizeof(size_t) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
-	This->archetypeWavelengths = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * oversampleFactor);
+	This->b2 = malloc(sizeof(float) * bufferLength);
+    This->b3 = malloc(sizeof(float) * bufferLength);
+	This->b4 = malloc(sizeof(size_t) * bufferLength);
+	This->archetypeWavelengths = malloc(sizeof(float) * bufferLength);
 	
 	// the archetype wavelength is the wavelength of the basic wave shape before
 	// we scale it to get the wavelength corresponding to the input frequency.
 	// We need an entire vector containing the same value because there is no
 	// vector - scalar floating point mod function in the Accelerate framework
 	float archetypeWavelength = 2.0f;
-	vDSP_vfill(&archetypeWavelength, This->archetypeWavelengths, 1, BM_BUFFER_CHUNK_SIZE * oversampleFactor);
+	vDSP_vfill(&archetypeWavelength, This->archetypeWavelengths, 1, bufferLength);
 	
 	// calculate the BLEP ramp increment. This is the change in the BLEP input
 	// for each sample of oversampled audio input.
@@ -135,12 +138,9 @@ void BMCDBlepOscillator_free(BMCDBlepOscillator *This){
 		This->blepInputBuffers[i] = NULL;
 	}
 	
-	BMDownsampler_free(&This->downsampler);
-	BMGaussianUpsampler_free(&This->upsampler);
+	BMOversampler_free(&This->oversampler);
 	BMMultiLevelBiquad_free(&This->highpass);
 	
-	free(This->b1);
-	This->b1 = NULL;
 	free(This->b2);
 	This->b2 = NULL;
 	free(This->b3);
@@ -396,53 +396,45 @@ void BMCDBlepOscillator_generateblepInputs(BMCDBlepOscillator *This, const float
 
 
 
-void BMCDBlepOscillator_process(BMCDBlepOscillator *This, const float *frequencies, float *output, size_t numSamples){
+/*!
+ *BMCDBlepOscillator_processOversampled
+ *
+ * @abstract the oversampler kernel. Generates one tile of output at the oversampled rate.
+ *
+ * @param context   pointer to the BMCDBlepOscillator
+ * @param outputOS  the frequencies, upsampled. Replaced with the output of the oscillator.
+ * @param unused    NULL. The oscillator is mono.
+ * @param lengthOS  number of samples at the oversampled rate
+ */
+void BMCDBlepOscillator_processOversampled(void *context, float *outputOS, float *unused, size_t lengthOS){
+	BMCDBlepOscillator *This = context;
 	
-	size_t samplesRemaining = numSamples;
-	size_t i=0;
-	while (samplesRemaining > 0){
-		size_t samplesProcessing = BM_MIN(BM_BUFFER_CHUNK_SIZE, samplesRemaining);
-		size_t samplesProcessingOS = This->oversampleFactor * samplesProcessing;
-		
-		// upsample the frequencies
-		float * frequenciesOS = This->b1;
-		BMGaussianUpsampler_processMono(&This->upsampler, frequencies + i, frequenciesOS, samplesProcessing);
-        
-//        // multiply the frequencies by the oversampling factor
-//        float osFactorF = This->oversampleFactor;
-//        vDSP_vsmul(frequenciesOS, 1, &osFactorF, frequenciesOS, 1, samplesProcessingOS);
-		
-		// convert frequencies to phases
-        float *phasesOS = This->b1;
-        BMCDBlepOscillator_freqsToPhases(This, frequenciesOS, phasesOS, samplesProcessingOS);
-		
-		// process naive saw oscillator
-        float *outputOS = This->b1;
-		BMCDBlepOscillator_naiveSaw(This, phasesOS, outputOS, samplesProcessingOS);
-		
-		// calculate the input indices for the BLEP filters and store them
-        // in the BLEP input Buffers
-        BMCDBlepOscillator_generateblepInputs(This, outputOS, samplesProcessingOS);
-
-// DEBUG
-		// zero out the naive wave for testing
-		// memset(outputOS,0,sizeof(float)*samplesProcessingOS);
-		
-		// sum the blep outputs into the main output
-		for(size_t j=0; j<This->numBleps; j++)
-			BMCDBlepOscillator_processBlep(This, This->blepInputBuffers[j], outputOS, samplesProcessingOS);
+	// convert frequencies to phases
+	BMCDBlepOscillator_freqsToPhases(This, outputOS, outputOS, lengthOS);
+	
+	// process naive saw oscillator
+	BMCDBlepOscillator_naiveSaw(This, outputOS, outputOS, lengthOS);
+	
+	// calculate the input indices for the BLEP filters and store them
+	// in the BLEP input Buffers
+	BMCDBlepOscillator_generateblepInputs(This, outputOS, lengthOS);
+	
+	// sum the blep outputs into the main output
+	for(size_t j=0; j<This->numBleps; j++)
+		BMCDBlepOscillator_processBlep(This, This->blepInputBuffers[j], outputOS, lengthOS);
 // DEBUG
-		// scale down to avoid clipping when debugging
-		float scale = 0.5f;
-		vDSP_vsmul(outputOS, 1, &scale, outputOS, 1, samplesProcessingOS);
-		
-		// downsample
-		BMDownsampler_processBufferMono(&This->downsampler, outputOS, output+i, samplesProcessingOS);
-		
-		// advance indices
-		samplesRemaining -= samplesProcessing;
-		i += samplesProcessing;
-	}
+	// scale down to avoid clipping when debugging
+	float scale = 0.5f;
+	vDSP_vsmul(outputOS, 1, &scale, outputOS, 1, lengthOS);
+}
+
+
+
+
+
+void BMCDBlepOscillator_process(BMCDBlepOscillator *This, const float *frequencies, float *output, size_t numSamples){
+	// upsample the frequencies, generate the waveform and downsample it
+	BMOversampler_processMono(&This->oversampler, frequencies, output, numSamples);
 	
 	// highpass filter
 	BMMultiLevelBiquad_processBufferMono(&This->highpass, output, output, numSamples);
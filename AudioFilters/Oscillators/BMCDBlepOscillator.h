@@ -30,8 +30,7 @@
 #define BMCDBlepOscillator_h
 
 #include <stdio.h>
-#include "BMGaussianUpsampler.h"
-#include "BMDownsampler.h"
+#include "BMOversampler.h"
 #include "BMMultiLevelBiquad.h"
 
 #define BMCDBLEP_MAX_BLEPS 20
@@ -45,10 +44,9 @@ typedef struct BMCDBlepOscillator {
 	float *blepInputBuffers [BMCDBLEP_MAX_BLEPS];
 	float stepResponseCoefficients [BMCDBLEP_MAX_FILTER_ORDER];
 	float *archetypeWavelengths;
-    float *b1, *b2, *b3;
+    float *b2, *b3;
     size_t *b4;
-	BMGaussianUpsampler upsampler;
-	BMDownsampler downsampler;
+	BMOversampler oversampler;
 	BMMultiLevelBiquad highpass;
 } BMCDBlepOscillator;
 
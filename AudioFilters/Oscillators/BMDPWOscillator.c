@@ -18,6 +18,7 @@
 #include "BMIntegerMath.h"
 
 void BMDPWOscillator_initDifferentiator(BMDPWOscillator *This);
+void BMDPWOscillator_processOversampled(void *context, float *buffer, float *unused, size_t length);
 
 void BMDPWOscillator_init(BMDPWOscillator *This,
 						  enum BMDPWOscillatorType oscillatorType,
@@ -36,14 +37,19 @@ void BMDPWOscillator_init(BMDPWOscillator *This,
 	This->oversampleFactor = oversampleFactor;
 	This->nextStartPhase = 0.0f;
 	
-
+	// init the oversampler. The frequency data is upsampled with a gaussian
+	// filter to match the internal oversampled rate of the oscillator.
+	assert(isPowerOfTwo(oversampleFactor) && oversampleFactor > 1);
+	size_t numLevels = 3;
+	BMOversampler_initGaussian(&This->oversampler, oversampleFactor, numLevels, BMRESAMPLER_FULL_SPECTRUM);
+	BMOversampler_setBlockKernel(&This->oversampler, BMDPWOscillator_processOversampled, This);
     
-    This->bufferLength = BM_BUFFER_CHUNK_SIZE * oversampleFactor;
+    // the buffers hold one tile of the oversampled signal
+    This->bufferLength = This->oversampler.tileLength * oversampleFactor;
 	
 	// allocate memory for two buffers
 	This->b1 = malloc(This->bufferLength * sizeof(float));
 	This->b2 = malloc(This->bufferLength * sizeof(float));
-    This->b3 = malloc(This->bufferLength * sizeof(float));
     This->rawPolyWavelength = malloc(This->bufferLength * sizeof(float));
     
     // this is the wavelength of the polynomial we use to generate the
@@ -51,16 +57,6 @@ void BMDPWOscillator_init(BMDPWOscillator *This,
     float two = 2.0f;
     vDSP_vfill(&two, This->rawPolyWavelength, 1, This->bufferLength);
 	
-	// init the downsampler for oversampled processing
-	bool stereo = false;
-	assert(isPowerOfTwo(oversampleFactor) && oversampleFactor > 0);
-	BMDownsampler_init(&This->downsampler, stereo, oversampleFactor, BMRESAMPLER_FULL_SPECTRUM);
-	
-	// init the upsampler for matching the sample rate of the input to the internal
-	// oversampled rate of the oscillators
-	size_t numLevels = 3;
-	BMGaussianUpsampler_init(&This->upsampler, oversampleFactor,numLevels);
-	
 	// init the finite-difference differentiator
 	BMDPWOscillator_initDifferentiator(This);
 }
@@ -70,8 +66,7 @@ void BMDPWOscillator_init(BMDPWOscillator *This,
 
 
 void BMDPWOscillator_free(BMDPWOscillator *This){
-	BMGaussianUpsampler_free(&This->upsampler);
-	BMDownsampler_free(&This->downsampler);
+	BMOversampler_free(&This->oversampler);
 	BMFIRFilter_free(&This->differentiator);
     BMFIRFilter_free(&This->scalingFilter);
 	
@@ -79,8 +74,6 @@ void BMDPWOscillator_free(BMDPWOscillator *This){
 	This->b1 = NULL;
 	free(This->b2);
 	This->b2 = NULL;
-    free(This->b3);
-    This->b3 = NULL;
     
     free(This->rawPolyWavelength);
     This->rawPolyWavelength = NULL;
@@ -375,43 +368,40 @@ void BMDPWOscillator_integratedWaveform(BMDPWOscillator *This, const float *freq
 
 
 
+/*!
+ *BMDPWOscillator_processOversampled
+ *
+ * @abstract the oversampler kernel. Generates one tile of output at the oversampled rate.
+ *
+ * @param context  pointer to the BMDPWOscillator
+ * @param buffer   the frequencies, upsampled. Replaced with the output of the oscillator.
+ * @param unused   NULL. The oscillator is mono.
+ * @param length   number of samples at the oversampled rate
+ */
+void BMDPWOscillator_processOversampled(void *context, float *buffer, float *unused, size_t length){
+	BMDPWOscillator *This = context;
+	
+	// generate the integrated waveform
+	BMDPWOscillator_integratedWaveform(This, buffer, This->b1, length);
+	
+	// get the volume scaling signal
+	BMDPWOscillator_ampScales(This, buffer, This->b2, length);
+	
+	// apply a smoothing filter to the scaling signal
+	BMFIRFilter_process(&This->scalingFilter, This->b2, This->b2, length);
+	
+	// differentiate
+	BMFIRFilter_process(&This->differentiator, This->b1, This->b1, length);
+	
+	// apply the volume scaling to the integrated waveform signal
+	vDSP_vmul(This->b1, 1, This->b2, 1, buffer, 1, length);
+}
+
+
+
+
+
 void BMDPWOscillator_process(BMDPWOscillator *This, const float *frequencies, float *output, size_t length){
-    
-    size_t samplesRemainingOS = length * This->oversampleFactor;
-    size_t i=0;
-    //size_t iOS=0;
-    
-    // process in limited-length chunks
-    while(samplesRemainingOS > 0){
-        size_t samplesProcessingOS = BM_MIN(samplesRemainingOS,This->bufferLength);
-        size_t samplesProcessing = samplesProcessingOS / This->oversampleFactor;
-        
-        // upsample the frequency data
-        BMGaussianUpsampler_processMono(&This->upsampler, frequencies+i, This->b3, samplesProcessing);
-        
-        // generate the integrated waveform
-        BMDPWOscillator_integratedWaveform(This, This->b3, This->b1, samplesProcessingOS);
-        
-        // get the volume scaling signal
-        BMDPWOscillator_ampScales(This, This->b3, This->b2, samplesProcessingOS);
-        
-        for(size_t i=0; i<samplesProcessingOS; i++)
-            printf("%f,",This->b1[i]);
-        
-        // apply a smoothing filter to the scaling signal
-        BMFIRFilter_process(&This->scalingFilter, This->b2, This->b2, samplesProcessingOS);
-        
-        // differentiate
-        BMFIRFilter_process(&This->differentiator, This->b1, This->b1, samplesProcessingOS);
-        
-        // apply the volume scaling to the integrated waveform signal
-        vDSP_vmul(This->b1, 1, This->b2, 1, This->b1, 1, samplesProcessingOS);
-        
-        // downsample
-        BMDownsampler_processBufferMono(&This->downsampler, This->b1, output+i, samplesProcessingOS);
-        
-        // advance pointers
-        samplesRemainingOS -= samplesProcessingOS;
-        i += samplesProcessing;
-    }
+	// upsample the frequency data, generate the waveform and downsample it
+	BMOversampler_processMono(&This->oversampler, frequencies, output, length);
 }
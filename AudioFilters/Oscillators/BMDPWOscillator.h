@@ -31,22 +31,20 @@
 
 #include <stdio.h>
 #include "BMFIRFilter.h"
-#include "BMDownsampler.h"
+#include "BMOversampler.h"
 #include "BMMultiLevelBiquad.h"
 #include "BMShortSimpleDelay.h"
-#include "BMGaussianUpsampler.h"
 
 enum BMDPWOscillatorType {BMDPWO_SAW};
 
 typedef struct BMDPWOscillator {
 	BMFIRFilter differentiator, scalingFilter;
-	BMDownsampler downsampler;
-	BMGaussianUpsampler upsampler;
+	BMOversampler oversampler;
     BMMultiLevelBiquad upsamplingLPFilter;
 	
 	float outputSampleRate, oversampledSampleRate, nextStartPhase;
 	size_t differentiationOrder, integrationOrder, oversampleFactor, bufferLength;
-	float *b1, *b2, *b3, *rawPolyWavelength;
+	float *b1, *b2, *rawPolyWavelength;
 } BMDPWOscillator;
 
 void BMDPWOscillator_init(BMDPWOscillator *This,
@@ -103,6 +103,34 @@ void BMSmoothSwitch_processBufferStereo(BMSmoothSwitch *This,
 
 
 
+void BMSmoothSwitch_processBuffers(BMSmoothSwitch *This,
+                                   const float **inputs,
+                                   float **outputs,
+                                   size_t numChannels,
+                                   size_t numSamples){
+    if(This->gainControl.inTransition)
+        BMSmoothGain_processBuffers(&This->gainControl, inputs, outputs, numChannels, numSamples);
+    
+    // if we aren't in a transition state then we are either on or off
+    else {
+        for(size_t i=0; i<numChannels; i++){
+            // if the switch is on, copy from input to output
+            if(BMSmoothSwitch_getState(This) == BMSwitchOn){
+                if(inputs[i] != outputs[i])
+                    memcpy(outputs[i],inputs[i],sizeof(float)*numSamples);
+            }
+            
+            // if the switch is off set the output to zero
+            else
+                memset(outputs[i],0,sizeof(float)*numSamples);
+        }
+    }
+}
+
+
+
+
+
 void BMSmoothSwitch_setState(BMSmoothSwitch *This, bool stateOnOff){
     // turn off
     if(stateOnOff == false)
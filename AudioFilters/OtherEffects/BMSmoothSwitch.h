@@ -46,6 +46,21 @@ void BMSmoothSwitch_processBufferStereo(BMSmoothSwitch *This,
                                       size_t numSamples);
 
 
+/*!
+ *BMSmoothSwitch_processBuffers
+ *
+ * @param inputs      input buffers with size [numChannels,numSamples]
+ * @param outputs     output buffers with size [numChannels,numSamples]
+ * @param numChannels major dimension of inputs and outputs
+ * @param numSamples  minor diminsion of inputs and outputs
+ */
+void BMSmoothSwitch_processBuffers(BMSmoothSwitch *This,
+                                   const float **inputs,
+                                   float **outputs,
+                                   size_t numChannels,
+                                   size_t numSamples);
+
+
 /*!
  *BMSmoothSwitch_setState
  */
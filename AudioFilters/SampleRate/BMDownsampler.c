@@ -30,6 +30,10 @@ extern "C" {
         This->stereo = stereo;
 		This->bufferEntriesFilled = 0;
         This->downsampleFactor = downsampleFactor;
+        This->numStages = 0;
+        This->downsamplers2x = NULL;
+        This->bufferL1 = This->bufferL2 = This->bufferR1 = This->bufferR2 = NULL;
+        This->remnantBufferL = This->remnantBufferR = NULL;
         
         if(downsampleFactor > 1){
             // the number of 2x downsampling stages is log2(upsampleFactor)
@@ -63,6 +67,7 @@ extern "C" {
             } else {
                 This->bufferR1 = NULL;
                 This->bufferR2 = NULL;
+                This->remnantBufferR = NULL;
             }
             
             // set up the anti-ringing filter
@@ -160,194 +165,126 @@ extern "C" {
     
 	
 	
-	void BMDownsampler_processBufferStereoOddInputLength(BMDownsampler *This, 
-														 float* inputL, float* inputR,
-														 float* outputL, float* outputR,
-														 size_t numSamplesIn, size_t *numSamplesOut){
-		// refuse to process empty input
-		if(numSamplesIn == 0) {
-			*numSamplesOut = 0;
-			return;
-		}
-		
-		/***********************************************************************
-		 * if the input buffer length is divisible by the downsample factor
-		 * and the buffer is empty then...
-		 **********************************************************************/
-		if((numSamplesIn % This->downsampleFactor) == 0 && This->bufferEntriesFilled == 0){
-			// process as usual
-			BMDownsampler_processBufferStereo(This, inputL, inputR, outputL, outputR, numSamplesIn);
-		
-			// inform the calling function about the length of the output
-			*numSamplesOut = numSamplesIn / This->downsampleFactor;
-			
-			return;
-		}
-		
-		
-	
-		size_t remnantBufferLength = This->downsampleFactor;
-		
-		
-//		
-//		/***********************************************************************
-//		 * if the input buffer length is divisible by the downsample factor
-//		 * and the buffer is occupied then...
-//		 **********************************************************************/
-//		if(numSamplesIn % This->downsampleFactor == 0 && This->bufferEntriesFilled > 0){
-//			size_t samplesToFillRemnantBuffer = remnantBufferLength - This->bufferEntriesFilled;
-//			
-//			// copy the first samples of input into the back of the buffer until it's filled
-//			for(size_t i=0; i < samplesToFillRemnantBuffer; i++){
-//				This->remnantBufferL[i+This->bufferEntriesFilled] = inputL[i];
-//				This->remnantBufferR[i+This->bufferEntriesFilled] = inputR[i];
-//			}
-//			
-//			// process all the samples in the buffer to get one sample of output
-//			BMDownsampler_processBufferStereo(This,
-//											  This->remnantBufferL, This->remnantBufferR,
-//											  outputL, outputR,
-//											  remnantBufferLength);
-//			
-//			// calculate the number of samples left to process and the number to cache
-//			// in the remnant buffer
-//			size_t inputSamplesRemaining = numSamplesIn - samplesToFillRemnantBuffer;
-//			size_t remnantLength = inputSamplesRemaining % This->downsampleFactor;
-//			size_t inputSamplesToDownsample = inputSamplesRemaining - remnantLength;
-//			
-//			// if there are enough samples in the input to downsample
-//			BMDownsampler_processBufferStereo(This,
-//											  inputL + remnantLength, inputR + remnantLength,
-//											  outputL + 1, outputR + 1,
-//											  inputSamplesToDownsample);
-//			
-//			// copy the last remnantLength samples into the front of the buffer
-//			for(size_t i=0; i < remnantLength; i++){
-//				This->remnantBufferL[i] = inputL[numSamplesIn - This->bufferEntriesFilled + i];
-//				This->remnantBufferL[i] = inputR[numSamplesIn - This->bufferEntriesFilled + i];
-//			}
-//			
-//			// inform the calling function about the length of the output
-//			*numSamplesOut = (remnantBufferLength + inputSamplesToDownsample) / This->downsampleFactor;
-//			
-//			return;
-//		}
-		
-		
-		
-		
-		/***********************************************************************
-		 * if the input buffer length is not divisible
-		 * and the buffer is empty then...
-		 **********************************************************************/
-		if((numSamplesIn % This->downsampleFactor) != 0 && This->bufferEntriesFilled == 0){
-			size_t remnantLength = numSamplesIn % This->downsampleFactor;
-			
-			// process the first part of the input (leaving back the remnant)
-			BMDownsampler_processBufferStereo(This,
-											  inputL, inputR,
-											  outputL, outputR, 
-											  numSamplesIn - remnantLength);
-			
-			// copy the last samples to the front of the buffer
-			for(size_t i=0; i<remnantLength; i++){
-				This->remnantBufferL[i] = inputL[numSamplesIn - remnantLength + i];
-				This->remnantBufferR[i] = inputR[numSamplesIn - remnantLength + i];
-			}
-			
-			// set the number of entries of the remnant buffer that are occupied
-			This->bufferEntriesFilled = remnantLength;
-			
-			// inform the calling function about the length of the output
-			*numSamplesOut = (numSamplesIn-remnantLength) / This->downsampleFactor;
-			
-			return;
-		}
-		
-		
-		
-		
-		
-		/***********************************************************************
-		 * if we're still going and the buffer is not empty then...
-		 **********************************************************************/
-		//if((numSamplesIn % This->downsampleFactor) != 0 && This->bufferEntriesFilled > 0){
-		if(This->bufferEntriesFilled > 0){
-			size_t bufferEntriesEmpty = remnantBufferLength - This->bufferEntriesFilled;
-			
-			// if there's not enough input to fill the remnant buffer
-			if(bufferEntriesEmpty > numSamplesIn){
-				// copy what we have and stop without processing anything
-				for(size_t i=0; i < numSamplesIn; i++){
-					This->remnantBufferL[i+This->bufferEntriesFilled] = inputL[i];
-					This->remnantBufferR[i+This->bufferEntriesFilled] = inputR[i];
-				}
-				
-				// update the number of samples occupied
-				This->bufferEntriesFilled += numSamplesIn;
-				
-				// and we didn't get any output
-				*numSamplesOut = 0;
-				
-			// else, if there's enough input to fill the remnant buffer
-			} else {
-				
-				// copy the first samples of input into the back of the buffer until it's filled
-				for(size_t i=0; i < bufferEntriesEmpty; i++){
-					This->remnantBufferL[i+This->bufferEntriesFilled] = inputL[i];
-					This->remnantBufferR[i+This->bufferEntriesFilled] = inputR[i];
-				}
-				
-				// process the downsampleFactor samples in the buffer to get one sample of output
-				BMDownsampler_processBufferStereo(This,
-												  This->remnantBufferL, This->remnantBufferR,
-												  outputL, outputR,
-												  remnantBufferLength);
-				
-				
-				// if the input had exactly enough to fill the buffer
-				if (numSamplesIn == bufferEntriesEmpty){
-					// then clear the remnant buffer
-					This->bufferEntriesFilled = 0;
-					
-					// and we only got one output sample
-					*numSamplesOut = 1;
-					
-				// if the buffer isn't exactly filled by the input then we have a new remnant
-				} else {
-					// calculate how many samples will remain un-processed at the end
-					size_t remnantLength2 = (numSamplesIn - bufferEntriesEmpty) % This->downsampleFactor;
-					
-					// calculate the number of samples to process now
-					size_t inputSamplesProcessing = numSamplesIn - (bufferEntriesEmpty + remnantLength2);
-					
-					// process the samples in the input buffers, possibly leaving another remnant
-					BMDownsampler_processBufferStereo(This,
-													  inputL + bufferEntriesEmpty, inputR + bufferEntriesEmpty,
-													  outputL + 1, outputR + 1,
-													  inputSamplesProcessing);
-					
-					// copy the second remnant into the remnant buffer
-					for(size_t i=0; i<remnantLength2; i++){
-						This->remnantBufferL[i] = inputL[numSamplesIn - remnantLength2 + i];
-						This->remnantBufferR[i] = inputR[numSamplesIn - remnantLength2 + i];
-					}
-					
-					// set the number of elements in the remnant buffer
-					This->bufferEntriesFilled = remnantLength2;
-					
-					// inform the calling function about the length of the output
-					*numSamplesOut = (inputSamplesProcessing + remnantBufferLength) / This->downsampleFactor;
-				}
-			}
-			
-			return;
-		}
-		
-		// if we get here then there was an error
-		assert(false);
-	}
-	
+    /*!
+     *BMDownsampler_processAnyLength
+     *
+     * @abstract downsample any number of samples, keeping the samples after the last full frame for the next call
+     *
+     * @discussion A frame is downsampleFactor input samples, which make one
+     * output sample. The full frames are downsampled straight from the input
+     * arrays. At most one partial frame is copied, into the remnant buffer,
+     * and it's completed from the front of the input on the next call.
+     *
+     * @param inputR    NULL for mono
+     * @param outputR   NULL for mono
+     * @returns the number of output samples
+     */
+    static size_t BMDownsampler_processAnyLength(BMDownsampler *This,
+                                                 float* inputL, float* inputR,
+                                                 float* outputL, float* outputR,
+                                                 size_t numSamplesIn){
+        size_t factor = This->downsampleFactor;
+        
+        // bypass the downsampler
+        if(factor == 1){
+            if(inputR)
+                BMDownsampler_processBufferStereo(This, inputL, inputR, outputL, outputR, numSamplesIn);
+            else
+                BMDownsampler_processBufferMono(This, inputL, outputL, numSamplesIn);
+            return numSamplesIn;
+        }
+        
+        size_t numSamplesOut = 0;
+        
+        // if we have a partial frame from last time, complete it first
+        if(This->bufferEntriesFilled > 0){
+            size_t samplesToCopy = BM_MIN(factor - This->bufferEntriesFilled, numSamplesIn);
+            memcpy(This->remnantBufferL + This->bufferEntriesFilled, inputL, sizeof(float)*samplesToCopy);
+            if(inputR)
+                memcpy(This->remnantBufferR + This->bufferEntriesFilled, inputR, sizeof(float)*samplesToCopy);
+            This->bufferEntriesFilled += samplesToCopy;
+            inputL += samplesToCopy;
+            if(inputR) inputR += samplesToCopy;
+            numSamplesIn -= samplesToCopy;
+            
+            // not enough input to complete it; wait for the next call
+            if(This->bufferEntriesFilled < factor)
+                return 0;
+            
+            // downsample the completed frame to one output sample
+            if(inputR)
+                BMDownsampler_processBufferStereo(This, This->remnantBufferL, This->remnantBufferR, outputL, outputR, factor);
+            else
+                BMDownsampler_processBufferMono(This, This->remnantBufferL, outputL, factor);
+            This->bufferEntriesFilled = 0;
+            outputL++;
+            if(outputR) outputR++;
+            numSamplesOut++;
+        }
+        
+        // downsample all the full frames in place in the input
+        size_t remnantLength = numSamplesIn % factor;
+        size_t samplesProcessing = numSamplesIn - remnantLength;
+        if(samplesProcessing > 0){
+            if(inputR)
+                BMDownsampler_processBufferStereo(This, inputL, inputR, outputL, outputR, samplesProcessing);
+            else
+                BMDownsampler_processBufferMono(This, inputL, outputL, samplesProcessing);
+            numSamplesOut += samplesProcessing / factor;
+        }
+        
+        // keep the partial frame at the end for next time
+        memcpy(This->remnantBufferL, inputL + samplesProcessing, sizeof(float)*remnantLength);
+        if(inputR)
+            memcpy(This->remnantBufferR, inputR + samplesProcessing, sizeof(float)*remnantLength);
+        This->bufferEntriesFilled = remnantLength;
+        
+        return numSamplesOut;
+    }
+    
+    
+    
+    
+    size_t BMDownsampler_processBufferMonoAnyLength(BMDownsampler *This, float* input, float* output, size_t numSamplesIn){
+        return BMDownsampler_processAnyLength(This, input, NULL, output, NULL, numSamplesIn);
+    }
+    
+    
+    
+    
+    size_t BMDownsampler_processBufferStereoAnyLength(BMDownsampler *This,
+                                                      float* inputL, float* inputR,
+                                                      float* outputL, float* outputR,
+                                                      size_t numSamplesIn){
+        assert(This->stereo);
+        return BMDownsampler_processAnyLength(This, inputL, inputR, outputL, outputR, numSamplesIn);
+    }
+    
+    
+    
+    
+    void BMDownsampler_processBufferStereoOddInputLength(BMDownsampler *This,
+                                                         float* inputL, float* inputR,
+                                                         float* outputL, float* outputR,
+                                                         size_t numSamplesIn, size_t *numSamplesOut){
+        *numSamplesOut = BMDownsampler_processBufferStereoAnyLength(This, inputL, inputR, outputL, outputR, numSamplesIn);
+    }
+    
+    
+    
+    
+    size_t BMDownsampler_getNumBufferedSamples(const BMDownsampler *This){
+        return This->bufferEntriesFilled;
+    }
+    
+    
+    
+    
+    size_t BMDownsampler_getOutputLength(const BMDownsampler *This, size_t numSamplesIn){
+        return (This->bufferEntriesFilled + numSamplesIn) / This->downsampleFactor;
+    }
+    
+    
     
     
     void BMDownsampler_processBufferStereo(BMDownsampler *This, float* inputL, float* inputR, float* outputL, float* outputR, size_t numSamplesIn){
@@ -446,6 +383,8 @@ extern "C" {
         This->bufferR1 = NULL;
         This->bufferL2 = NULL;
         This->bufferR2 = NULL;
+        This->remnantBufferL = NULL;
+        This->remnantBufferR = NULL;
     }
     
     
@@ -475,10 +414,14 @@ extern "C" {
 		// latency is frequency dependent. We will check it at this frequency
 		float groupDelayTestFrequency = 300.0f;
 		
+		// the halfband filters are designed in normalised frequency so we
+		// assume a sample rate of 48 kHz here
+		double w = 2.0 * M_PI * groupDelayTestFrequency / 48000.0;
+		
 		// get the latency at each stage
 		float latency = 0.0f;
 		for(size_t i=0; i<This->numStages; i++){
-			float stageILatencyInSamples = BMMultiLevelBiquad_groupDelay(&This->downsamplers2x[i].even, groupDelayTestFrequency);
+			float stageILatencyInSamples = BMHIIRStageProc_groupDelay(&This->downsamplers2x[i].stages, 0, w);
 			float stageIOversampleFactor = powf(2.0f,(float)(This->numStages - i - 1));
 			latency += stageILatencyInSamples / stageIOversampleFactor;
 		}
@@ -46,7 +46,7 @@ void BMDownsampler_init(BMDownsampler* This, bool stereo, size_t downsampleFacto
  *
  * @param input    length = numSamplesIn
  * @param output   length = numSamplesIn / upsampleFactor
- * @param numSamplesIn  number of input samples to process
+ * @param numSamplesIn  number of input samples to process. must be divisible by downsampleFactor. For other lengths, use BMDownsampler_processBufferMonoAnyLength.
  */
 void BMDownsampler_processBufferMono(BMDownsampler* This, float* input, float* output, size_t numSamplesIn);
 
@@ -60,26 +60,69 @@ void BMDownsampler_processBufferMono(BMDownsampler* This, float* input, float* o
  * @param inputR    length = numSamplesIn
  * @param outputL   length = numSamplesIn / upsampleFactor
  * @param outputR   length = numSamplesIn / upsampleFactor
- * @param numSamplesIn  number of input samples to process
+ * @param numSamplesIn  number of input samples to process. must be divisible by downsampleFactor. For other lengths, use BMDownsampler_processBufferStereoAnyLength.
  */
 void BMDownsampler_processBufferStereo(BMDownsampler* This, float* inputL, float* inputR, float* outputL, float* outputR, size_t numSamplesIn);
 
 
 /*!
- *BMDownsampler_processBufferStereoOddInputLength
+ *BMDownsampler_processBufferMonoAnyLength
+ *
+ * @abstract downsample a buffer of any length
  *
- * @abstract downsample a buffer that contains an even or odd number of samples
+ * @discussion Each output sample needs downsampleFactor input samples. Input
+ * samples after the last complete group are kept in the downsampler and
+ * used at the start of the next call, so the output length varies from
+ * call to call. Use BMDownsampler_getOutputLength to find it in advance.
+ * This does not allocate memory.
+ *
+ * @param input    length = numSamplesIn
+ * @param output   length >= BMDownsampler_getOutputLength(This, numSamplesIn)
+ * @param numSamplesIn  number of input samples to process
+ * @returns the number of output samples
+ */
+size_t BMDownsampler_processBufferMonoAnyLength(BMDownsampler* This, float* input, float* output, size_t numSamplesIn);
+
+
+/*!
+ *BMDownsampler_processBufferStereoAnyLength
+ *
+ * @abstract downsample stereo buffers of any length. See BMDownsampler_processBufferMonoAnyLength.
  *
  * @param inputL    length = numSamplesIn
  * @param inputR    length = numSamplesIn
- * @param outputL   length = numSamplesIn / upsampleFactor
- * @param outputR   length = numSamplesIn / upsampleFactor
+ * @param outputL   length >= BMDownsampler_getOutputLength(This, numSamplesIn)
+ * @param outputR   length >= BMDownsampler_getOutputLength(This, numSamplesIn)
  * @param numSamplesIn  number of input samples to process
- * @param numSamplesOut For odd input length, the output length will be (numSamplesIn/2) rounded down or up, depending on the state of an internal buffer. This variable is used to inform the calling function of the actual length of the output.
+ * @returns the number of output samples
+ */
+size_t BMDownsampler_processBufferStereoAnyLength(BMDownsampler* This, float* inputL, float* inputR, float* outputL, float* outputR, size_t numSamplesIn);
+
+
+/*!
+ *BMDownsampler_processBufferStereoOddInputLength
+ *
+ * @abstract same as BMDownsampler_processBufferStereoAnyLength, with the output length returned in numSamplesOut
  */
 void BMDownsampler_processBufferStereoOddInputLength(BMDownsampler *This, float* inputL, float* inputR, float* outputL, float* outputR, size_t numSamplesIn, size_t *numSamplesOut);
 
 
+/*!
+ *BMDownsampler_getNumBufferedSamples
+ *
+ * @returns the number of input samples held by the AnyLength functions, waiting for enough input to make an output sample. Always less than downsampleFactor.
+ */
+size_t BMDownsampler_getNumBufferedSamples(const BMDownsampler* This);
+
+
+/*!
+ *BMDownsampler_getOutputLength
+ *
+ * @returns the exact number of output samples the next call to an AnyLength function will produce for numSamplesIn input samples
+ */
+size_t BMDownsampler_getOutputLength(const BMDownsampler* This, size_t numSamplesIn);
+
+
 void BMDownsampler_free(BMDownsampler* This);
 
 
@@ -3,8 +3,11 @@
 //  AudioFiltersXcodeProject
 //
 //  Upsampling by gaussian kernel interpolation between samples. The gaussian
-//  kernel antialiasing filter is implemented by a series of sliding window sum
-//  operations.
+//  kernel antialiasing filter is the convolution of a series of sliding window
+//  sums. Rather than filtering a zero stuffed signal with each window in turn,
+//  we merge the windows into one filter and split it into polyphase
+//  components, one for each output phase, so that only the input samples are
+//  multiplied.
 //
 //  Created by Hans on 17/11/20.
 //  Copyright © 2020 BlueMangoo. We release this file
@@ -13,25 +16,56 @@
 
 #include "BMGaussianUpsampler.h"
 #include <Accelerate/Accelerate.h>
+#include <assert.h>
+#include "Constants.h"
 
 void BMGaussianUpsampler_init(BMGaussianUpsampler *This, size_t upsampleFactor, size_t lowpassNumPasses){
+	assert(lowpassNumPasses >= 1);
 	This->upsampleFactor = upsampleFactor;
 	This->numLevels = lowpassNumPasses;
 	
-	This->swSum = malloc(sizeof(BMSlidingWindowSum) * lowpassNumPasses);
+	// Convolve numLevels rectangular windows of length upsampleFactor to get
+	// the impulse response of all the sliding window sum passes together.
+	// Its length is numLevels*(upsampleFactor-1) + 1. We pad it with zeros
+	// to numLevels*upsampleFactor so every phase has numLevels taps.
+	size_t L = upsampleFactor;
+	size_t P = lowpassNumPasses;
+	size_t impulseLength = P*L;
+	double *impulse = calloc(impulseLength, sizeof(double));
+	double *temp = calloc(impulseLength, sizeof(double));
+	impulse[0] = 1.0;
+	size_t length = 1;
+	for(size_t pass=0; pass<P; pass++){
+		memset(temp, 0, sizeof(double)*impulseLength);
+		for(size_t n=0; n<length; n++)
+			for(size_t k=0; k<L; k++)
+				temp[n+k] += impulse[n];
+		memcpy(impulse, temp, sizeof(double)*impulseLength);
+		length += L-1;
+	}
+	
+	// Scale the response as the zero stuffing version does, so that a
+	// constant input gives the same constant output after the filter has
+	// filled up.
+	double scale = 1.0 / pow((double)L, (double)(P-1));
+	This->coefficients = malloc(sizeof(float)*impulseLength);
+	for(size_t n=0; n<impulseLength; n++)
+		This->coefficients[n] = impulse[n]*scale;
+	free(impulse);
+	free(temp);
 	
-	for(size_t i=0; i<This->numLevels; i++)
-		BMSlidingWindowSum_init(&This->swSum[i], upsampleFactor);
+	// the input buffer starts with P-1 zeros of history
+	This->inputBuffer = calloc(P-1 + BM_BUFFER_CHUNK_SIZE, sizeof(float));
 }
 
 
 
 
 void BMGaussianUpsampler_free(BMGaussianUpsampler *This){
-	for(size_t i=0; i<This->numLevels; i++)
-		BMSlidingWindowSum_free(&This->swSum[i]);
-	free(This->swSum);
-	This->swSum = NULL;
+	free(This->coefficients);
+	free(This->inputBuffer);
+	This->coefficients = NULL;
+	This->inputBuffer = NULL;
 }
 
 
@@ -39,21 +73,49 @@ void BMGaussianUpsampler_free(BMGaussianUpsampler *This){
 
 void BMGaussianUpsampler_processMono(BMGaussianUpsampler *This, const float *input, float *output, size_t inputLength){
 	if(This->upsampleFactor > 1){
-		size_t outputLength = inputLength*This->upsampleFactor;
-		
-		// set output to zero
-		memset(output,0,sizeof(float)*outputLength);
+		size_t L = This->upsampleFactor;
+		size_t historyLength = This->numLevels-1;
+		float *current = This->inputBuffer + historyLength;
 		
-		// copy the input samples to the output with scaling factor and stride for upsampling
-		float scale = 1.0f / powf(This->upsampleFactor,This->numLevels-1);
-		vDSP_vsmul(input, 1, &scale, output, This->upsampleFactor, inputLength);
-		
-		// gaussian kernel antialias filter implemented by a series of sliding
-		// window sum operations
-		for(size_t i=0; i<This->numLevels; i++)
-			BMSlidingWindowSum_processMono(&This->swSum[i], output, output, inputLength*This->upsampleFactor);
+		while(inputLength > 0){
+			size_t samplesProcessing = BM_MIN(inputLength, BM_BUFFER_CHUNK_SIZE);
+			memcpy(current, input, sizeof(float)*samplesProcessing);
+			
+			// Output sample k*L + r is the sum over j of input[k-j] times
+			// tap j of phase r. For each tap and phase we do that for all k
+			// at once, writing with stride L.
+			for(size_t j=0; j<This->numLevels; j++){
+				const float *inputDelayed = current - j;
+				const float *tap = This->coefficients + j*L;
+				for(size_t r=0; r<L; r++){
+					if(j == 0)
+						vDSP_vsmul(inputDelayed, 1, tap + r, output + r, L, samplesProcessing);
+					else
+						vDSP_vsma(inputDelayed, 1, tap + r, output + r, L, output + r, L, samplesProcessing);
+				}
+			}
+			
+			// save the end of the input as history for the next chunk
+			memmove(This->inputBuffer, current + samplesProcessing - historyLength, sizeof(float)*historyLength);
+			
+			// advance pointers
+			input += samplesProcessing;
+			output += samplesProcessing*L;
+			inputLength -= samplesProcessing;
+		}
 	} else {
 		if(input != output)
 			memcpy(output,input,sizeof(float)*inputLength);
 	}
 }
+
+
+
+
+float BMGaussianUpsampler_getLatencyInSamples(BMGaussianUpsampler *This){
+	// The filter is symmetric with length numLevels*(upsampleFactor-1) + 1
+	// at the output rate so its delay is half of one less than that.
+	float L = (float)This->upsampleFactor;
+	float P = (float)This->numLevels;
+	return P * (L - 1.0f) / (2.0f * L);
+}
@@ -12,12 +12,15 @@
 #define BMGaussianUpsampler_h
 
 #include <stdio.h>
-#include "BMSlidingWindowSum.h"
 #include "BMFIRFilter.h"
 
 typedef struct BMGaussianUpsampler {
-	BMSlidingWindowSum *swSum;
-	// BMFIRFilter *aaFilter;
+	// polyphase coefficients of the merged sliding window filters. Tap j of
+	// phase r is at coefficients[j*upsampleFactor + r].
+	float *coefficients;
+	
+	// the last numLevels-1 input samples followed by the current chunk
+	float *inputBuffer;
 	
 	size_t upsampleFactor, numLevels;
 } BMGaussianUpsampler;
@@ -28,6 +31,11 @@ typedef struct BMGaussianUpsampler {
  * @param This pointer to an initialised struct
  * @param upsampleFactor upsample factor
  * @param lowpassNumPasses >= 1 this class implements a gaussian FIR lowpass filter by using multiple passes of a sliding rectangular window filter. When this value is 1, we get linear interpolation. Higher values approximate a gaussian lowpass filter.
+ *
+ * @discussion The passes are merged into a single FIR filter and applied in
+ * polyphase form, so the output is computed directly from the input without
+ * filtering the zeros that upsampling inserts. Each output sample costs
+ * lowpassNumPasses multiply-adds.
  */
 void BMGaussianUpsampler_init(BMGaussianUpsampler *This, size_t upsampleFactor, size_t lowpassNumPasses);
 
@@ -37,8 +45,20 @@ void BMGaussianUpsampler_init(BMGaussianUpsampler *This, size_t upsampleFactor,
 void BMGaussianUpsampler_free(BMGaussianUpsampler *This);
 
 /*!
- *BMGaussianUpsampler_process
+ *BMGaussianUpsampler_processMono
+ *
+ * @param This         pointer to an initialised struct
+ * @param input        length = inputLength
+ * @param output       length = inputLength * upsampleFactor. must not overlap input.
+ * @param inputLength  number of input samples
  */
 void BMGaussianUpsampler_processMono(BMGaussianUpsampler *This, const float *input, float *output, size_t inputLength);
 
+/*!
+ *BMGaussianUpsampler_getLatencyInSamples
+ *
+ * @returns the group delay of the filter in samples at the input rate
+ */
+float BMGaussianUpsampler_getLatencyInSamples(BMGaussianUpsampler *This);
+
 #endif /* BMGaussianUpsampler_h */
@@ -0,0 +1,228 @@
+//
+//  BMHIIRStageProc.h
+//  AudioFiltersXcodeProject
+//
+//  The allpass filter chains of the polyphase IIR halfband filters used by
+//  BMIIRUpsampler2x and BMIIRDownsampler2x. Based on StageProcFpu.hpp from
+//  the HIIR library by Laurent de Soras
+//  http://ldesoras.free.fr/prod.html
+//
+//  Each coefficient a is a first order allpass filter
+//
+//          a + z^-1
+//  H(z) = ----------
+//         1 + a z^-1
+//
+//  The even numbered coefficients make one chain and the odd numbered ones
+//  make the other. We process both chains of the left and right channels at
+//  once, one in each lane of a simd_float4:
+//
+//      {left even chain, left odd chain, right even chain, right odd chain}
+//
+//  For mono, lanes 2 and 3 are unused. Each stage is one subtract and one
+//  multiply-add for all four chains.
+//
+//  We tried HIIR's packed mono layout, with two stages of both chains in each
+//  vector and the stages pipelined one sample apart. It was slower. Mono is
+//  limited by the latency of each stage's feedback, not by the number of
+//  vector operations, so the idle lanes cost nothing. What does help is
+//  keeping x and y in registers for the whole buffer, so the buffer
+//  functions below do that.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifndef BMHIIRStageProc_h
+#define BMHIIRStageProc_h
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <simd/simd.h>
+
+
+// the buffer functions keep the filter state in registers for filters with
+// up to this many stages
+#define BMHIIRStageProc_MaxUnrolledStages 6
+
+
+typedef struct BMHIIRStageProc {
+	// one entry for each stage. x and y are the previous input and output
+	// of each stage
+	simd_float4 *coefficients, *x, *y;
+	size_t numStages;
+} BMHIIRStageProc;
+
+
+
+/*!
+ *BMHIIRStageProc_init
+ *
+ * @param This             pointer to a struct
+ * @param numCoefficients  number of allpass coefficients. must be even.
+ */
+static inline void BMHIIRStageProc_init(BMHIIRStageProc *This, size_t numCoefficients){
+	This->numStages = numCoefficients / 2;
+	This->coefficients = malloc(sizeof(simd_float4) * This->numStages * 3);
+	This->x = This->coefficients + This->numStages;
+	This->y = This->x + This->numStages;
+	memset(This->x, 0, sizeof(simd_float4) * This->numStages * 2);
+}
+
+
+
+/*!
+ *BMHIIRStageProc_setCoefs
+ *
+ * @param This      pointer to an initialised struct
+ * @param coef_arr  allpass coefficients from BMPolyphaseIIR2Designer, length 2 * numStages
+ */
+static inline void BMHIIRStageProc_setCoefs(BMHIIRStageProc *This, const double *coef_arr){
+	for(size_t i=0; i<This->numStages; i++){
+		float even = coef_arr[2*i];
+		float odd = coef_arr[2*i + 1];
+		This->coefficients[i] = simd_make_float4(even, odd, even, odd);
+	}
+}
+
+
+
+/*!
+ *BMHIIRStageProc_free
+ */
+static inline void BMHIIRStageProc_free(BMHIIRStageProc *This){
+	free(This->coefficients);
+	This->coefficients = NULL;
+	This->x = NULL;
+	This->y = NULL;
+}
+
+
+
+/*!
+ *BMHIIRStageProc_bufferKernel
+ *
+ * @abstract process a buffer through all stages of the four chains
+ *
+ * @param c, x, y     coefficients and state, one entry per stage
+ * @param stereo      if false, inputR and outputR are ignored
+ * @param downsample  if true, each chain takes every other input sample and the output is the average of the two chains. if false, both chains take every input and write interleaved output.
+ */
+static __inline__ __attribute__((always_inline)) void BMHIIRStageProc_bufferKernel(const simd_float4 *c, simd_float4 *x, simd_float4 *y, size_t numStages, const float *inputL, const float *inputR, float *outputL, float *outputR, size_t length, bool stereo, bool downsample){
+	for(size_t n=0; n<length; n++){
+		simd_float4 input;
+		if(downsample)
+			input = simd_make_float4(inputL[2*n + 1], inputL[2*n],
+									 stereo ? inputR[2*n + 1] : 0.0f,
+									 stereo ? inputR[2*n] : 0.0f);
+		else
+			input = simd_make_float4(inputL[n], inputL[n],
+									 stereo ? inputR[n] : 0.0f,
+									 stereo ? inputR[n] : 0.0f);
+		
+		// unrolls completely when numStages is a constant up to
+		// BMHIIRStageProc_MaxUnrolledStages
+		#pragma clang loop unroll_count(6)
+		for(size_t i=0; i<numStages; i++){
+			simd_float4 output = (input - y[i]) * c[i] + x[i];
+			x[i] = input;
+			y[i] = output;
+			input = output;
+		}
+		
+		if(downsample){
+			outputL[n] = 0.5f * (input.x + input.y);
+			if(stereo) outputR[n] = 0.5f * (input.z + input.w);
+		} else {
+			outputL[2*n]     = input.x;
+			outputL[2*n + 1] = input.y;
+			if(stereo){
+				outputR[2*n]     = input.z;
+				outputR[2*n + 1] = input.w;
+			}
+		}
+	}
+}
+
+
+
+/*!
+ *BMHIIRStageProc_bufferUnrolled
+ *
+ * @abstract copy the coefficients and state to local arrays so that, with numStages known at compile time, the stage loop unrolls and the state stays in registers for the whole buffer
+ */
+static __inline__ __attribute__((always_inline)) void BMHIIRStageProc_bufferUnrolled(BMHIIRStageProc *This, size_t numStages, const float *inputL, const float *inputR, float *outputL, float *outputR, size_t length, bool stereo, bool downsample){
+	simd_float4 c [BMHIIRStageProc_MaxUnrolledStages];
+	simd_float4 x [BMHIIRStageProc_MaxUnrolledStages];
+	simd_float4 y [BMHIIRStageProc_MaxUnrolledStages];
+	for(size_t i=0; i<numStages; i++){
+		c[i] = This->coefficients[i];
+		x[i] = This->x[i];
+		y[i] = This->y[i];
+	}
+	
+	BMHIIRStageProc_bufferKernel(c, x, y, numStages, inputL, inputR, outputL, outputR, length, stereo, downsample);
+	
+	for(size_t i=0; i<numStages; i++){
+		This->x[i] = x[i];
+		This->y[i] = y[i];
+	}
+}
+
+
+
+/*!
+ *BMHIIRStageProc_processBuffer
+ *
+ * @abstract filter a buffer through the even and odd chains
+ *
+ * @param This        pointer to an initialised struct
+ * @param inputL      length samples for upsampling, 2 * length for downsampling
+ * @param inputR      same as inputL. ignored in mono
+ * @param outputL     2 * length samples for upsampling, length for downsampling
+ * @param outputR     same as outputL. ignored in mono
+ * @param length      number of samples through each chain
+ * @param stereo      true to process inputR into outputR as well
+ * @param downsample  true to downsample, false to upsample
+ */
+static __inline__ __attribute__((always_inline)) void BMHIIRStageProc_processBuffer(BMHIIRStageProc *This, const float *inputL, const float *inputR, float *outputL, float *outputR, size_t length, bool stereo, bool downsample){
+	switch(This->numStages){
+		case 1: BMHIIRStageProc_bufferUnrolled(This, 1, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		case 2: BMHIIRStageProc_bufferUnrolled(This, 2, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		case 3: BMHIIRStageProc_bufferUnrolled(This, 3, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		case 4: BMHIIRStageProc_bufferUnrolled(This, 4, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		case 5: BMHIIRStageProc_bufferUnrolled(This, 5, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		case 6: BMHIIRStageProc_bufferUnrolled(This, 6, inputL, inputR, outputL, outputR, length, stereo, downsample); break;
+		// longer filters are rare. Process them with the state in memory.
+		default:
+			BMHIIRStageProc_bufferKernel(This->coefficients, This->x, This->y, This->numStages, inputL, inputR, outputL, outputR, length, stereo, downsample);
+	}
+}
+
+
+
+/*!
+ *BMHIIRStageProc_groupDelay
+ *
+ * @abstract the group delay in samples of one chain
+ *
+ * @param This   pointer to an initialised struct
+ * @param chain  0 for the chain of even numbered coefficients, 1 for odd
+ * @param w      radian normalised frequency in [0,pi]
+ *
+ * @discussion the group delay of a first order allpass section with
+ * coefficient a is (1 - a^2) / (1 + 2a cos(w) + a^2)
+ */
+static inline double BMHIIRStageProc_groupDelay(const BMHIIRStageProc *This, size_t chain, double w){
+	double delay = 0.0;
+	double cosW = cos(w);
+	for(size_t i=0; i<This->numStages; i++){
+		double a = This->coefficients[i][chain];
+		delay += (1.0 - a*a) / (1.0 + 2.0*a*cosW + a*a);
+	}
+	return delay;
+}
+
+#endif /* BMHIIRStageProc_h */
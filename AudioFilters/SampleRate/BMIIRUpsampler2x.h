@@ -13,13 +13,12 @@
 #define BMIIRUpsampler2x_h
 
 #include <stdio.h>
-#include "BMMultiLevelBiquad.h"
+#include <stdbool.h>
+#include "BMHIIRStageProc.h"
 
 typedef struct BMIIRUpsampler2x {
-    BMMultiLevelBiquad even;
-    BMMultiLevelBiquad odd;
-    float *b1L, *b2L, *b1R, *b2R;
-    size_t numCoefficients,numBiquadStages;
+    BMHIIRStageProc stages;
+    size_t numCoefficients;
     bool stereo;
 } BMIIRUpsampler2x;
 
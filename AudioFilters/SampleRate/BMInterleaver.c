@@ -8,6 +8,11 @@
 
 #include "BMInterleaver.h"
 #include <Accelerate/Accelerate.h>
+#include <simd/simd.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "Constants.h"
 
 
 /*!
@@ -45,29 +50,18 @@
  * @param out2  empty array for storing the odd samples of input (length / numSamplesIn/4)
  * @param out3  empty array for storing the even samples of input (length / numSamplesIn/4)
  * @param out4  empty array for storing the odd samples of input (length / numSamplesIn/4)
- * @param buffer array for temp storage with length = numSamplesIn (This can point to input)
+ * @param buffer not used. BMInterleaver_deInterleave does this without temp storage.
  */
  void BMDeInterleave4(const float* input,
                             float* out1, float* out2, float* out3, float* out4,
                             float* buffer,
                             size_t numSamplesIn){
     
-    // package the two output buffers as if they were real and imaginary components
-    // of complex numbers. This is a misuse of notation, but computationally
-    // speaking, the vDSP_ctoz function does exactly what we need here, except
-    // that its syntax is designed for splitting an interleaved complex array
-    // into separate real and imaginary arrays.
-    float* temp13 = buffer;
-    float* temp24 = buffer + numSamplesIn/2;
-    DSPSplitComplex outputEvenOdd = {temp13, temp24};
-    
-    // split the even and odd samples into two separate vectors.
-    vDSP_ctoz((const DSPComplex *)input, 2, &outputEvenOdd, 1, numSamplesIn/2);
-    
-    DSPSplitComplex output13 = {out1, out3};
-    DSPSplitComplex output24 = {out2, out4};
-    vDSP_ctoz((const DSPComplex *)temp13, 2, &output13, 1, numSamplesIn/4);
-    vDSP_ctoz((const DSPComplex *)temp24, 2, &output24, 1, numSamplesIn/4);
+    // BMInterleaver_deInterleave does this with vDSP_ctoz
+    BMInterleaver interleaver;
+    BMInterleaver_init(&interleaver, 4, BMSampleFormat_float32);
+    float* outputs [4] = {out1, out2, out3, out4};
+    BMInterleaver_deInterleave(&interleaver, input, outputs, numSamplesIn/4);
 }
 
 
@@ -112,23 +106,422 @@
                           float*  input3, float* input4,
                           float*  output, size_t numSamplesIn){
 
-    // package the two input buffers as if they were real and imaginary components
-    // of complex numbers. This is a misuse of notation, but computationally
-    // speaking, the vDSP_ztoc function does exactly what we need here, except
-    // that its syntax is designed for joining separate arrays of real and
-    // imaginary numbers into a single array of interleaved real and imaginary
-    // values.
-    DSPSplitComplex input13 = {input1, input3};
-    DSPSplitComplex input24 = {input2, input4};
+    // BMInterleaver_interleave does this with vDSP_ztoc
+    BMInterleaver interleaver;
+    BMInterleaver_init(&interleaver, 4, BMSampleFormat_float32);
+    const float* inputs [4] = {input1, input2, input3, input4};
+    BMInterleaver_interleave(&interleaver, inputs, output, numSamplesIn);
+}
+
+
+
+
+void BMInterleaver_init(BMInterleaver *This, size_t numChannels, BMSampleFormat format){
+    assert(numChannels > 0);
+    This->numChannels = numChannels;
+    This->format = format;
+    This->gain = 1.0f;
+    This->clip = false;
+    This->dither = false;
+    
+    // any non-zero seeds will do for the xorshift generators
+    for(size_t i=0; i<4; i++)
+        This->ditherState[i] = 0x9E3779B9u * (uint32_t)(i + 1);
+}
+
+
+
+
+void BMInterleaver_setGain(BMInterleaver *This, float gain){
+    This->gain = gain;
+}
+
+
+
+
+void BMInterleaver_setClip(BMInterleaver *This, bool clip){
+    This->clip = clip;
+}
+
+
+
+
+void BMInterleaver_setDither(BMInterleaver *This, bool dither){
+    This->dither = dither;
+}
+
+
+
+
+/*!
+ *BMInterleaver_fullScale
+ *
+ * @returns the integer value that corresponds to 1.0 in float
+ */
+static float BMInterleaver_fullScale(BMSampleFormat format){
+    switch (format) {
+        case BMSampleFormat_int16: return 32768.0f;
+        case BMSampleFormat_int24: return 8388608.0f;
+        case BMSampleFormat_int32: return 2147483648.0f;
+        default: return 1.0f;
+    }
+}
+
+
+
+/*!
+ *BMInterleaver_load4
+ *
+ * @returns four consecutive samples of the stream, converted to float without scaling
+ */
+static __inline__ __attribute__((always_inline)) simd_float4 BMInterleaver_load4(const void* stream, BMSampleFormat format, size_t index){
+    switch (format) {
+        case BMSampleFormat_int16:
+            return __builtin_convertvector(*(const simd_packed_short4*)((const int16_t*)stream + index), simd_float4);
+        case BMSampleFormat_int24: {
+            // put the three bytes of each sample in the top of a 32 bit
+            // lane and shift back down to extend the sign. Byte 15 is zero.
+            simd_uchar16 b = 0;
+            memcpy(&b, (const uint8_t*)stream + 3*index, 12);
+            b = __builtin_shufflevector(b, b, 15, 0, 1, 2, 15, 3, 4, 5, 15, 6, 7, 8, 15, 9, 10, 11);
+            return __builtin_convertvector((simd_int4)b >> 8, simd_float4);
+        }
+        case BMSampleFormat_int32:
+            return __builtin_convertvector(*(const simd_packed_int4*)((const int32_t*)stream + index), simd_float4);
+        default:
+            return *(const simd_packed_float4*)((const float*)stream + index);
+    }
+}
+
+
+
+
+/*!
+ *BMInterleaver_store4
+ *
+ * @abstract write four consecutive samples of the stream. Integer values must already be in range.
+ */
+static __inline__ __attribute__((always_inline)) void BMInterleaver_store4(void* stream, BMSampleFormat format, size_t index, simd_float4 v){
+    if(format == BMSampleFormat_float32){
+        *(simd_packed_float4*)((float*)stream + index) = v;
+        return;
+    }
+    
+    // round to nearest, ties to even, the same as the vDSP_vfixr functions
+    simd_int4 w = __builtin_convertvector(simd_rint(v), simd_int4);
+    switch (format) {
+        case BMSampleFormat_int16:
+            *(simd_packed_short4*)((int16_t*)stream + index) = __builtin_convertvector(w, simd_short4);
+            break;
+        case BMSampleFormat_int24: {
+            // drop the top byte of each lane
+            simd_uchar16 b = (simd_uchar16)w;
+            b = __builtin_shufflevector(b, b, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0);
+            memcpy((uint8_t*)stream + 3*index, &b, 12);
+            break;
+        }
+        default:
+            *(simd_packed_int4*)((int32_t*)stream + index) = w;
+    }
+}
+
+
+
+
+/*!
+ *BMInterleaver_transpose4
+ *
+ * @abstract transpose four vectors of four, in place. This turns four frames of four channels into four channels of four frames and back.
+ */
+static __inline__ __attribute__((always_inline)) void BMInterleaver_transpose4(simd_float4* v){
+    simd_float4 t0 = __builtin_shufflevector(v[0], v[1], 0, 4, 1, 5);
+    simd_float4 t1 = __builtin_shufflevector(v[2], v[3], 0, 4, 1, 5);
+    simd_float4 t2 = __builtin_shufflevector(v[0], v[1], 2, 6, 3, 7);
+    simd_float4 t3 = __builtin_shufflevector(v[2], v[3], 2, 6, 3, 7);
+    v[0] = __builtin_shufflevector(t0, t1, 0, 1, 4, 5);
+    v[1] = __builtin_shufflevector(t0, t1, 2, 3, 6, 7);
+    v[2] = __builtin_shufflevector(t2, t3, 0, 1, 4, 5);
+    v[3] = __builtin_shufflevector(t2, t3, 2, 3, 6, 7);
+}
+
+
 
-    // combine 1 and 3 samples and combine 2 and 4 samples
-    float* odd = output;
-    float* even = output + 2*numSamplesIn;
-    vDSP_ztoc(&input13, 1, (DSPComplex*)odd, 2, numSamplesIn);
-    vDSP_ztoc(&input24, 1, (DSPComplex*)odd, 2, numSamplesIn);
+
+/*!
+ *BMInterleaver_tpdf
+ *
+ * @returns triangular PDF noise in [-1,1], one value per lane
+ */
+static inline simd_float4 BMInterleaver_tpdf(simd_uint4* state){
+    simd_float4 noise = 0.0f;
+    for(size_t i=0; i<2; i++){
+        // xorshift32 in each lane
+        simd_uint4 s = *state;
+        s ^= s << 13;
+        s ^= s >> 17;
+        s ^= s << 5;
+        *state = s;
+        
+        // uniform in [-0.5,0.5)
+        noise += __builtin_convertvector(s >> 8, simd_float4) * (1.0f / 16777216.0f) - 0.5f;
+    }
+    return noise;
+}
+
+
+
+
+/*!
+ *BMInterleaver_deInterleaveGroups
+ *
+ * @abstract convert each group of four channels, four frames at a time, with vector loads and a transpose
+ *
+ * This is inlined with a constant format so that each format gets its own
+ * loop with no switch inside.
+ *
+ * @returns the number of frames converted, a multiple of four
+ */
+static __inline__ __attribute__((always_inline)) size_t BMInterleaver_deInterleaveGroups(const void* input, float* const* outputs, size_t numChannels, size_t numFrames, float scale, bool clip, BMSampleFormat format){
+    size_t i = 0;
+    for(; i+4 <= numFrames; i+=4){
+        for(size_t c=0; c+4 <= numChannels; c+=4){
+            simd_float4 v [4];
+            for(size_t j=0; j<4; j++)
+                v[j] = BMInterleaver_load4(input, format, (i+j)*numChannels + c);
+            BMInterleaver_transpose4(v);
+            for(size_t j=0; j<4; j++){
+                v[j] *= scale;
+                if(clip)
+                    v[j] = simd_clamp(v[j], -1.0f, 1.0f);
+                *(simd_packed_float4*)(outputs[c+j] + i) = v[j];
+            }
+        }
+    }
+    return i;
+}
+
+
+
+
+/*!
+ *BMInterleaver_deInterleaveChannel
+ *
+ * @abstract convert frames [start, numFrames) of one channel with strided vDSP functions
+ */
+static void BMInterleaver_deInterleaveChannel(const void* input, float* output, size_t channel, size_t numChannels, size_t start, size_t numFrames, float scale, bool clip, BMSampleFormat format){
+    if(start >= numFrames)
+        return;
     
-    // combine the odd and even samples into one output
-    DSPSplitComplex inputAll = {odd,even};
-    vDSP_ztoc(&inputAll, 1, (DSPComplex*)output, 2, 2*numSamplesIn);
+    size_t index = start*numChannels + channel;
+    size_t length = numFrames - start;
+    output += start;
+    switch (format) {
+        case BMSampleFormat_int16:
+            vDSP_vflt16((const short*)input + index, numChannels, output, 1, length);
+            vDSP_vsmul(output, 1, &scale, output, 1, length);
+            break;
+        case BMSampleFormat_int24:
+            vDSP_vflt24((const vDSP_int24*)input + index, numChannels, output, 1, length);
+            vDSP_vsmul(output, 1, &scale, output, 1, length);
+            break;
+        case BMSampleFormat_int32:
+            vDSP_vflt32((const int*)input + index, numChannels, output, 1, length);
+            vDSP_vsmul(output, 1, &scale, output, 1, length);
+            break;
+        default:
+            vDSP_vsmul((const float*)input + index, numChannels, &scale, output, 1, length);
+    }
+    
+    if(clip){
+        float lower = -1.0f, upper = 1.0f;
+        vDSP_vclip(output, 1, &lower, &upper, output, 1, length);
+    }
 }
 
+
+
+
+void BMInterleaver_deInterleave(BMInterleaver *This, const void* input, float* const* outputs, size_t numFrames){
+    size_t numChannels = This->numChannels;
+    BMSampleFormat format = This->format;
+    float scale = This->gain / BMInterleaver_fullScale(format);
+    bool clip = This->clip;
+    
+    // plain float stereo and quad is what vDSP_ctoz does. Its stride
+    // is in floats, so each call splits one pair of channels.
+    if(format == BMSampleFormat_float32 && scale == 1.0f && !clip &&
+       (numChannels == 2 || numChannels == 4)){
+        for(size_t c=0; c<numChannels; c+=2){
+            DSPSplitComplex pair = {outputs[c], outputs[c+1]};
+            vDSP_ctoz((const DSPComplex*)input + c/2, numChannels, &pair, 1, numFrames);
+        }
+        return;
+    }
+    
+    // groups of four channels
+    size_t framesDone = 0;
+    switch (format) {
+        case BMSampleFormat_int16:
+            framesDone = BMInterleaver_deInterleaveGroups(input, outputs, numChannels, numFrames, scale, clip, BMSampleFormat_int16);
+            break;
+        case BMSampleFormat_int24:
+            framesDone = BMInterleaver_deInterleaveGroups(input, outputs, numChannels, numFrames, scale, clip, BMSampleFormat_int24);
+            break;
+        case BMSampleFormat_int32:
+            framesDone = BMInterleaver_deInterleaveGroups(input, outputs, numChannels, numFrames, scale, clip, BMSampleFormat_int32);
+            break;
+        default:
+            framesDone = BMInterleaver_deInterleaveGroups(input, outputs, numChannels, numFrames, scale, clip, BMSampleFormat_float32);
+    }
+    
+    // the frames at the end that didn't fill a group of four, and the
+    // channels that didn't fill a group
+    size_t numGrouped = numChannels - numChannels % 4;
+    for(size_t c=0; c<numChannels; c++)
+        BMInterleaver_deInterleaveChannel(input, outputs[c], c, numChannels, c < numGrouped ? framesDone : 0, numFrames, scale, clip, format);
+}
+
+
+
+
+/*!
+ *BMInterleaver_interleaveGroups
+ *
+ * @abstract convert each group of four channels, four frames at a time, with a transpose and vector stores
+ *
+ * This is inlined with a constant format so that each format gets its own
+ * loop with no switch inside.
+ *
+ * @returns the number of frames converted, a multiple of four
+ */
+static __inline__ __attribute__((always_inline)) size_t BMInterleaver_interleaveGroups(const float* const* inputs, void* output, size_t numChannels, size_t numFrames, float scale, bool dither, bool clip, float lower, float upper, simd_uint4* ditherState, BMSampleFormat format){
+    size_t i = 0;
+    for(; i+4 <= numFrames; i+=4){
+        for(size_t c=0; c+4 <= numChannels; c+=4){
+            simd_float4 v [4];
+            for(size_t j=0; j<4; j++){
+                v[j] = *(const simd_packed_float4*)(inputs[c+j] + i) * scale;
+                if(dither)
+                    v[j] += BMInterleaver_tpdf(ditherState);
+                if(clip)
+                    v[j] = simd_clamp(v[j], lower, upper);
+            }
+            BMInterleaver_transpose4(v);
+            for(size_t j=0; j<4; j++)
+                BMInterleaver_store4(output, format, (i+j)*numChannels + c, v[j]);
+        }
+    }
+    return i;
+}
+
+
+
+
+/*!
+ *BMInterleaver_interleaveChannel
+ *
+ * @abstract convert frames [start, numFrames) of one channel with strided vDSP functions
+ */
+static void BMInterleaver_interleaveChannel(const float* input, void* output, size_t channel, size_t numChannels, size_t start, size_t numFrames, float scale, bool dither, bool clip, float lower, float upper, simd_uint4* ditherState, BMSampleFormat format){
+    // float output needs no conversion so it goes straight to the stream
+    if(format == BMSampleFormat_float32){
+        if(start >= numFrames)
+            return;
+        float *out = (float*)output + start*numChannels + channel;
+        size_t length = numFrames - start;
+        vDSP_vsmul(input + start, 1, &scale, out, numChannels, length);
+        if(clip)
+            vDSP_vclip(out, numChannels, &lower, &upper, out, numChannels, length);
+        return;
+    }
+    
+    float buffer [BM_BUFFER_CHUNK_SIZE];
+    for(size_t i=start; i<numFrames; ){
+        size_t length = BM_MIN(BM_BUFFER_CHUNK_SIZE, numFrames - i);
+        size_t index = i*numChannels + channel;
+        
+        // scale, dither and clip
+        vDSP_vsmul(input + i, 1, &scale, buffer, 1, length);
+        if(dither){
+            size_t j = 0;
+            for(; j+4 <= length; j+=4)
+                *(simd_packed_float4*)(buffer + j) += BMInterleaver_tpdf(ditherState);
+            if(j < length){
+                simd_float4 noise = BMInterleaver_tpdf(ditherState);
+                for(size_t k=0; j+k < length; k++)
+                    buffer[j+k] += noise[k];
+            }
+        }
+        if(clip)
+            vDSP_vclip(buffer, 1, &lower, &upper, buffer, 1, length);
+        
+        // round and convert
+        switch (format) {
+            case BMSampleFormat_int16:
+                vDSP_vfixr16(buffer, 1, (short*)output + index, numChannels, length);
+                break;
+            case BMSampleFormat_int24:
+                vDSP_vfixr24(buffer, 1, (vDSP_int24*)output + index, numChannels, length);
+                break;
+            default:
+                vDSP_vfixr32(buffer, 1, (int*)output + index, numChannels, length);
+        }
+        
+        i += length;
+    }
+}
+
+
+
+
+void BMInterleaver_interleave(BMInterleaver *This, const float* const* inputs, void* output, size_t numFrames){
+    size_t numChannels = This->numChannels;
+    BMSampleFormat format = This->format;
+    float fullScale = BMInterleaver_fullScale(format);
+    float scale = This->gain * fullScale;
+    bool isInteger = format != BMSampleFormat_float32;
+    bool dither = This->dither && isInteger;
+    bool clip = This->clip || isInteger;
+    
+    // Integer output saturates at full scale. The largest int32 isn't
+    // exactly representable in float, so we use the largest float below it.
+    float upper = isInteger ? BM_MIN(fullScale - 1.0f, nextafterf(fullScale, 0.0f)) : 1.0f;
+    float lower = isInteger ? -fullScale : -1.0f;
+    
+    // plain float stereo and quad is what vDSP_ztoc does
+    if(format == BMSampleFormat_float32 && scale == 1.0f && !clip &&
+       (numChannels == 2 || numChannels == 4)){
+        for(size_t c=0; c<numChannels; c+=2){
+            DSPSplitComplex pair = {(float*)inputs[c], (float*)inputs[c+1]};
+            vDSP_ztoc(&pair, 1, (DSPComplex*)output + c/2, numChannels, numFrames);
+        }
+        return;
+    }
+    
+    simd_uint4 ditherState = {This->ditherState[0], This->ditherState[1], This->ditherState[2], This->ditherState[3]};
+    
+    // groups of four channels
+    size_t framesDone = 0;
+    switch (format) {
+        case BMSampleFormat_int16:
+            framesDone = BMInterleaver_interleaveGroups(inputs, output, numChannels, numFrames, scale, dither, clip, lower, upper, &ditherState, BMSampleFormat_int16);
+            break;
+        case BMSampleFormat_int24:
+            framesDone = BMInterleaver_interleaveGroups(inputs, output, numChannels, numFrames, scale, dither, clip, lower, upper, &ditherState, BMSampleFormat_int24);
+            break;
+        case BMSampleFormat_int32:
+            framesDone = BMInterleaver_interleaveGroups(inputs, output, numChannels, numFrames, scale, dither, clip, lower, upper, &ditherState, BMSampleFormat_int32);
+            break;
+        default:
+            framesDone = BMInterleaver_interleaveGroups(inputs, output, numChannels, numFrames, scale, dither, clip, lower, upper, &ditherState, BMSampleFormat_float32);
+    }
+    
+    // the frames at the end that didn't fill a group of four, and the
+    // channels that didn't fill a group
+    size_t numGrouped = numChannels - numChannels % 4;
+    for(size_t c=0; c<numChannels; c++)
+        BMInterleaver_interleaveChannel(inputs[c], output, c, numChannels, c < numGrouped ? framesDone : 0, numFrames, scale, dither, clip, lower, upper, &ditherState, format);
+    
+    for(size_t i=0; i<4; i++)
+        This->ditherState[i] = ditherState[i];
+}
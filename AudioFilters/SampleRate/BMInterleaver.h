@@ -10,6 +10,41 @@
 #define BMInterleaver_h
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/*
+ * Sample formats of interleaved streams. Integer formats are signed and
+ * little endian. BMSampleFormat_int24 is packed into 3 bytes per sample.
+ */
+typedef enum BMSampleFormat {
+	BMSampleFormat_float32,
+	BMSampleFormat_int16,
+	BMSampleFormat_int24,
+	BMSampleFormat_int32
+} BMSampleFormat;
+
+
+/*
+ * Converts between an interleaved stream of numChannels channels in any
+ * BMSampleFormat and separate float arrays, one per channel. Format
+ * conversion, gain, dither and clipping are done in the same pass as the
+ * (de)interleaving. Float stereo and quad streams with no gain or clipping
+ * go through vDSP_ctoz and vDSP_ztoc. Otherwise each group of four
+ * channels is converted four frames at a time with vector loads and a 4x4
+ * transpose. The remaining one to three channels, and the last few frames
+ * that don't fill a group, go through the strided vDSP conversions.
+ *
+ * Integer samples are scaled so that full scale is 1.0 in float.
+ */
+typedef struct BMInterleaver {
+	BMSampleFormat format;
+	size_t numChannels;
+	float gain;
+	bool clip, dither;
+	uint32_t ditherState [4];
+} BMInterleaver;
 
 
 /*!
@@ -35,7 +70,7 @@ void BMDeInterleave(const float* input, float* evenOut, float* oddOut, size_t nu
  * @param out2  empty array for storing the odd samples of input (length / numSamplesIn/4)
  * @param out3  empty array for storing the even samples of input (length / numSamplesIn/4)
  * @param out4  empty array for storing the odd samples of input (length / numSamplesIn/4)
- * @param buffer array for temp storage with length = numSamplesIn (This can point to input)
+ * @param buffer not used. BMInterleaver_deInterleave does this without temp storage.
  */
 void BMDeInterleave4(const float* input,
 					 float* out1, float* out2, float* out3, float* out4,
@@ -70,4 +105,67 @@ void BMInterleave4(float*  input1, float* input2,
 				   float*  input3, float* input4,
 				   float*  output, size_t numSamplesIn);
 
+
+
+/*!
+ *BMInterleaver_init
+ *
+ * @param This         pointer to an uninitialised struct
+ * @param numChannels  number of channels in the interleaved stream
+ * @param format       sample format of the interleaved stream
+ */
+void BMInterleaver_init(BMInterleaver *This, size_t numChannels, BMSampleFormat format);
+
+
+/*!
+ *BMInterleaver_setGain
+ *
+ * @abstract set a gain to apply during conversion, in both directions. The default is 1.
+ */
+void BMInterleaver_setGain(BMInterleaver *This, float gain);
+
+
+/*!
+ *BMInterleaver_setClip
+ *
+ * @abstract clip float samples to [-1,1]. Off by default.
+ *
+ * @discussion this applies to float output from BMInterleaver_deInterleave and to float32 streams written by BMInterleaver_interleave. Integer output always saturates at full scale.
+ */
+void BMInterleaver_setClip(BMInterleaver *This, bool clip);
+
+
+/*!
+ *BMInterleaver_setDither
+ *
+ * @abstract add TPDF dither of one LSB when BMInterleaver_interleave writes an integer format. Off by default.
+ */
+void BMInterleaver_setDither(BMInterleaver *This, bool dither);
+
+
+/*!
+ *BMInterleaver_deInterleave
+ *
+ * @abstract split an interleaved stream into one float array per channel
+ *
+ * @param This       pointer to an initialised struct
+ * @param input      interleaved stream of numFrames * numChannels samples in the format of This
+ * @param outputs    array of numChannels pointers to output arrays of length numFrames
+ * @param numFrames  number of samples in each channel
+ */
+void BMInterleaver_deInterleave(BMInterleaver *This, const void* input, float* const* outputs, size_t numFrames);
+
+
+/*!
+ *BMInterleaver_interleave
+ *
+ * @abstract join one float array per channel into an interleaved stream
+ *
+ * @param This       pointer to an initialised struct
+ * @param inputs     array of numChannels pointers to input arrays of length numFrames
+ * @param output     interleaved stream of numFrames * numChannels samples in the format of This
+ * @param numFrames  number of samples in each channel
+ */
+void BMInterleaver_interleave(BMInterleaver *This, const float* const* inputs, void* output, size_t numFrames);
+
 #endif /* BMInterleaver_h */
@@ -0,0 +1,204 @@
+//
+//  BMOversampler.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#include "BMOversampler.h"
+#include <stdlib.h>
+#include <assert.h>
+#include "Constants.h"
+
+
+// forward declarations
+void BMOversampler_initTiles(BMOversampler *This);
+void BMOversampler_processTile(BMOversampler *This, float *tileL, float *tileR, size_t lengthOS);
+
+
+
+void BMOversampler_init(BMOversampler *This, bool stereo, size_t oversampleFactor, enum resamplerType type){
+	// BMUpsampler and BMDownsampler don't set up their filters for a factor
+	// of 1. Call the kernel directly instead.
+	assert(oversampleFactor > 1);
+
+	This->stereo = stereo;
+	This->gaussian = false;
+	This->oversampleFactor = oversampleFactor;
+	This->blockKernel = NULL;
+	This->sampleKernel = NULL;
+	This->context = NULL;
+
+	BMUpsampler_init(&This->upsampler, stereo, oversampleFactor, type);
+	BMDownsampler_init(&This->downsampler, stereo, oversampleFactor, type);
+
+	BMOversampler_initTiles(This);
+}
+
+
+
+
+void BMOversampler_initGaussian(BMOversampler *This, size_t oversampleFactor, size_t gaussianNumPasses, enum resamplerType downsamplerType){
+	assert(oversampleFactor > 1);
+
+	This->stereo = false;
+	This->gaussian = true;
+	This->oversampleFactor = oversampleFactor;
+	This->blockKernel = NULL;
+	This->sampleKernel = NULL;
+	This->context = NULL;
+
+	BMGaussianUpsampler_init(&This->gaussianUpsampler, oversampleFactor, gaussianNumPasses);
+	BMDownsampler_init(&This->downsampler, false, oversampleFactor, downsamplerType);
+
+	BMOversampler_initTiles(This);
+}
+
+
+
+
+/*!
+ *BMOversampler_initTiles
+ *
+ * @abstract set the tile length and allocate the tile buffers
+ */
+void BMOversampler_initTiles(BMOversampler *This){
+	// Choose the tile length so that the oversampled signal of one tile
+	// fits in BMOversampler_tileBytes. The upsampler can't take more than
+	// BM_BUFFER_CHUNK_SIZE input samples at once without splitting them
+	// into chunks itself, so that is the limit.
+	size_t numChannels = This->stereo ? 2 : 1;
+	This->tileLength = BMOversampler_tileBytes / (sizeof(float) * This->oversampleFactor * numChannels);
+	This->tileLength = BM_MAX(This->tileLength, 1);
+	This->tileLength = BM_MIN(This->tileLength, BM_BUFFER_CHUNK_SIZE);
+
+	size_t tileLengthOS = This->tileLength * This->oversampleFactor;
+	This->tileL = malloc(sizeof(float) * tileLengthOS);
+	This->tileR = This->stereo ? malloc(sizeof(float) * tileLengthOS) : NULL;
+}
+
+
+
+
+void BMOversampler_free(BMOversampler *This){
+	if(This->gaussian)
+		BMGaussianUpsampler_free(&This->gaussianUpsampler);
+	else
+		BMUpsampler_free(&This->upsampler);
+	BMDownsampler_free(&This->downsampler);
+
+	free(This->tileL);
+	free(This->tileR);
+	This->tileL = NULL;
+	This->tileR = NULL;
+}
+
+
+
+
+void BMOversampler_setBlockKernel(BMOversampler *This, BMOversamplerBlockKernel kernel, void *context){
+	This->blockKernel = kernel;
+	This->sampleKernel = NULL;
+	This->context = context;
+}
+
+
+
+
+void BMOversampler_setSampleKernel(BMOversampler *This, BMOversamplerSampleKernel kernel, void *context){
+	This->sampleKernel = kernel;
+	This->blockKernel = NULL;
+	This->context = context;
+}
+
+
+
+
+/*!
+ *BMOversampler_processTile
+ *
+ * @abstract run the kernel on one tile of the oversampled signal, in place
+ */
+void BMOversampler_processTile(BMOversampler *This, float *tileL, float *tileR, size_t lengthOS){
+	if(This->blockKernel){
+		This->blockKernel(This->context, tileL, tileR, lengthOS);
+	}
+	else if(This->sampleKernel){
+		BMOversamplerSampleKernel kernel = This->sampleKernel;
+		void *context = This->context;
+		for(size_t i=0; i<lengthOS; i++)
+			tileL[i] = kernel(context, tileL[i], 0);
+		if(tileR)
+			for(size_t i=0; i<lengthOS; i++)
+				tileR[i] = kernel(context, tileR[i], 1);
+	}
+}
+
+
+
+
+void BMOversampler_processMono(BMOversampler *This, const float *input, float *output, size_t numSamples){
+	assert(!This->stereo);
+
+	while(numSamples > 0){
+		size_t samplesProcessing = BM_MIN(numSamples, This->tileLength);
+		size_t lengthOS = samplesProcessing * This->oversampleFactor;
+
+		// upsample, process and downsample one tile. The input is read
+		// before the output is written so it's safe to process in place.
+		if(This->gaussian)
+			BMGaussianUpsampler_processMono(&This->gaussianUpsampler, input, This->tileL, samplesProcessing);
+		else
+			BMUpsampler_processBufferMono(&This->upsampler, input, This->tileL, samplesProcessing);
+		BMOversampler_processTile(This, This->tileL, NULL, lengthOS);
+		BMDownsampler_processBufferMono(&This->downsampler, This->tileL, output, lengthOS);
+
+		// advance pointers
+		input += samplesProcessing;
+		output += samplesProcessing;
+		numSamples -= samplesProcessing;
+	}
+}
+
+
+
+
+void BMOversampler_processStereo(BMOversampler *This,
+								 const float *inputL, const float *inputR,
+								 float *outputL, float *outputR,
+								 size_t numSamples){
+	assert(This->stereo);
+
+	while(numSamples > 0){
+		size_t samplesProcessing = BM_MIN(numSamples, This->tileLength);
+		size_t lengthOS = samplesProcessing * This->oversampleFactor;
+
+		BMUpsampler_processBufferStereo(&This->upsampler,
+										inputL, inputR,
+										This->tileL, This->tileR,
+										samplesProcessing);
+		BMOversampler_processTile(This, This->tileL, This->tileR, lengthOS);
+		BMDownsampler_processBufferStereo(&This->downsampler,
+										  This->tileL, This->tileR,
+										  outputL, outputR,
+										  lengthOS);
+
+		// advance pointers
+		inputL += samplesProcessing;
+		inputR += samplesProcessing;
+		outputL += samplesProcessing;
+		outputR += samplesProcessing;
+		numSamples -= samplesProcessing;
+	}
+}
+
+
+
+
+float BMOversampler_getLatencyInSamples(BMOversampler *This){
+	float upsamplerLatency = This->gaussian ?
+		BMGaussianUpsampler_getLatencyInSamples(&This->gaussianUpsampler) :
+		BMUpsampler_getLatencyInSamples(&This->upsampler);
+	return upsamplerLatency + BMDownsampler_getLatencyInSamples(&This->downsampler);
+}
@@ -0,0 +1,179 @@
+//
+//  BMOversampler.h
+//  AudioFiltersXcodeProject
+//
+//  Runs a nonlinear process at an oversampled rate. The input is upsampled,
+//  processed by a kernel function supplied by the owner and downsampled
+//  back to the original rate.
+//
+//  The work is done in tiles, short enough that the oversampled signal of
+//  one tile fits in the L1 cache. Each tile passes through the upsampler,
+//  the kernel and the downsampler before we start the next one, so the
+//  oversampled signal never goes out to main memory and the owner doesn't
+//  need buffers of its own for it.
+//
+//  The kernel can work on a block of samples at a time:
+//
+//      void myKernel(void *context, float *bufferL, float *bufferR, size_t numSamples){
+//          MyEffect *This = context;
+//          // process bufferL and bufferR in place
+//      }
+//      BMOversampler_setBlockKernel(&os, myKernel, This);
+//
+//  or one sample at a time, with BMOversampler_setSampleKernel. For mono,
+//  bufferR is NULL.
+//
+//  BMOversampler_initGaussian sets up a mono oversampler that upsamples with
+//  a BMGaussianUpsampler instead of the IIR filters. It does not ring, so it
+//  is the one to use for control signals such as the frequency inputs of the
+//  oscillators.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifndef BMOversampler_h
+#define BMOversampler_h
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "BMUpsampler.h"
+#include "BMDownsampler.h"
+#include "BMGaussianUpsampler.h"
+
+// the oversampled signal of one tile, all channels, fits in this many bytes
+#define BMOversampler_tileBytes 16384
+
+
+/*!
+ *BMOversamplerBlockKernel
+ *
+ * @param context     the context pointer given to BMOversampler_setBlockKernel
+ * @param bufferL     left or mono channel at the oversampled rate. process in place.
+ * @param bufferR     right channel at the oversampled rate, or NULL for mono
+ * @param numSamples  length of the buffers
+ */
+typedef void (*BMOversamplerBlockKernel)(void *context, float *bufferL, float *bufferR, size_t numSamples);
+
+
+/*!
+ *BMOversamplerSampleKernel
+ *
+ * @param context  the context pointer given to BMOversampler_setSampleKernel
+ * @param input    one sample at the oversampled rate
+ * @param channel  0 for left or mono, 1 for right
+ * @returns the processed sample
+ */
+typedef float (*BMOversamplerSampleKernel)(void *context, float input, size_t channel);
+
+
+typedef struct BMOversampler {
+	BMUpsampler upsampler;
+	BMGaussianUpsampler gaussianUpsampler;
+	BMDownsampler downsampler;
+	BMOversamplerBlockKernel blockKernel;
+	BMOversamplerSampleKernel sampleKernel;
+	void *context;
+	float *tileL, *tileR;
+	size_t oversampleFactor, tileLength;
+	bool stereo, gaussian;
+} BMOversampler;
+
+
+
+/*!
+ *BMOversampler_init
+ *
+ * @param This              pointer to an uninitialised struct
+ * @param stereo            true for stereo, false for mono
+ * @param oversampleFactor  supported values: 2^n
+ * @param type              the type of resampler filters. See BMUpsampler_init.
+ */
+void BMOversampler_init(BMOversampler *This, bool stereo, size_t oversampleFactor, enum resamplerType type);
+
+
+
+/*!
+ *BMOversampler_initGaussian
+ *
+ * @abstract init a mono oversampler that upsamples with a BMGaussianUpsampler
+ *
+ * @param This               pointer to an uninitialised struct
+ * @param oversampleFactor   supported values: 2^n
+ * @param gaussianNumPasses  see BMGaussianUpsampler_init
+ * @param downsamplerType    the type of downsampler filters. See BMDownsampler_init.
+ */
+void BMOversampler_initGaussian(BMOversampler *This, size_t oversampleFactor, size_t gaussianNumPasses, enum resamplerType downsamplerType);
+
+
+
+/*!
+ *BMOversampler_free
+ */
+void BMOversampler_free(BMOversampler *This);
+
+
+
+/*!
+ *BMOversampler_setBlockKernel
+ *
+ * @abstract set the function that processes the oversampled signal a block at a time. This replaces any sample kernel.
+ *
+ * @param This     pointer to an initialised struct
+ * @param kernel   the kernel function, or NULL to pass the oversampled signal through unchanged
+ * @param context  passed to the kernel on each call
+ */
+void BMOversampler_setBlockKernel(BMOversampler *This, BMOversamplerBlockKernel kernel, void *context);
+
+
+
+/*!
+ *BMOversampler_setSampleKernel
+ *
+ * @abstract set the function that processes the oversampled signal a sample at a time. This replaces any block kernel.
+ *
+ * @param This     pointer to an initialised struct
+ * @param kernel   the kernel function, or NULL to pass the oversampled signal through unchanged
+ * @param context  passed to the kernel on each call
+ */
+void BMOversampler_setSampleKernel(BMOversampler *This, BMOversamplerSampleKernel kernel, void *context);
+
+
+
+/*!
+ *BMOversampler_processMono
+ *
+ * @param This        pointer to an initialised mono struct
+ * @param input       length = numSamples
+ * @param output      length = numSamples. may be the same as input.
+ * @param numSamples  number of samples at the original rate
+ */
+void BMOversampler_processMono(BMOversampler *This, const float *input, float *output, size_t numSamples);
+
+
+
+/*!
+ *BMOversampler_processStereo
+ *
+ * @param This        pointer to an initialised stereo struct
+ * @param inputL      length = numSamples
+ * @param inputR      length = numSamples
+ * @param outputL     length = numSamples. may be the same as inputL.
+ * @param outputR     length = numSamples. may be the same as inputR.
+ * @param numSamples  number of samples at the original rate
+ */
+void BMOversampler_processStereo(BMOversampler *This,
+								 const float *inputL, const float *inputR,
+								 float *outputL, float *outputR,
+								 size_t numSamples);
+
+
+
+/*!
+ *BMOversampler_getLatencyInSamples
+ *
+ * @returns the latency of the upsampler and the downsampler together, in samples at the original rate
+ */
+float BMOversampler_getLatencyInSamples(BMOversampler *This);
+
+#endif /* BMOversampler_h */
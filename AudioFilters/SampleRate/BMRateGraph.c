@@ -0,0 +1,287 @@
+//
+//  BMRateGraph.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#include "BMRateGraph.h"
+#include <string.h>
+#include <assert.h>
+#include "Constants.h"
+#include "BMIntegerMath.h"
+
+
+// forward declarations
+void BMRateGraph_processSection(void *context, float *bufferL, float *bufferR, size_t numSamples);
+void BMRateGraph_freeSections(BMRateGraph *This);
+
+
+
+void BMRateGraph_init(BMRateGraph *This, bool stereo, float sampleRate, enum resamplerType resamplerType){
+	This->stereo = stereo;
+	This->sampleRate = sampleRate;
+	This->resamplerType = resamplerType;
+	This->numStages = 0;
+	This->numSections = 0;
+	This->planned = false;
+}
+
+
+
+
+void BMRateGraph_free(BMRateGraph *This){
+	BMRateGraph_freeSections(This);
+	This->numStages = 0;
+}
+
+
+
+
+/*!
+ *BMRateGraph_freeSections
+ *
+ * @abstract free the resamplers of the current plan
+ */
+void BMRateGraph_freeSections(BMRateGraph *This){
+	for(size_t i=0; i<This->numSections; i++)
+		if(This->sections[i].oversampleFactor > 1)
+			BMOversampler_free(&This->sections[i].oversampler);
+	This->numSections = 0;
+	This->planned = false;
+}
+
+
+
+
+size_t BMRateGraph_addStage(BMRateGraph *This,
+							BMOversamplerBlockKernel kernel,
+							void *context,
+							size_t oversampleFactor,
+							BMRateGraphSetSampleRate setSampleRate,
+							BMRateGraphGetLatency getLatency){
+	assert(This->numStages < BMRateGraph_maxStages);
+	assert(oversampleFactor >= 1 && isPowerOfTwo(oversampleFactor));
+
+	BMRateGraphStage *stage = &This->stages[This->numStages];
+	stage->kernel = kernel;
+	stage->context = context;
+	stage->oversampleFactor = oversampleFactor;
+	stage->setSampleRate = setSampleRate;
+	stage->getLatency = getLatency;
+
+	// the plan is out of date now
+	This->planned = false;
+
+	return This->numStages++;
+}
+
+
+
+
+/*!
+ *BMRateGraph_canJoin
+ *
+ * @abstract check whether a stage can join an oversampled section and, if so, find the factor the section would run at
+ *
+ * @param stage        the stage
+ * @param fixedFactor  the factor of the fixed rate stages in the section, or 0 if they are all flexible
+ * @param factor       the current factor of the section. Updated if the stage can join.
+ * @returns true if the stage can join
+ */
+static bool BMRateGraph_canJoin(const BMRateGraphStage *stage, size_t *fixedFactor, size_t *factor){
+	size_t f = stage->oversampleFactor;
+
+	// a fixed rate stage sets the factor for the whole section
+	if(stage->setSampleRate == NULL){
+		bool ok = (*fixedFactor == 0) ? (f >= *factor) : (f == *fixedFactor);
+		if(ok){
+			*fixedFactor = f;
+			*factor = f;
+		}
+		return ok;
+	}
+
+	// a flexible stage runs at the section's factor if that is high enough
+	if(*fixedFactor != 0 && f > *fixedFactor)
+		return false;
+	*factor = BM_MAX(*factor, f);
+	return true;
+}
+
+
+
+
+void BMRateGraph_plan(BMRateGraph *This){
+	BMRateGraph_freeSections(This);
+
+	// the factor of the fixed rate stages in each section, or 0 if none
+	size_t fixedFactors [BMRateGraph_maxStages];
+
+	size_t i = 0;
+	while(i < This->numStages){
+		BMRateGraphStage *stage = &This->stages[i];
+		BMRateGraphSection *last = This->numSections > 0 ? &This->sections[This->numSections-1] : NULL;
+		size_t *lastFixed = This->numSections > 0 ? &fixedFactors[This->numSections-1] : NULL;
+
+		if(stage->oversampleFactor == 1){
+			// If this stage and any base rate stages after it are flexible and
+			// they are followed by a stage that can join the previous
+			// oversampled section, run them all at the oversampled rate. That
+			// saves a downsampler and an upsampler.
+			if(last && last->oversampleFactor > 1){
+				size_t j = i;
+				while(j < This->numStages &&
+					  This->stages[j].oversampleFactor == 1 &&
+					  This->stages[j].setSampleRate != NULL)
+					j++;
+
+				size_t fixedFactor = *lastFixed;
+				size_t factor = last->oversampleFactor;
+				if(j < This->numStages &&
+				   This->stages[j].oversampleFactor > 1 &&
+				   BMRateGraph_canJoin(&This->stages[j], &fixedFactor, &factor)){
+					// the stage at j joins the section on the next iteration
+					last->numStages += j - i;
+					i = j;
+					continue;
+				}
+			}
+
+			// otherwise run at the base rate
+			if(last && last->oversampleFactor == 1){
+				last->numStages++;
+				i++;
+				continue;
+			}
+		}
+		else if(last && last->oversampleFactor > 1){
+			size_t fixedFactor = *lastFixed;
+			size_t factor = last->oversampleFactor;
+			if(BMRateGraph_canJoin(stage, &fixedFactor, &factor)){
+				*lastFixed = fixedFactor;
+				last->oversampleFactor = factor;
+				last->numStages++;
+				i++;
+				continue;
+			}
+		}
+
+		// start a new section
+		BMRateGraphSection *section = &This->sections[This->numSections];
+		section->stages = stage;
+		section->numStages = 1;
+		section->oversampleFactor = stage->oversampleFactor;
+		fixedFactors[This->numSections] = (stage->setSampleRate == NULL) ? stage->oversampleFactor : 0;
+		This->numSections++;
+		i++;
+	}
+
+	// set up the resamplers and tell the flexible stages their rates
+	for(size_t s=0; s<This->numSections; s++){
+		BMRateGraphSection *section = &This->sections[s];
+		if(section->oversampleFactor > 1){
+			BMOversampler_init(&section->oversampler, This->stereo, section->oversampleFactor, This->resamplerType);
+			BMOversampler_setBlockKernel(&section->oversampler, BMRateGraph_processSection, section);
+		}
+
+		float sectionSampleRate = This->sampleRate * (float)section->oversampleFactor;
+		for(size_t j=0; j<section->numStages; j++)
+			if(section->stages[j].setSampleRate)
+				section->stages[j].setSampleRate(section->stages[j].context, sectionSampleRate);
+	}
+
+	This->planned = true;
+}
+
+
+
+
+/*!
+ *BMRateGraph_processSection
+ *
+ * @abstract run all the stages of a section on one block, in place
+ */
+void BMRateGraph_processSection(void *context, float *bufferL, float *bufferR, size_t numSamples){
+	BMRateGraphSection *section = context;
+	for(size_t i=0; i<section->numStages; i++)
+		if(section->stages[i].kernel)
+			section->stages[i].kernel(section->stages[i].context, bufferL, bufferR, numSamples);
+}
+
+
+
+
+void BMRateGraph_processMono(BMRateGraph *This, const float *input, float *output, size_t numSamples){
+	assert(This->planned && !This->stereo);
+
+	if(input != output)
+		memcpy(output, input, sizeof(float)*numSamples);
+
+	for(size_t s=0; s<This->numSections; s++){
+		BMRateGraphSection *section = &This->sections[s];
+		if(section->oversampleFactor > 1)
+			BMOversampler_processMono(&section->oversampler, output, output, numSamples);
+		else
+			BMRateGraph_processSection(section, output, NULL, numSamples);
+	}
+}
+
+
+
+
+void BMRateGraph_processStereo(BMRateGraph *This,
+							   const float *inputL, const float *inputR,
+							   float *outputL, float *outputR,
+							   size_t numSamples){
+	assert(This->planned && This->stereo);
+
+	if(inputL != outputL)
+		memcpy(outputL, inputL, sizeof(float)*numSamples);
+	if(inputR != outputR)
+		memcpy(outputR, inputR, sizeof(float)*numSamples);
+
+	for(size_t s=0; s<This->numSections; s++){
+		BMRateGraphSection *section = &This->sections[s];
+		if(section->oversampleFactor > 1)
+			BMOversampler_processStereo(&section->oversampler,
+										outputL, outputR,
+										outputL, outputR,
+										numSamples);
+		else
+			BMRateGraph_processSection(section, outputL, outputR, numSamples);
+	}
+}
+
+
+
+
+float BMRateGraph_getLatencyInSamples(BMRateGraph *This){
+	assert(This->planned);
+
+	float latency = 0.0f;
+	for(size_t s=0; s<This->numSections; s++){
+		BMRateGraphSection *section = &This->sections[s];
+		if(section->oversampleFactor > 1)
+			latency += BMOversampler_getLatencyInSamples(&section->oversampler);
+
+		// stage latencies are at the section's rate
+		for(size_t j=0; j<section->numStages; j++)
+			if(section->stages[j].getLatency)
+				latency += section->stages[j].getLatency(section->stages[j].context) / (float)section->oversampleFactor;
+	}
+
+	return latency;
+}
+
+
+
+
+size_t BMRateGraph_getNumResamplerPairs(const BMRateGraph *This){
+	size_t numPairs = 0;
+	for(size_t s=0; s<This->numSections; s++)
+		if(This->sections[s].oversampleFactor > 1)
+			numPairs++;
+	return numPairs;
+}
@@ -0,0 +1,195 @@
+//
+//  BMRateGraph.h
+//  AudioFiltersXcodeProject
+//
+//  Runs a chain of processors, each of which declares the sample rate it
+//  wants to run at, and plans the resampling between them.
+//
+//  A chain like
+//
+//      upsample -> saturator -> downsample -> filter -> upsample -> limiter -> downsample
+//
+//  pays for two pairs of resamplers and the latency of both. If the filter
+//  can run at the higher rate, the planner merges the two oversampled
+//  sections into one so that the chain needs only one pair:
+//
+//      upsample -> saturator -> filter -> limiter -> downsample
+//
+//  Each stage is a block kernel, as in BMOversampler, with the minimum
+//  oversampling factor it needs. A stage that gives a setSampleRate
+//  function is flexible: it can run at any rate at or above its minimum and
+//  the planner tells it which rate it got. A stage without one always runs
+//  at exactly its own factor.
+//
+//  Consecutive oversampled stages go into one section when their factors
+//  are compatible. A section runs at the highest factor of its stages.
+//  Flexible base rate stages between two oversampled sections are pulled
+//  into the oversampled rate when that lets the two sections merge. Other
+//  base rate stages run at the base rate.
+//
+//  Usage:
+//
+//      BMRateGraph_init(&graph, false, sampleRate, BMRESAMPLER_FULL_SPECTRUM);
+//      BMRateGraph_addStage(&graph, saturatorKernel, &saturator, 4, NULL, NULL);
+//      BMRateGraph_addStage(&graph, filterKernel, &filter, 1, filterSetSampleRate, NULL);
+//      BMRateGraph_addStage(&graph, limiterKernel, &limiter, 4, NULL, NULL);
+//      BMRateGraph_plan(&graph);
+//      ...
+//      BMRateGraph_processMono(&graph, input, output, numSamples);
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifndef BMRateGraph_h
+#define BMRateGraph_h
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "BMOversampler.h"
+
+#define BMRateGraph_maxStages 32
+
+
+/*!
+ *BMRateGraphSetSampleRate
+ *
+ * @abstract called by BMRateGraph_plan to tell a flexible stage the sample rate it will run at
+ */
+typedef void (*BMRateGraphSetSampleRate)(void *context, float sampleRate);
+
+
+/*!
+ *BMRateGraphGetLatency
+ *
+ * @returns the latency of a stage, in samples at the rate the stage runs at
+ */
+typedef float (*BMRateGraphGetLatency)(void *context);
+
+
+typedef struct BMRateGraphStage {
+	BMOversamplerBlockKernel kernel;
+	BMRateGraphSetSampleRate setSampleRate;
+	BMRateGraphGetLatency getLatency;
+	void *context;
+	size_t oversampleFactor;
+} BMRateGraphStage;
+
+
+typedef struct BMRateGraphSection {
+	// only initialised when oversampleFactor > 1
+	BMOversampler oversampler;
+	BMRateGraphStage *stages;
+	size_t numStages, oversampleFactor;
+} BMRateGraphSection;
+
+
+typedef struct BMRateGraph {
+	BMRateGraphStage stages [BMRateGraph_maxStages];
+	BMRateGraphSection sections [BMRateGraph_maxStages];
+	size_t numStages, numSections;
+	float sampleRate;
+	enum resamplerType resamplerType;
+	bool stereo, planned;
+} BMRateGraph;
+
+
+
+/*!
+ *BMRateGraph_init
+ *
+ * @param This           pointer to an uninitialised struct
+ * @param stereo         true for stereo, false for mono
+ * @param sampleRate     the base sample rate
+ * @param resamplerType  the type of resampler filters. See BMUpsampler_init.
+ */
+void BMRateGraph_init(BMRateGraph *This, bool stereo, float sampleRate, enum resamplerType resamplerType);
+
+
+
+/*!
+ *BMRateGraph_free
+ */
+void BMRateGraph_free(BMRateGraph *This);
+
+
+
+/*!
+ *BMRateGraph_addStage
+ *
+ * @abstract add a processor to the end of the chain. Call BMRateGraph_plan after adding stages.
+ *
+ * @param This              pointer to an initialised struct
+ * @param kernel            processes a block in place. must accept any block length.
+ * @param context           passed to kernel, setSampleRate and getLatency
+ * @param oversampleFactor  the minimum oversampling factor the stage needs. 1 or 2^n.
+ * @param setSampleRate     NULL if the stage must run at exactly oversampleFactor. Otherwise the stage may run at a higher rate and this is called to tell it which.
+ * @param getLatency        NULL if the stage has no latency
+ * @returns the index of the stage
+ */
+size_t BMRateGraph_addStage(BMRateGraph *This,
+							BMOversamplerBlockKernel kernel,
+							void *context,
+							size_t oversampleFactor,
+							BMRateGraphSetSampleRate setSampleRate,
+							BMRateGraphGetLatency getLatency);
+
+
+
+/*!
+ *BMRateGraph_plan
+ *
+ * @abstract group the stages into sections, set up the resamplers and call setSampleRate on the flexible stages
+ *
+ * @discussion This allocates memory. Don't call it on the audio thread.
+ */
+void BMRateGraph_plan(BMRateGraph *This);
+
+
+
+/*!
+ *BMRateGraph_processMono
+ *
+ * @param This        pointer to a planned mono struct
+ * @param input       length = numSamples
+ * @param output      length = numSamples. may be the same as input.
+ * @param numSamples  number of samples at the base rate
+ */
+void BMRateGraph_processMono(BMRateGraph *This, const float *input, float *output, size_t numSamples);
+
+
+
+/*!
+ *BMRateGraph_processStereo
+ *
+ * @param This        pointer to a planned stereo struct
+ * @param inputL      length = numSamples
+ * @param inputR      length = numSamples
+ * @param outputL     length = numSamples. may be the same as inputL.
+ * @param outputR     length = numSamples. may be the same as inputR.
+ * @param numSamples  number of samples at the base rate
+ */
+void BMRateGraph_processStereo(BMRateGraph *This,
+							   const float *inputL, const float *inputR,
+							   float *outputL, float *outputR,
+							   size_t numSamples);
+
+
+
+/*!
+ *BMRateGraph_getLatencyInSamples
+ *
+ * @returns the total latency of the resamplers and the stages, in samples at the base rate
+ */
+float BMRateGraph_getLatencyInSamples(BMRateGraph *This);
+
+
+
+/*!
+ *BMRateGraph_getNumResamplerPairs
+ *
+ * @returns the number of upsampler and downsampler pairs in the plan
+ */
+size_t BMRateGraph_getNumResamplerPairs(const BMRateGraph *This);
+
+#endif /* BMRateGraph_h */
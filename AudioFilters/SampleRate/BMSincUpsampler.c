@@ -8,6 +8,7 @@
 
 #include "BMSincUpsampler.h"
 #include <Accelerate/Accelerate.h>
+#include <simd/simd.h>
 #include "BMFFT.h"
 
 
@@ -31,11 +32,14 @@ void BMSincUpsampler_init(BMSincUpsampler *This,
         This->kernelLength = interpolationPoints;
         This->inputPaddingLeft = (This->kernelLength / 2) - 1;
         This->inputPaddingRight = (This->kernelLength / 2) - 1;
-        This->numKernels = This->upsampleFactor;
         
-        This->filterKernels = malloc(sizeof(float*) * This->numKernels);
-        for(size_t i=0; i<This->numKernels; i++)
-            This->filterKernels[i] = malloc(sizeof(float*)*This->kernelLength);
+        // the table has a whole number of phases for each output phase of
+        // the upsampler and at least BMSINC_MIN_TABLE_PHASES in total
+        This->phaseStride = (BMSINC_MIN_TABLE_PHASES + upsampleFactor - 1) / upsampleFactor;
+        This->numTablePhases = This->phaseStride * upsampleFactor;
+        
+        This->kernelTable = malloc(sizeof(float) * This->numTablePhases * This->kernelLength);
+        This->kernelSlopes = malloc(sizeof(float) * This->numTablePhases * This->kernelLength);
         
         BMSincUpsampler_initFilterKernels(This);
     }
@@ -54,10 +58,10 @@ void BMSincUpsampler_init(BMSincUpsampler *This,
 
 void BMSincUpsampler_free(BMSincUpsampler *This){
     if(This->upsampleFactor > 1){
-        for(size_t i=0; i<This->numKernels; i++)
-            free(This->filterKernels[i]);
-        free(This->filterKernels);
-        This->filterKernels = NULL;
+        free(This->kernelTable);
+        free(This->kernelSlopes);
+        This->kernelTable = NULL;
+        This->kernelSlopes = NULL;
     }
 }
 
@@ -77,18 +81,57 @@ size_t BMSincUpsampler_process(BMSincUpsampler *This,
     
     assert(input != output);
     
+    size_t upsampleFactor = This->upsampleFactor;
+    size_t kernelLength = This->kernelLength;
+    
     // how many samples of the input must be left out from the output at the beginning and end?
     size_t inputLengthMinusPadding = inputLength - This->inputPaddingLeft - This->inputPaddingRight;
     
-    // do the interpolation by convolution
-    // the index starts at 1 because the first filter kernel will be
-    // replaced by the vsmul command on the line below
-    for(size_t i=1; i<This->upsampleFactor; i++)
-        vDSP_conv(input, 1, This->filterKernels[This->numKernels - i], 1, output+i, This->upsampleFactor, inputLengthMinusPadding-1, This->kernelLength);
+    // output[n*upsampleFactor + p] is at position inputPaddingLeft + n + p/upsampleFactor
+    // and reads input[n] through input[n + kernelLength - 1]. All phases
+    // are available for n < inputLengthMinusPadding - 1. After that there is
+    // only the final sample at phase zero.
+    size_t numFullPeriods = inputLengthMinusPadding - 1;
+    const float* centre = input + This->inputPaddingLeft;
     
-    // copy the original samples from input to output to fill in the remaining samples
-    float zero = 0.0f;
-    vDSP_vsadd(input+This->inputPaddingLeft, 1, &zero, output, This->upsampleFactor, inputLengthMinusPadding);
+    // Process 8 input positions at a time. For each phase, the outputs of
+    // all 8 positions are computed together in one register, reading one
+    // kernel coefficient and 8 consecutive input samples for each tap.
+    size_t n = 0;
+    while(n + 8 <= numFullPeriods){
+        float* out = output + n*upsampleFactor;
+        
+        // phase zero is the input signal
+        for(size_t j=0; j<8; j++)
+            out[j*upsampleFactor] = centre[n + j];
+        
+        for(size_t p=1; p<upsampleFactor; p++){
+            const float* kernel = This->kernelTable + p*This->phaseStride*kernelLength;
+            simd_float8 acc = 0.0f;
+            for(size_t k=0; k<kernelLength; k++)
+                acc += kernel[k] * *(const simd_packed_float8*)(input + n + k);
+            for(size_t j=0; j<8; j++)
+                out[j*upsampleFactor + p] = acc[j];
+        }
+        
+        n += 8;
+    }
+    
+    // process the remaining positions one at a time
+    for(; n<numFullPeriods; n++){
+        float* out = output + n*upsampleFactor;
+        out[0] = centre[n];
+        for(size_t p=1; p<upsampleFactor; p++){
+            const float* kernel = This->kernelTable + p*This->phaseStride*kernelLength;
+            float acc = 0.0f;
+            for(size_t k=0; k<kernelLength; k++)
+                acc += kernel[k] * input[n + k];
+            out[p] = acc;
+        }
+    }
+    
+    // the final output sample
+    output[numFullPeriods*upsampleFactor] = centre[numFullPeriods];
     
     return 1 + (inputLengthMinusPadding - 1)*This->upsampleFactor;
 }
@@ -97,6 +140,67 @@ size_t BMSincUpsampler_process(BMSincUpsampler *This,
 
 
 
+void BMSincUpsampler_processFractional(BMSincUpsampler *This,
+                                       const float* input,
+                                       size_t inputLength,
+                                       const float* positions,
+                                       float* output,
+                                       size_t numPositions){
+    assert(This->upsampleFactor > 1);
+    
+    size_t kernelLength = This->kernelLength;
+    float numTablePhases = This->numTablePhases;
+    
+    for(size_t i=0; i<numPositions; i++){
+        // the read positions are positive so truncation works as floor
+        float position = positions[i];
+        size_t centreIdx = (size_t)position;
+        assert(centreIdx >= This->inputPaddingLeft);
+        
+        // at the last valid position the kernel would read one sample past
+        // the end of the input. The phase there is zero, so the output is
+        // the input sample itself.
+        size_t startIdx = centreIdx - This->inputPaddingLeft;
+        if(startIdx + kernelLength > inputLength){
+            assert(centreIdx < inputLength);
+            output[i] = input[centreIdx];
+            continue;
+        }
+        
+        // find the table phase and interpolate between adjacent phases. When
+        // the fraction is just below 1, phaseF can round up to numTablePhases.
+        // The end of the slope from the last phase gives the same kernel.
+        float phaseF = (position - (float)centreIdx) * numTablePhases;
+        size_t phase = (size_t)phaseF;
+        float t = phaseF - (float)phase;
+        if(phase >= This->numTablePhases){
+            phase = This->numTablePhases - 1;
+            t = 1.0f;
+        }
+        const float* kernel = This->kernelTable + phase*kernelLength;
+        const float* slope = This->kernelSlopes + phase*kernelLength;
+        const float* x = input + startIdx;
+        
+        // dot product of the interpolated kernel with the input. The kernel
+        // length is even, so there may be two taps left after the groups of four.
+        simd_float4 acc4 = 0.0f;
+        size_t k = 0;
+        for(; k+4 <= kernelLength; k+=4){
+            simd_float4 h = *(const simd_packed_float4*)(kernel + k) + t * *(const simd_packed_float4*)(slope + k);
+            acc4 += h * *(const simd_packed_float4*)(x + k);
+        }
+        float acc = simd_reduce_add(acc4);
+        for(; k<kernelLength; k++)
+            acc += (kernel[k] + t * slope[k]) * x[k];
+        
+        output[i] = acc;
+    }
+}
+
+
+
+
+
 /*!
  *BMSincUpsampler_inputPaddingBefore
  *
@@ -139,53 +243,59 @@ size_t BMSincUpsampler_outputLength(BMSincUpsampler *This, size_t inputLength){
 
 
 
-void BMSincUpsampler_initFilterKernels(BMSincUpsampler *This){
-    // allocate an array for the complete discretised sinc interpolation function
-    size_t completeKernelLength = This->kernelLength * This->upsampleFactor;
-    float *interleavedKernel = malloc(sizeof(float) * completeKernelLength);
+/*!
+ *BMSincUpsampler_windowedSinc
+ *
+ * @returns the windowed sinc kernel at distance x from the output position, for x in [-kernelLength/2, kernelLength/2]
+ */
+static double BMSincUpsampler_windowedSinc(double x, size_t kernelLength){
+    // sinc function
+    double phi = x * M_PI;
+    double sinc = 1.0;
+    if(fabs(phi) > FLT_EPSILON)
+        sinc = sin(phi)/phi;
     
-    // generate the sinc function
-    // Mathematica prototype:
-    //    Table[Sinc[(t - K/2) \[Pi] / us], {t, 0, K}]
-    for(size_t t=0; t<completeKernelLength; t++){
-        // rename and cast variables for easier readability
-        double td = t;
-        double K = completeKernelLength;
-        double us = This->upsampleFactor;
-        double phi = (td - (K / 2.0)) * M_PI / us;
-        
-        // calculate the sinc function
-        if(fabs(phi) > FLT_EPSILON)
-            interleavedKernel[t] = sin(phi)/phi;
-        else
-            interleavedKernel[t] = 1.0;
-    }
+    // Blackman window over the length of the kernel. It is zero at both
+    // ends and 1 in the centre, so the kernel at phase zero is exactly a
+    // unit impulse.
+    double u = (x / (double)kernelLength) + 0.5;
+    double window = 0.42 - 0.5*cos(2.0*M_PI*u) + 0.08*cos(4.0*M_PI*u);
     
-    // generate window coefficients (hamming, blackman-harris, hann, etc.)
+    return sinc * window;
+}
+
+
+
+
+
+void BMSincUpsampler_initFilterKernels(BMSincUpsampler *This){
+    // Mathematica prototype of the unwindowed kernel:
+    //    Table[Sinc[(t - K/2) \[Pi] / us], {t, 0, K}]
     //
-    // note that the window has an extra coefficient at the end that is not used
-    // on the kernel. This is because the complete interleaved kernel is not
-    // perfectly symmetric. It is missing a zero at the end that would make it
-    // symmetric. That zero is missing because it doesn't fit into any of the
-    // polyphase kernels. Technically, that final zero belongs to the first
-    // polyphase kernel, the one that is all zeros except its centre element.
+    // Row q of the table is the kernel for an output at fractional position
+    // f = q / numTablePhases after input sample n. Tap k reads input sample
+    // n - inputPaddingLeft + k, which is at distance k - inputPaddingLeft - f
+    // from the output.
     //
-    size_t windowLength = completeKernelLength + 1;
-    float* window = malloc(sizeof(float)*windowLength);
-    // BMFFT_generateBlackmanHarrisCoefficients(window, windowLength);
-    // BMFFT_generateKaiserCoefficients(window, windowLength);
-    int useHalfWindow = false;
-    //vDSP_hamm_window(window, windowLength, useHalfWindow);
-    vDSP_blkman_window(window, windowLength, useHalfWindow);
-    
-    // apply the blackman-harris window to the interleaved kernel
-    vDSP_vmul(window,1,interleavedKernel,1,interleavedKernel,1,completeKernelLength);
-    
-    // copy from the complete kernel to the polyphase kernels
-    for(size_t i=0; i<This->numKernels; i++)
-        for(size_t j=0; j<This->kernelLength; j++)
-            This->filterKernels[i][j] = interleavedKernel[j*This->numKernels + i];
+    // We generate one extra row, for f = 1, to compute the slopes of the
+    // last row.
+    size_t kernelLength = This->kernelLength;
+    float* nextRow = malloc(sizeof(float)*kernelLength);
+    for(size_t q=0; q<=This->numTablePhases; q++){
+        double f = (double)q / (double)This->numTablePhases;
+        float* row = q < This->numTablePhases ? This->kernelTable + q*kernelLength : nextRow;
+        for(size_t k=0; k<kernelLength; k++){
+            double x = (double)k - (double)This->inputPaddingLeft - f;
+            row[k] = BMSincUpsampler_windowedSinc(x, kernelLength);
+        }
+        
+        // the slopes of the previous row
+        if(q > 0){
+            const float* previousRow = This->kernelTable + (q-1)*kernelLength;
+            float* slope = This->kernelSlopes + (q-1)*kernelLength;
+            vDSP_vsub(previousRow, 1, row, 1, slope, 1, kernelLength);
+        }
+    }
     
-    free(interleavedKernel);
-    free(window);
+    free(nextRow);
 }
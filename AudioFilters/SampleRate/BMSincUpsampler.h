@@ -13,9 +13,21 @@
 
 #define BMSINC_MAX_KERNEL_LENGTH
 
+// the kernel table has at least this many phases between adjacent input
+// samples, for BMSincUpsampler_processFractional
+#define BMSINC_MIN_TABLE_PHASES 64
+
+/*
+ * The windowed sinc kernel is stored as a polyphase table. Row q holds
+ * kernelLength taps for an output at fractional position q / numTablePhases
+ * after an input sample. The integer upsampler reads every phaseStride-th
+ * row. BMSincUpsampler_processFractional interpolates linearly between
+ * adjacent rows, using kernelSlopes[q] = row q+1 - row q.
+ */
 typedef struct BMSincUpsampler {
-    size_t upsampleFactor, kernelLength, inputPaddingLeft, inputPaddingRight, numKernels;
-    float **filterKernels;
+    size_t upsampleFactor, kernelLength, inputPaddingLeft, inputPaddingRight;
+    size_t numTablePhases, phaseStride;
+    float *kernelTable, *kernelSlopes;
 } BMSincUpsampler;
 
 
@@ -89,4 +101,36 @@ size_t BMSincUpsampler_process(BMSincUpsampler *This,
                              size_t inputLength);
 
 
+
+
+
+/*!
+ *BMSincUpsampler_processFractional
+ *
+ * @abstract interpolate the input at arbitrary fractional positions, using the same kernel as BMSincUpsampler_process
+ *
+ * @discussion This is for waveform renderers and pitch shifters. Position x
+ * reads input samples floor(x) - inputPaddingBefore through
+ * floor(x) + inputPaddingAfter + 1. The kernel is found by linear
+ * interpolation between the phases of a table with at least
+ * BMSINC_MIN_TABLE_PHASES phases per sample. At the phases used by
+ * BMSincUpsampler_process the result is the same as that function's output.
+ *
+ * Requires upsampleFactor > 1.
+ *
+ * @param This        pointer to an initialised struct
+ * @param input       input array with length inputLength
+ * @param inputLength length of input
+ * @param positions   read positions in samples, relative to input[0]. Each must be in [inputPaddingBefore, inputLength - inputPaddingAfter - 1].
+ * @param output      output array with length numPositions
+ * @param numPositions number of positions to read
+ */
+void BMSincUpsampler_processFractional(BMSincUpsampler *This,
+                                       const float* input,
+                                       size_t inputLength,
+                                       const float* positions,
+                                       float* output,
+                                       size_t numPositions);
+
+
 #endif /* BMSincUpsampler_h */
@@ -232,10 +232,14 @@ extern "C" {
 		// latency is frequency dependent. We will check it at this frequency
 		float groupDelayTestFrequency = 300.0f;
 		
+		// the halfband filters are designed in normalised frequency so we
+		// assume a sample rate of 48 kHz here
+		double w = 2.0 * M_PI * groupDelayTestFrequency / 48000.0;
+		
 		// get the latency at each stage
 		float latency = 0.0f;
 		for(size_t i=0; i<This->numStages; i++){
-			float stageILatencyInSamples = BMMultiLevelBiquad_groupDelay(&This->upsamplers2x[i].even, groupDelayTestFrequency);
+			float stageILatencyInSamples = BMHIIRStageProc_groupDelay(&This->upsamplers2x[i].stages, 0, w);
 			float stageIOversampleFactor = powf(2.0f,(float)i);
 			latency += stageILatencyInSamples / stageIOversampleFactor;
 		}
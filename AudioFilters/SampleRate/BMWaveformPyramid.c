@@ -0,0 +1,493 @@
+//
+//  BMWaveformPyramid.c
+//  AudioFiltersXcodeProject
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#include "BMWaveformPyramid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <Accelerate/Accelerate.h>
+#include "Decimation.h"
+#include "Constants.h"
+
+#define BMWaveformPyramid_magic 0x504d5742 // "BMWP"
+#define BMWaveformPyramid_version 1
+
+
+// forward declarations
+size_t BMWaveformPyramid_layout(size_t factor, size_t capacity, size_t *offsets, size_t *numLevels);
+bool BMWaveformPyramid_map(BMWaveformPyramid *This, size_t mapSize);
+void BMWaveformPyramid_setPointers(BMWaveformPyramid *This);
+bool BMWaveformPyramid_reserve(BMWaveformPyramid *This, size_t numSamples);
+void BMWaveformPyramid_propagate(BMWaveformPyramid *This);
+void BMWaveformPyramid_updatePartialEntries(BMWaveformPyramid *This);
+
+
+
+/*!
+ *BMWaveformPyramid_layout
+ *
+ * @abstract find the byte offsets of the min, max and meanSquare arrays of each level for the given capacity
+ *
+ * @param factor     decimation factor between levels
+ * @param capacity   capacity in samples
+ * @param offsets    output array of length 3 * BMWaveformPyramid_maxLevels
+ * @param numLevels  output: the number of levels
+ * @returns the total size in bytes, including the header
+ */
+size_t BMWaveformPyramid_layout(size_t factor, size_t capacity, size_t *offsets, size_t *numLevels){
+	size_t offset = sizeof(BMWaveformPyramidHeader);
+	size_t levelCapacity = capacity;
+	*numLevels = 0;
+
+	// add levels until one entry covers the whole capacity
+	do {
+		levelCapacity = (levelCapacity + factor - 1) / factor;
+		assert(*numLevels < BMWaveformPyramid_maxLevels);
+		for(size_t i=0; i<3; i++){
+			offsets[3 * *numLevels + i] = offset;
+			offset += sizeof(float) * levelCapacity;
+		}
+		(*numLevels)++;
+	} while (levelCapacity > 1);
+
+	return offset;
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_map
+ *
+ * @abstract map mapSize bytes of the file, or of anonymous memory if there is no file
+ */
+bool BMWaveformPyramid_map(BMWaveformPyramid *This, size_t mapSize){
+	void *map;
+	if(This->fileDescriptor >= 0)
+		map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, This->fileDescriptor, 0);
+	else
+		map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if(map == MAP_FAILED)
+		return false;
+
+	This->map = map;
+	This->mapSize = mapSize;
+	This->header = map;
+	return true;
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_setPointers
+ *
+ * @abstract set the array pointers of each level from the capacity in the header
+ */
+void BMWaveformPyramid_setPointers(BMWaveformPyramid *This){
+	size_t offsets [3 * BMWaveformPyramid_maxLevels];
+	BMWaveformPyramid_layout(This->factor, This->header->capacity, offsets, &This->numLevels);
+
+	char *base = This->map;
+	size_t blockLength = This->factor;
+	for(size_t i=0; i<This->numLevels; i++){
+		BMWaveformPyramidLevel *level = &This->levels[i];
+		level->min = (float*)(base + offsets[3*i]);
+		level->max = (float*)(base + offsets[3*i + 1]);
+		level->meanSquare = (float*)(base + offsets[3*i + 2]);
+		level->blockLength = blockLength;
+		blockLength *= This->factor;
+	}
+}
+
+
+
+
+bool BMWaveformPyramid_init(BMWaveformPyramid *This, size_t factor, const char *filePath){
+	assert(factor >= 2 && factor <= BMWaveformPyramid_maxFactor);
+
+	This->factor = factor;
+	This->fileDescriptor = -1;
+	This->map = NULL;
+	This->temp = NULL;
+
+	// open the file and see if it already holds a pyramid
+	bool reopening = false;
+	if(filePath){
+		This->fileDescriptor = open(filePath, O_RDWR | O_CREAT, 0644);
+		if(This->fileDescriptor < 0)
+			return false;
+
+		struct stat fileInfo;
+		if(fstat(This->fileDescriptor, &fileInfo) != 0)
+			goto fail;
+		reopening = (size_t)fileInfo.st_size >= sizeof(BMWaveformPyramidHeader);
+
+		if(reopening){
+			if(!BMWaveformPyramid_map(This, (size_t)fileInfo.st_size))
+				goto fail;
+
+			// check that the file holds a pyramid that fits the size of the file
+			BMWaveformPyramidHeader *header = This->header;
+			size_t offsets [3 * BMWaveformPyramid_maxLevels];
+			size_t numLevels;
+			if(header->magic != BMWaveformPyramid_magic ||
+			   header->version != BMWaveformPyramid_version ||
+			   header->factor != factor ||
+			   header->numSamples > header->capacity ||
+			   BMWaveformPyramid_layout(factor, header->capacity, offsets, &numLevels) > This->mapSize)
+				goto fail;
+		}
+	}
+
+	// set up a new, empty pyramid
+	if(!reopening){
+		size_t offsets [3 * BMWaveformPyramid_maxLevels];
+		size_t numLevels;
+		size_t mapSize = BMWaveformPyramid_layout(factor, BMWaveformPyramid_initialCapacity, offsets, &numLevels);
+		if(This->fileDescriptor >= 0 && ftruncate(This->fileDescriptor, mapSize) != 0)
+			goto fail;
+		if(!BMWaveformPyramid_map(This, mapSize))
+			goto fail;
+
+		memset(This->header, 0, sizeof(BMWaveformPyramidHeader));
+		This->header->magic = BMWaveformPyramid_magic;
+		This->header->version = BMWaveformPyramid_version;
+		This->header->factor = factor;
+		This->header->capacity = BMWaveformPyramid_initialCapacity;
+		This->header->numSamples = 0;
+	}
+
+	BMWaveformPyramid_setPointers(This);
+
+	// every level is up to date in a reopened file
+	for(size_t i=0; i<This->numLevels; i++)
+		This->levels[i].numComplete = This->header->numSamples / This->levels[i].blockLength;
+
+	This->temp = malloc(sizeof(float) * BM_BUFFER_CHUNK_SIZE * factor);
+
+	return true;
+
+fail:
+	BMWaveformPyramid_free(This);
+	return false;
+}
+
+
+
+
+void BMWaveformPyramid_free(BMWaveformPyramid *This){
+	if(This->map)
+		munmap(This->map, This->mapSize);
+	This->map = NULL;
+	This->header = NULL;
+
+	if(This->fileDescriptor >= 0)
+		close(This->fileDescriptor);
+	This->fileDescriptor = -1;
+
+	free(This->temp);
+	This->temp = NULL;
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_reserve
+ *
+ * @abstract make sure there is room for at least numSamples samples
+ *
+ * Doubles the capacity until it's large enough and moves the levels to
+ * their positions in the new layout. Levels that didn't exist before are
+ * built from the level below.
+ *
+ * @returns false if the file can't be enlarged or the new size can't be
+ * mapped. The old mapping is still in place and unchanged in that case.
+ */
+bool BMWaveformPyramid_reserve(BMWaveformPyramid *This, size_t numSamples){
+	size_t oldCapacity = This->header->capacity;
+	if(numSamples <= oldCapacity)
+		return true;
+
+	size_t newCapacity = oldCapacity;
+	while(newCapacity < numSamples)
+		newCapacity *= 2;
+
+	size_t oldOffsets [3 * BMWaveformPyramid_maxLevels];
+	size_t newOffsets [3 * BMWaveformPyramid_maxLevels];
+	size_t oldNumLevels, newNumLevels;
+	BMWaveformPyramid_layout(This->factor, oldCapacity, oldOffsets, &oldNumLevels);
+	size_t newMapSize = BMWaveformPyramid_layout(This->factor, newCapacity, newOffsets, &newNumLevels);
+
+	// the length of the arrays in use at each level, in bytes
+	size_t usedBytes [BMWaveformPyramid_maxLevels];
+	for(size_t i=0; i<oldNumLevels; i++){
+		size_t blockLength = This->levels[i].blockLength;
+		usedBytes[i] = sizeof(float) * ((This->header->numSamples + blockLength - 1) / blockLength);
+	}
+
+	void *oldMap = This->map;
+	size_t oldMapSize = This->mapSize;
+	if(This->fileDescriptor >= 0){
+		// Enlarge the file and map it again. The old mapping stays valid
+		// until the new one is in place, so we can give up without losing
+		// anything if either step fails.
+		if(ftruncate(This->fileDescriptor, newMapSize) != 0)
+			return false;
+		if(!BMWaveformPyramid_map(This, newMapSize)){
+			ftruncate(This->fileDescriptor, oldMapSize);
+			return false;
+		}
+		munmap(oldMap, oldMapSize);
+
+		// Each array moves to a higher offset than it had before. Moving
+		// them in reverse order, we never write over an array before it has
+		// been moved.
+		char *base = This->map;
+		for(size_t j=3*oldNumLevels; j>0; j--)
+			memmove(base + newOffsets[j-1], base + oldOffsets[j-1], usedBytes[(j-1)/3]);
+	}
+	else {
+		// copy to a new anonymous mapping
+		if(!BMWaveformPyramid_map(This, newMapSize))
+			return false;
+		char *base = This->map;
+		memcpy(base, oldMap, sizeof(BMWaveformPyramidHeader));
+		for(size_t j=0; j<3*oldNumLevels; j++)
+			memcpy(base + newOffsets[j], (char*)oldMap + oldOffsets[j], usedBytes[j/3]);
+		munmap(oldMap, oldMapSize);
+	}
+
+	This->header->capacity = newCapacity;
+	BMWaveformPyramid_setPointers(This);
+
+	// the new levels have no entries yet
+	for(size_t i=oldNumLevels; i<This->numLevels; i++)
+		This->levels[i].numComplete = 0;
+	BMWaveformPyramid_propagate(This);
+	return true;
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_propagate
+ *
+ * @abstract reduce the complete entries of each level into complete entries of the level above
+ */
+void BMWaveformPyramid_propagate(BMWaveformPyramid *This){
+	size_t factor = This->factor;
+	for(size_t i=0; i+1<This->numLevels; i++){
+		BMWaveformPyramidLevel *source = &This->levels[i];
+		BMWaveformPyramidLevel *destination = &This->levels[i+1];
+		size_t numNew = source->numComplete / factor - destination->numComplete;
+		if(numNew == 0)
+			continue;
+
+		size_t sourceStart = destination->numComplete * factor;
+		size_t destinationStart = destination->numComplete;
+		minDecimation(source->min + sourceStart, destination->min + destinationStart, factor, numNew);
+		maxDecimation(source->max + sourceStart, destination->max + destinationStart, factor, numNew);
+		meanDecimation(source->meanSquare + sourceStart, destination->meanSquare + destinationStart, factor, numNew);
+		destination->numComplete += numNew;
+	}
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_sumSquares
+ *
+ * @returns the sum of squares of the samples covered by entries [start, end) of a level
+ */
+static double BMWaveformPyramid_sumSquares(const BMWaveformPyramid *This, size_t levelIndex, size_t start, size_t end){
+	const BMWaveformPyramidLevel *level = &This->levels[levelIndex];
+
+	// the complete entries each cover blockLength samples
+	size_t completeEnd = BM_MIN(end, level->numComplete);
+	float sum = 0.0f;
+	if(completeEnd > start)
+		vDSP_sve(level->meanSquare + start, 1, &sum, completeEnd - start);
+	double sumSquares = (double)sum * (double)level->blockLength;
+
+	// the partial entry at the end covers the rest of the samples
+	if(end > level->numComplete){
+		size_t partialLength = This->header->numSamples - level->numComplete * level->blockLength;
+		sumSquares += (double)level->meanSquare[level->numComplete] * (double)partialLength;
+	}
+
+	return sumSquares;
+}
+
+
+
+
+/*!
+ *BMWaveformPyramid_updatePartialEntries
+ *
+ * @abstract recompute the entry after the last complete one at each level
+ */
+void BMWaveformPyramid_updatePartialEntries(BMWaveformPyramid *This){
+	size_t numSamples = This->header->numSamples;
+	size_t factor = This->factor;
+
+	for(size_t i=0; i<This->numLevels; i++){
+		BMWaveformPyramidLevel *level = &This->levels[i];
+		size_t partialLength = numSamples - level->numComplete * level->blockLength;
+		if(partialLength == 0)
+			continue;
+
+		size_t index = level->numComplete;
+		if(i == 0){
+			// level 0 reads the pending samples in the header
+			const float *pending = This->header->pendingSamples;
+			vDSP_minv(pending, 1, level->min + index, partialLength);
+			vDSP_maxv(pending, 1, level->max + index, partialLength);
+			float sumSquares;
+			vDSP_svesq(pending, 1, &sumSquares, partialLength);
+			level->meanSquare[index] = sumSquares / (float)partialLength;
+		}
+		else {
+			// other levels read the entries of the level below, including
+			// its partial entry
+			const BMWaveformPyramidLevel *below = &This->levels[i-1];
+			size_t start = index * factor;
+			size_t end = (numSamples + below->blockLength - 1) / below->blockLength;
+			vDSP_minv(below->min + start, 1, level->min + index, end - start);
+			vDSP_maxv(below->max + start, 1, level->max + index, end - start);
+			double sumSquares = BMWaveformPyramid_sumSquares(This, i-1, start, end);
+			level->meanSquare[index] = sumSquares / (double)partialLength;
+		}
+	}
+}
+
+
+
+
+bool BMWaveformPyramid_append(BMWaveformPyramid *This, const float *samples, size_t numSamples){
+	if(numSamples == 0)
+		return true;
+
+	if(!BMWaveformPyramid_reserve(This, This->header->numSamples + numSamples))
+		return false;
+
+	size_t factor = This->factor;
+	BMWaveformPyramidHeader *header = This->header;
+	BMWaveformPyramidLevel *level0 = &This->levels[0];
+
+	while(numSamples > 0){
+		size_t numPending = header->numSamples % factor;
+
+		// fill up a partial block
+		if(numPending > 0 || numSamples < factor){
+			size_t samplesProcessing = BM_MIN(factor - numPending, numSamples);
+			memcpy(header->pendingSamples + numPending, samples, sizeof(float) * samplesProcessing);
+			header->numSamples += samplesProcessing;
+			samples += samplesProcessing;
+			numSamples -= samplesProcessing;
+
+			// if the block is full, it becomes a complete entry of level 0
+			if(numPending + samplesProcessing == factor){
+				const float *pending = header->pendingSamples;
+				size_t index = level0->numComplete;
+				vDSP_minv(pending, 1, level0->min + index, factor);
+				vDSP_maxv(pending, 1, level0->max + index, factor);
+				float sumSquares;
+				vDSP_svesq(pending, 1, &sumSquares, factor);
+				level0->meanSquare[index] = sumSquares / (float)factor;
+				level0->numComplete++;
+			}
+		}
+
+		// reduce whole blocks straight from the input
+		else {
+			size_t numBlocks = BM_MIN(numSamples / factor, BM_BUFFER_CHUNK_SIZE);
+			size_t samplesProcessing = numBlocks * factor;
+			size_t index = level0->numComplete;
+
+			minDecimation(samples, level0->min + index, factor, numBlocks);
+			maxDecimation(samples, level0->max + index, factor, numBlocks);
+			vDSP_vsq(samples, 1, This->temp, 1, samplesProcessing);
+			meanDecimation(This->temp, level0->meanSquare + index, factor, numBlocks);
+
+			level0->numComplete += numBlocks;
+			header->numSamples += samplesProcessing;
+			samples += samplesProcessing;
+			numSamples -= samplesProcessing;
+		}
+	}
+
+	BMWaveformPyramid_propagate(This);
+	BMWaveformPyramid_updatePartialEntries(This);
+	return true;
+}
+
+
+
+
+void BMWaveformPyramid_getOverview(BMWaveformPyramid *This,
+								   double startSample,
+								   double samplesPerPixel,
+								   float *min, float *max, float *rms,
+								   size_t numPixels){
+	assert(samplesPerPixel > 0.0);
+	size_t numSamples = This->header->numSamples;
+
+	// find the coarsest level with blocks no longer than a pixel
+	size_t levelIndex = 0;
+	while(levelIndex + 1 < This->numLevels &&
+		  (double)This->levels[levelIndex + 1].blockLength <= samplesPerPixel)
+		levelIndex++;
+	const BMWaveformPyramidLevel *level = &This->levels[levelIndex];
+	double blockLength = level->blockLength;
+	size_t levelLength = (numSamples + level->blockLength - 1) / level->blockLength;
+
+	for(size_t i=0; i<numPixels; i++){
+		double pixelStart = BM_MAX(startSample + (double)i * samplesPerPixel, 0.0);
+		double pixelEnd = startSample + (double)(i+1) * samplesPerPixel;
+
+		// pixels outside the audio are silent
+		if(pixelStart >= (double)numSamples || pixelEnd <= 0.0){
+			min[i] = max[i] = rms[i] = 0.0f;
+			continue;
+		}
+
+		// the entries that overlap the pixel
+		size_t start = (size_t)(pixelStart / blockLength);
+		size_t end = BM_MIN((size_t)ceil(pixelEnd / blockLength), levelLength);
+		end = BM_MAX(end, start + 1);
+
+		vDSP_minv(level->min + start, 1, min + i, end - start);
+		vDSP_maxv(level->max + start, 1, max + i, end - start);
+		size_t samplesCovered = BM_MIN(end * level->blockLength, numSamples) - start * level->blockLength;
+		rms[i] = sqrt(BMWaveformPyramid_sumSquares(This, levelIndex, start, end) / (double)samplesCovered);
+	}
+}
+
+
+
+
+size_t BMWaveformPyramid_getLength(const BMWaveformPyramid *This){
+	return This->header->numSamples;
+}
+
+
+
+
+void BMWaveformPyramid_sync(BMWaveformPyramid *This){
+	if(This->fileDescriptor >= 0)
+		msync(This->map, This->mapSize, MS_SYNC);
+}
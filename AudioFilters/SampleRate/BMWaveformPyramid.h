@@ -0,0 +1,152 @@
+//
+//  BMWaveformPyramid.h
+//  AudioFiltersXcodeProject
+//
+//  A mipmapped min / max / RMS overview of a long recording, for drawing
+//  waveforms at any zoom level without rescanning the audio.
+//
+//  Level 0 has one entry for every factor samples of audio. Each level
+//  above has one entry for every factor entries of the level below. The
+//  pyramid is built incrementally as audio is appended, using the
+//  decimation functions in Decimation.c to reduce each level into the next.
+//  The last entry of each level may cover a partial block. It is updated on
+//  every append so that the overview always includes all of the audio.
+//
+//  The pyramid lives in a memory mapped file, or in anonymous memory if no
+//  file is given. The file contains everything needed to reopen the pyramid
+//  and continue appending. Its layout is:
+//
+//      BMWaveformPyramidHeader
+//      level 0: min[capacity], max[capacity], meanSquare[capacity]
+//      level 1: min[capacity], max[capacity], meanSquare[capacity]
+//      ...
+//
+//  where the capacity of each level is fixed by the header's capacity in
+//  samples. When the audio outgrows the capacity, the file is enlarged and
+//  the levels are moved to their new positions.
+//
+//  Created by hans anderson on 10/19/26.
+//  Anyone may use this file without restrictions of any kind
+//
+
+#ifndef BMWaveformPyramid_h
+#define BMWaveformPyramid_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BMWaveformPyramid_maxLevels 32
+#define BMWaveformPyramid_maxFactor 16
+#define BMWaveformPyramid_initialCapacity (1 << 20)
+
+
+typedef struct BMWaveformPyramidHeader {
+	uint32_t magic, version;
+	uint64_t factor, capacity, numSamples;
+	// samples after the last complete block of level 0
+	float pendingSamples [BMWaveformPyramid_maxFactor];
+} BMWaveformPyramidHeader;
+
+
+typedef struct BMWaveformPyramidLevel {
+	float *min, *max, *meanSquare;
+	// number of input samples in each entry
+	size_t blockLength;
+	// number of entries that cover a full block
+	size_t numComplete;
+} BMWaveformPyramidLevel;
+
+
+typedef struct BMWaveformPyramid {
+	BMWaveformPyramidLevel levels [BMWaveformPyramid_maxLevels];
+	BMWaveformPyramidHeader *header;
+	void *map;
+	float *temp;
+	size_t mapSize, numLevels, factor;
+	int fileDescriptor;
+} BMWaveformPyramid;
+
+
+
+/*!
+ *BMWaveformPyramid_init
+ *
+ * @param This      pointer to an uninitialised struct
+ * @param factor    decimation factor between levels, in [2, BMWaveformPyramid_maxFactor]. 4 and 16 are good choices.
+ * @param filePath  file to keep the pyramid in, or NULL to keep it in memory. If the file already holds a pyramid with the same factor, it is reopened and new audio is appended to it.
+ * @returns false if the file can't be opened or mapped, or it holds something other than a pyramid with this factor
+ */
+bool BMWaveformPyramid_init(BMWaveformPyramid *This, size_t factor, const char *filePath);
+
+
+
+/*!
+ *BMWaveformPyramid_free
+ *
+ * Unmaps the pyramid and closes its file. The file is left on disk.
+ */
+void BMWaveformPyramid_free(BMWaveformPyramid *This);
+
+
+
+/*!
+ *BMWaveformPyramid_append
+ *
+ * @abstract add audio to the end of the pyramid. Cost is O(numSamples) regardless of the length already stored.
+ *
+ * @param This        pointer to an initialised struct
+ * @param samples     audio samples
+ * @param numSamples  length of samples
+ * @returns false if there is no room for the samples because the file can't be enlarged or mapped. Nothing is appended in that case and the pyramid is still usable.
+ */
+bool BMWaveformPyramid_append(BMWaveformPyramid *This, const float *samples, size_t numSamples);
+
+
+
+/*!
+ *BMWaveformPyramid_getOverview
+ *
+ * @abstract get the min, max and RMS of the audio under each pixel of a waveform display
+ *
+ * @discussion Reads from the coarsest level whose blocks are no longer
+ * than one pixel, so the cost is O(numPixels * factor) at any zoom. Each
+ * pixel includes every entry it overlaps. When a pixel is narrower than
+ * the factor, the entries of level 0 are wider than the pixels; draw from
+ * the audio itself at that zoom.
+ *
+ * Pixels past the end of the audio are set to zero.
+ *
+ * @param This             pointer to an initialised struct
+ * @param startSample      position of the left edge of the first pixel, in samples
+ * @param samplesPerPixel  width of each pixel, in samples
+ * @param min              output array of length numPixels
+ * @param max              output array of length numPixels
+ * @param rms              output array of length numPixels
+ * @param numPixels        number of pixels
+ */
+void BMWaveformPyramid_getOverview(BMWaveformPyramid *This,
+								   double startSample,
+								   double samplesPerPixel,
+								   float *min, float *max, float *rms,
+								   size_t numPixels);
+
+
+
+/*!
+ *BMWaveformPyramid_getLength
+ *
+ * @returns the number of samples of audio in the pyramid
+ */
+size_t BMWaveformPyramid_getLength(const BMWaveformPyramid *This);
+
+
+
+/*!
+ *BMWaveformPyramid_sync
+ *
+ * @abstract write changes to the file now, rather than when the system gets to it
+ */
+void BMWaveformPyramid_sync(BMWaveformPyramid *This);
+
+#endif /* BMWaveformPyramid_h */
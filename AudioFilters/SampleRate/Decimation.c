@@ -79,6 +79,24 @@ void minMaxDecimationInterleaved(const float *input, float *output, float *temp1
 }
 
 
+void meanDecimation(const float* input, float* output, size_t N, size_t outputLength){
+    assert(input != output);
+    
+    if(N == 1)
+        memcpy(output,input,sizeof(float)*outputLength);
+    else {
+        // add the first two elements in each group of N elements
+        vDSP_vadd(input, N, input+1, N, output, 1, outputLength);
+        // add the ith element in each group of N input elements
+        for(size_t i=2; i<N; i++)
+            vDSP_vadd(output, 1, input+i, N, output, 1, outputLength);
+        // divide by N
+        float scale = 1.0f / (float)N;
+        vDSP_vsmul(output, 1, &scale, output, 1, outputLength);
+    }
+}
+
+
 /*!
  *maxAbsDecimation
  *
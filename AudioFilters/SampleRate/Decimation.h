@@ -54,6 +54,19 @@ void minMaxDecimation(const float *input, float *outputMin, float *outputMax, si
 void minMaxDecimationInterleaved(const float *input, float *output, float *temp1, float *temp2, size_t N, size_t halfOutputLength);
 
 
+/*!
+ *meanDecimation
+ *
+ * Decimates the input by a factor of N, leaving the mean value of each group of N input samples.
+ *
+ * @param input input array of length outputLength*N
+ * @param output length = outputLength
+ * @param N decimation factor
+ * @param outputLength length of output
+ */
+void meanDecimation(const float* input, float* output, size_t N, size_t outputLength);
+
+
 /*!
 *maxAbsDecimation
 */